@@ -0,0 +1,106 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <eddyserver/compressor.h>
+
+typedef std::vector<uint8_t> Bytes;
+
+// 样本大小
+const size_t kSampleSize = 1024 * 1024;
+
+// 默认的重复次数
+const size_t kDefaultIterations = 200;
+
+/**
+ * 生成重复的样本
+ * 类似JSON的消息，字段值在少量取值间变化
+ */
+Bytes RepetitiveSample()
+{
+    Bytes sample;
+    for (size_t i = 0; sample.size() < kSampleSize; ++i)
+    {
+        const std::string message = "{\"id\":" + std::to_string(i % 1000)
+            + ",\"type\":\"move\",\"position\":{\"x\":" + std::to_string(i % 37)
+            + ",\"y\":" + std::to_string(i % 53) + "},\"status\":\"ok\"}\n";
+        sample.insert(sample.end(), message.begin(), message.end());
+    }
+    sample.resize(kSampleSize);
+    return sample;
+}
+
+/**
+ * 生成不可压缩的样本
+ */
+Bytes RandomSample()
+{
+    std::mt19937 engine(1);
+    Bytes sample(kSampleSize);
+    for (size_t i = 0; i < sample.size(); ++i)
+    {
+        sample[i] = static_cast<uint8_t>(engine());
+    }
+    return sample;
+}
+
+/**
+ * 计算吞吐量
+ * @return 每秒处理的原始数据，单位MB
+ */
+double Throughput(size_t bytes, std::chrono::steady_clock::duration elapsed)
+{
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    return static_cast<double>(bytes) / (1024 * 1024) / seconds;
+}
+
+/**
+ * 测量压缩和解压的吞吐量
+ * @return 是否成功
+ */
+bool Measure(const char *name, const Bytes &sample, size_t iterations)
+{
+    Bytes compressed(eddyserver::Compressor::compress_bound(sample.size()));
+    Bytes output(sample.size());
+    size_t compressed_size = 0;
+
+    const auto compress_begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        compressed_size = eddyserver::Compressor::compress(sample.data(), sample.size(), compressed.data(), compressed.size());
+    }
+    const auto compress_elapsed = std::chrono::steady_clock::now() - compress_begin;
+
+    bool success = compressed_size > 0;
+    const auto decompress_begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; success && i < iterations; ++i)
+    {
+        success = eddyserver::Compressor::decompress(compressed.data(), compressed_size, output.data(), output.size());
+    }
+    const auto decompress_elapsed = std::chrono::steady_clock::now() - decompress_begin;
+
+    if (!success || output != sample)
+    {
+        std::cerr << name << ": round-trip failed" << std::endl;
+        return false;
+    }
+
+    std::cout << name << ": ratio " << static_cast<double>(sample.size()) / static_cast<double>(compressed_size)
+        << ", compress " << Throughput(sample.size() * iterations, compress_elapsed) << " MB/s"
+        << ", decompress " << Throughput(sample.size() * iterations, decompress_elapsed) << " MB/s" << std::endl;
+    return true;
+}
+
+/**
+ * 压缩吞吐量
+ * 用法：compressor_benchmark [重复次数]
+ */
+int main(int argc, char *argv[])
+{
+    const size_t iterations = argc > 1 ? static_cast<size_t>(std::strtoul(argv[1], nullptr, 10)) : kDefaultIterations;
+    const bool success = Measure("repetitive", RepetitiveSample(), iterations)
+        && Measure("random", RandomSample(), iterations);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
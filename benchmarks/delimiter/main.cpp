@@ -0,0 +1,112 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <eddyserver.h>
+#include <eddyserver/simd.h>
+#include <eddyserver/basic_message_filter.h>
+#include <eddyserver/delimiter_message_filter.h>
+
+typedef std::vector<uint8_t> Bytes;
+
+// 样本大小
+const size_t kSampleSize = 1024 * 1024;
+
+// 每行的长度，不含分隔符
+const size_t kLineSize = 40;
+
+// 默认的重复次数
+const size_t kDefaultIterations = 200;
+
+/**
+ * 计算吞吐量
+ * @return 每秒处理的数据，单位MB
+ */
+double Throughput(size_t bytes, std::chrono::steady_clock::duration elapsed)
+{
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    return static_cast<double>(bytes) / (1024 * 1024) / seconds;
+}
+
+/**
+ * 生成样本
+ * 相同的消息分别以分隔符和长度前缀分帧
+ */
+void MakeSamples(Bytes &delimited, Bytes &prefixed)
+{
+    std::vector<eddyserver::NetMessage> messages;
+    for (size_t i = 0; messages.size() * (kLineSize + 1) < kSampleSize; ++i)
+    {
+        std::string line = "line " + std::to_string(i) + " ";
+        line.resize(kLineSize, static_cast<char>('a' + i % 26));
+        messages.emplace_back(line.data(), line.size());
+    }
+
+    eddyserver::DelimiterMessageFilter delimiter_filter;
+    delimiter_filter.write(messages, delimited);
+    eddyserver::VarintMessageFilter varint_filter;
+    varint_filter.write(messages, prefixed);
+}
+
+/**
+ * 测量解析吞吐量
+ * 每次从头解析整个样本，包括生成消息
+ */
+void MeasureParse(const char *name, eddyserver::MessageFilterInterface &filter, const Bytes &sample, size_t iterations)
+{
+    std::vector<eddyserver::NetMessage> messages;
+    size_t count = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        filter.read_stream(sample.data(), sample.size(), messages);
+        count += messages.size();
+        messages.clear();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    std::cout << name << ": " << count / iterations << " messages, "
+        << Throughput(sample.size() * iterations, elapsed) << " MB/s" << std::endl;
+}
+
+/**
+ * 测量各实现查找字节的吞吐量
+ * 样本中没有要查找的字节，测量完整扫描
+ */
+void MeasureFindByte(size_t iterations)
+{
+    const Bytes sample(kSampleSize, 'x');
+    const std::vector<eddyserver::SIMD::Implementation> implementations = eddyserver::SIMD::implementations();
+    for (size_t i = 0; i < implementations.size(); ++i)
+    {
+        size_t found = 0;
+        const auto begin = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < iterations; ++j)
+        {
+            found += implementations[i].find_byte(sample.data(), sample.data() + sample.size(), '\n') - sample.data();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - begin;
+        std::cout << "find_byte " << implementations[i].instruction_set << ": "
+            << Throughput(found, elapsed) << " MB/s" << std::endl;
+    }
+}
+
+/**
+ * 按分隔符和按长度前缀解析的吞吐量
+ * 用法：delimiter_benchmark [重复次数]
+ */
+int main(int argc, char *argv[])
+{
+    const size_t iterations = argc > 1 ? static_cast<size_t>(std::strtoul(argv[1], nullptr, 10)) : kDefaultIterations;
+
+    Bytes delimited;
+    Bytes prefixed;
+    MakeSamples(delimited, prefixed);
+
+    eddyserver::DelimiterMessageFilter delimiter_filter;
+    MeasureParse("delimiter", delimiter_filter, delimited, iterations);
+    eddyserver::VarintMessageFilter varint_filter;
+    MeasureParse("varint", varint_filter, prefixed, iterations);
+    MeasureFindByte(iterations);
+    return EXIT_SUCCESS;
+}
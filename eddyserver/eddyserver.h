@@ -7,17 +7,37 @@ namespace eddyserver
     class TCPServer;
     class NetMessage;
     class MessageFilter;
+    class ChainedMessage;
+    class LoadBalancer;
+    class SessionGroup;
     class IOServiceThread;
     class TCPSessionHandler;
     class IOServiceThreadManager;
     class MessageFilterInterface;
+    class CompressionFilter;
+    class FilterPipeline;
+    class DelimiterMessageFilter;
+    class WebSocketMessageFilter;
+    class HttpMessageFilter;
+    class HttpRequest;
+    class HttpResponse;
 }
 
 #include "eddyserver/tcp_client.h"
 #include "eddyserver/tcp_server.h"
+#include "eddyserver/coroutine.h"
 #include "eddyserver/net_message.h"
+#include "eddyserver/chained_message.h"
 #include "eddyserver/id_generator.h"
+#include "eddyserver/load_balancer.h"
 #include "eddyserver/message_filter.h"
+#include "eddyserver/basic_message_filter.h"
+#include "eddyserver/delimiter_message_filter.h"
+#include "eddyserver/websocket_message_filter.h"
+#include "eddyserver/http_message_filter.h"
+#include "eddyserver/filter_pipeline.h"
+#include "eddyserver/compression_filter.h"
+#include "eddyserver/session_group.h"
 #include "eddyserver/tcp_session_handler.h"
 #include "eddyserver/io_service_thread_manager.h"
 
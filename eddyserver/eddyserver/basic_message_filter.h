@@ -0,0 +1,471 @@
+﻿#ifndef __BASIC_MESSAGE_FILTER_H__
+#define __BASIC_MESSAGE_FILTER_H__
+
+#include <limits>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "net_message.h"
+#include "message_filter.h"
+#include "chained_message.h"
+
+namespace eddyserver
+{
+    /**
+     * 2字节长度编码
+     * 与MessageFilter的消息格式相同，长度为网络字节序
+     */
+    struct Uint16LengthCodec
+    {
+        /* 消息头最大长度 */
+        static const size_t kMaxHeaderSize = 2;
+
+        /* 消息体最大长度 */
+        static const uint64_t kMaxLength = 0xFFFF;
+
+        /* 消息头格式错误时decode的返回值 */
+        static const size_t kMalformed = std::numeric_limits<size_t>::max();
+
+        /**
+         * 解码消息头
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param length 消息体长度
+         * @return 消息头字节数，不完整时返回0，格式错误时返回kMalformed
+         */
+        static size_t decode(const uint8_t *data, size_t size, uint64_t &length)
+        {
+            if (size < kMaxHeaderSize)
+            {
+                return 0;
+            }
+            length = (static_cast<uint64_t>(data[0]) << 8) | data[1];
+            return kMaxHeaderSize;
+        }
+
+        /**
+         * 编码消息头
+         * @param length 消息体长度
+         * @param out 输出缓存，至少kMaxHeaderSize字节
+         * @return 消息头字节数
+         */
+        static size_t encode(uint64_t length, uint8_t *out)
+        {
+            assert(length <= kMaxLength);
+            out[0] = static_cast<uint8_t>(length >> 8);
+            out[1] = static_cast<uint8_t>(length);
+            return kMaxHeaderSize;
+        }
+    };
+
+    /**
+     * 变长长度编码
+     * 长度为LEB128编码，最长10字节，支持64位长度
+     */
+    struct VarintLengthCodec
+    {
+        /* 消息头最大长度 */
+        static const size_t kMaxHeaderSize = 10;
+
+        /* 消息体最大长度 */
+        static const uint64_t kMaxLength = std::numeric_limits<uint64_t>::max();
+
+        /* 消息头格式错误时decode的返回值 */
+        static const size_t kMalformed = std::numeric_limits<size_t>::max();
+
+        /**
+         * 解码消息头
+         * 第10个字节只能是0或1（64位长度的最高位），否则超出64位，视为格式错误
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param length 消息体长度
+         * @return 消息头字节数，不完整时返回0，格式错误时返回kMalformed
+         */
+        static size_t decode(const uint8_t *data, size_t size, uint64_t &length)
+        {
+            uint64_t value = 0;
+            const size_t limit = size < kMaxHeaderSize ? size : kMaxHeaderSize;
+            for (size_t i = 0; i < limit; ++i)
+            {
+                if (i + 1 == kMaxHeaderSize && data[i] > 1)
+                {
+                    return kMalformed;
+                }
+
+                value |= static_cast<uint64_t>(data[i] & 0x7F) << (7 * i);
+                if ((data[i] & 0x80) == 0)
+                {
+                    length = value;
+                    return i + 1;
+                }
+            }
+            return 0;
+        }
+
+        /**
+         * 编码消息头
+         * @param length 消息体长度
+         * @param out 输出缓存，至少kMaxHeaderSize字节
+         * @return 消息头字节数
+         */
+        static size_t encode(uint64_t length, uint8_t *out)
+        {
+            size_t size = 0;
+            while (length >= 0x80)
+            {
+                out[size++] = static_cast<uint8_t>(length | 0x80);
+                length >>= 7;
+            }
+            out[size++] = static_cast<uint8_t>(length);
+            return size;
+        }
+    };
+
+    /**
+     * 长度前缀消息过滤器模板
+     * 消息头由Codec编解码，Codec的decode和encode为静态函数，按(地址, 大小)读写任意内存区域
+     * 每条消息的解析和编码在模板内展开，Session每次读写只经过一次虚函数调用
+     * 总是流式读取，超过阈值的消息体逐块读入ChainedMessage，不需要连续的大缓存
+     * 消息头格式错误或长度超过上限时出错，Session关闭连接
+     */
+    template <typename Codec>
+    class BasicMessageFilter final : public MessageFilterInterface
+    {
+    public:
+        /* 聚集写入时小于此大小的消息体直接拷贝到消息头缓存区 */
+        static const size_t kGatherThreshold = MessageFilter::kGatherThreshold;
+
+        /* 默认的消息最大长度 */
+        static const uint64_t kDefaultMaxMessageSize = 64 * 1024 * 1024;
+
+    public:
+        /**
+         * 构造函数
+         * @param chain_threshold 超过此大小的消息读入ChainedMessage
+         * @param max_message_size 消息体最大长度，超过时出错
+         */
+        explicit BasicMessageFilter(size_t chain_threshold = ChainedMessage::kChunkSize,
+                                    uint64_t max_message_size = kDefaultMaxMessageSize)
+            : length_(0)
+            , header_read_(false)
+            , chain_reading_(false)
+            , chain_ready_(false)
+            , error_(false)
+            , chain_threshold_(chain_threshold)
+            , max_message_size_(max_message_size)
+        {
+        }
+
+    public:
+        /**
+         * 获取欲读取数据大小
+         */
+        size_t bytes_wanna_read() override
+        {
+            return MessageFilterInterface::stream_bytes();
+        }
+
+        /**
+         * 获取欲写入数据大小
+         * @param messages_to_be_sent 将被发送的消息列表
+         */
+        size_t bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent) override
+        {
+            uint8_t header[Codec::kMaxHeaderSize];
+            size_t bytes = 0;
+            for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+            {
+                if (messages_to_be_sent[i].readable() <= Codec::kMaxLength)
+                {
+                    bytes += Codec::encode(messages_to_be_sent[i].readable(), header) + messages_to_be_sent[i].readable();
+                }
+            }
+            return bytes;
+        }
+
+        /**
+         * 读取数据
+         * 与流式读取相同
+         */
+        size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received) override
+        {
+            return read_stream(buffer.data(), buffer.size(), messages_received);
+        }
+
+        /**
+         * 流式读取数据
+         * 解析data中所有完整的消息，链式消息的消息体有多少读多少，读完一条后返回，出错后不再读取
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received) override
+        {
+            size_t bytes = 0;
+            while (bytes < size && !chain_ready_ && !error_)
+            {
+                if (!header_read_)
+                {
+                    const size_t header_size = Codec::decode(data + bytes, size - bytes, length_);
+                    if (header_size == 0)
+                    {
+                        break;
+                    }
+
+                    if (header_size == Codec::kMalformed || length_ > max_message_size_)
+                    {
+                        error_ = true;
+                        break;
+                    }
+                    bytes += header_size;
+                    header_read_ = true;
+                    chain_reading_ = length_ > chain_threshold_;
+                }
+
+                if (chain_reading_)
+                {
+                    const size_t bytes_read = static_cast<size_t>(std::min<uint64_t>(size - bytes, length_ - chain_.readable()));
+                    chain_.write(data + bytes, bytes_read);
+                    bytes += bytes_read;
+                    if (chain_.readable() == length_)
+                    {
+                        header_read_ = false;
+                        chain_reading_ = false;
+                        chain_ready_ = true;
+                    }
+                }
+                else
+                {
+                    if (size - bytes < length_)
+                    {
+                        break;
+                    }
+
+                    const size_t length = static_cast<size_t>(length_);
+                    NetMessage new_message(length);
+                    new_message.write(data + bytes, length);
+                    messages_received.push_back(std::move(new_message));
+                    bytes += length;
+                    header_read_ = false;
+                }
+            }
+            return bytes;
+        }
+
+        /**
+         * 写入数据
+         * 将param1 messages_to_be_sent的消息列表写入param2 buffer中，长度超过Codec上限的消息丢弃并标记出错
+         * @param messages_to_be_sent 写入的消息列表
+         * @param &buffer 缓存区
+         * @return 写入字节数
+         */
+        size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer) override
+        {
+            uint8_t header[Codec::kMaxHeaderSize];
+            size_t bytes = 0;
+            for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+            {
+                const NetMessage &message = messages_to_be_sent[i];
+                if (message.readable() > Codec::kMaxLength)
+                {
+                    error_ = true;
+                    continue;
+                }
+
+                const size_t header_size = Codec::encode(message.readable(), header);
+                buffer.insert(buffer.end(), header, header + header_size);
+                buffer.insert(buffer.end(), message.data(), message.data() + message.readable());
+                bytes += header_size + message.readable();
+            }
+            return bytes;
+        }
+
+        /**
+         * 是否支持聚集写入
+         */
+        bool supports_gather_write() const override
+        {
+            return true;
+        }
+
+        /**
+         * 聚集写入数据
+         * 消息头写入param2 headers，消息体不拷贝，由param3 buffers按顺序引用
+         * 独占缓冲块的消息直接在消息体前写入消息头
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers) override
+        {
+            // 先确定缓存区大小，避免写入过程中重新分配导致缓冲区失效
+            uint8_t header[Codec::kMaxHeaderSize];
+            size_t headers_size = 0;
+            for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+            {
+                const NetMessage &message = messages_to_be_sent[i];
+                if (message.readable() > Codec::kMaxLength)
+                {
+                    continue;
+                }
+
+                const size_t header_size = Codec::encode(message.readable(), header);
+                if (message.readable() < kGatherThreshold)
+                {
+                    headers_size += header_size + message.readable();
+                }
+                else if (!in_place(message, header_size))
+                {
+                    headers_size += header_size;
+                }
+            }
+            headers.resize(headers_size);
+
+            size_t bytes = 0;
+            size_t offset = 0;
+            size_t chunk_begin = 0;
+            for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+            {
+                NetMessage &message = messages_to_be_sent[i];
+                const NetMessage &content = message;
+                if (message.readable() > Codec::kMaxLength)
+                {
+                    error_ = true;
+                    continue;
+                }
+
+                const size_t header_size = Codec::encode(message.readable(), header);
+                bytes += header_size + message.readable();
+
+                if (message.readable() >= kGatherThreshold && in_place(message, header_size))
+                {
+                    // 消息头直接写入消息体前的头部空间，整条消息作为一个缓冲区
+                    message.prepend(header, header_size);
+                    if (offset > chunk_begin)
+                    {
+                        buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                        chunk_begin = offset;
+                    }
+                    buffers.push_back(asio::buffer(content.data(), content.readable()));
+                    continue;
+                }
+
+                memcpy(headers.data() + offset, header, header_size);
+                offset += header_size;
+
+                if (message.readable() < kGatherThreshold)
+                {
+                    memcpy(headers.data() + offset, content.data(), content.readable());
+                    offset += content.readable();
+                }
+                else
+                {
+                    buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                    buffers.push_back(asio::buffer(content.data(), content.readable()));
+                    chunk_begin = offset;
+                }
+            }
+
+            if (offset > chunk_begin)
+            {
+                buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+            }
+            return bytes;
+        }
+
+        /**
+         * 编码广播帧
+         * @param message 消息
+         * @param frame 编码后的帧
+         * @return 是否支持，长度超过Codec上限时不支持
+         */
+        bool write_frame(const NetMessage &message, NetMessage &frame) const override
+        {
+            if (message.readable() > Codec::kMaxLength)
+            {
+                return false;
+            }
+
+            uint8_t header[Codec::kMaxHeaderSize];
+            const size_t header_size = Codec::encode(message.readable(), header);
+            frame = message;
+            frame.prepend(header, header_size);
+            return true;
+        }
+
+        /**
+         * 取出读取完成的链式消息
+         * @param message 链式消息
+         * @return 是否有读取完成的链式消息
+         */
+        bool take_chained_message(ChainedMessage &message) override
+        {
+            if (!chain_ready_)
+            {
+                return false;
+            }
+
+            message = std::move(chain_);
+            chain_ready_ = false;
+            return true;
+        }
+
+        /**
+         * 编码链式消息的消息头
+         * @param message 链式消息
+         * @param header 编码后的消息头
+         * @return 是否支持，长度超过Codec上限时不支持
+         */
+        bool write_chain_header(const ChainedMessage &message, NetMessage &header) const override
+        {
+            if (message.readable() > Codec::kMaxLength)
+            {
+                return false;
+            }
+
+            uint8_t bytes[Codec::kMaxHeaderSize];
+            const size_t header_size = Codec::encode(message.readable(), bytes);
+            header = NetMessage(reinterpret_cast<const char*>(bytes), header_size);
+            return true;
+        }
+
+        /**
+         * 是否出错
+         */
+        bool has_error() const override
+        {
+            return error_;
+        }
+
+    private:
+        /**
+         * 是否可以在消息体前直接写入消息头
+         */
+        static bool in_place(const NetMessage &message, size_t header_size)
+        {
+            return message.prependable() >= header_size && !message.is_shared();
+        }
+
+    private:
+        uint64_t            length_;
+        bool                header_read_;
+        bool                chain_reading_;
+        bool                chain_ready_;
+        bool                error_;
+        const size_t        chain_threshold_;
+        const uint64_t      max_message_size_;
+        ChainedMessage      chain_;
+    };
+
+    /**
+     * 变长消息头过滤器
+     * 支持64位长度的消息
+     */
+    typedef BasicMessageFilter<VarintLengthCodec> VarintMessageFilter;
+}
+
+#endif
@@ -0,0 +1,228 @@
+﻿#include "buffer_pool.h"
+#include <new>
+#include <cassert>
+
+namespace eddyserver
+{
+    namespace buffer_pool_stuff
+    {
+        /**
+         * 线程缓存
+         * 本线程释放的缓冲块进入本地链表，其它线程释放的进入远程链表，本地链表为空时取回
+         */
+        struct ThreadCache
+        {
+            BufferBlock*                free_lists[BufferPool::kSizeClasses];
+            size_t                      free_counts[BufferPool::kSizeClasses];
+            std::atomic<BufferBlock*>   remote_frees[BufferPool::kSizeClasses];
+            std::atomic_bool            alive;
+
+            ThreadCache()
+                : free_lists()
+                , free_counts()
+                , alive(true)
+            {
+                for (size_t i = 0; i < BufferPool::kSizeClasses; ++i)
+                {
+                    remote_frees[i].store(nullptr, std::memory_order_relaxed);
+                }
+            }
+        };
+
+        /* 线程缓存状态 */
+        enum CacheState
+        {
+            kCacheNone,
+            kCacheAlive,
+            kCacheDestroyed,
+        };
+
+        /* 线程缓存，使用平凡类型保证线程退出过程中仍可安全访问 */
+        thread_local ThreadCache *cache = nullptr;
+        thread_local int cache_state = kCacheNone;
+
+        /**
+         * 链表中下一个缓冲块
+         */
+        inline BufferBlock*& NextOf(BufferBlock *block)
+        {
+            return *reinterpret_cast<BufferBlock**>(block->data());
+        }
+
+        /**
+         * 释放缓冲块内存
+         */
+        inline void Destroy(BufferBlock *block)
+        {
+            block->~BufferBlock();
+            ::operator delete(block);
+        }
+
+        /**
+         * 释放链表中的全部缓冲块
+         */
+        inline void DestroyList(BufferBlock *block)
+        {
+            while (block != nullptr)
+            {
+                BufferBlock *next = NextOf(block);
+                Destroy(block);
+                block = next;
+            }
+        }
+
+        /**
+         * 线程退出时释放缓存
+         * 缓存本身不释放，其它线程仍可能归还缓冲块，归还时发现线程已退出会直接释放
+         */
+        struct CacheGuard
+        {
+            ~CacheGuard()
+            {
+                ThreadCache *dead = cache;
+                cache = nullptr;
+                cache_state = kCacheDestroyed;
+
+                dead->alive.store(false, std::memory_order_seq_cst);
+                for (size_t i = 0; i < BufferPool::kSizeClasses; ++i)
+                {
+                    DestroyList(dead->free_lists[i]);
+                    dead->free_lists[i] = nullptr;
+                    DestroyList(dead->remote_frees[i].exchange(nullptr, std::memory_order_seq_cst));
+                }
+            }
+        };
+
+        /**
+         * 获取线程缓存
+         * 线程退出后返回nullptr
+         */
+        inline ThreadCache* LocalCache()
+        {
+            if (cache_state == kCacheNone)
+            {
+                thread_local CacheGuard guard;
+                cache = new ThreadCache();
+                cache_state = kCacheAlive;
+            }
+            return cache;
+        }
+
+        /**
+         * 获取容量所在级别
+         * 超过最大级别时返回kSizeClasses
+         */
+        inline size_t SizeClassOf(size_t capacity)
+        {
+            size_t size_class = 0;
+            size_t block_size = BufferPool::kMinBlockSize;
+            while (block_size < capacity && size_class < BufferPool::kSizeClasses)
+            {
+                block_size <<= 1;
+                ++size_class;
+            }
+            return size_class;
+        }
+
+        /**
+         * 从线程缓存中取出缓冲块
+         */
+        inline BufferBlock* PopBlock(ThreadCache *local, size_t size_class)
+        {
+            BufferBlock *block = local->free_lists[size_class];
+            if (block == nullptr)
+            {
+                // 取回其它线程归还的缓冲块
+                block = local->remote_frees[size_class].exchange(nullptr, std::memory_order_acquire);
+                if (block == nullptr)
+                {
+                    return nullptr;
+                }
+                for (BufferBlock *next = NextOf(block); next != nullptr; next = NextOf(next))
+                {
+                    ++local->free_counts[size_class];
+                }
+                local->free_lists[size_class] = NextOf(block);
+                return block;
+            }
+
+            local->free_lists[size_class] = NextOf(block);
+            --local->free_counts[size_class];
+            return block;
+        }
+
+        /**
+         * 归还缓冲块给分配它的线程
+         */
+        inline void PushRemote(ThreadCache *owner, size_t size_class, BufferBlock *block)
+        {
+            BufferBlock *head = owner->remote_frees[size_class].load(std::memory_order_relaxed);
+            do
+            {
+                NextOf(block) = head;
+            } while (!owner->remote_frees[size_class].compare_exchange_weak(head, block, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+            // 线程已退出，不会再取回
+            if (!owner->alive.load(std::memory_order_seq_cst))
+            {
+                DestroyList(owner->remote_frees[size_class].exchange(nullptr, std::memory_order_acquire));
+            }
+        }
+    }
+
+    // 分配缓冲块
+    BufferBlock* BufferPool::allocate(size_t capacity)
+    {
+        buffer_pool_stuff::ThreadCache *local = nullptr;
+        const size_t size_class = buffer_pool_stuff::SizeClassOf(capacity);
+        if (size_class < kSizeClasses)
+        {
+            local = buffer_pool_stuff::LocalCache();
+            if (local != nullptr)
+            {
+                BufferBlock *block = buffer_pool_stuff::PopBlock(local, size_class);
+                if (block != nullptr)
+                {
+                    block->refs.store(1, std::memory_order_relaxed);
+                    return block;
+                }
+            }
+            capacity = kMinBlockSize << size_class;
+        }
+
+        assert(capacity <= UINT32_MAX);
+        BufferBlock *block = new (::operator new(sizeof(BufferBlock) + capacity)) BufferBlock();
+        block->refs.store(1, std::memory_order_relaxed);
+        block->capacity = static_cast<uint32_t>(capacity);
+        block->owner = local;
+        return block;
+    }
+
+    // 回收缓冲块
+    void BufferPool::recycle(BufferBlock *block)
+    {
+        buffer_pool_stuff::ThreadCache *owner = block->owner;
+        if (owner == nullptr)
+        {
+            buffer_pool_stuff::Destroy(block);
+            return;
+        }
+
+        const size_t size_class = buffer_pool_stuff::SizeClassOf(block->capacity);
+        if (owner != buffer_pool_stuff::LocalCache())
+        {
+            buffer_pool_stuff::PushRemote(owner, size_class, block);
+            return;
+        }
+
+        if (owner->free_counts[size_class] * block->capacity >= kMaxCachedBytes)
+        {
+            buffer_pool_stuff::Destroy(block);
+            return;
+        }
+
+        buffer_pool_stuff::NextOf(block) = owner->free_lists[size_class];
+        owner->free_lists[size_class] = block;
+        ++owner->free_counts[size_class];
+    }
+}
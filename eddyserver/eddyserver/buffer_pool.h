@@ -0,0 +1,139 @@
+﻿#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace eddyserver
+{
+    namespace buffer_pool_stuff
+    {
+        struct ThreadCache;
+    }
+
+    /**
+     * 引用计数缓冲块
+     * 数据紧跟在块头之后
+     */
+    struct alignas(16) BufferBlock
+    {
+        std::atomic<uint32_t>           refs;
+        uint32_t                        capacity;
+        buffer_pool_stuff::ThreadCache* owner;
+
+        uint8_t* data()
+        {
+            return reinterpret_cast<uint8_t*>(this + 1);
+        }
+
+        const uint8_t* data() const
+        {
+            return reinterpret_cast<const uint8_t*>(this + 1);
+        }
+    };
+
+    /**
+     * 缓冲块池
+     * 按2的幂分级，每个线程缓存释放的缓冲块供下一次分配复用
+     * 缓冲块可以在任意线程释放，其它线程释放的缓冲块通过无锁链表归还给分配它的线程
+     */
+    class BufferPool final
+    {
+    public:
+        /* 最小缓冲块容量 */
+        static const size_t kMinBlockSize = 64;
+
+        /* 分级数量，超过最大级别的缓冲块不缓存 */
+        static const size_t kSizeClasses = 11;
+
+        /* 最大缓冲块容量 */
+        static const size_t kMaxBlockSize = kMinBlockSize << (kSizeClasses - 1);
+
+        /* 每个线程每级最多缓存的字节数 */
+        static const size_t kMaxCachedBytes = 256 * 1024;
+
+    public:
+        /**
+         * 分配缓冲块
+         * 引用计数为1，容量向上取整到所在级别
+         * @param capacity 最小容量
+         */
+        static BufferBlock* allocate(size_t capacity);
+
+        /**
+         * 增加引用
+         */
+        static void retain(BufferBlock *block)
+        {
+            block->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * 减少引用
+         * 引用计数归零时回收缓冲块
+         */
+        static void release(BufferBlock *block)
+        {
+            if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                recycle(block);
+            }
+        }
+
+    private:
+        /**
+         * 回收缓冲块
+         */
+        static void recycle(BufferBlock *block);
+
+    private:
+        BufferPool() = delete;
+    };
+
+    /**
+     * 从BufferPool分配内存的分配器
+     * 可用于std::allocate_shared等接受分配器的场合，内存可以在任意线程释放
+     */
+    template <typename T>
+    class PoolAllocator final
+    {
+        static_assert(alignof(T) <= alignof(BufferBlock), "type must fit the alignment of pooled blocks");
+
+    public:
+        typedef T value_type;
+
+    public:
+        PoolAllocator() = default;
+
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>&)
+        {
+        }
+
+    public:
+        T* allocate(size_t n)
+        {
+            return reinterpret_cast<T*>(BufferPool::allocate(n * sizeof(T))->data());
+        }
+
+        void deallocate(T *p, size_t)
+        {
+            BufferPool::release(reinterpret_cast<BufferBlock*>(p) - 1);
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator== (const PoolAllocator<T>&, const PoolAllocator<U>&)
+    {
+        return true;
+    }
+
+    template <typename T, typename U>
+    bool operator!= (const PoolAllocator<T>&, const PoolAllocator<U>&)
+    {
+        return false;
+    }
+}
+
+#endif
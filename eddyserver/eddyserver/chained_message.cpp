@@ -0,0 +1,135 @@
+﻿#include "chained_message.h"
+#include <algorithm>
+
+namespace eddyserver
+{
+    ChainedMessage::ChainedMessage()
+        : head_(0)
+        , size_(0)
+    {
+    }
+
+    ChainedMessage::ChainedMessage(ChainedMessage &&other)
+        : chunks_(std::move(other.chunks_))
+        , head_(other.head_)
+        , size_(other.size_)
+    {
+        other.clear();
+    }
+
+    ChainedMessage& ChainedMessage::operator= (ChainedMessage &&rhs)
+    {
+        if (std::addressof(rhs) != this)
+        {
+            chunks_ = std::move(rhs.chunks_);
+            head_ = rhs.head_;
+            size_ = rhs.size_;
+            rhs.clear();
+        }
+        return *this;
+    }
+
+    // 清空
+    void ChainedMessage::clear()
+    {
+        chunks_.clear();
+        head_ = 0;
+        size_ = 0;
+    }
+
+    // 写入数据
+    size_t ChainedMessage::write(const void *data, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t*>(data);
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            if (chunk_count() == 0 || chunks_.back().writeable() == 0 || chunks_.back().is_shared())
+            {
+                chunks_.push_back(NetMessage(kChunkSize));
+            }
+
+            NetMessage &chunk = chunks_.back();
+            const size_t bytes_written = std::min(remaining, chunk.writeable());
+            chunk.write(bytes, bytes_written);
+            bytes += bytes_written;
+            remaining -= bytes_written;
+        }
+        size_ += size;
+        return size;
+    }
+
+    // 追加消息
+    void ChainedMessage::append(const NetMessage &message)
+    {
+        if (!message.empty())
+        {
+            chunks_.push_back(message);
+            size_ += message.readable();
+        }
+    }
+
+    // 读取数据
+    size_t ChainedMessage::read(void *data, size_t size)
+    {
+        uint8_t *bytes = static_cast<uint8_t*>(data);
+        size_t bytes_read = 0;
+        while (bytes_read < size && head_ < chunks_.size())
+        {
+            NetMessage &chunk = chunks_[head_];
+            const NetMessage &content = chunk;
+            const size_t n = std::min(size - bytes_read, chunk.readable());
+            memcpy(bytes + bytes_read, content.data(), n);
+            chunk.retrieve(n);
+            bytes_read += n;
+            size_ -= n;
+            pop_chunks();
+        }
+        return bytes_read;
+    }
+
+    // 获取数据
+    void ChainedMessage::retrieve(size_t size)
+    {
+        assert(readable() >= size);
+        while (size > 0 && head_ < chunks_.size())
+        {
+            NetMessage &chunk = chunks_[head_];
+            const size_t n = std::min(size, chunk.readable());
+            chunk.retrieve(n);
+            size -= n;
+            size_ -= n;
+            pop_chunks();
+        }
+    }
+
+    // 移除已读完的块
+    void ChainedMessage::pop_chunks()
+    {
+        while (head_ < chunks_.size() && chunks_[head_].empty())
+        {
+            chunks_[head_++] = NetMessage();
+        }
+
+        if (head_ == chunks_.size())
+        {
+            clear();
+        }
+    }
+
+    // 合并为连续的消息
+    NetMessage ChainedMessage::flatten() const
+    {
+        if (chunk_count() == 1)
+        {
+            return chunks_[head_];
+        }
+
+        NetMessage message(size_);
+        for (size_t i = head_; i < chunks_.size(); ++i)
+        {
+            message.write(chunks_[i].data(), chunks_[i].readable());
+        }
+        return message;
+    }
+}
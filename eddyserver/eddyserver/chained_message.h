@@ -0,0 +1,131 @@
+﻿#ifndef __CHAINED_MESSAGE_H__
+#define __CHAINED_MESSAGE_H__
+
+#include <vector>
+#include "net_message.h"
+
+namespace eddyserver
+{
+    /**
+     * 链式消息
+     * 由固定大小的NetMessage块依次连接组成，用于超过单个缓冲块的大消息
+     * 追加数据只分配新块，不会重新分配和拷贝已有数据
+     * 拷贝共享所有块，读取只移动自身的读位置
+     */
+    class ChainedMessage
+    {
+    public:
+        /* 每块的容量，恰好占用BufferPool最大一级的缓冲块 */
+        static const size_t kChunkSize = BufferPool::kMaxBlockSize - NetMessage::kDefaultHeadroom;
+
+    public:
+        ChainedMessage();
+        ChainedMessage(const ChainedMessage &other) = default;
+        ChainedMessage(ChainedMessage &&other);
+
+        ChainedMessage& operator= (const ChainedMessage &rhs) = default;
+        ChainedMessage& operator= (ChainedMessage &&rhs);
+
+    public:
+        /**
+         * 获取可读数据大小
+         */
+        size_t readable() const
+        {
+            return size_;
+        }
+
+        /**
+         * 是否为空
+         */
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        /**
+         * 获取块数量
+         */
+        size_t chunk_count() const
+        {
+            return chunks_.size() - head_;
+        }
+
+        /**
+         * 获取块
+         * @param index 块索引
+         */
+        const NetMessage& chunk(size_t index) const
+        {
+            assert(head_ + index < chunks_.size());
+            return chunks_[head_ + index];
+        }
+
+    public:
+        /**
+         * 清空
+         */
+        void clear();
+
+        /**
+         * 写入数据
+         * 先填满最后一块，剩余数据写入新分配的块
+         * @param data 数据地址
+         * @param size 数据大小
+         */
+        size_t write(const void *data, size_t size);
+
+        /**
+         * 追加消息
+         * 消息作为一块共享到末尾，不拷贝数据
+         * @param message 消息
+         */
+        void append(const NetMessage &message);
+
+        /**
+         * 读取数据
+         * 将数据拷贝到param1 data，读取的块从链中移除
+         * @param data 数据地址
+         * @param size 数据大小
+         * @return 读取字节数
+         */
+        size_t read(void *data, size_t size);
+
+        /**
+         * 获取数据（只会移动读位置）
+         * @param size 数据大小
+         */
+        void retrieve(size_t size);
+
+        /**
+         * 合并为连续的消息
+         * 需要一次分配全部大小的缓冲块
+         */
+        NetMessage flatten() const;
+
+    private:
+        /**
+         * 移除已读完的块
+         */
+        void pop_chunks();
+
+    private:
+        NetMessageVector    chunks_;
+        size_t              head_;
+        size_t              size_;
+    };
+
+    /**
+     * 接收的链式消息
+     * position为它在同一批普通消息中的位置，分发时排在该位置的消息之前
+     */
+    struct ReceivedChain
+    {
+        size_t              position;
+        ChainedMessage      message;
+    };
+
+    typedef std::vector<ReceivedChain> ReceivedChainVector;
+}
+
+#endif
@@ -0,0 +1,233 @@
+﻿#include "compression_filter.h"
+#include "chained_message.h"
+#include "basic_message_filter.h"
+
+namespace eddyserver
+{
+    const uint8_t CompressionStage::kRaw;
+    const uint8_t CompressionStage::kCompressed;
+    const uint8_t CompressionStage::kCompressedWithDictionary;
+    const size_t CompressionStage::kDefaultThreshold;
+
+    CompressionStage::CompressionStage(size_t threshold, const CompressionDictionaryPointer &dictionary)
+        : threshold_(threshold)
+        , dictionary_(dictionary)
+    {
+    }
+
+    // 压缩消息
+    void CompressionStage::encode(NetMessage &message) const
+    {
+        const NetMessage &content = message;
+        if (content.readable() >= threshold_ && content.readable() <= Compressor::kMaxInputSize)
+        {
+            uint8_t header[1 + VarintLengthCodec::kMaxHeaderSize];
+            header[0] = dictionary_ != nullptr ? kCompressedWithDictionary : kCompressed;
+            const size_t header_size = 1 + VarintLengthCodec::encode(content.readable(), header + 1);
+
+            // 压缩到新的池化缓冲块，头部空间留给标志、原始长度和分帧过滤器的消息头
+            NetMessage compressed(Compressor::compress_bound(content.readable()), header_size + NetMessage::kDefaultHeadroom);
+            const size_t size = Compressor::compress(content.data(), content.readable(),
+                compressed.data(), compressed.writeable(), dictionary_.get());
+            if (size > 0 && size + header_size < content.readable())
+            {
+                compressed.has_written(size);
+                compressed.prepend(header, header_size);
+                message = std::move(compressed);
+                return;
+            }
+        }
+
+        const uint8_t flag = kRaw;
+        message.prepend(&flag, sizeof(flag));
+    }
+
+    // 读取标志并解压消息
+    bool CompressionStage::decode(NetMessage &message) const
+    {
+        if (message.empty())
+        {
+            return false;
+        }
+        return decode(message.read_pod<uint8_t>(), message);
+    }
+
+    // 按标志解压消息体
+    bool CompressionStage::decode(uint8_t flag, NetMessage &message) const
+    {
+        if (flag == kRaw)
+        {
+            return true;
+        }
+
+        const bool with_dictionary = flag == kCompressedWithDictionary;
+        if ((flag != kCompressed && !with_dictionary) || with_dictionary != (dictionary_ != nullptr))
+        {
+            return false;
+        }
+
+        uint64_t original_size = 0;
+        const NetMessage &content = message;
+        const size_t header_size = VarintLengthCodec::decode(content.data(), content.readable(), original_size);
+        if (header_size == 0 || header_size == VarintLengthCodec::kMalformed)
+        {
+            return false;
+        }
+        message.retrieve(header_size);
+
+        // 原始长度不能超过压缩格式的最大压缩比，避免按伪造的长度分配
+        if (original_size > (static_cast<uint64_t>(content.readable()) + 1) * 255)
+        {
+            return false;
+        }
+
+        const size_t size = static_cast<size_t>(original_size);
+        NetMessage original(size);
+        if (!Compressor::decompress(content.data(), content.readable(), original.data(), size, dictionary_.get()))
+        {
+            return false;
+        }
+        original.has_written(size);
+        message = std::move(original);
+        return true;
+    }
+
+    CompressionFilter::CompressionFilter(const MessageFilterPointer &filter,
+        size_t threshold,
+        const CompressionDictionaryPointer &dictionary)
+        : filter_(filter)
+        , stage_(threshold, dictionary)
+        , error_(false)
+    {
+        assert(filter_ != nullptr);
+    }
+
+    // 获取欲读取数据大小
+    size_t CompressionFilter::bytes_wanna_read()
+    {
+        return filter_->bytes_wanna_read();
+    }
+
+    // 获取欲写入数据大小
+    size_t CompressionFilter::bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent)
+    {
+        return filter_->bytes_wanna_write(messages_to_be_sent) + messages_to_be_sent.size();
+    }
+
+    // 读取数据
+    size_t CompressionFilter::read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received)
+    {
+        const size_t first = messages_received.size();
+        const size_t bytes = filter_->read(buffer, messages_received);
+        decode_messages(messages_received, first);
+        return bytes;
+    }
+
+    // 流式读取数据
+    size_t CompressionFilter::read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+    {
+        const size_t first = messages_received.size();
+        const size_t bytes = filter_->read_stream(data, size, messages_received);
+        decode_messages(messages_received, first);
+        return bytes;
+    }
+
+    // 写入数据
+    size_t CompressionFilter::write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer)
+    {
+        messages_encoded_.assign(messages_to_be_sent.begin(), messages_to_be_sent.end());
+        for (size_t i = 0; i < messages_encoded_.size(); ++i)
+        {
+            stage_.encode(messages_encoded_[i]);
+        }
+        const size_t bytes = filter_->write(messages_encoded_, buffer);
+        messages_encoded_.clear();
+        return bytes;
+    }
+
+    // 是否支持聚集写入
+    bool CompressionFilter::supports_gather_write() const
+    {
+        return filter_->supports_gather_write();
+    }
+
+    // 聚集写入数据
+    size_t CompressionFilter::write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+    {
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            stage_.encode(messages_to_be_sent[i]);
+        }
+        return filter_->write_gather(messages_to_be_sent, headers, buffers);
+    }
+
+    // 取出读取完成的链式消息
+    bool CompressionFilter::take_chained_message(ChainedMessage &message)
+    {
+        if (error_ || !filter_->take_chained_message(message))
+        {
+            return false;
+        }
+
+        uint8_t flag = CompressionStage::kRaw;
+        if (message.read(&flag, sizeof(flag)) == sizeof(flag) && flag != CompressionStage::kRaw)
+        {
+            NetMessage content = message.flatten();
+            message.clear();
+            if (!stage_.decode(flag, content))
+            {
+                error_ = true;
+                return false;
+            }
+            message.append(content);
+        }
+        return true;
+    }
+
+    // 编码链式消息的消息头
+    bool CompressionFilter::write_chain_header(const ChainedMessage &message, NetMessage &header) const
+    {
+        // 以带标志的长度编码消息头，各块仍由Session直接发送
+        const uint8_t flag = CompressionStage::kRaw;
+        ChainedMessage flagged;
+        flagged.append(NetMessage(reinterpret_cast<const char*>(&flag), sizeof(flag)));
+        for (size_t i = 0; i < message.chunk_count(); ++i)
+        {
+            flagged.append(message.chunk(i));
+        }
+
+        if (!filter_->write_chain_header(flagged, header))
+        {
+            return false;
+        }
+        header.write(&flag, sizeof(flag));
+        return true;
+    }
+
+    // 是否需要重新解析已接收的数据
+    bool CompressionFilter::take_read_resumed()
+    {
+        return filter_->take_read_resumed();
+    }
+
+    // 是否出错
+    bool CompressionFilter::has_error() const
+    {
+        return error_ || filter_->has_error();
+    }
+
+    // 解压从first开始的消息，失败时丢弃之后的消息
+    void CompressionFilter::decode_messages(std::vector<NetMessage> &messages, size_t first)
+    {
+        for (size_t i = first; i < messages.size(); ++i)
+        {
+            // 数据损坏或字典不匹配，Session分发之前的消息后关闭连接
+            if (!stage_.decode(messages[i]))
+            {
+                error_ = true;
+                messages.erase(messages.begin() + i, messages.end());
+                return;
+            }
+        }
+    }
+}
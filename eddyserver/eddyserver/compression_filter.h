@@ -0,0 +1,195 @@
+﻿#ifndef __COMPRESSION_FILTER_H__
+#define __COMPRESSION_FILTER_H__
+
+#include "types.h"
+#include "compressor.h"
+#include "net_message.h"
+#include "message_filter.h"
+#include "filter_pipeline.h"
+
+namespace eddyserver
+{
+    /**
+     * 压缩阶段
+     * 消息体前写入1字节标志，压缩的消息体在标志后写入变长编码的原始长度
+     * 只压缩不小于阈值且压缩后变小的消息，其余消息在头部空间写入标志，不拷贝
+     * 压缩上下文按线程复用，解压直接写入池化的NetMessage
+     * 收发双方必须使用相同的字典
+     */
+    class CompressionStage final : public MessageStage
+    {
+    public:
+        /* 消息体标志 */
+        static const uint8_t kRaw = 0;
+        static const uint8_t kCompressed = 1;
+        static const uint8_t kCompressedWithDictionary = 2;
+
+        /* 默认压缩阈值 */
+        static const size_t kDefaultThreshold = 256;
+
+    public:
+        /**
+         * 构造函数
+         * @param threshold 小于此大小的消息不压缩
+         * @param dictionary 共享的压缩字典，可以为nullptr
+         */
+        explicit CompressionStage(size_t threshold = kDefaultThreshold,
+            const CompressionDictionaryPointer &dictionary = nullptr);
+
+    public:
+        virtual const char* name() const
+        {
+            return "compression";
+        }
+
+        /**
+         * 不压缩时在头部空间写入标志，压缩时写入新的缓冲块
+         */
+        virtual size_t headroom() const
+        {
+            return sizeof(uint8_t);
+        }
+
+        /**
+         * 压缩消息
+         * 结果替换原消息
+         */
+        virtual void encode(NetMessage &message) const;
+
+        /**
+         * 读取标志并解压消息
+         * @return 是否成功
+         */
+        virtual bool decode(NetMessage &message) const;
+
+        /**
+         * 按标志解压消息体
+         * @param flag 已读取的标志
+         * @param message 标志后的消息体
+         * @return 是否成功
+         */
+        bool decode(uint8_t flag, NetMessage &message) const;
+
+    private:
+        const size_t                    threshold_;
+        CompressionDictionaryPointer    dictionary_;
+    };
+
+    /**
+     * 压缩过滤器
+     * 包装一个分帧过滤器，由CompressionStage压缩消息体
+     * 需要组合其它处理阶段时使用FilterPipelineBuilder
+     * 编码结果依赖字典和分帧过滤器，广播时不在Session间共享帧
+     */
+    class CompressionFilter final : public MessageFilterInterface
+    {
+    public:
+        /**
+         * 构造函数
+         * @param filter 分帧过滤器
+         * @param threshold 小于此大小的消息不压缩
+         * @param dictionary 共享的压缩字典，可以为nullptr
+         */
+        CompressionFilter(const MessageFilterPointer &filter,
+            size_t threshold = CompressionStage::kDefaultThreshold,
+            const CompressionDictionaryPointer &dictionary = nullptr);
+
+    public:
+        /**
+         * 获取欲读取数据大小
+         */
+        virtual size_t bytes_wanna_read();
+
+        /**
+         * 获取欲写入数据大小
+         * @param messages_to_be_sent 将被发送的消息列表
+         */
+        virtual size_t bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent);
+
+        /**
+         * 读取数据
+         * 分帧过滤器读取后解压，解压失败时出错，之后的消息丢弃
+         * @param buffer 缓存区数据
+         * @param messages_received 读取的消息列表
+         * @return 读取字节数
+         */
+        virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 流式读取数据
+         * 分帧过滤器解析后解压，解压失败时出错，之后的消息丢弃
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 写入数据
+         * 压缩后由分帧过滤器写入
+         * @param messages_to_be_sent 写入的消息列表
+         * @param &buffer 缓存区
+         * @return 写入字节数
+         */
+        virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer);
+
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const;
+
+        /**
+         * 聚集写入数据
+         * 消息就地压缩后由分帧过滤器聚集写入
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers);
+
+        /**
+         * 取出读取完成的链式消息
+         * 链式发送的消息不压缩，读取到压缩的大消息时解压为一块
+         * @param message 链式消息
+         * @return 是否有读取完成的链式消息，解压失败时出错并返回false
+         */
+        virtual bool take_chained_message(ChainedMessage &message);
+
+        /**
+         * 编码链式消息的消息头
+         * 链式消息不压缩，标志写在消息头末尾
+         * @param message 链式消息
+         * @param header 编码后的消息头
+         * @return 是否支持
+         */
+        virtual bool write_chain_header(const ChainedMessage &message, NetMessage &header) const;
+
+        /**
+         * 是否需要重新解析已接收的数据
+         * 由分帧过滤器决定
+         */
+        virtual bool take_read_resumed();
+
+        /**
+         * 是否出错
+         * 解压失败或分帧过滤器出错
+         */
+        virtual bool has_error() const;
+
+    private:
+        /**
+         * 解压从first开始的消息，失败时出错并丢弃之后的消息
+         */
+        void decode_messages(std::vector<NetMessage> &messages, size_t first);
+
+    private:
+        MessageFilterPointer            filter_;
+        CompressionStage                stage_;
+        NetMessageVector                messages_encoded_;
+        bool                            error_;
+    };
+}
+
+#endif
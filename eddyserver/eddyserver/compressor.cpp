@@ -0,0 +1,297 @@
+﻿#include "compressor.h"
+#include <limits>
+#include <cstring>
+#include <algorithm>
+
+namespace eddyserver
+{
+    namespace compressor_stuff
+    {
+        /* 末尾至少保留为字面量的字节数 */
+        const size_t kLastLiterals = 5;
+
+        /* 最后一个匹配距离末尾的最小字节数 */
+        const size_t kMatchFindLimit = 12;
+
+        /* 长度字段的最大值，超过时使用扩展字节 */
+        const size_t kRunMask = 15;
+
+        /**
+         * 压缩上下文
+         * 哈希表记录base加位置，小于本次base的项来自之前的压缩，视为空
+         */
+        struct CompressionContext
+        {
+            uint32_t base;
+            uint32_t table[1 << Compressor::kHashLog];
+        };
+
+        thread_local CompressionContext context;
+
+        /**
+         * 读取4字节序列
+         */
+        inline uint32_t Read32(const uint8_t *data)
+        {
+            uint32_t value = 0;
+            memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        /**
+         * 写入长度的扩展字节
+         */
+        inline void WriteLength(uint8_t *&op, size_t length)
+        {
+            while (length >= 255)
+            {
+                *op++ = 255;
+                length -= 255;
+            }
+            *op++ = static_cast<uint8_t>(length);
+        }
+
+        /**
+         * 读取长度的扩展字节
+         */
+        inline bool ReadLength(const uint8_t *&ip, const uint8_t *iend, size_t &length)
+        {
+            uint8_t byte = 0;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return false;
+                }
+                byte = *ip++;
+                length += byte;
+            } while (byte == 255);
+            return true;
+        }
+
+        /**
+         * 写入一个序列
+         * match_length为0时只写入字面量，作为最后一个序列
+         */
+        inline bool WriteSequence(uint8_t *&op, uint8_t *oend, const uint8_t *literals, size_t literal_length,
+            size_t offset, size_t match_length)
+        {
+            const size_t bytes_needed = 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+            if (static_cast<size_t>(oend - op) < bytes_needed)
+            {
+                return false;
+            }
+
+            uint8_t *token = op++;
+            *token = static_cast<uint8_t>(std::min(literal_length, kRunMask) << 4);
+            if (literal_length >= kRunMask)
+            {
+                WriteLength(op, literal_length - kRunMask);
+            }
+            if (literal_length > 0)
+            {
+                memcpy(op, literals, literal_length);
+                op += literal_length;
+            }
+
+            if (match_length == 0)
+            {
+                return true;
+            }
+
+            *op++ = static_cast<uint8_t>(offset);
+            *op++ = static_cast<uint8_t>(offset >> 8);
+            match_length -= Compressor::kMinMatch;
+            *token |= static_cast<uint8_t>(std::min(match_length, kRunMask));
+            if (match_length >= kRunMask)
+            {
+                WriteLength(op, match_length - kRunMask);
+            }
+            return true;
+        }
+    }
+
+    CompressionDictionary::CompressionDictionary(const void *data, size_t size)
+        : table_(1 << Compressor::kHashLog, 0)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t*>(data);
+        if (size > kMaxSize)
+        {
+            bytes += size - kMaxSize;
+            size = kMaxSize;
+        }
+        data_.assign(bytes, bytes + size);
+
+        // 靠后的位置覆盖靠前的，匹配偏移更小
+        for (size_t i = 0; i + Compressor::kMinMatch <= data_.size(); ++i)
+        {
+            table_[Compressor::hash(compressor_stuff::Read32(data_.data() + i))] = static_cast<uint32_t>(i + 1);
+        }
+    }
+
+    // 压缩
+    size_t Compressor::compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity,
+        const CompressionDictionary *dictionary)
+    {
+        using namespace compressor_stuff;
+        if (size > kMaxInputSize)
+        {
+            return 0;
+        }
+
+        // 代数用尽时清空哈希表
+        CompressionContext &ctx = context;
+        if (ctx.base == 0 || ctx.base > std::numeric_limits<uint32_t>::max() - size - 1)
+        {
+            memset(ctx.table, 0, sizeof(ctx.table));
+            ctx.base = 1;
+        }
+        const uint32_t base = ctx.base;
+        ctx.base += static_cast<uint32_t>(size + 1);
+
+        uint8_t *op = dst;
+        uint8_t *oend = dst + capacity;
+        size_t ip = 0;
+        size_t anchor = 0;
+        const size_t match_limit = size > kLastLiterals ? size - kLastLiterals : 0;
+        while (ip + kMatchFindLimit <= size)
+        {
+            const uint32_t sequence = Read32(src + ip);
+            const uint32_t h = hash(sequence);
+            const uint32_t entry = ctx.table[h];
+            ctx.table[h] = base + static_cast<uint32_t>(ip);
+
+            // 先在本次数据中查找，再到字典中查找
+            const uint8_t *match = nullptr;
+            size_t match_end = 0;
+            size_t offset = 0;
+            if (entry >= base && ip - (entry - base) <= kMaxDistance
+                && Read32(src + (entry - base)) == sequence)
+            {
+                match = src + (entry - base);
+                offset = ip - (entry - base);
+                match_end = match_limit - ip;
+            }
+            else if (dictionary != nullptr && dictionary->lookup(h) != 0)
+            {
+                const size_t position = dictionary->lookup(h) - 1;
+                offset = ip + dictionary->size() - position;
+                if (offset <= kMaxDistance && Read32(dictionary->data() + position) == sequence)
+                {
+                    match = dictionary->data() + position;
+                    match_end = std::min(match_limit - ip, dictionary->size() - position);
+                }
+            }
+
+            if (match == nullptr)
+            {
+                // 长时间没有匹配时加大步长，快速跳过不可压缩的数据
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            size_t match_length = kMinMatch;
+            while (match_length < match_end && match[match_length] == src[ip + match_length])
+            {
+                ++match_length;
+            }
+
+            if (!WriteSequence(op, oend, src + anchor, ip - anchor, offset, match_length))
+            {
+                return 0;
+            }
+            ip += match_length;
+            anchor = ip;
+        }
+
+        if (!WriteSequence(op, oend, src + anchor, size - anchor, 0, 0))
+        {
+            return 0;
+        }
+        return op - dst;
+    }
+
+    // 解压
+    bool Compressor::decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t original_size,
+        const CompressionDictionary *dictionary)
+    {
+        using namespace compressor_stuff;
+        const uint8_t *ip = src;
+        const uint8_t *iend = src + size;
+        uint8_t *op = dst;
+        uint8_t *oend = dst + original_size;
+        const size_t dictionary_size = dictionary != nullptr ? dictionary->size() : 0;
+
+        while (ip < iend)
+        {
+            const uint8_t token = *ip++;
+            size_t literal_length = token >> 4;
+            if (literal_length == kRunMask && !ReadLength(ip, iend, literal_length))
+            {
+                return false;
+            }
+            if (literal_length > static_cast<size_t>(iend - ip) || literal_length > static_cast<size_t>(oend - op))
+            {
+                return false;
+            }
+            memcpy(op, ip, literal_length);
+            op += literal_length;
+            ip += literal_length;
+
+            if (ip == iend)
+            {
+                break;
+            }
+
+            if (iend - ip < 2)
+            {
+                return false;
+            }
+            const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+
+            size_t match_length = token & kRunMask;
+            if (match_length == kRunMask && !ReadLength(ip, iend, match_length))
+            {
+                return false;
+            }
+            match_length += kMinMatch;
+
+            const size_t produced = op - dst;
+            if (offset == 0 || offset > produced + dictionary_size || match_length > static_cast<size_t>(oend - op))
+            {
+                return false;
+            }
+
+            // 偏移超出已解压的数据时从字典末尾开始复制
+            if (offset > produced)
+            {
+                const size_t back = offset - produced;
+                const size_t length = std::min(match_length, back);
+                memcpy(op, dictionary->data() + dictionary_size - back, length);
+                op += length;
+                match_length -= length;
+            }
+
+            if (match_length == 0)
+            {
+                continue;
+            }
+
+            const uint8_t *match = op - offset;
+            if (offset >= match_length)
+            {
+                memcpy(op, match, match_length);
+                op += match_length;
+            }
+            else
+            {
+                for (size_t i = 0; i < match_length; ++i)
+                {
+                    *op++ = *match++;
+                }
+            }
+        }
+        return op == oend;
+    }
+}
@@ -0,0 +1,127 @@
+﻿#ifndef __COMPRESSOR_H__
+#define __COMPRESSOR_H__
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace eddyserver
+{
+    /**
+     * 压缩字典
+     * 预先训练的样本数据，压缩时消息开头即可引用字典中的重复内容
+     * 哈希表在构造时建立一次，之后只读，可在多个线程和过滤器间共享
+     * 收发双方必须使用相同的字典
+     */
+    class CompressionDictionary final
+    {
+    public:
+        /* 字典最大长度，匹配偏移为16位，只保留末尾的数据 */
+        static const size_t kMaxSize = 64 * 1024 - 1;
+
+    public:
+        CompressionDictionary(const void *data, size_t size);
+
+    public:
+        /**
+         * 获取数据地址
+         */
+        const uint8_t* data() const
+        {
+            return data_.data();
+        }
+
+        /**
+         * 获取数据大小
+         */
+        size_t size() const
+        {
+            return data_.size();
+        }
+
+        /**
+         * 查找哈希值对应的位置
+         * @return 位置加1，没有时返回0
+         */
+        uint32_t lookup(uint32_t hash) const
+        {
+            return table_[hash];
+        }
+
+    private:
+        CompressionDictionary(const CompressionDictionary&) = delete;
+        CompressionDictionary& operator= (const CompressionDictionary&) = delete;
+
+    private:
+        std::vector<uint8_t>    data_;
+        std::vector<uint32_t>   table_;
+    };
+
+    typedef std::shared_ptr<const CompressionDictionary> CompressionDictionaryPointer;
+
+    /**
+     * 数据块压缩
+     * 使用LZ4块格式，哈希表作为压缩上下文按线程复用，不随每次压缩分配和清空
+     * 解压检查所有边界，可以安全处理不可信的输入
+     */
+    class Compressor final
+    {
+    public:
+        /* 哈希表大小的对数 */
+        static const size_t kHashLog = 12;
+
+        /* 最短匹配长度 */
+        static const size_t kMinMatch = 4;
+
+        /* 最大匹配偏移 */
+        static const size_t kMaxDistance = 65535;
+
+        /* 单次压缩的最大输入 */
+        static const size_t kMaxInputSize = 0x7E000000;
+
+    public:
+        /**
+         * 压缩后的最大长度
+         * @param size 原始数据大小
+         */
+        static size_t compress_bound(size_t size)
+        {
+            return size + size / 255 + 16;
+        }
+
+        /**
+         * 计算4字节序列的哈希值
+         */
+        static uint32_t hash(uint32_t sequence)
+        {
+            return (sequence * 2654435761u) >> (32 - kHashLog);
+        }
+
+        /**
+         * 压缩
+         * @param src 原始数据
+         * @param size 原始数据大小
+         * @param dst 输出缓存
+         * @param capacity 输出缓存大小
+         * @param dictionary 字典，可以为nullptr
+         * @return 压缩后的大小，输出缓存不足或输入过大时返回0
+         */
+        static size_t compress(const uint8_t *src, size_t size, uint8_t *dst, size_t capacity,
+            const CompressionDictionary *dictionary = nullptr);
+
+        /**
+         * 解压
+         * @param src 压缩数据
+         * @param size 压缩数据大小
+         * @param dst 输出缓存
+         * @param original_size 原始数据大小，输出缓存至少为此大小
+         * @param dictionary 字典，必须与压缩时相同
+         * @return 是否成功，数据损坏或大小不符时返回false
+         */
+        static bool decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t original_size,
+            const CompressionDictionary *dictionary = nullptr);
+    };
+}
+
+#endif
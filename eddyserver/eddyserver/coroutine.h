@@ -0,0 +1,734 @@
+﻿#ifndef __COROUTINE_H__
+#define __COROUTINE_H__
+
+/**
+ * 协程接口
+ * 需要C++20协程支持，未开启时此文件为空
+ */
+#if defined(__cpp_impl_coroutine)
+
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <optional>
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <coroutine>
+#include <asio/ip/tcp.hpp>
+#include "future.h"
+#include "tcp_client.h"
+#include "net_message.h"
+#include "io_service_thread.h"
+#include "tcp_session_handler.h"
+
+namespace eddyserver
+{
+    namespace coroutine_stuff
+    {
+        /**
+         * 协程帧内存池
+         * 每个线程独立的按大小分级的空闲链表，释放的协程帧留给下一次分配复用
+         */
+        class FramePool final
+        {
+            struct FreeNode
+            {
+                FreeNode* next;
+            };
+
+        public:
+            /* 大小分级粒度 */
+            static const size_t kGranularity = 64;
+
+            /* 超过此大小直接使用堆分配 */
+            static const size_t kMaxPooledSize = 1024;
+
+            /* 每级最多缓存的空闲块 */
+            static const size_t kMaxCachedBlocks = 64;
+
+        public:
+            FramePool()
+                : free_lists_()
+                , free_counts_()
+            {
+            }
+
+            ~FramePool()
+            {
+                for (size_t i = 0; i < kClassCount; ++i)
+                {
+                    while (free_lists_[i] != nullptr)
+                    {
+                        FreeNode *node = free_lists_[i];
+                        free_lists_[i] = node->next;
+                        ::operator delete(node);
+                    }
+                }
+            }
+
+        public:
+            /**
+             * 分配内存
+             */
+            static void* allocate(size_t size)
+            {
+                if (size > kMaxPooledSize)
+                {
+                    return ::operator new(size);
+                }
+
+                FramePool &pool = local();
+                const size_t index = class_of(size);
+                FreeNode *node = pool.free_lists_[index];
+                if (node != nullptr)
+                {
+                    pool.free_lists_[index] = node->next;
+                    --pool.free_counts_[index];
+                    return node;
+                }
+                return ::operator new((index + 1) * kGranularity);
+            }
+
+            /**
+             * 释放内存
+             * 可以在分配之外的线程释放，内存进入释放线程的空闲链表
+             */
+            static void deallocate(void *pointer, size_t size)
+            {
+                if (size > kMaxPooledSize)
+                {
+                    ::operator delete(pointer);
+                    return;
+                }
+
+                FramePool &pool = local();
+                const size_t index = class_of(size);
+                if (pool.free_counts_[index] >= kMaxCachedBlocks)
+                {
+                    ::operator delete(pointer);
+                    return;
+                }
+
+                FreeNode *node = static_cast<FreeNode*>(pointer);
+                node->next = pool.free_lists_[index];
+                pool.free_lists_[index] = node;
+                ++pool.free_counts_[index];
+            }
+
+        private:
+            static const size_t kClassCount = kMaxPooledSize / kGranularity;
+
+            static size_t class_of(size_t size)
+            {
+                return size == 0 ? 0 : (size - 1) / kGranularity;
+            }
+
+            static FramePool& local()
+            {
+                thread_local FramePool pool;
+                return pool;
+            }
+
+        private:
+            FramePool(const FramePool&) = delete;
+            FramePool& operator= (const FramePool&) = delete;
+
+        private:
+            FreeNode*   free_lists_[kClassCount];
+            size_t      free_counts_[kClassCount];
+        };
+
+        /**
+         * 在指定线程中恢复协程
+         * 已在该线程中或未指定线程时直接恢复
+         */
+        inline void Resume(IOServiceThread *td, std::coroutine_handle<> handle)
+        {
+            if (td == nullptr || td->running_in_this_thread())
+            {
+                handle.resume();
+            }
+            else
+            {
+                td->post([handle]()
+                {
+                    handle.resume();
+                });
+            }
+        }
+
+        /**
+         * 协程承诺基类
+         */
+        class PromiseBase
+        {
+            /**
+             * 结束时转到等待者，分离的协程自行销毁
+             */
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                template <typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+                {
+                    PromiseBase &promise = handle.promise();
+                    if (promise.continuation_)
+                    {
+                        return promise.continuation_;
+                    }
+                    if (promise.detached_)
+                    {
+                        handle.destroy();
+                    }
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept
+                {
+                }
+            };
+
+        public:
+            PromiseBase()
+                : detached_(false)
+            {
+            }
+
+        public:
+            static void* operator new(size_t size)
+            {
+                return FramePool::allocate(size);
+            }
+
+            static void operator delete(void *pointer, size_t size)
+            {
+                FramePool::deallocate(pointer, size);
+            }
+
+            std::suspend_always initial_suspend() const noexcept
+            {
+                return {};
+            }
+
+            FinalAwaiter final_suspend() const noexcept
+            {
+                return {};
+            }
+
+            void unhandled_exception()
+            {
+                if (!detached_)
+                {
+                    exception_ = std::current_exception();
+                    return;
+                }
+
+                // 分离的协程没有等待者，异常只能输出
+                try
+                {
+                    throw;
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << e.what() << std::endl;
+                }
+                catch (...)
+                {
+                    std::cerr << "unknown exception in detached coroutine" << std::endl;
+                }
+            }
+
+            void set_continuation(std::coroutine_handle<> continuation)
+            {
+                continuation_ = continuation;
+            }
+
+            void detach()
+            {
+                detached_ = true;
+            }
+
+            void rethrow_if_exception()
+            {
+                if (exception_ != nullptr)
+                {
+                    std::rethrow_exception(exception_);
+                }
+            }
+
+        private:
+            std::coroutine_handle<>     continuation_;
+            std::exception_ptr          exception_;
+            bool                        detached_;
+        };
+
+        template <typename T>
+        class Promise : public PromiseBase
+        {
+        public:
+            template <typename U>
+            void return_value(U &&value)
+            {
+                value_.emplace(std::forward<U>(value));
+            }
+
+            T take()
+            {
+                rethrow_if_exception();
+                return std::move(*value_);
+            }
+
+        private:
+            std::optional<T> value_;
+        };
+
+        template <>
+        class Promise<void> : public PromiseBase
+        {
+        public:
+            void return_void()
+            {
+            }
+
+            void take()
+            {
+                rethrow_if_exception();
+            }
+        };
+    }
+
+    /**
+     * 协程
+     * 创建后挂起，被co_await时开始执行，结束后恢复等待者
+     * 协程帧从线程内存池分配
+     */
+    template <typename T = void>
+    class Coroutine final
+    {
+    public:
+        struct promise_type : public coroutine_stuff::Promise<T>
+        {
+            Coroutine get_return_object()
+            {
+                return Coroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+        };
+
+        typedef std::coroutine_handle<promise_type> Handle;
+
+    public:
+        Coroutine() = default;
+
+        Coroutine(Coroutine &&other) noexcept
+            : handle_(std::exchange(other.handle_, nullptr))
+        {
+        }
+
+        Coroutine& operator= (Coroutine &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle_)
+                {
+                    handle_.destroy();
+                }
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+
+        ~Coroutine()
+        {
+            if (handle_)
+            {
+                handle_.destroy();
+            }
+        }
+
+    public:
+        /**
+         * 是否持有协程
+         */
+        bool valid() const
+        {
+            return static_cast<bool>(handle_);
+        }
+
+        /**
+         * 分离并开始执行
+         * 协程结束后自行销毁，未捕获的异常输出到标准错误
+         */
+        void detach()
+        {
+            if (handle_)
+            {
+                Handle handle = std::exchange(handle_, nullptr);
+                handle.promise().detach();
+                handle.resume();
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return !handle_ || handle_.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle_.promise().set_continuation(awaiting);
+            return handle_;
+        }
+
+        T await_resume()
+        {
+            return handle_.promise().take();
+        }
+
+    private:
+        explicit Coroutine(Handle handle)
+            : handle_(handle)
+        {
+        }
+
+    private:
+        Coroutine(const Coroutine&) = delete;
+        Coroutine& operator= (const Coroutine&) = delete;
+
+    private:
+        Handle handle_;
+    };
+
+    /**
+     * 启动协程
+     * 在当前线程中开始执行，直到第一次挂起
+     */
+    inline void spawn(Coroutine<> &&coroutine)
+    {
+        coroutine.detach();
+    }
+
+    /**
+     * 定时等待
+     * 挂到当前IOServiceThread的时间轮上，精度为时间轮刻度
+     */
+    class SleepAwaiter final
+    {
+    public:
+        explicit SleepAwaiter(std::chrono::milliseconds delay)
+            : delay_(delay)
+        {
+        }
+
+    public:
+        bool await_ready() const noexcept
+        {
+            return delay_.count() <= 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            IOServiceThread *td = IOServiceThread::current_thread();
+            if (td == nullptr)
+            {
+                throw std::logic_error("sleep_for must be awaited in an IOServiceThread");
+            }
+            td->get_timing_wheel().add(delay_, [handle]()
+            {
+                handle.resume();
+            });
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+    private:
+        std::chrono::milliseconds delay_;
+    };
+
+    /**
+     * 定时等待
+     * @param duration 等待时间
+     */
+    template <typename Rep, typename Period>
+    inline SleepAwaiter sleep_for(const std::chrono::duration<Rep, Period> &duration)
+    {
+        return SleepAwaiter(std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+    }
+
+    /**
+     * 等待Future就绪
+     * 在IOServiceThread中等待时，结果就绪后投递回该线程恢复
+     */
+    template <typename T>
+    class FutureAwaiter final
+    {
+    public:
+        explicit FutureAwaiter(Future<T> &&future)
+            : future_(std::move(future))
+        {
+        }
+
+    public:
+        bool await_ready() const
+        {
+            return future_.is_ready();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            IOServiceThread *td = IOServiceThread::current_thread();
+            auto resume = [this, handle](Future<T> future)
+            {
+                future_ = std::move(future);
+                handle.resume();
+            };
+
+            if (td != nullptr)
+            {
+                future_.then(*td, std::move(resume));
+            }
+            else
+            {
+                future_.then(std::move(resume));
+            }
+        }
+
+        T await_resume()
+        {
+            return future_.get();
+        }
+
+    private:
+        Future<T> future_;
+    };
+
+    template <typename T>
+    inline FutureAwaiter<T> operator co_await(Future<T> &&future)
+    {
+        return FutureAwaiter<T>(std::move(future));
+    }
+
+    /**
+     * 异步连接
+     * 连接完成后回到发起连接的IOServiceThread恢复
+     */
+    class ConnectAwaiter final
+    {
+    public:
+        ConnectAwaiter(TCPClient &client, const asio::ip::tcp::endpoint &endpoint)
+            : client_(client)
+            , endpoint_(endpoint)
+        {
+        }
+
+    public:
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            IOServiceThread *td = IOServiceThread::current_thread();
+            client_.async_connect(endpoint_, [this, handle, td](asio::error_code error_code)
+            {
+                error_code_ = error_code;
+                coroutine_stuff::Resume(td, handle);
+            });
+        }
+
+        asio::error_code await_resume() const noexcept
+        {
+            return error_code_;
+        }
+
+    private:
+        TCPClient&              client_;
+        asio::ip::tcp::endpoint endpoint_;
+        asio::error_code        error_code_;
+    };
+
+    inline ConnectAwaiter TCPClient::async_connect(const asio::ip::tcp::endpoint &endpoint)
+    {
+        return ConnectAwaiter(*this, endpoint);
+    }
+
+    /**
+     * 协程Session处理器
+     * 连接建立后启动run()，在其中以co_await receive()顺序读取消息
+     * 协程在SessionHandler所在的线程中运行，执行期间SessionHandler不会被释放
+     */
+    class CoroutineSessionHandler : public TCPSessionHandler
+    {
+    public:
+        /**
+         * 接收消息
+         * 队列中有消息时立即返回，连接关闭后返回空消息
+         */
+        class ReceiveAwaiter final
+        {
+        public:
+            explicit ReceiveAwaiter(CoroutineSessionHandler &handler)
+                : handler_(handler)
+            {
+            }
+
+        public:
+            bool await_ready() const noexcept
+            {
+                return !handler_.messages_.empty() || handler_.closed_;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) noexcept
+            {
+                handler_.receiver_ = handle;
+            }
+
+            NetMessage await_resume()
+            {
+                if (handler_.messages_.empty())
+                {
+                    return NetMessage();
+                }
+                NetMessage message(std::move(handler_.messages_.front()));
+                handler_.messages_.pop_front();
+                return message;
+            }
+
+        private:
+            CoroutineSessionHandler &handler_;
+        };
+
+        /**
+         * 发送消息
+         * 调用时即投递到Session的发送信箱，co_await得到是否投递成功
+         */
+        class SendAwaiter final
+        {
+        public:
+            explicit SendAwaiter(bool sent)
+                : sent_(sent)
+            {
+            }
+
+        public:
+            bool await_ready() const noexcept
+            {
+                return true;
+            }
+
+            void await_suspend(std::coroutine_handle<>) const noexcept
+            {
+            }
+
+            bool await_resume() const noexcept
+            {
+                return sent_;
+            }
+
+        private:
+            bool sent_;
+        };
+
+    public:
+        CoroutineSessionHandler()
+            : closed_(false)
+        {
+        }
+
+    public:
+        /**
+         * 会话协程
+         * 连接建立后启动
+         */
+        virtual Coroutine<> run() = 0;
+
+        /**
+         * 连接事件
+         * 重写时需要调用此实现
+         */
+        void on_connected() override
+        {
+            spawn(start(std::static_pointer_cast<CoroutineSessionHandler>(shared_from_this())));
+        }
+
+        /**
+         * 接收消息事件
+         * 消息放入队列，有协程等待时立即恢复
+         */
+        void on_message(NetMessage &message) override
+        {
+            messages_.push_back(std::move(message));
+            resume_receiver();
+        }
+
+        /**
+         * 关闭事件
+         * 重写时需要调用此实现
+         */
+        void on_closed() override
+        {
+            closed_ = true;
+            resume_receiver();
+        }
+
+    public:
+        /**
+         * 接收消息
+         */
+        ReceiveAwaiter receive()
+        {
+            return ReceiveAwaiter(*this);
+        }
+
+        /**
+         * 发送消息
+         */
+        SendAwaiter send(const NetMessage &message)
+        {
+            if (is_closed() || closed_ || message.empty())
+            {
+                return SendAwaiter(false);
+            }
+            TCPSessionHandler::send(message);
+            return SendAwaiter(true);
+        }
+
+    private:
+        /**
+         * 运行会话协程并在结束前持有SessionHandler
+         */
+        static Coroutine<> start(std::shared_ptr<CoroutineSessionHandler> self)
+        {
+            co_await self->run();
+        }
+
+        /**
+         * 恢复等待消息的协程
+         */
+        void resume_receiver()
+        {
+            if (receiver_)
+            {
+                std::exchange(receiver_, nullptr).resume();
+            }
+        }
+
+    private:
+        bool                    closed_;
+        std::deque<NetMessage>  messages_;
+        std::coroutine_handle<> receiver_;
+    };
+}
+
+#endif
+
+#endif
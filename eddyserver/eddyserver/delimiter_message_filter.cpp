@@ -0,0 +1,194 @@
+﻿#include "delimiter_message_filter.h"
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+#include "simd.h"
+#include "net_message.h"
+
+namespace eddyserver
+{
+    const size_t DelimiterMessageFilter::kMaxDelimiterSize;
+    const size_t DelimiterMessageFilter::kDefaultMaxLength;
+    const size_t DelimiterMessageFilter::kGatherThreshold;
+
+    DelimiterMessageFilter::DelimiterMessageFilter(const std::string &delimiter, size_t max_length)
+        : delimiter_size_(delimiter.size())
+        , max_length_(max_length)
+        , scanned_(0)
+        , discarding_(false)
+        , discarded_(0)
+    {
+        assert(delimiter_size_ > 0 && delimiter_size_ <= kMaxDelimiterSize);
+        memcpy(delimiter_, delimiter.data(), delimiter_size_);
+    }
+
+    // 获取欲读取数据大小
+    size_t DelimiterMessageFilter::bytes_wanna_read()
+    {
+        return MessageFilterInterface::stream_bytes();
+    }
+
+    // 获取欲写入数据大小
+    size_t DelimiterMessageFilter::bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent)
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            bytes += messages_to_be_sent[i].readable() + delimiter_size_;
+        }
+        return bytes;
+    }
+
+    // 读取数据
+    size_t DelimiterMessageFilter::read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received)
+    {
+        return read_stream(buffer.data(), buffer.size(), messages_received);
+    }
+
+    // 流式读取数据
+    size_t DelimiterMessageFilter::read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+    {
+        // 只查找分隔符的最后一个字节，找到后再比较前面的字节
+        size_t bytes = 0;
+        size_t cursor = scanned_;
+        const uint8_t last = delimiter_[delimiter_size_ - 1];
+        while (cursor < size)
+        {
+            const uint8_t *found = SIMD::find_byte(data + cursor, data + size, last);
+            if (found == data + size)
+            {
+                break;
+            }
+
+            const size_t end = found - data + 1;
+            cursor = end;
+            if (end - bytes < delimiter_size_ || memcmp(found + 1 - delimiter_size_, delimiter_, delimiter_size_ - 1) != 0)
+            {
+                continue;
+            }
+
+            const size_t length = end - delimiter_size_ - bytes;
+            if (discarding_ || length > max_length_)
+            {
+                discarding_ = false;
+                ++discarded_;
+            }
+            else
+            {
+                spans_.push_back(Span{ bytes, length });
+            }
+            bytes = end;
+        }
+
+        // 剩余的数据已不可能组成合法的消息时丢弃，只保留可能属于分隔符的末尾字节
+        const size_t pending = size - bytes;
+        const size_t partial = std::min(pending, delimiter_size_ - 1);
+        if (discarding_ || pending - partial > max_length_)
+        {
+            discarding_ = true;
+            bytes = size - partial;
+            scanned_ = 0;
+        }
+        else
+        {
+            scanned_ = pending;
+        }
+
+        if (!spans_.empty())
+        {
+            // 所有完整的消息拷贝到同一个缓冲块，每条消息共享缓冲块并只保留自身的数据
+            const size_t base = spans_.front().offset;
+            const Span &back = spans_.back();
+            NetMessage block(reinterpret_cast<const char*>(data) + base, back.offset + back.size - base);
+            for (size_t i = 0; i + 1 < spans_.size(); ++i)
+            {
+                NetMessage message(block);
+                message.retrieve(spans_[i].offset - base);
+                message.truncate(spans_[i].size);
+                messages_received.push_back(std::move(message));
+            }
+            block.retrieve(back.offset - base);
+            messages_received.push_back(std::move(block));
+            spans_.clear();
+        }
+        return bytes;
+    }
+
+    // 写入数据
+    size_t DelimiterMessageFilter::write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer)
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            const NetMessage &message = messages_to_be_sent[i];
+            buffer.insert(buffer.end(), message.data(), message.data() + message.readable());
+            buffer.insert(buffer.end(), delimiter_, delimiter_ + delimiter_size_);
+            bytes += message.readable() + delimiter_size_;
+        }
+        return bytes;
+    }
+
+    // 聚集写入数据
+    size_t DelimiterMessageFilter::write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+    {
+        // 先确定缓存区大小，避免写入过程中重新分配导致缓冲区失效
+        size_t headers_size = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            if (messages_to_be_sent[i].readable() < kGatherThreshold)
+            {
+                headers_size += messages_to_be_sent[i].readable() + delimiter_size_;
+            }
+        }
+        headers.resize(headers_size);
+
+        size_t bytes = 0;
+        size_t offset = 0;
+        size_t chunk_begin = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            NetMessage &message = messages_to_be_sent[i];
+            const NetMessage &content = message;
+            bytes += message.readable() + delimiter_size_;
+
+            if (message.readable() < kGatherThreshold)
+            {
+                memcpy(headers.data() + offset, content.data(), content.readable());
+                offset += content.readable();
+                memcpy(headers.data() + offset, delimiter_, delimiter_size_);
+                offset += delimiter_size_;
+                continue;
+            }
+
+            if (offset > chunk_begin)
+            {
+                buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                chunk_begin = offset;
+            }
+
+            if (in_place(message))
+            {
+                // 分隔符直接写入消息体后的尾部空间，整条消息作为一个缓冲区
+                message.write(delimiter_, delimiter_size_);
+                buffers.push_back(asio::buffer(content.data(), content.readable()));
+            }
+            else
+            {
+                buffers.push_back(asio::buffer(content.data(), content.readable()));
+                buffers.push_back(asio::buffer(delimiter_, delimiter_size_));
+            }
+        }
+
+        if (offset > chunk_begin)
+        {
+            buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+        }
+        return bytes;
+    }
+
+    // 是否可以在消息体后直接写入分隔符
+    bool DelimiterMessageFilter::in_place(const NetMessage &message) const
+    {
+        return message.writeable() >= delimiter_size_ && !message.is_shared();
+    }
+}
@@ -0,0 +1,131 @@
+﻿#ifndef __DELIMITER_MESSAGE_FILTER_H__
+#define __DELIMITER_MESSAGE_FILTER_H__
+
+#include <string>
+#include <vector>
+#include "message_filter.h"
+
+namespace eddyserver
+{
+    /**
+     * 分隔符消息过滤器
+     * 用于按行划分消息的文本协议，分隔符可以是"\n"、"\r\n"等1到8个字节
+     * 总是流式读取，按向量指令查找分隔符的最后一个字节（见simd.h），已查找过的数据不再重复查找
+     * 一次读取的所有完整消息只拷贝一次到同一个池化缓冲块，各消息共享缓冲块，只引用各自的数据
+     * 长期保存消息时缓冲块会一直被占用，需要时可拷贝一份
+     * 接收的消息不包含分隔符，超过最大长度的消息被丢弃，直到下一个分隔符
+     * 发送时在消息体后写入分隔符
+     */
+    class DelimiterMessageFilter final : public MessageFilterInterface
+    {
+    public:
+        /* 分隔符最大长度 */
+        static const size_t kMaxDelimiterSize = 8;
+
+        /* 默认的消息最大长度 */
+        static const size_t kDefaultMaxLength = 64 * 1024;
+
+        /* 聚集写入时小于此大小的消息体直接拷贝到消息头缓存区 */
+        static const size_t kGatherThreshold = MessageFilter::kGatherThreshold;
+
+    public:
+        /**
+         * 构造函数
+         * @param delimiter 分隔符
+         * @param max_length 不含分隔符的消息最大长度
+         */
+        explicit DelimiterMessageFilter(const std::string &delimiter = "\n", size_t max_length = kDefaultMaxLength);
+
+    public:
+        /**
+         * 获取丢弃的超长消息数量
+         */
+        size_t discarded() const
+        {
+            return discarded_;
+        }
+
+    public:
+        /**
+         * 获取欲读取数据大小
+         */
+        virtual size_t bytes_wanna_read();
+
+        /**
+         * 获取欲写入数据大小
+         * @param messages_to_be_sent 将被发送的消息列表
+         */
+        virtual size_t bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent);
+
+        /**
+         * 读取数据
+         * 与流式读取相同
+         */
+        virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 流式读取数据
+         * 解析data中所有完整的消息，不完整的消息由Session保留到下次读取
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 写入数据
+         * 将param1 messages_to_be_sent的消息列表写入param2 buffer中
+         * @param messages_to_be_sent 写入的消息列表
+         * @param &buffer 缓存区
+         * @return 写入字节数
+         */
+        virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer);
+
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const
+        {
+            return true;
+        }
+
+        /**
+         * 聚集写入数据
+         * 小消息连同分隔符拷贝到param2 headers，大消息不拷贝
+         * 独占缓冲块的消息直接在消息体后写入分隔符，否则引用过滤器的分隔符
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers);
+
+    private:
+        /**
+         * 是否可以在消息体后直接写入分隔符
+         */
+        bool in_place(const NetMessage &message) const;
+
+    private:
+        /**
+         * 消息在读取数据中的位置
+         */
+        struct Span
+        {
+            size_t offset;
+            size_t size;
+        };
+
+    private:
+        uint8_t             delimiter_[kMaxDelimiterSize];
+        const size_t        delimiter_size_;
+        const size_t        max_length_;
+        size_t              scanned_;
+        bool                discarding_;
+        size_t              discarded_;
+        std::vector<Span>   spans_;
+    };
+}
+
+#endif
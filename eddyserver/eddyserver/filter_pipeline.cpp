@@ -0,0 +1,473 @@
+﻿#include "filter_pipeline.h"
+#include <chrono>
+#include <cassert>
+#include "chained_message.h"
+
+namespace eddyserver
+{
+    namespace pipeline_stuff
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * CRC32查找表
+         * 每次按8字节查8张表，第0张为逐字节的表
+         */
+        struct CRC32Table
+        {
+            uint32_t values[8][256];
+
+            CRC32Table()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t crc = i;
+                    for (size_t j = 0; j < 8; ++j)
+                    {
+                        crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+                    }
+                    values[0][i] = crc;
+                }
+
+                for (size_t i = 0; i < 256; ++i)
+                {
+                    for (size_t j = 1; j < 8; ++j)
+                    {
+                        values[j][i] = (values[j - 1][i] >> 8) ^ values[0][values[j - 1][i] & 0xFF];
+                    }
+                }
+            }
+        };
+
+        // 获取CRC32查找表
+        const CRC32Table& GetCRC32Table()
+        {
+            static const CRC32Table table;
+            return table;
+        }
+
+        // 读取小端32位整数
+        inline uint32_t LoadLittleEndian32(const uint8_t *data)
+        {
+            return static_cast<uint32_t>(data[0])
+                | (static_cast<uint32_t>(data[1]) << 8)
+                | (static_cast<uint32_t>(data[2]) << 16)
+                | (static_cast<uint32_t>(data[3]) << 24);
+        }
+
+        /**
+         * 阶段计时
+         * 未开启计时时不读取时钟
+         */
+        class StageTimer
+        {
+        public:
+            explicit StageTimer(bool enabled)
+                : start_(enabled ? Clock::now() : Clock::time_point())
+                , enabled_(enabled)
+            {
+            }
+
+            uint64_t elapsed() const
+            {
+                if (!enabled_)
+                {
+                    return 0;
+                }
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+            }
+
+        private:
+            const Clock::time_point start_;
+            const bool              enabled_;
+        };
+    }
+
+    const size_t ChecksumStage::kChecksumSize;
+
+    // 计算CRC32
+    uint32_t ChecksumStage::crc32(const void *data, size_t size, uint32_t crc)
+    {
+        const pipeline_stuff::CRC32Table &table = pipeline_stuff::GetCRC32Table();
+        const uint8_t *bytes = static_cast<const uint8_t*>(data);
+        crc = ~crc;
+        while (size >= 8)
+        {
+            const uint32_t low = pipeline_stuff::LoadLittleEndian32(bytes) ^ crc;
+            const uint32_t high = pipeline_stuff::LoadLittleEndian32(bytes + 4);
+            crc = table.values[7][low & 0xFF] ^ table.values[6][(low >> 8) & 0xFF]
+                ^ table.values[5][(low >> 16) & 0xFF] ^ table.values[4][low >> 24]
+                ^ table.values[3][high & 0xFF] ^ table.values[2][(high >> 8) & 0xFF]
+                ^ table.values[1][(high >> 16) & 0xFF] ^ table.values[0][high >> 24];
+            bytes += 8;
+            size -= 8;
+        }
+
+        while (size-- > 0)
+        {
+            crc = (crc >> 8) ^ table.values[0][(crc ^ *bytes++) & 0xFF];
+        }
+        return ~crc;
+    }
+
+    // 写入校验码
+    void ChecksumStage::encode(NetMessage &message) const
+    {
+        const NetMessage &content = message;
+        const uint32_t crc = crc32(content.data(), content.readable());
+        const uint8_t checksum[kChecksumSize] = {
+            static_cast<uint8_t>(crc),
+            static_cast<uint8_t>(crc >> 8),
+            static_cast<uint8_t>(crc >> 16),
+            static_cast<uint8_t>(crc >> 24)
+        };
+        message.write(checksum, sizeof(checksum));
+    }
+
+    // 校验并去掉校验码
+    bool ChecksumStage::decode(NetMessage &message) const
+    {
+        const NetMessage &content = message;
+        if (content.readable() < kChecksumSize)
+        {
+            return false;
+        }
+
+        const size_t size = content.readable() - kChecksumSize;
+        if (crc32(content.data(), size) != pipeline_stuff::LoadLittleEndian32(content.data() + size))
+        {
+            return false;
+        }
+        message.truncate(size);
+        return true;
+    }
+
+    FilterPipelineStatistics::FilterPipelineStatistics(const std::vector<std::string> &names, bool timing)
+        : names_(names)
+        , timing_(timing)
+        , encode_(new Counters[names.size()])
+        , decode_(new Counters[names.size()])
+    {
+        reset();
+    }
+
+    // 累加编码计数
+    void FilterPipelineStatistics::add_encode(size_t stage, uint64_t calls, uint64_t bytes, uint64_t nanoseconds)
+    {
+        assert(stage < stage_count());
+        add(encode_[stage], calls, bytes, nanoseconds);
+    }
+
+    // 累加解码计数
+    void FilterPipelineStatistics::add_decode(size_t stage, uint64_t calls, uint64_t bytes, uint64_t nanoseconds)
+    {
+        assert(stage < stage_count());
+        add(decode_[stage], calls, bytes, nanoseconds);
+    }
+
+    // 获取统计快照
+    std::vector<StageStatistics> FilterPipelineStatistics::snapshot() const
+    {
+        std::vector<StageStatistics> result(stage_count());
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            StageStatistics &stage = result[i];
+            stage.name = names_[i];
+            stage.encode_calls = encode_[i].calls.load(std::memory_order_relaxed);
+            stage.encode_bytes = encode_[i].bytes.load(std::memory_order_relaxed);
+            stage.encode_nanoseconds = encode_[i].nanoseconds.load(std::memory_order_relaxed);
+            stage.decode_calls = decode_[i].calls.load(std::memory_order_relaxed);
+            stage.decode_bytes = decode_[i].bytes.load(std::memory_order_relaxed);
+            stage.decode_nanoseconds = decode_[i].nanoseconds.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // 清零
+    void FilterPipelineStatistics::reset()
+    {
+        for (size_t i = 0; i < stage_count(); ++i)
+        {
+            encode_[i].calls.store(0, std::memory_order_relaxed);
+            encode_[i].bytes.store(0, std::memory_order_relaxed);
+            encode_[i].nanoseconds.store(0, std::memory_order_relaxed);
+            decode_[i].calls.store(0, std::memory_order_relaxed);
+            decode_[i].bytes.store(0, std::memory_order_relaxed);
+            decode_[i].nanoseconds.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 累加计数
+    void FilterPipelineStatistics::add(Counters &counters, uint64_t calls, uint64_t bytes, uint64_t nanoseconds)
+    {
+        counters.calls.fetch_add(calls, std::memory_order_relaxed);
+        counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (nanoseconds > 0)
+        {
+            counters.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    FilterPipeline::FilterPipeline(const MessageFilterPointer &filter,
+        const MessageStageVectorPointer &stages,
+        const FilterPipelineStatisticsPointer &statistics)
+        : filter_(filter)
+        , stages_(stages)
+        , statistics_(statistics)
+        , headroom_(stages->size() + 1, 0)
+        , tailroom_(stages->size() + 1, 0)
+        , error_(false)
+    {
+        assert(filter_ != nullptr && stages_ != nullptr);
+        assert(statistics_ == nullptr || statistics_->stage_count() == stages_->size() + 1);
+
+        // 每个阶段编码前需要为自身和之后的阶段预留空间，分帧过滤器使用默认头部空间
+        headroom_.back() = NetMessage::kDefaultHeadroom;
+        for (size_t i = stages_->size(); i-- > 0;)
+        {
+            headroom_[i] = headroom_[i + 1] + (*stages_)[i]->headroom();
+            tailroom_[i] = tailroom_[i + 1] + (*stages_)[i]->tailroom();
+        }
+    }
+
+    // 获取欲读取数据大小
+    size_t FilterPipeline::bytes_wanna_read()
+    {
+        return filter_->bytes_wanna_read();
+    }
+
+    // 获取欲写入数据大小
+    size_t FilterPipeline::bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent)
+    {
+        const size_t room = headroom_[0] - NetMessage::kDefaultHeadroom + tailroom_[0];
+        return filter_->bytes_wanna_write(messages_to_be_sent) + messages_to_be_sent.size() * room;
+    }
+
+    // 读取数据
+    size_t FilterPipeline::read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received)
+    {
+        const size_t first = messages_received.size();
+        pipeline_stuff::StageTimer timer(statistics_ != nullptr && statistics_->timing());
+        const size_t bytes = filter_->read(buffer, messages_received);
+        if (statistics_ != nullptr)
+        {
+            statistics_->add_decode(0, messages_received.size() - first, bytes, timer.elapsed());
+        }
+        decode_messages(messages_received, first);
+        return bytes;
+    }
+
+    // 流式读取数据
+    size_t FilterPipeline::read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+    {
+        const size_t first = messages_received.size();
+        pipeline_stuff::StageTimer timer(statistics_ != nullptr && statistics_->timing());
+        const size_t bytes = filter_->read_stream(data, size, messages_received);
+        if (statistics_ != nullptr)
+        {
+            statistics_->add_decode(0, messages_received.size() - first, bytes, timer.elapsed());
+        }
+        decode_messages(messages_received, first);
+        return bytes;
+    }
+
+    // 写入数据
+    size_t FilterPipeline::write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer)
+    {
+        messages_encoded_.assign(messages_to_be_sent.begin(), messages_to_be_sent.end());
+        encode_messages(messages_encoded_, 0);
+
+        const uint64_t bytes = count_bytes(messages_encoded_, 0);
+        pipeline_stuff::StageTimer timer(statistics_ != nullptr && statistics_->timing());
+        const size_t bytes_written = filter_->write(messages_encoded_, buffer);
+        if (statistics_ != nullptr)
+        {
+            statistics_->add_encode(0, messages_encoded_.size(), bytes, timer.elapsed());
+        }
+        messages_encoded_.clear();
+        return bytes_written;
+    }
+
+    // 是否支持聚集写入
+    bool FilterPipeline::supports_gather_write() const
+    {
+        return filter_->supports_gather_write();
+    }
+
+    // 聚集写入数据
+    size_t FilterPipeline::write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+    {
+        encode_messages(messages_to_be_sent, 0);
+
+        const uint64_t bytes = count_bytes(messages_to_be_sent, 0);
+        pipeline_stuff::StageTimer timer(statistics_ != nullptr && statistics_->timing());
+        const size_t bytes_written = filter_->write_gather(messages_to_be_sent, headers, buffers);
+        if (statistics_ != nullptr)
+        {
+            statistics_->add_encode(0, messages_to_be_sent.size(), bytes, timer.elapsed());
+        }
+        return bytes_written;
+    }
+
+    // 取出读取完成的链式消息
+    bool FilterPipeline::take_chained_message(ChainedMessage &message)
+    {
+        if (error_ || !filter_->take_chained_message(message))
+        {
+            return false;
+        }
+
+        // 链式消息的字节数和读取时间已计入read_stream
+        if (statistics_ != nullptr)
+        {
+            statistics_->add_decode(0, 1, 0, 0);
+        }
+
+        if (!stages_->empty())
+        {
+            NetMessageVector messages(1, message.flatten());
+            message.clear();
+            decode_messages(messages, 0);
+            if (messages.empty())
+            {
+                return false;
+            }
+            message.append(messages.front());
+        }
+        return true;
+    }
+
+    // 编码链式消息的消息头
+    bool FilterPipeline::write_chain_header(const ChainedMessage &message, NetMessage &header) const
+    {
+        if (!stages_->empty())
+        {
+            return false;
+        }
+        return filter_->write_chain_header(message, header);
+    }
+
+    // 是否需要重新解析已接收的数据
+    bool FilterPipeline::take_read_resumed()
+    {
+        return filter_->take_read_resumed();
+    }
+
+    // 是否出错
+    bool FilterPipeline::has_error() const
+    {
+        return error_ || filter_->has_error();
+    }
+
+    // 逐阶段编码从first开始的消息
+    void FilterPipeline::encode_messages(std::vector<NetMessage> &messages, size_t first) const
+    {
+        const MessageStageVector &stages = *stages_;
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            uint64_t bytes = 0;
+            const MessageStage &stage = *stages[i];
+            pipeline_stuff::StageTimer timer(statistics_ != nullptr && statistics_->timing());
+            for (size_t j = first; j < messages.size(); ++j)
+            {
+                // 空间已足够时不移动数据，只有替换了缓冲块的阶段之后才可能移动
+                NetMessage &message = messages[j];
+                message.reserve_room(headroom_[i], tailroom_[i]);
+                bytes += message.readable();
+                stage.encode(message);
+            }
+
+            if (statistics_ != nullptr)
+            {
+                statistics_->add_encode(i + 1, messages.size() - first, bytes, timer.elapsed());
+            }
+        }
+    }
+
+    // 逐阶段解码从first开始的消息，失败时丢弃之后的消息
+    void FilterPipeline::decode_messages(std::vector<NetMessage> &messages, size_t first)
+    {
+        const MessageStageVector &stages = *stages_;
+        for (size_t i = stages.size(); i-- > 0 && messages.size() > first;)
+        {
+            uint64_t bytes = 0;
+            const size_t calls = messages.size() - first;
+            const MessageStage &stage = *stages[i];
+            pipeline_stuff::StageTimer timer(statistics_ != nullptr && statistics_->timing());
+            for (size_t j = first; j < messages.size(); ++j)
+            {
+                NetMessage &message = messages[j];
+                bytes += message.readable();
+
+                // 校验失败或数据损坏，Session分发之前的消息后关闭连接
+                if (!stage.decode(message))
+                {
+                    error_ = true;
+                    messages.erase(messages.begin() + j, messages.end());
+                    break;
+                }
+            }
+
+            if (statistics_ != nullptr)
+            {
+                statistics_->add_decode(i + 1, calls, bytes, timer.elapsed());
+            }
+        }
+    }
+
+    // 统计从first开始的消息字节数
+    uint64_t FilterPipeline::count_bytes(const std::vector<NetMessage> &messages, size_t first)
+    {
+        uint64_t bytes = 0;
+        for (size_t i = first; i < messages.size(); ++i)
+        {
+            bytes += messages[i].readable();
+        }
+        return bytes;
+    }
+
+    FilterPipelineBuilder::FilterPipelineBuilder(const MessageFilterCreator &framing_creator)
+        : framing_creator_(framing_creator)
+        , timing_(false)
+    {
+        assert(framing_creator_ != nullptr);
+    }
+
+    // 添加处理阶段
+    FilterPipelineBuilder& FilterPipelineBuilder::add_stage(const MessageStagePointer &stage)
+    {
+        assert(stage != nullptr);
+        stages_.push_back(stage);
+        return *this;
+    }
+
+    // 设置是否计时
+    FilterPipelineBuilder& FilterPipelineBuilder::enable_timing(bool enable)
+    {
+        timing_ = enable;
+        return *this;
+    }
+
+    // 创建管道
+    MessageFilterCreator FilterPipelineBuilder::build(FilterPipelineStatisticsPointer *statistics) const
+    {
+        std::vector<std::string> names(1, "framing");
+        for (size_t i = 0; i < stages_.size(); ++i)
+        {
+            names.push_back(stages_[i]->name());
+        }
+
+        FilterPipeline::MessageStageVectorPointer stages = std::make_shared<MessageStageVector>(stages_);
+        FilterPipelineStatisticsPointer pipeline_statistics = std::make_shared<FilterPipelineStatistics>(names, timing_);
+        if (statistics != nullptr)
+        {
+            *statistics = pipeline_statistics;
+        }
+
+        MessageFilterCreator framing_creator = framing_creator_;
+        return [framing_creator, stages, pipeline_statistics]() -> MessageFilterPointer
+        {
+            return std::make_shared<FilterPipeline>(framing_creator(), stages, pipeline_statistics);
+        };
+    }
+}
@@ -0,0 +1,376 @@
+﻿#ifndef __FILTER_PIPELINE_H__
+#define __FILTER_PIPELINE_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "types.h"
+#include "net_message.h"
+#include "message_filter.h"
+
+namespace eddyserver
+{
+    /**
+     * 消息处理阶段
+     * 发送时按顺序编码消息体，接收时按相反顺序解码
+     * 编码优先写入消息的头部或尾部空间，不拷贝消息体
+     * 同一阶段由多个Session的过滤器在多个IO线程中共享，不能修改自身状态
+     */
+    class MessageStage
+    {
+    public:
+        MessageStage() = default;
+        virtual ~MessageStage() = default;
+
+    public:
+        /**
+         * 获取名称
+         * 用于统计
+         */
+        virtual const char* name() const = 0;
+
+        /**
+         * 编码时在消息体前最多写入的字节数
+         */
+        virtual size_t headroom() const
+        {
+            return 0;
+        }
+
+        /**
+         * 编码时在消息体后最多写入的字节数
+         */
+        virtual size_t tailroom() const
+        {
+            return 0;
+        }
+
+        /**
+         * 编码消息
+         * 调用前已预留headroom和tailroom大小的空间
+         * @param message 消息，结果替换原消息
+         */
+        virtual void encode(NetMessage &message) const = 0;
+
+        /**
+         * 解码消息
+         * @param message 消息，结果替换原消息
+         * @return 是否成功，失败时管道出错，Session关闭连接
+         */
+        virtual bool decode(NetMessage &message) const = 0;
+
+    private:
+        MessageStage(const MessageStage&) = delete;
+        MessageStage& operator= (const MessageStage&) = delete;
+    };
+
+    typedef std::shared_ptr<const MessageStage> MessageStagePointer;
+    typedef std::vector<MessageStagePointer> MessageStageVector;
+
+    /**
+     * 校验阶段
+     * 在消息体后写入4字节的CRC32（与zlib相同），接收时校验并去掉
+     */
+    class ChecksumStage final : public MessageStage
+    {
+    public:
+        /* 校验码大小 */
+        static const size_t kChecksumSize = sizeof(uint32_t);
+
+    public:
+        /**
+         * 计算CRC32
+         * @param crc 上一段数据的CRC32，首段为0
+         */
+        static uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+    public:
+        virtual const char* name() const
+        {
+            return "checksum";
+        }
+
+        virtual size_t tailroom() const
+        {
+            return kChecksumSize;
+        }
+
+        virtual void encode(NetMessage &message) const;
+
+        virtual bool decode(NetMessage &message) const;
+    };
+
+    /**
+     * 阶段统计
+     */
+    struct StageStatistics
+    {
+        std::string name;
+        uint64_t    encode_calls;
+        uint64_t    encode_bytes;
+        uint64_t    encode_nanoseconds;
+        uint64_t    decode_calls;
+        uint64_t    decode_bytes;
+        uint64_t    decode_nanoseconds;
+    };
+
+    /**
+     * 过滤器管道统计
+     * 同一管道创建的所有过滤器共享，第0个阶段为分帧过滤器
+     * 过滤器每批消息只更新一次计数，开启计时后每个阶段每批读取两次时钟
+     */
+    class FilterPipelineStatistics final
+    {
+        /**
+         * 单向计数
+         */
+        struct Counters
+        {
+            std::atomic<uint64_t>   calls;
+            std::atomic<uint64_t>   bytes;
+            std::atomic<uint64_t>   nanoseconds;
+        };
+
+    public:
+        FilterPipelineStatistics(const std::vector<std::string> &names, bool timing);
+
+    public:
+        /**
+         * 获取阶段数量
+         */
+        size_t stage_count() const
+        {
+            return names_.size();
+        }
+
+        /**
+         * 是否计时
+         */
+        bool timing() const
+        {
+            return timing_;
+        }
+
+        /**
+         * 累加编码计数
+         * @param stage 阶段序号
+         * @param calls 消息数量
+         * @param bytes 输入字节数
+         * @param nanoseconds 耗时
+         */
+        void add_encode(size_t stage, uint64_t calls, uint64_t bytes, uint64_t nanoseconds);
+
+        /**
+         * 累加解码计数
+         * @param stage 阶段序号
+         * @param calls 消息数量
+         * @param bytes 输入字节数
+         * @param nanoseconds 耗时
+         */
+        void add_decode(size_t stage, uint64_t calls, uint64_t bytes, uint64_t nanoseconds);
+
+        /**
+         * 获取统计快照
+         */
+        std::vector<StageStatistics> snapshot() const;
+
+        /**
+         * 清零
+         */
+        void reset();
+
+    private:
+        /**
+         * 累加计数
+         */
+        static void add(Counters &counters, uint64_t calls, uint64_t bytes, uint64_t nanoseconds);
+
+    private:
+        FilterPipelineStatistics(const FilterPipelineStatistics&) = delete;
+        FilterPipelineStatistics& operator= (const FilterPipelineStatistics&) = delete;
+
+    private:
+        const std::vector<std::string>  names_;
+        const bool                      timing_;
+        std::unique_ptr<Counters[]>     encode_;
+        std::unique_ptr<Counters[]>     decode_;
+    };
+
+    typedef std::shared_ptr<FilterPipelineStatistics> FilterPipelineStatisticsPointer;
+
+    /**
+     * 过滤器管道
+     * 包装一个分帧过滤器，发送时各阶段按顺序编码后分帧，接收时分帧后按相反顺序解码
+     * 每个阶段处理完一批消息再交给下一个阶段，编码前一次预留所有阶段需要的头部和尾部空间
+     * 有处理阶段时链式消息合并后发送，接收的链式消息解码为一块，解码失败时为空
+     * 编码结果依赖处理阶段，广播时不在Session间共享帧
+     * 由FilterPipelineBuilder创建
+     */
+    class FilterPipeline final : public MessageFilterInterface
+    {
+    public:
+        typedef std::shared_ptr<const MessageStageVector> MessageStageVectorPointer;
+
+    public:
+        /**
+         * 构造函数
+         * @param filter 分帧过滤器
+         * @param stages 处理阶段，按编码顺序排列
+         * @param statistics 统计，可以为nullptr
+         */
+        FilterPipeline(const MessageFilterPointer &filter,
+            const MessageStageVectorPointer &stages,
+            const FilterPipelineStatisticsPointer &statistics);
+
+    public:
+        /**
+         * 获取欲读取数据大小
+         */
+        virtual size_t bytes_wanna_read();
+
+        /**
+         * 获取欲写入数据大小
+         * @param messages_to_be_sent 将被发送的消息列表
+         */
+        virtual size_t bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent);
+
+        /**
+         * 读取数据
+         * 分帧过滤器读取后逐阶段解码，解码失败时出错，之后的消息丢弃
+         * @param buffer 缓存区数据
+         * @param messages_received 读取的消息列表
+         * @return 读取字节数
+         */
+        virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 流式读取数据
+         * 分帧过滤器解析后逐阶段解码，解码失败时出错，之后的消息丢弃
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 写入数据
+         * 逐阶段编码后由分帧过滤器写入
+         * @param messages_to_be_sent 写入的消息列表
+         * @param &buffer 缓存区
+         * @return 写入字节数
+         */
+        virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer);
+
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const;
+
+        /**
+         * 聚集写入数据
+         * 消息就地逐阶段编码后由分帧过滤器聚集写入
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers);
+
+        /**
+         * 取出读取完成的链式消息
+         * @param message 链式消息
+         * @return 是否有读取完成的链式消息，解码失败时出错并返回false
+         */
+        virtual bool take_chained_message(ChainedMessage &message);
+
+        /**
+         * 编码链式消息的消息头
+         * 没有处理阶段时由分帧过滤器编码
+         * @param message 链式消息
+         * @param header 编码后的消息头
+         * @return 是否支持
+         */
+        virtual bool write_chain_header(const ChainedMessage &message, NetMessage &header) const;
+
+        /**
+         * 是否需要重新解析已接收的数据
+         * 由分帧过滤器决定
+         */
+        virtual bool take_read_resumed();
+
+        /**
+         * 是否出错
+         * 处理阶段解码失败或分帧过滤器出错
+         */
+        virtual bool has_error() const;
+
+    private:
+        /**
+         * 逐阶段编码从first开始的消息
+         */
+        void encode_messages(std::vector<NetMessage> &messages, size_t first) const;
+
+        /**
+         * 逐阶段解码从first开始的消息，失败时出错并丢弃之后的消息
+         */
+        void decode_messages(std::vector<NetMessage> &messages, size_t first);
+
+        /**
+         * 统计从first开始的消息字节数
+         */
+        static uint64_t count_bytes(const std::vector<NetMessage> &messages, size_t first);
+
+    private:
+        MessageFilterPointer                filter_;
+        MessageStageVectorPointer           stages_;
+        FilterPipelineStatisticsPointer     statistics_;
+        std::vector<size_t>                 headroom_;
+        std::vector<size_t>                 tailroom_;
+        NetMessageVector                    messages_encoded_;
+        bool                                error_;
+    };
+
+    /**
+     * 过滤器管道构造器
+     * 处理阶段和统计只创建一次，由返回的MessageFilterCreator创建的所有过滤器共享
+     * 常见的顺序为压缩、加密、校验，分帧过滤器总在最外层
+     */
+    class FilterPipelineBuilder final
+    {
+    public:
+        /**
+         * 构造函数
+         * @param framing_creator 分帧过滤器的创建函数，每个Session创建一个
+         */
+        explicit FilterPipelineBuilder(const MessageFilterCreator &framing_creator);
+
+    public:
+        /**
+         * 添加处理阶段
+         * 按编码顺序添加
+         */
+        FilterPipelineBuilder& add_stage(const MessageStagePointer &stage);
+
+        /**
+         * 设置是否计时
+         * 默认只统计消息数量和字节数
+         */
+        FilterPipelineBuilder& enable_timing(bool enable);
+
+        /**
+         * 创建管道
+         * @param statistics 输出统计，可以为nullptr
+         * @return 过滤器的创建函数
+         */
+        MessageFilterCreator build(FilterPipelineStatisticsPointer *statistics = nullptr) const;
+
+    private:
+        MessageFilterCreator    framing_creator_;
+        MessageStageVector      stages_;
+        bool                    timing_;
+    };
+}
+
+#endif
@@ -0,0 +1,674 @@
+﻿#ifndef __FUTURE_H__
+#define __FUTURE_H__
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <future>
+#include <cassert>
+#include <exception>
+#include <type_traits>
+#include <condition_variable>
+#include "task.h"
+#include "buffer_pool.h"
+
+namespace eddyserver
+{
+    template <typename T> class Future;
+    template <typename T> class Promise;
+
+    namespace future_stuff
+    {
+        /**
+         * 调用结果类型
+         * 替代C++17起弃用的std::result_of
+         */
+        template <typename Function, typename... Args>
+        struct ResultOf
+        {
+            typedef decltype(std::declval<Function>()(std::declval<Args>()...)) type;
+        };
+
+        /**
+         * 结果存储
+         */
+        template <typename T>
+        class Storage final
+        {
+        public:
+            Storage()
+                : has_value_(false)
+            {
+            }
+
+            ~Storage()
+            {
+                if (has_value_)
+                {
+                    reinterpret_cast<T*>(&buffer_)->~T();
+                }
+            }
+
+        public:
+            template <typename... Args>
+            void emplace(Args&&... args)
+            {
+                new (&buffer_) T(std::forward<Args>(args)...);
+                has_value_ = true;
+            }
+
+            T take()
+            {
+                assert(has_value_);
+                T *value = reinterpret_cast<T*>(&buffer_);
+                T result(std::move(*value));
+                value->~T();
+                has_value_ = false;
+                return result;
+            }
+
+        private:
+            Storage(const Storage&) = delete;
+            Storage& operator= (const Storage&) = delete;
+
+        private:
+            bool                                                        has_value_;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type  buffer_;
+        };
+
+        template <>
+        class Storage<void> final
+        {
+        public:
+            void emplace()
+            {
+            }
+
+            void take()
+            {
+            }
+        };
+
+        /**
+         * 共享状态
+         * Promise和Future共同持有，结果就绪后执行后续任务
+         */
+        template <typename T>
+        class SharedState final
+        {
+        public:
+            SharedState()
+                : ready_(false)
+                , retrieved_(false)
+            {
+            }
+
+        public:
+            /**
+             * 是否就绪
+             */
+            bool is_ready() const
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return ready_;
+            }
+
+            /**
+             * 标记Future已获取
+             * @return 是否首次获取
+             */
+            bool mark_retrieved()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const bool retrieved = retrieved_;
+                retrieved_ = true;
+                return !retrieved;
+            }
+
+            /**
+             * 等待就绪
+             */
+            void wait() const
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this] { return ready_; });
+            }
+
+            /**
+             * 设置结果
+             */
+            template <typename... Args>
+            void set_value(Args&&... args)
+            {
+                Task continuation;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (ready_)
+                    {
+                        throw std::future_error(std::future_errc::promise_already_satisfied);
+                    }
+                    storage_.emplace(std::forward<Args>(args)...);
+                    ready_ = true;
+                    continuation = std::move(continuation_);
+                }
+                condition_.notify_all();
+                if (continuation)
+                {
+                    continuation();
+                }
+            }
+
+            /**
+             * 设置异常
+             */
+            void set_exception(std::exception_ptr exception)
+            {
+                Task continuation;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (ready_)
+                    {
+                        throw std::future_error(std::future_errc::promise_already_satisfied);
+                    }
+                    exception_ = exception;
+                    ready_ = true;
+                    continuation = std::move(continuation_);
+                }
+                condition_.notify_all();
+                if (continuation)
+                {
+                    continuation();
+                }
+            }
+
+            /**
+             * 取出结果
+             * 未就绪时阻塞等待，有异常时重新抛出
+             */
+            T take()
+            {
+                wait();
+                if (exception_ != nullptr)
+                {
+                    std::rethrow_exception(exception_);
+                }
+                return storage_.take();
+            }
+
+            /**
+             * 设置后续任务
+             * 已就绪时在当前线程立即执行，否则在设置结果的线程执行
+             * 只能设置一次
+             */
+            void on_ready(Task &&continuation)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    assert(!continuation_);
+                    if (!ready_)
+                    {
+                        continuation_ = std::move(continuation);
+                        return;
+                    }
+                }
+                continuation();
+            }
+
+        private:
+            SharedState(const SharedState&) = delete;
+            SharedState& operator= (const SharedState&) = delete;
+
+        private:
+            mutable std::mutex              mutex_;
+            mutable std::condition_variable condition_;
+            bool                            ready_;
+            bool                            retrieved_;
+            Storage<T>                      storage_;
+            std::exception_ptr              exception_;
+            Task                            continuation_;
+        };
+
+        /**
+         * 以函数返回值兑现Promise
+         */
+        template <typename T, typename Function, typename... Args>
+        void Fulfill(Promise<T> &promise, Function &func, Args&&... args);
+
+        /**
+         * 执行器持有方式
+         * 执行器需要提供post(handler)方法，如IOServiceThread
+         * 以引用传入时只保存指针，调用者需要保证执行器的生命周期
+         */
+        template <typename Executor>
+        struct ExecutorTraits
+        {
+            typedef Executor* Holder;
+
+            static Holder hold(Executor &executor)
+            {
+                return &executor;
+            }
+
+            static Executor& get(const Holder &holder)
+            {
+                return *holder;
+            }
+        };
+
+        template <typename Executor>
+        struct ExecutorTraits< std::shared_ptr<Executor> >
+        {
+            typedef std::shared_ptr<Executor> Holder;
+
+            static Holder hold(const std::shared_ptr<Executor> &executor)
+            {
+                return executor;
+            }
+
+            static Executor& get(const Holder &holder)
+            {
+                return *holder;
+            }
+        };
+
+        /**
+         * 访问Future的共享状态
+         */
+        struct FutureAccess
+        {
+            template <typename T>
+            static const std::shared_ptr<SharedState<T>>& state(const Future<T> &future)
+            {
+                return future.state_;
+            }
+        };
+    }
+
+    /**
+     * Future
+     * 只能移动，get()和then()会取走结果
+     */
+    template <typename T>
+    class Future final
+    {
+        friend class Promise<T>;
+        friend struct future_stuff::FutureAccess;
+        typedef future_stuff::SharedState<T> State;
+
+        template <typename Function>
+        using ContinuationResult = typename future_stuff::ResultOf<typename std::decay<Function>::type&, Future<T>>::type;
+
+    public:
+        Future() = default;
+        Future(Future&&) = default;
+        Future& operator= (Future&&) = default;
+
+    public:
+        /**
+         * 是否持有共享状态
+         */
+        bool valid() const
+        {
+            return state_ != nullptr;
+        }
+
+        /**
+         * 是否就绪
+         */
+        bool is_ready() const
+        {
+            assert(valid());
+            return state_->is_ready();
+        }
+
+        /**
+         * 等待就绪
+         * 不要在线程池或IO线程中等待，可能导致死锁
+         */
+        void wait() const
+        {
+            assert(valid());
+            state_->wait();
+        }
+
+        /**
+         * 获取结果
+         * 未就绪时阻塞等待，有异常时重新抛出
+         */
+        T get()
+        {
+            if (!valid())
+            {
+                throw std::future_error(std::future_errc::no_state);
+            }
+            std::shared_ptr<State> state = std::move(state_);
+            return state->take();
+        }
+
+        /**
+         * 设置后续任务
+         * 在设置结果的线程中执行，已就绪时立即在当前线程执行
+         * @param func 以就绪的Future<T>为参数
+         * @return 后续任务结果的Future
+         */
+        template <typename Function>
+        Future<ContinuationResult<Function>> then(Function &&func)
+        {
+            typedef ContinuationResult<Function> Result;
+            if (!valid())
+            {
+                throw std::future_error(std::future_errc::no_state);
+            }
+
+            Promise<Result> promise;
+            Future<Result> future = promise.get_future();
+            std::shared_ptr<State> state = std::move(state_);
+            state->on_ready([state, promise = std::move(promise), func = std::forward<Function>(func)]() mutable
+            {
+                future_stuff::Fulfill(promise, func, Future<T>(state));
+            });
+            return future;
+        }
+
+        /**
+         * 设置后续任务
+         * 就绪后投递到执行器中执行，可用于把结果送回IOServiceThread或主线程
+         * @param executor 执行器，需要提供post(handler)方法，可传入引用或shared_ptr
+         * @param func 以就绪的Future<T>为参数
+         * @return 后续任务结果的Future
+         */
+        template <typename Executor, typename Function>
+        Future<ContinuationResult<Function>> then(Executor &&executor, Function &&func)
+        {
+            typedef ContinuationResult<Function> Result;
+            typedef future_stuff::ExecutorTraits<typename std::decay<Executor>::type> Traits;
+            if (!valid())
+            {
+                throw std::future_error(std::future_errc::no_state);
+            }
+
+            // asio要求投递的handler可以复制
+            typename Traits::Holder holder = Traits::hold(executor);
+            std::shared_ptr<Promise<Result>> promise = std::make_shared<Promise<Result>>();
+            std::shared_ptr<typename std::decay<Function>::type> function =
+                std::make_shared<typename std::decay<Function>::type>(std::forward<Function>(func));
+            Future<Result> future = promise->get_future();
+            std::shared_ptr<State> state = std::move(state_);
+            state->on_ready([holder, state, promise, function]()
+            {
+                Traits::get(holder).post([state, promise, function]()
+                {
+                    future_stuff::Fulfill(*promise, *function, Future<T>(state));
+                });
+            });
+            return future;
+        }
+
+    private:
+        explicit Future(const std::shared_ptr<State> &state)
+            : state_(state)
+        {
+        }
+
+    private:
+        Future(const Future&) = delete;
+        Future& operator= (const Future&) = delete;
+
+    private:
+        std::shared_ptr<State> state_;
+    };
+
+    /**
+     * Promise
+     * 销毁时尚未设置结果则设置broken_promise异常
+     * 共享状态从BufferPool分配，稳定状态下创建Promise不分配堆内存
+     */
+    template <typename T>
+    class Promise final
+    {
+        typedef future_stuff::SharedState<T> State;
+
+    public:
+        Promise()
+            : state_(std::allocate_shared<State>(PoolAllocator<State>()))
+        {
+        }
+
+        Promise(Promise&&) = default;
+
+        Promise& operator= (Promise &&other)
+        {
+            if (this != &other)
+            {
+                abandon();
+                state_ = std::move(other.state_);
+            }
+            return *this;
+        }
+
+        ~Promise()
+        {
+            abandon();
+        }
+
+    public:
+        /**
+         * 获取Future
+         * 只能获取一次
+         */
+        Future<T> get_future()
+        {
+            if (state_ == nullptr)
+            {
+                throw std::future_error(std::future_errc::no_state);
+            }
+            if (!state_->mark_retrieved())
+            {
+                throw std::future_error(std::future_errc::future_already_retrieved);
+            }
+            return Future<T>(state_);
+        }
+
+        /**
+         * 设置结果
+         */
+        template <typename... Args>
+        void set_value(Args&&... args)
+        {
+            if (state_ == nullptr)
+            {
+                throw std::future_error(std::future_errc::no_state);
+            }
+            state_->set_value(std::forward<Args>(args)...);
+        }
+
+        /**
+         * 设置异常
+         */
+        void set_exception(std::exception_ptr exception)
+        {
+            if (state_ == nullptr)
+            {
+                throw std::future_error(std::future_errc::no_state);
+            }
+            state_->set_exception(exception);
+        }
+
+    private:
+        /**
+         * 放弃共享状态
+         */
+        void abandon()
+        {
+            if (state_ != nullptr && !state_->is_ready())
+            {
+                state_->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+            state_.reset();
+        }
+
+    private:
+        Promise(const Promise&) = delete;
+        Promise& operator= (const Promise&) = delete;
+
+    private:
+        std::shared_ptr<State> state_;
+    };
+
+    namespace future_stuff
+    {
+        /**
+         * 以函数返回值兑现Promise
+         * 函数抛出的异常转交给Promise
+         */
+        template <typename T>
+        struct Fulfiller
+        {
+            template <typename Function, typename... Args>
+            static void apply(Promise<T> &promise, Function &func, Args&&... args)
+            {
+                promise.set_value(func(std::forward<Args>(args)...));
+            }
+        };
+
+        template <>
+        struct Fulfiller<void>
+        {
+            template <typename Function, typename... Args>
+            static void apply(Promise<void> &promise, Function &func, Args&&... args)
+            {
+                func(std::forward<Args>(args)...);
+                promise.set_value();
+            }
+        };
+
+        template <typename T, typename Function, typename... Args>
+        void Fulfill(Promise<T> &promise, Function &func, Args&&... args)
+        {
+            try
+            {
+                Fulfiller<T>::apply(promise, func, std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    }
+
+    /**
+     * when_any的结果
+     */
+    template <typename T>
+    struct WhenAnyResult
+    {
+        size_t                  index;
+        std::vector<Future<T>>  futures;
+    };
+
+    /**
+     * 全部就绪
+     * @param futures Future列表
+     * @return 全部就绪后返回原Future列表，列表为空时立即就绪
+     */
+    template <typename T>
+    Future<std::vector<Future<T>>> when_all(std::vector<Future<T>> futures)
+    {
+        struct Context
+        {
+            std::atomic<size_t>                     remaining;
+            std::vector<Future<T>>                  futures;
+            Promise<std::vector<Future<T>>>         promise;
+        };
+
+        std::shared_ptr<Context> context = std::make_shared<Context>();
+        Future<std::vector<Future<T>>> result = context->promise.get_future();
+        if (futures.empty())
+        {
+            context->promise.set_value(std::move(futures));
+            return result;
+        }
+
+        // 后续任务可能立即执行并取走列表，先保存共享状态
+        std::vector<std::shared_ptr<future_stuff::SharedState<T>>> states;
+        states.reserve(futures.size());
+        for (size_t i = 0; i < futures.size(); ++i)
+        {
+            assert(futures[i].valid());
+            states.push_back(future_stuff::FutureAccess::state(futures[i]));
+        }
+
+        context->remaining = futures.size();
+        context->futures = std::move(futures);
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            states[i]->on_ready([context]()
+            {
+                if (--context->remaining == 0)
+                {
+                    context->promise.set_value(std::move(context->futures));
+                }
+            });
+        }
+        return result;
+    }
+
+    /**
+     * 任一就绪
+     * 原Future的后续任务由when_any占用，结果转交给新的Future，返回的Future可以再设置后续任务
+     * @param futures Future列表
+     * @return 任一就绪后返回其下标和新的Future列表，列表为空时立即就绪且下标为size_t(-1)
+     */
+    template <typename T>
+    Future<WhenAnyResult<T>> when_any(std::vector<Future<T>> futures)
+    {
+        struct Context
+        {
+            std::atomic_bool                        done;
+            std::vector<Promise<T>>                 promises;
+            std::vector<Future<T>>                  futures;
+            Promise<WhenAnyResult<T>>               promise;
+        };
+
+        std::shared_ptr<Context> context = std::make_shared<Context>();
+        Future<WhenAnyResult<T>> result = context->promise.get_future();
+        if (futures.empty())
+        {
+            context->promise.set_value(WhenAnyResult<T>{ static_cast<size_t>(-1), std::move(futures) });
+            return result;
+        }
+
+        std::vector<std::shared_ptr<future_stuff::SharedState<T>>> states;
+        states.reserve(futures.size());
+        context->promises.resize(futures.size());
+        context->futures.reserve(futures.size());
+        for (size_t i = 0; i < futures.size(); ++i)
+        {
+            assert(futures[i].valid());
+            states.push_back(future_stuff::FutureAccess::state(futures[i]));
+            context->futures.push_back(context->promises[i].get_future());
+        }
+        futures.clear();
+
+        context->done = false;
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            std::shared_ptr<future_stuff::SharedState<T>> state = states[i];
+            state->on_ready([context, state, i]()
+            {
+                // 先转交结果，获胜时列表中的Future已就绪
+                auto take = [&state]() { return state->take(); };
+                future_stuff::Fulfill(context->promises[i], take);
+                if (!context->done.exchange(true))
+                {
+                    context->promise.set_value(WhenAnyResult<T>{ i, std::move(context->futures) });
+                }
+            });
+        }
+        return result;
+    }
+}
+
+#endif
@@ -0,0 +1,179 @@
+﻿#ifndef __HANDLER_ALLOCATOR_H__
+#define __HANDLER_ALLOCATOR_H__
+
+#include <new>
+#include <atomic>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+
+namespace eddyserver
+{
+    /**
+     * 异步操作内存
+     * 同一时刻只服务一个未完成的异步操作，操作完成后内存被下一次操作复用
+     * 内存不足或已被占用时退回到堆分配
+     * 占用标记为原子变量，跨线程投递时可以在投递线程分配、在执行线程释放
+     */
+    class HandlerMemory final
+    {
+    public:
+        /* 内存块大小 */
+        static const size_t kStorageSize = 512;
+
+    public:
+        HandlerMemory()
+            : in_use_(false)
+        {
+        }
+
+    public:
+        /**
+         * 分配内存
+         * @param size 内存大小
+         */
+        void* allocate(size_t size)
+        {
+            if (size <= sizeof(storage_) && !in_use_.exchange(true, std::memory_order_acquire))
+            {
+                return &storage_;
+            }
+            return ::operator new(size);
+        }
+
+        /**
+         * 释放内存
+         * @param pointer 内存地址
+         */
+        void deallocate(void *pointer)
+        {
+            if (pointer == &storage_)
+            {
+                in_use_.store(false, std::memory_order_release);
+            }
+            else
+            {
+                ::operator delete(pointer);
+            }
+        }
+
+    private:
+        HandlerMemory(const HandlerMemory&) = delete;
+        HandlerMemory& operator= (const HandlerMemory&) = delete;
+
+    private:
+        typename std::aligned_storage<kStorageSize>::type   storage_;
+        std::atomic_bool                                    in_use_;
+    };
+
+    /**
+     * 异步操作分配器
+     * 通过asio的associated_allocator使用HandlerMemory
+     */
+    template <typename T>
+    class HandlerAllocator
+    {
+        template <typename> friend class HandlerAllocator;
+
+    public:
+        typedef T value_type;
+
+    public:
+        explicit HandlerAllocator(HandlerMemory &memory)
+            : memory_(memory)
+        {
+        }
+
+        template <typename U>
+        HandlerAllocator(const HandlerAllocator<U> &other)
+            : memory_(other.memory_)
+        {
+        }
+
+    public:
+        T* allocate(size_t n) const
+        {
+            return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+        }
+
+        void deallocate(T *pointer, size_t n) const
+        {
+            memory_.deallocate(pointer);
+        }
+
+        bool operator== (const HandlerAllocator &rhs) const
+        {
+            return &memory_ == &rhs.memory_;
+        }
+
+        bool operator!= (const HandlerAllocator &rhs) const
+        {
+            return &memory_ != &rhs.memory_;
+        }
+
+    private:
+        HandlerMemory &memory_;
+    };
+
+    /**
+     * 使用自定义内存的异步操作处理器
+     */
+    template <typename Handler>
+    class AllocHandler
+    {
+    public:
+        typedef HandlerAllocator<Handler> allocator_type;
+
+    public:
+        AllocHandler(HandlerMemory &memory, Handler handler)
+            : memory_(memory)
+            , handler_(std::move(handler))
+        {
+        }
+
+    public:
+        /**
+         * 获取分配器
+         */
+        allocator_type get_allocator() const
+        {
+            return allocator_type(memory_);
+        }
+
+        template <typename ...Args>
+        void operator() (Args&&... args)
+        {
+            handler_(std::forward<Args>(args)...);
+        }
+
+        /**
+         * 旧版asio的内存分配钩子
+         */
+        friend void* asio_handler_allocate(size_t size, AllocHandler<Handler> *this_handler)
+        {
+            return this_handler->memory_.allocate(size);
+        }
+
+        friend void asio_handler_deallocate(void *pointer, size_t size, AllocHandler<Handler> *this_handler)
+        {
+            this_handler->memory_.deallocate(pointer);
+        }
+
+    private:
+        HandlerMemory&  memory_;
+        Handler         handler_;
+    };
+
+    /**
+     * 包装异步操作处理器
+     * @param memory 异步操作内存
+     * @param handler 处理器
+     */
+    template <typename Handler>
+    inline AllocHandler<Handler> make_alloc_handler(HandlerMemory &memory, Handler handler)
+    {
+        return AllocHandler<Handler>(memory, std::move(handler));
+    }
+}
+
+#endif
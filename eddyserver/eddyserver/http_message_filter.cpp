@@ -0,0 +1,645 @@
+﻿#include "http_message_filter.h"
+#include <cctype>
+#include <cstring>
+#include "simd.h"
+
+namespace eddyserver
+{
+    namespace http_stuff
+    {
+        // 是否为空白字符
+        inline bool IsSpace(uint8_t value)
+        {
+            return value == ' ' || value == '\t';
+        }
+
+        // 去掉行尾的回车
+        inline const uint8_t* TrimCR(const uint8_t *begin, const uint8_t *end)
+        {
+            return end > begin && end[-1] == '\r' ? end - 1 : end;
+        }
+
+        // 去掉首尾的空白字符
+        inline void TrimSpaces(const uint8_t *&begin, const uint8_t *&end)
+        {
+            while (begin < end && IsSpace(*begin))
+            {
+                ++begin;
+            }
+            while (end > begin && IsSpace(end[-1]))
+            {
+                --end;
+            }
+        }
+
+        // 不区分大小写比较
+        bool EqualsIgnoreCase(const uint8_t *data, size_t size, const char *literal, size_t literal_size)
+        {
+            if (size != literal_size)
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (tolower(data[i]) != tolower(static_cast<uint8_t>(literal[i])))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        template <size_t N>
+        inline bool EqualsIgnoreCase(const uint8_t *begin, const uint8_t *end, const char (&literal)[N])
+        {
+            return EqualsIgnoreCase(begin, end - begin, literal, N - 1);
+        }
+
+        // 按逗号切分列表，依次处理去掉空白的元素
+        template <typename Visitor>
+        void ForEachToken(const uint8_t *begin, const uint8_t *end, Visitor visitor)
+        {
+            while (begin < end)
+            {
+                const uint8_t *comma = SIMD::find_byte(begin, end, ',');
+                const uint8_t *token_begin = begin;
+                const uint8_t *token_end = comma;
+                TrimSpaces(token_begin, token_end);
+                if (token_begin < token_end)
+                {
+                    visitor(token_begin, token_end);
+                }
+                begin = comma < end ? comma + 1 : end;
+            }
+        }
+
+        // 解析Content-Length
+        bool ParseContentLength(const uint8_t *begin, const uint8_t *end, size_t max_value, size_t &value)
+        {
+            if (begin == end)
+            {
+                return false;
+            }
+
+            value = 0;
+            for (; begin < end; ++begin)
+            {
+                if (*begin < '0' || *begin > '9')
+                {
+                    return false;
+                }
+
+                value = value * 10 + (*begin - '0');
+                if (value > max_value)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // 解析响应的状态码，格式不正确时返回0
+        int ParseStatus(const NetMessage &message)
+        {
+            static const char kPrefix[] = "HTTP/1.";
+            const uint8_t *data = message.data();
+            if (message.readable() < 12 || memcmp(data, kPrefix, sizeof(kPrefix) - 1) != 0 || data[8] != ' ')
+            {
+                return 0;
+            }
+
+            int status = 0;
+            for (size_t i = 9; i < 12; ++i)
+            {
+                if (data[i] < '0' || data[i] > '9')
+                {
+                    return 0;
+                }
+                status = status * 10 + (data[i] - '0');
+            }
+            return status;
+        }
+    }
+
+    const uint8_t HttpMessageFilter::kRequest;
+    const size_t HttpMessageFilter::kDefaultMaxHeaderSize;
+    const size_t HttpMessageFilter::kDefaultMaxBodySize;
+
+    HttpMessageFilter::HttpMessageFilter(size_t max_header_size, size_t max_body_size, size_t max_websocket_message_size)
+        : max_header_size_(max_header_size)
+        , max_body_size_(max_body_size)
+        , error_(false)
+        , scanned_(0)
+        , head_size_(0)
+        , body_size_(0)
+        , flags_(0)
+        , minor_version_(0)
+        , requests_(0)
+        , responses_(0)
+        , upgrading_(false)
+        , input_held_(false)
+        , read_resumed_(false)
+        , websocket_(false)
+        , websocket_filter_(max_websocket_message_size)
+    {
+    }
+
+    // 获取欲读取数据大小
+    size_t HttpMessageFilter::bytes_wanna_read()
+    {
+        return MessageFilterInterface::stream_bytes();
+    }
+
+    // 获取欲写入数据大小
+    size_t HttpMessageFilter::bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent)
+    {
+        // 升级后按帧头最大长度估计，空消息不会写入
+        const size_t overhead = websocket_ || upgrading_ ? WebSocketMessageFilter::kMaxHeaderSize : 0;
+        size_t bytes = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            if (!messages_to_be_sent[i].empty())
+            {
+                bytes += messages_to_be_sent[i].readable() + overhead;
+            }
+        }
+        return bytes;
+    }
+
+    // 读取数据
+    size_t HttpMessageFilter::read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received)
+    {
+        return read_stream(buffer.data(), buffer.size(), messages_received);
+    }
+
+    // 流式读取数据
+    size_t HttpMessageFilter::read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+    {
+        size_t bytes = 0;
+        while (!error_ && !upgrading_ && !websocket_)
+        {
+            if (head_size_ == 0)
+            {
+                // 跳过请求之间多余的空行
+                if (scanned_ == 0)
+                {
+                    while (bytes < size && (data[bytes] == '\r' || data[bytes] == '\n'))
+                    {
+                        ++bytes;
+                    }
+                }
+
+                if (!find_head(data + bytes, size - bytes))
+                {
+                    break;
+                }
+
+                if (!parse_head(data + bytes))
+                {
+                    error_ = true;
+                    break;
+                }
+            }
+
+            // 等待完整的请求体
+            if (size - bytes < head_size_ + body_size_)
+            {
+                break;
+            }
+
+            messages_received.push_back(make_request(data + bytes));
+            bytes += head_size_ + body_size_;
+            head_size_ = 0;
+            ++requests_;
+            if ((flags_ & HttpRequest::kWebSocketUpgrade) != 0)
+            {
+                upgrading_ = true;
+            }
+        }
+
+        if (websocket_)
+        {
+            bytes += websocket_filter_.read_stream(data + bytes, size - bytes, messages_received);
+        }
+        else if (upgrading_ && bytes < size)
+        {
+            // 暂缓解析，等握手请求的响应发出后由Session重新解析
+            input_held_ = true;
+            if (size - bytes > max_header_size_)
+            {
+                error_ = true;
+            }
+        }
+        return bytes;
+    }
+
+    // 写入数据
+    size_t HttpMessageFilter::write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer)
+    {
+        size_t bytes = 0;
+        size_t i = 0;
+        for (; i < messages_to_be_sent.size() && !websocket_; ++i)
+        {
+            const NetMessage &message = messages_to_be_sent[i];
+            buffer.insert(buffer.end(), message.data(), message.data() + message.readable());
+            bytes += message.readable();
+            on_response(message);
+        }
+
+        if (i < messages_to_be_sent.size())
+        {
+            bytes += WebSocketMessageFilter::write_frames(messages_to_be_sent, i, buffer, error_);
+        }
+        return bytes;
+    }
+
+    // 聚集写入数据
+    size_t HttpMessageFilter::write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+    {
+        size_t bytes = 0;
+        size_t i = 0;
+        for (; i < messages_to_be_sent.size() && !websocket_; ++i)
+        {
+            const NetMessage &message = messages_to_be_sent[i];
+            buffers.push_back(asio::buffer(message.data(), message.readable()));
+            bytes += message.readable();
+            on_response(message);
+        }
+
+        // 101响应之后的消息已是WebSocket消息
+        if (i < messages_to_be_sent.size())
+        {
+            bytes += WebSocketMessageFilter::write_frames(messages_to_be_sent, i, headers, buffers, error_);
+        }
+        return bytes;
+    }
+
+    // 查找请求头的结尾
+    bool HttpMessageFilter::find_head(const uint8_t *data, size_t size)
+    {
+        const uint8_t *end = data + size;
+        const uint8_t *cursor = data + scanned_;
+        while (cursor < end)
+        {
+            const uint8_t *found = SIMD::find_byte(cursor, end, '\n');
+            if (found == end)
+            {
+                break;
+            }
+
+            cursor = found + 1;
+            if (static_cast<size_t>(cursor - data) > max_header_size_)
+            {
+                error_ = true;
+                return false;
+            }
+
+            // 空行表示请求头结束
+            const size_t offset = found - data;
+            if ((offset >= 1 && found[-1] == '\n') || (offset >= 2 && found[-1] == '\r' && found[-2] == '\n'))
+            {
+                head_size_ = cursor - data;
+                scanned_ = 0;
+                return true;
+            }
+        }
+
+        scanned_ = size;
+        if (size > max_header_size_)
+        {
+            error_ = true;
+        }
+        return false;
+    }
+
+    // 解析请求行和请求头
+    bool HttpMessageFilter::parse_head(const uint8_t *data)
+    {
+        using namespace http_stuff;
+        const uint8_t *end = data + head_size_;
+        fields_.clear();
+        flags_ = 0;
+        body_size_ = 0;
+
+        // 请求行：方法 目标 版本
+        const uint8_t *line_end = SIMD::find_byte(data, end, '\n');
+        const uint8_t *line_stop = TrimCR(data, line_end);
+        const uint8_t *method_end = SIMD::find_byte(data, line_stop, ' ');
+        if (method_end == data || method_end == line_stop)
+        {
+            return false;
+        }
+
+        const uint8_t *target = method_end + 1;
+        const uint8_t *target_end = SIMD::find_byte(target, line_stop, ' ');
+        if (target_end == target || target_end == line_stop)
+        {
+            return false;
+        }
+
+        const uint8_t *version = target_end + 1;
+        if (line_stop - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 || (version[7] != '0' && version[7] != '1'))
+        {
+            return false;
+        }
+
+        minor_version_ = version[7] - '0';
+        fields_.push_back(Field{ 0, static_cast<uint32_t>(method_end - data) });
+        fields_.push_back(Field{ static_cast<uint32_t>(target - data), static_cast<uint32_t>(target_end - target) });
+        fields_.push_back(Field{ static_cast<uint32_t>(head_size_), 0 });
+
+        // 请求头：名称: 值
+        bool has_length = false;
+        bool close = false;
+        bool keep_alive = false;
+        bool upgrade = false;
+        bool websocket = false;
+        bool has_key = false;
+        bool version_13 = false;
+        for (const uint8_t *line = line_end + 1; line < end; line = line_end + 1)
+        {
+            line_end = SIMD::find_byte(line, end, '\n');
+            line_stop = TrimCR(line, line_end);
+            if (line_stop == line)
+            {
+                break;
+            }
+
+            // 不接受折行和名称后的空白
+            const uint8_t *colon = SIMD::find_byte(line, line_stop, ':');
+            if (IsSpace(*line) || colon == line || colon == line_stop || IsSpace(colon[-1]))
+            {
+                return false;
+            }
+
+            const uint8_t *value = colon + 1;
+            const uint8_t *value_end = line_stop;
+            TrimSpaces(value, value_end);
+            fields_.push_back(Field{ static_cast<uint32_t>(line - data), static_cast<uint32_t>(colon - line) });
+            fields_.push_back(Field{ static_cast<uint32_t>(value - data), static_cast<uint32_t>(value_end - value) });
+
+            if (EqualsIgnoreCase(line, colon, "content-length"))
+            {
+                size_t length = 0;
+                if (!ParseContentLength(value, value_end, max_body_size_, length) || (has_length && length != body_size_))
+                {
+                    return false;
+                }
+                has_length = true;
+                body_size_ = length;
+            }
+            else if (EqualsIgnoreCase(line, colon, "transfer-encoding"))
+            {
+                return false;
+            }
+            else if (EqualsIgnoreCase(line, colon, "connection"))
+            {
+                ForEachToken(value, value_end, [&](const uint8_t *token, const uint8_t *token_end)
+                {
+                    close = close || EqualsIgnoreCase(token, token_end, "close");
+                    keep_alive = keep_alive || EqualsIgnoreCase(token, token_end, "keep-alive");
+                    upgrade = upgrade || EqualsIgnoreCase(token, token_end, "upgrade");
+                });
+            }
+            else if (EqualsIgnoreCase(line, colon, "upgrade"))
+            {
+                ForEachToken(value, value_end, [&](const uint8_t *token, const uint8_t *token_end)
+                {
+                    websocket = websocket || EqualsIgnoreCase(token, token_end, "websocket");
+                });
+            }
+            else if (EqualsIgnoreCase(line, colon, "sec-websocket-key"))
+            {
+                has_key = value < value_end;
+            }
+            else if (EqualsIgnoreCase(line, colon, "sec-websocket-version"))
+            {
+                version_13 = value_end - value == 2 && memcmp(value, "13", 2) == 0;
+            }
+        }
+
+        fields_[HttpRequest::kBodyField].size = static_cast<uint32_t>(body_size_);
+        if (minor_version_ == 1 ? !close : keep_alive)
+        {
+            flags_ |= HttpRequest::kKeepAlive;
+        }
+
+        const bool get = method_end - data == 3 && memcmp(data, "GET", 3) == 0;
+        if (get && minor_version_ == 1 && upgrade && websocket && has_key && version_13)
+        {
+            flags_ |= HttpRequest::kWebSocketUpgrade;
+        }
+        return true;
+    }
+
+    // 生成请求消息
+    NetMessage HttpMessageFilter::make_request(const uint8_t *data) const
+    {
+        const size_t index_size = fields_.size() * sizeof(Field);
+        NetMessage message(HttpRequest::kPrefixSize + index_size + head_size_ + body_size_);
+        message.write_pod<uint8_t>(kRequest);
+        message.write_pod<uint8_t>(flags_);
+        message.write_pod<uint8_t>(minor_version_);
+        message.write_pod<uint8_t>(0);
+        message.write_pod<uint32_t>(static_cast<uint32_t>(fields_.size()));
+        message.write(fields_.data(), index_size);
+        message.write(data, head_size_ + body_size_);
+        return message;
+    }
+
+    // 发送响应后更新状态
+    void HttpMessageFilter::on_response(const NetMessage &message)
+    {
+        // 1xx临时响应不对应请求
+        const int status = http_stuff::ParseStatus(message);
+        if (status >= 100 && status < 200 && status != 101)
+        {
+            return;
+        }
+
+        ++responses_;
+        if (upgrading_ && responses_ >= requests_)
+        {
+            upgrading_ = false;
+            websocket_ = status == 101;
+            read_resumed_ = input_held_;
+            input_held_ = false;
+        }
+    }
+
+    // 是否需要重新解析已接收的数据
+    bool HttpMessageFilter::take_read_resumed()
+    {
+        const bool resumed = read_resumed_;
+        read_resumed_ = false;
+        return resumed;
+    }
+
+    const uint8_t HttpRequest::kKeepAlive;
+    const uint8_t HttpRequest::kWebSocketUpgrade;
+    const size_t HttpRequest::kPrefixSize;
+    const size_t HttpRequest::kMethodField;
+    const size_t HttpRequest::kTargetField;
+    const size_t HttpRequest::kBodyField;
+    const size_t HttpRequest::kHeaderFields;
+
+    HttpRequest::HttpRequest(const NetMessage &message)
+        : message_(message)
+    {
+    }
+
+    // 是否为请求消息
+    bool HttpRequest::valid() const
+    {
+        return message_.readable() >= kPrefixSize
+            && message_.data()[0] == HttpMessageFilter::kRequest
+            && message_.readable() >= kPrefixSize + field_count() * sizeof(uint32_t) * 2;
+    }
+
+    // 获取请求方法
+    std::string HttpRequest::method() const
+    {
+        return field_string(kMethodField);
+    }
+
+    // 获取请求目标
+    std::string HttpRequest::target() const
+    {
+        return field_string(kTargetField);
+    }
+
+    // 获取HTTP次版本号
+    int HttpRequest::minor_version() const
+    {
+        return message_.data()[2];
+    }
+
+    // 是否保持连接
+    bool HttpRequest::keep_alive() const
+    {
+        return (message_.data()[1] & kKeepAlive) != 0;
+    }
+
+    // 是否为WebSocket握手请求
+    bool HttpRequest::is_websocket_upgrade() const
+    {
+        return (message_.data()[1] & kWebSocketUpgrade) != 0;
+    }
+
+    // 获取请求头数量
+    size_t HttpRequest::header_count() const
+    {
+        return (field_count() - kHeaderFields) / 2;
+    }
+
+    // 获取请求头的名称
+    std::string HttpRequest::header_name(size_t index) const
+    {
+        return field_string(kHeaderFields + index * 2);
+    }
+
+    // 获取请求头的值
+    std::string HttpRequest::header_value(size_t index) const
+    {
+        return field_string(kHeaderFields + index * 2 + 1);
+    }
+
+    // 按名称获取请求头的值
+    std::string HttpRequest::header(const std::string &name) const
+    {
+        for (size_t i = 0; i < header_count(); ++i)
+        {
+            size_t size = 0;
+            const uint8_t *data = field(kHeaderFields + i * 2, size);
+            if (http_stuff::EqualsIgnoreCase(data, size, name.data(), name.size()))
+            {
+                return header_value(i);
+            }
+        }
+        return std::string();
+    }
+
+    // 获取请求体
+    NetMessage HttpRequest::body() const
+    {
+        size_t size = 0;
+        const uint8_t *data = field(kBodyField, size);
+        if (size == 0)
+        {
+            return NetMessage();
+        }
+
+        NetMessage body(message_);
+        body.retrieve(data - message_.data());
+        body.truncate(size);
+        return body;
+    }
+
+    // 获取字段数量
+    size_t HttpRequest::field_count() const
+    {
+        uint32_t count = 0;
+        memcpy(&count, message_.data() + 4, sizeof(count));
+        return count;
+    }
+
+    // 获取字段的地址和大小
+    const uint8_t* HttpRequest::field(size_t index, size_t &size) const
+    {
+        uint32_t position[2] = { 0 };
+        const size_t count = field_count();
+        const uint8_t *index_data = message_.data() + kPrefixSize;
+        memcpy(position, index_data + index * sizeof(position), sizeof(position));
+        size = position[1];
+        return index_data + count * sizeof(position) + position[0];
+    }
+
+    // 获取字段的值
+    std::string HttpRequest::field_string(size_t index) const
+    {
+        size_t size = 0;
+        const uint8_t *data = field(index, size);
+        return std::string(reinterpret_cast<const char*>(data), size);
+    }
+
+    HttpResponse::HttpResponse(int status, const std::string &reason)
+        : head_("HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n")
+    {
+    }
+
+    // 添加响应头
+    void HttpResponse::add_header(const std::string &name, const std::string &value)
+    {
+        head_ += name + ": " + value + "\r\n";
+    }
+
+    // 生成响应消息
+    NetMessage HttpResponse::to_message(NetMessage body, bool keep_alive) const
+    {
+        const std::string head = head_ + "Content-Length: " + std::to_string(body.readable())
+            + (keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        body.prepend(head.data(), head.size());
+        return body;
+    }
+
+    NetMessage HttpResponse::to_message(const std::string &body, bool keep_alive) const
+    {
+        const std::string head = head_ + "Content-Length: " + std::to_string(body.size())
+            + (keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        NetMessage message(head.size() + body.size());
+        message.write(head.data(), head.size());
+        message.write(body.data(), body.size());
+        return message;
+    }
+
+    // 生成WebSocket握手的101响应
+    NetMessage HttpResponse::websocket_accept(const HttpRequest &request)
+    {
+        const std::string head = "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " + WebSocketMessageFilter::accept_key(request.header("Sec-WebSocket-Key")) + "\r\n\r\n";
+        return NetMessage(head.data(), head.size());
+    }
+}
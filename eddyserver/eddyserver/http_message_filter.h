@@ -0,0 +1,323 @@
+﻿#ifndef __HTTP_MESSAGE_FILTER_H__
+#define __HTTP_MESSAGE_FILTER_H__
+
+#include <string>
+#include <vector>
+#include "net_message.h"
+#include "message_filter.h"
+#include "websocket_message_filter.h"
+
+namespace eddyserver
+{
+    /**
+     * HTTP/1.1消息过滤器（服务端）
+     * 总是流式读取，按向量指令查找换行、空格、冒号和逗号切分请求头（见simd.h），已查找过的数据不再重复查找
+     * 每个请求拷贝一次为一条消息，开头为字段索引，之后为原始的请求头和请求体，用HttpRequest访问
+     * 支持长连接和流水线，响应需按请求的顺序逐个发送，发送的消息原样写入，可用HttpResponse生成
+     * 不支持分块传输的请求体，带Transfer-Encoding的请求视为出错
+     * 收到WebSocket握手请求后暂停解析，发出101响应后切换为WebSocket协议（见websocket_message_filter.h），
+     * 之后收发的消息与WebSocketMessageFilter相同，Session和接收缓存不变；发出其他响应时继续解析HTTP请求
+     * 升级期间已收到的数据由Session在响应写入完成后立即重新解析，不等待新的数据
+     */
+    class HttpMessageFilter final : public MessageFilterInterface
+    {
+    public:
+        /* 请求消息的类型，不与WebSocket操作码重复 */
+        static const uint8_t kRequest = 0x80;
+
+        /* 默认的请求头最大长度 */
+        static const size_t kDefaultMaxHeaderSize = 8 * 1024;
+
+        /* 默认的请求体最大长度 */
+        static const size_t kDefaultMaxBodySize = 1024 * 1024;
+
+    public:
+        /**
+         * 构造函数
+         * @param max_header_size 请求行和请求头的最大长度
+         * @param max_body_size 请求体最大长度
+         * @param max_websocket_message_size 升级后WebSocket消息最大长度
+         */
+        explicit HttpMessageFilter(size_t max_header_size = kDefaultMaxHeaderSize,
+                                   size_t max_body_size = kDefaultMaxBodySize,
+                                   size_t max_websocket_message_size = WebSocketMessageFilter::kDefaultMaxMessageSize);
+
+    public:
+        /**
+         * 是否已升级为WebSocket
+         */
+        bool is_websocket() const
+        {
+            return websocket_;
+        }
+
+    public:
+        /**
+         * 获取欲读取数据大小
+         */
+        virtual size_t bytes_wanna_read();
+
+        /**
+         * 获取欲写入数据大小
+         * @param messages_to_be_sent 将被发送的消息列表
+         */
+        virtual size_t bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent);
+
+        /**
+         * 读取数据
+         * 与流式读取相同
+         */
+        virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 流式读取数据
+         * 解析data中所有完整的请求，升级后解析WebSocket帧，出错后不再读取
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 写入数据
+         * 将param1 messages_to_be_sent的消息列表写入param2 buffer中
+         * @param messages_to_be_sent 写入的消息列表
+         * @param &buffer 缓存区
+         * @return 写入字节数
+         */
+        virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer);
+
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const
+        {
+            return true;
+        }
+
+        /**
+         * 聚集写入数据
+         * 响应不拷贝，升级后的消息编码为WebSocket帧
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers);
+
+        /**
+         * 是否需要重新解析已接收的数据
+         * 升级期间有暂缓解析的数据，且已发出握手请求的响应时返回true
+         */
+        virtual bool take_read_resumed();
+
+        /**
+         * 是否出错
+         */
+        virtual bool has_error() const
+        {
+            return error_ || websocket_filter_.has_error();
+        }
+
+    private:
+        /**
+         * 查找请求头的结尾
+         * @return 是否找到
+         */
+        bool find_head(const uint8_t *data, size_t size);
+
+        /**
+         * 解析请求行和请求头，结果写入fields_
+         * @return 是否合法
+         */
+        bool parse_head(const uint8_t *data);
+
+        /**
+         * 生成请求消息
+         */
+        NetMessage make_request(const uint8_t *data) const;
+
+        /**
+         * 发送响应后更新状态
+         */
+        void on_response(const NetMessage &message);
+
+    private:
+        /**
+         * 字段在请求中的位置
+         */
+        struct Field
+        {
+            uint32_t offset;
+            uint32_t size;
+        };
+
+    private:
+        const size_t            max_header_size_;
+        const size_t            max_body_size_;
+        bool                    error_;
+        size_t                  scanned_;
+        size_t                  head_size_;
+        size_t                  body_size_;
+        uint8_t                 flags_;
+        uint8_t                 minor_version_;
+        std::vector<Field>      fields_;
+        size_t                  requests_;
+        size_t                  responses_;
+        bool                    upgrading_;
+        bool                    input_held_;
+        bool                    read_resumed_;
+        bool                    websocket_;
+        WebSocketMessageFilter  websocket_filter_;
+    };
+
+    /**
+     * HTTP请求
+     * 访问HttpMessageFilter读取的请求消息，字段和请求体都引用消息的数据
+     */
+    class HttpRequest final
+    {
+        friend class HttpMessageFilter;
+
+    public:
+        /**
+         * 构造函数
+         * @param message HttpMessageFilter读取的消息
+         */
+        explicit HttpRequest(const NetMessage &message);
+
+    public:
+        /**
+         * 是否为请求消息，升级后读取的WebSocket消息返回false
+         */
+        bool valid() const;
+
+        /**
+         * 获取请求方法
+         */
+        std::string method() const;
+
+        /**
+         * 获取请求目标
+         */
+        std::string target() const;
+
+        /**
+         * 获取HTTP次版本号，0或1
+         */
+        int minor_version() const;
+
+        /**
+         * 是否保持连接
+         * HTTP/1.1默认保持，HTTP/1.0需要Connection: keep-alive
+         */
+        bool keep_alive() const;
+
+        /**
+         * 是否为WebSocket握手请求
+         */
+        bool is_websocket_upgrade() const;
+
+        /**
+         * 获取请求头数量
+         */
+        size_t header_count() const;
+
+        /**
+         * 获取请求头的名称
+         */
+        std::string header_name(size_t index) const;
+
+        /**
+         * 获取请求头的值
+         */
+        std::string header_value(size_t index) const;
+
+        /**
+         * 按名称获取请求头的值，名称不区分大小写
+         * @return 不存在时返回空字符串
+         */
+        std::string header(const std::string &name) const;
+
+        /**
+         * 获取请求体
+         * 与请求消息共享缓冲块
+         */
+        NetMessage body() const;
+
+    private:
+        /* 标志位 */
+        static const uint8_t kKeepAlive = 0x1;
+        static const uint8_t kWebSocketUpgrade = 0x2;
+
+        /* 固定部分：类型、标志位、次版本号、保留字节和字段数量 */
+        static const size_t kPrefixSize = 8;
+
+        /* 固定字段：方法、目标和请求体，之后为请求头的名称和值 */
+        static const size_t kMethodField = 0;
+        static const size_t kTargetField = 1;
+        static const size_t kBodyField = 2;
+        static const size_t kHeaderFields = 3;
+
+    private:
+        /**
+         * 获取字段数量
+         */
+        size_t field_count() const;
+
+        /**
+         * 获取字段的地址和大小
+         */
+        const uint8_t* field(size_t index, size_t &size) const;
+
+        /**
+         * 获取字段的值
+         */
+        std::string field_string(size_t index) const;
+
+    private:
+        NetMessage message_;
+    };
+
+    /**
+     * HTTP响应
+     * 响应头写入响应体前的头部空间，独占缓冲块的响应体不移动数据
+     */
+    class HttpResponse final
+    {
+    public:
+        /**
+         * 构造函数
+         * @param status 状态码
+         * @param reason 原因短语
+         */
+        HttpResponse(int status, const std::string &reason);
+
+    public:
+        /**
+         * 添加响应头
+         */
+        void add_header(const std::string &name, const std::string &value);
+
+        /**
+         * 生成响应消息
+         * 自动添加Content-Length和Connection
+         * @param body 响应体
+         * @param keep_alive 是否保持连接
+         */
+        NetMessage to_message(NetMessage body, bool keep_alive) const;
+        NetMessage to_message(const std::string &body, bool keep_alive) const;
+
+        /**
+         * 生成WebSocket握手的101响应
+         * @param request 握手请求
+         */
+        static NetMessage websocket_accept(const HttpRequest &request);
+
+    private:
+        std::string head_;
+    };
+}
+
+#endif
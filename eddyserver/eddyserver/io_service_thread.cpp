@@ -1,29 +1,93 @@
 ﻿#include "io_service_thread.h"
+#include <ctime>
+#include <cassert>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
 #include "tcp_session.h"
+#include "tcp_session_handler.h"
 #include "io_service_thread_manager.h"
 
 namespace eddyserver
 {
+    namespace io_thread_stuff
+    {
+        /* 当前线程运行的IOServiceThread */
+        thread_local IOServiceThread *current_thread = nullptr;
+
+        /* 负载采样间隔 */
+        static const std::chrono::milliseconds kLoadSampleInterval(1000);
+
+        /* 最多缓存的可复用消息列表数量 */
+        static const size_t kMaxSpareLists = 64;
+
+        /* 广播因迁移转发的次数上限，Session反复迁移时放弃 */
+        static const size_t kMaxBroadcastHops = 8;
+
+        /**
+         * 获取当前线程占用的CPU时间
+         * 阻塞等待时不计入，可用于衡量线程的繁忙程度
+         */
+        inline std::chrono::microseconds ThreadCPUTime()
+        {
+#if defined(_WIN32)
+            FILETIME creation_time, exit_time, kernel_time, user_time;
+            if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time))
+            {
+                return std::chrono::microseconds(0);
+            }
+            const uint64_t kernel = (static_cast<uint64_t>(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime;
+            const uint64_t user = (static_cast<uint64_t>(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+            return std::chrono::microseconds((kernel + user) / 10);
+#else
+            timespec ts;
+            if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+            {
+                return std::chrono::microseconds(0);
+            }
+            return std::chrono::microseconds(static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+#endif
+        }
+    }
+
     IOServiceThread::IOServiceThread(IOThreadID id, IOServiceThreadManager &td_manager)
         : td_id_(id)
         , timer_(io_service_)
         , td_manager_(td_manager)
-        , wait_handler_(std::bind(&IOServiceThread::check_keep_alive, this, std::placeholders::_1))
+        , load_(0)
+        , session_handlers_(id)
+        , bytes_total_(0)
+        , messages_total_(0)
+        , bytes_sampled_(0)
+        , messages_sampled_(0)
+        , sample_time_(timing_wheel_.now())
+        , byte_rate_(0)
+        , message_rate_(0)
+        , cpu_time_sampled_(0)
+        , busy_ratio_(0)
     {
+        spare_lists_.reserve(io_thread_stuff::kMaxSpareLists);
     }
 
     // 线程执行函数
     void IOServiceThread::run()
     {
+        io_thread_stuff::current_thread = this;
+
         if (io_work_ == nullptr)
         {
             io_work_ = std::make_unique<asio::io_service::work>(io_service_);
         }
 
-        timer_.expires_from_now(std::chrono::seconds(1));
-        timer_.async_wait(wait_handler_);
+        timer_.expires_from_now(timing_wheel_.tick());
+        timer_.async_wait(make_alloc_handler(tick_memory_,
+            std::bind(&IOServiceThread::handle_tick, this, std::placeholders::_1)));
+        sample_time_ = timing_wheel_.now();
+        cpu_time_sampled_ = io_thread_stuff::ThreadCPUTime();
+        timing_wheel_.add(io_thread_stuff::kLoadSampleInterval, [this]() { sample_load(); });
 
         asio::error_code error_code;
         io_service_.run(error_code);
@@ -31,6 +95,19 @@ namespace eddyserver
         {
             std::cerr << error_code.message() << std::endl;
         }
+        io_thread_stuff::current_thread = nullptr;
+    }
+
+    // 是否在此线程中运行
+    bool IOServiceThread::running_in_this_thread() const
+    {
+        return io_thread_stuff::current_thread == this;
+    }
+
+    // 获取当前线程的IOServiceThread
+    IOServiceThread* IOServiceThread::current_thread()
+    {
+        return io_thread_stuff::current_thread;
     }
 
     // 合并线程
@@ -61,24 +138,264 @@ namespace eddyserver
         }
     }
 
-    // 检查Session存活
-    void IOServiceThread::check_keep_alive(asio::error_code error_code)
+    // 投递消息列表到信箱
+    void IOServiceThread::post_messages(IOServiceThread &source, TCPSessionID id, NetMessageVector &&messages, ReceivedChainVector &&chains)
     {
-        if (error_code)
+        if (mailbox_.push(MessageBatch(source, id, std::move(messages), std::move(chains))))
         {
-            std::cerr << error_code.message() << std::endl;
+            io_service_.post(make_alloc_handler(mailbox_memory_,
+                std::bind(&IOServiceThread::handle_mailbox, this)));
         }
-        else
+    }
+
+    // 处理信箱
+    void IOServiceThread::handle_mailbox()
+    {
+        mailbox_.consume_all([this](MessageBatch &batch)
+        {
+            // 先换出消息再归还上一次分发的列表，来源线程读取回复之前一定能取到可复用的列表
+            dispatching_messages_.swap(batch.messages);
+            if (batch.messages.capacity() > 0)
+            {
+                batch.source->recycle_message_list(std::move(batch.messages));
+            }
+
+            SessionHandlePointer handler_ptr = get_session_handler(batch.session_id);
+            if (handler_ptr != nullptr)
+            {
+                handler_ptr->dispatch(dispatching_messages_, batch.chains);
+            }
+            dispatching_messages_.clear();
+        });
+    }
+
+    // 归还消息列表
+    void IOServiceThread::recycle_message_list(NetMessageVector &&messages)
+    {
+        recycled_lists_.push(std::move(messages));
+    }
+
+    // 取出可复用的消息列表
+    void IOServiceThread::reuse_message_list(NetMessageVector &messages)
+    {
+        if (spare_lists_.empty())
         {
-            session_queue_.foreach([=](const SessionPointer &session)
+            recycled_lists_.consume_all([this](NetMessageVector &list)
             {
-                if (!session->check_keep_alive())
+                if (spare_lists_.size() < io_thread_stuff::kMaxSpareLists)
                 {
-                    io_service_.post(std::bind(&TCPSession::close, session));
+                    spare_lists_.push_back(std::move(list));
                 }
             });
-            timer_.expires_from_now(std::chrono::seconds(1));
-            timer_.async_wait(wait_handler_);
+        }
+
+        if (!spare_lists_.empty())
+        {
+            messages.swap(spare_lists_.back());
+            spare_lists_.pop_back();
+        }
+    }
+
+    // 处理广播
+    void IOServiceThread::handle_broadcast(BroadcastBatchPointer batch)
+    {
+        // 迁移走的Session由handle_mailbox转到新线程
+        for (size_t i = 0; i < batch->sessions.size(); ++i)
+        {
+            batch->sessions[i]->handle_mailbox();
+        }
+        batch->sessions.clear();
+
+        // 分组后迁出的Session按所在线程表转发，所在线程表在迁移投递之后更新，转发的批次排在Session之后到达
+        // 已关闭的Session查不到所在线程，直接丢弃
+        std::vector<BroadcastBatchPointer> forwards;
+        for (size_t i = 0; i < batch->session_ids.size(); ++i)
+        {
+            const TCPSessionID id = batch->session_ids[i];
+            SessionPointer session_ptr = session_queue_.get(id);
+            if (session_ptr != nullptr)
+            {
+                send_broadcast(*batch, session_ptr);
+                continue;
+            }
+
+            const IOThreadID owner = td_manager_.get_session_owner(id);
+            if (owner == 0 || owner == td_id_ || owner > td_manager_.get_thread_count() ||
+                batch->hops >= io_thread_stuff::kMaxBroadcastHops)
+            {
+                continue;
+            }
+
+            forwards.resize(td_manager_.get_thread_count());
+            BroadcastBatchPointer &forward = forwards[owner - 1];
+            if (forward == nullptr)
+            {
+                forward = std::make_shared<BroadcastBatch>(batch->message);
+                forward->frame = batch->frame;
+                forward->frame_filter = batch->frame_filter;
+                forward->hops = batch->hops + 1;
+            }
+            forward->session_ids.push_back(id);
+        }
+
+        for (size_t i = 0; i < forwards.size(); ++i)
+        {
+            if (forwards[i] != nullptr)
+            {
+                ThreadPointer owner = td_manager_.get_thread(static_cast<IOThreadID>(i + 1));
+                owner->post(std::bind(&IOServiceThread::handle_broadcast, owner.get(), forwards[i]));
+            }
+        }
+    }
+
+    // 发送广播帧到Session
+    void IOServiceThread::send_broadcast(BroadcastBatch &batch, SessionPointer &session_ptr)
+    {
+        session_ptr->write_frame(batch.message, batch.frame, batch.frame_filter);
+        if (session_ptr->push_frame(batch.message, batch.frame, batch.frame_filter))
+        {
+            session_ptr->handle_mailbox();
+        }
+    }
+
+    // 获取Session处理器
+    SessionHandlePointer IOServiceThread::get_session_handler(TCPSessionID id) const
+    {
+        if (SessionHandlerMap::tag_of(id) == td_id_)
+        {
+            const SessionHandlePointer *handler_ptr = session_handlers_.get(id);
+            return handler_ptr != nullptr ? *handler_ptr : SessionHandlePointer();
+        }
+
+        MigratedHandlerMap::const_iterator found = migrated_handlers_.find(id);
+        if (found != migrated_handlers_.end())
+        {
+            return found->second;
+        }
+        return SessionHandlePointer();
+    }
+
+    // 添加SessionHandler
+    TCPSessionID IOServiceThread::add_session_handler(const SessionHandlePointer &handler_ptr, IOThreadID owner)
+    {
+        const TCPSessionID id = session_handlers_.insert(handler_ptr);
+        session_owners_.insert(id, owner);
+        return id;
+    }
+
+    // 取出SessionHandler
+    SessionHandlePointer IOServiceThread::detach_session_handler(TCPSessionID id)
+    {
+        SessionHandlePointer handler_ptr;
+        if (SessionHandlerMap::tag_of(id) == td_id_)
+        {
+            // 保留槽位，避免迁移期间Session ID被重新分配
+            SessionHandlePointer *slot = session_handlers_.get(id);
+            if (slot != nullptr)
+            {
+                handler_ptr.swap(*slot);
+            }
+        }
+        else
+        {
+            MigratedHandlerMap::iterator found = migrated_handlers_.find(id);
+            if (found != migrated_handlers_.end())
+            {
+                handler_ptr.swap(found->second);
+                migrated_handlers_.erase(found);
+            }
+        }
+        return handler_ptr;
+    }
+
+    // 放入迁移来的SessionHandler
+    void IOServiceThread::attach_session_handler(TCPSessionID id, const SessionHandlePointer &handler_ptr)
+    {
+        if (SessionHandlerMap::tag_of(id) == td_id_)
+        {
+            SessionHandlePointer *slot = session_handlers_.get(id);
+            assert(slot != nullptr && *slot == nullptr);
+            if (slot != nullptr)
+            {
+                *slot = handler_ptr;
+            }
+        }
+        else
+        {
+            migrated_handlers_[id] = handler_ptr;
+        }
+    }
+
+    // 移除SessionHandler并释放Session ID
+    SessionHandlePointer IOServiceThread::remove_session_handler(TCPSessionID id)
+    {
+        SessionHandlePointer handler_ptr = detach_session_handler(id);
+        const IOThreadID owner_id = SessionHandlerMap::tag_of(id);
+        if (owner_id == td_id_)
+        {
+            release_session_id(id);
+        }
+        else
+        {
+            ThreadPointer owner = td_manager_.get_thread(owner_id);
+            if (owner != nullptr)
+            {
+                owner->post(std::bind(&IOServiceThread::release_session_id, owner, id));
+            }
+        }
+        return handler_ptr;
+    }
+
+    // 释放Session ID
+    void IOServiceThread::release_session_id(TCPSessionID id)
+    {
+        // Session ID只能归还给分配它的线程，否则可能分配出仍在使用的ID
+        assert(SessionHandlerMap::tag_of(id) == td_id_);
+        session_owners_.erase(id);
+        session_handlers_.erase(id);
+    }
+
+    // 采样负载
+    void IOServiceThread::sample_load()
+    {
+        const TimingWheel::TimePoint now = timing_wheel_.now();
+        const std::chrono::microseconds cpu_time = io_thread_stuff::ThreadCPUTime();
+        const int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - sample_time_).count();
+        if (elapsed > 0)
+        {
+            // 与上次结果取平均，平滑短时间的突发流量
+            const uint64_t byte_rate = (bytes_total_ - bytes_sampled_) * 1000 / elapsed;
+            const uint64_t message_rate = (messages_total_ - messages_sampled_) * 1000 / elapsed;
+            byte_rate_.store((byte_rate_.load(std::memory_order_relaxed) + byte_rate) / 2, std::memory_order_relaxed);
+            message_rate_.store((message_rate_.load(std::memory_order_relaxed) + message_rate) / 2, std::memory_order_relaxed);
+
+            // 微秒除以毫秒即为千分比
+            const uint64_t busy_ratio = std::min<uint64_t>((cpu_time - cpu_time_sampled_).count() / elapsed, 1000);
+            busy_ratio_.store(static_cast<uint32_t>((busy_ratio_.load(std::memory_order_relaxed) + busy_ratio) / 2), std::memory_order_relaxed);
+        }
+
+        sample_time_ = now;
+        cpu_time_sampled_ = cpu_time;
+        bytes_sampled_ = bytes_total_;
+        messages_sampled_ = messages_total_;
+
+        // 只捕获this，std::function直接存放在内部，不分配堆内存
+        timing_wheel_.add(io_thread_stuff::kLoadSampleInterval, [this]() { sample_load(); });
+    }
+
+    // 推进时间轮
+    void IOServiceThread::handle_tick(asio::error_code error_code)
+    {
+        if (error_code)
+        {
+            std::cerr << error_code.message() << std::endl;
+        }
+        else
+        {
+            timing_wheel_.advance(std::chrono::steady_clock::now());
+            timer_.expires_from_now(timing_wheel_.tick());
+            timer_.async_wait(make_alloc_handler(tick_memory_,
+                std::bind(&IOServiceThread::handle_tick, this, std::placeholders::_1)));
         }
     }
 }
@@ -1,11 +1,22 @@
 ﻿#ifndef __IO_SERVICE_THREAD_H__
 #define __IO_SERVICE_THREAD_H__
 
+#include <atomic>
 #include <memory>
 #include <thread>
+#include <vector>
+#include <typeinfo>
+#include <unordered_map>
 #include <asio/io_service.hpp>
 #include <asio/steady_timer.hpp>
+#include "slot_map.h"
+#include "mpsc_queue.h"
+#include "net_message.h"
+#include "timing_wheel.h"
+#include "handler_allocator.h"
+#include "chained_message.h"
 #include "tcp_session_queue.h"
+#include "session_owner_table.h"
 
 namespace eddyserver
 {
@@ -13,10 +24,62 @@ namespace eddyserver
 
     class IOServiceThread final : public std::enable_shared_from_this< IOServiceThread >
     {
+        friend class SessionGroup;
         friend class IOServiceThreadManager;
-        typedef std::function<void(asio::error_code error_code)> WaitHandler;
+        typedef SlotMap<SessionHandlePointer> SessionHandlerMap;
+        typedef std::unordered_map<TCPSessionID, SessionHandlePointer> MigratedHandlerMap;
+
+        /**
+         * 消息批次
+         * chains为同批收到的链式消息，按接收位置插在普通消息之间
+         * 分发后消息列表交还给投递它的IO线程
+         */
+        struct MessageBatch
+        {
+            IOServiceThread*    source;
+            TCPSessionID        session_id;
+            NetMessageVector    messages;
+            ReceivedChainVector chains;
+
+            MessageBatch(IOServiceThread &source_thread, TCPSessionID id, NetMessageVector &&message_list, ReceivedChainVector &&chain_list)
+                : source(&source_thread)
+                , session_id(id)
+                , messages(std::move(message_list))
+                , chains(std::move(chain_list))
+            {
+            }
+        };
+
+        /**
+         * 广播批次
+         * 一次广播按线程分组，每个线程投递一个批次，所有批次共享同一帧
+         * sessions为信箱由空变为非空、需要唤醒的Session，session_ids为按所在线程表投递到此线程的Session
+         * hops为因迁移而转发的次数
+         */
+        struct BroadcastBatch
+        {
+            NetMessage                  message;
+            NetMessage                  frame;
+            const std::type_info*       frame_filter;
+            std::vector<SessionPointer> sessions;
+            std::vector<TCPSessionID>   session_ids;
+            size_t                      hops;
+
+            explicit BroadcastBatch(const NetMessage &msg)
+                : message(msg)
+                , frame_filter(nullptr)
+                , hops(0)
+            {
+            }
+        };
+        typedef std::shared_ptr<BroadcastBatch> BroadcastBatchPointer;
 
     public:
+        /**
+         * 构造函数
+         * @param id 线程id
+         * @param td_manager 线程管理器
+         */
         IOServiceThread(IOThreadID id, IOServiceThreadManager &td_manager);
 
     public:
@@ -44,7 +107,36 @@ namespace eddyserver
             io_service_.post(handler);
         }
 
+        /**
+         * 投递消息列表到信箱
+         * 可在任意线程调用，由此线程分发给SessionHandler
+         * 信箱由空变为非空时才唤醒io_service
+         * @param source 投递消息的IO线程，分发后消息列表交还给它复用
+         * @param id Session ID
+         * @param messages 消息列表
+         * @param chains 链式消息列表
+         */
+        void post_messages(IOServiceThread &source, TCPSessionID id, NetMessageVector &&messages, ReceivedChainVector &&chains);
+
+        /**
+         * 取出可复用的消息列表
+         * 只能在此线程中调用，没有可复用的列表时保持不变
+         * @param messages 没有容量的空消息列表
+         */
+        void reuse_message_list(NetMessageVector &messages);
+
     public:
+        /**
+         * 是否在此线程中运行
+         */
+        bool running_in_this_thread() const;
+
+        /**
+         * 获取当前线程的IOServiceThread
+         * 不在任何IOServiceThread中运行时返回nullptr
+         */
+        static IOServiceThread* current_thread();
+
         /**
          * 获取线程id
          */
@@ -62,6 +154,69 @@ namespace eddyserver
             return session_queue_;
         }
 
+        /**
+         * 获取负载
+         * 此线程管辖的Session数量，可在任意线程调用
+         */
+        size_t get_load() const
+        {
+            return load_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * 累计流量
+         * 只能在此线程中调用
+         * @param bytes 收发的字节数
+         * @param messages 收发的消息数
+         */
+        void add_traffic(size_t bytes, size_t messages)
+        {
+            bytes_total_ += bytes;
+            messages_total_ += messages;
+        }
+
+        /**
+         * 获取最近每秒收发的字节数
+         * 可在任意线程调用
+         */
+        uint64_t get_byte_rate() const
+        {
+            return byte_rate_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * 获取最近每秒收发的消息数
+         * 可在任意线程调用
+         */
+        uint64_t get_message_rate() const
+        {
+            return message_rate_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * 获取繁忙程度
+         * 最近一次采样中线程占用CPU的时间比例（千分比），可在任意线程调用
+         */
+        uint32_t get_busy_ratio() const
+        {
+            return busy_ratio_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * 获取时间轮
+         * 用于Session存活检查、延迟关闭和用户定时器，只能在此线程中使用
+         */
+        TimingWheel& get_timing_wheel()
+        {
+            return timing_wheel_;
+        }
+
+        /**
+         * 获取Session处理器
+         * 只能获取在此线程中运行的SessionHandler
+         */
+        SessionHandlePointer get_session_handler(TCPSessionID id) const;
+
         /**
          * 获取io_service
          */
@@ -85,9 +240,71 @@ namespace eddyserver
         void run();
 
         /**
-         * 检查Session存活
+         * 推进时间轮
+         */
+        void handle_tick(asio::error_code error_code);
+
+        /**
+         * 采样负载
+         * 每秒计算一次收发速率和繁忙程度
+         */
+        void sample_load();
+
+        /**
+         * 添加SessionHandler
+         * 分配的Session ID以线程id为标签，各线程独立分配互不冲突
+         * @param handler_ptr SessionHandler
+         * @param owner Session所属的IO线程id，记入所在线程表
+         * @return Session ID
+         */
+        TCPSessionID add_session_handler(const SessionHandlePointer &handler_ptr, IOThreadID owner);
+
+        /**
+         * 取出SessionHandler
+         * 用于迁移，Session ID仍保留在分配它的线程中
+         */
+        SessionHandlePointer detach_session_handler(TCPSessionID id);
+
+        /**
+         * 放入迁移来的SessionHandler
+         */
+        void attach_session_handler(TCPSessionID id, const SessionHandlePointer &handler_ptr);
+
+        /**
+         * 移除SessionHandler并释放Session ID
+         * 由其它线程分配的Session ID交还给分配它的线程
+         */
+        SessionHandlePointer remove_session_handler(TCPSessionID id);
+
+        /**
+         * 释放Session ID
+         */
+        void release_session_id(TCPSessionID id);
+
+        /**
+         * 处理信箱
+         * 一次取出全部消息批次并分发，分发前把上一批次的列表归还给来源线程
+         */
+        void handle_mailbox();
+
+        /**
+         * 归还消息列表
+         * 可在任意线程调用，已分发的列表保留容量供此线程下一次投递使用
+         */
+        void recycle_message_list(NetMessageVector &&messages);
+
+        /**
+         * 处理广播
+         * 唤醒批次中的Session，并向此线程中的Session ID投递广播帧
+         * 未找到的Session正在迁出，按所在线程表直接转发到新线程
+         */
+        void handle_broadcast(BroadcastBatchPointer batch);
+
+        /**
+         * 发送广播帧到Session
+         * 批次中还没有帧时使用此Session的过滤器编码
          */
-        void check_keep_alive(asio::error_code error_code);
+        void send_broadcast(BroadcastBatch &batch, SessionPointer &session_ptr);
 
     private:
         IOServiceThread(const IOServiceThread&) = delete;
@@ -98,10 +315,29 @@ namespace eddyserver
         IOServiceThreadManager&                 td_manager_;
         asio::io_service                        io_service_;
         asio::steady_timer                      timer_;
-        const WaitHandler                       wait_handler_;
+        HandlerMemory                           tick_memory_;
         std::unique_ptr<std::thread>            thread_;
         std::unique_ptr<asio::io_service::work> io_work_;
         TCPSessionQueue                         session_queue_;
+        TimingWheel                             timing_wheel_;
+        std::atomic<size_t>                     load_;
+        SessionHandlerMap                       session_handlers_;
+        SessionOwnerTable                       session_owners_;
+        MigratedHandlerMap                      migrated_handlers_;
+        MPSCQueue<MessageBatch>                 mailbox_;
+        HandlerMemory                           mailbox_memory_;
+        NetMessageVector                        dispatching_messages_;
+        MPSCQueue<NetMessageVector>             recycled_lists_;
+        std::vector<NetMessageVector>           spare_lists_;
+        uint64_t                                bytes_total_;
+        uint64_t                                messages_total_;
+        uint64_t                                bytes_sampled_;
+        uint64_t                                messages_sampled_;
+        TimingWheel::TimePoint                  sample_time_;
+        std::atomic<uint64_t>                   byte_rate_;
+        std::atomic<uint64_t>                   message_rate_;
+        std::chrono::microseconds               cpu_time_sampled_;
+        std::atomic<uint32_t>                   busy_ratio_;
     };
 }
 
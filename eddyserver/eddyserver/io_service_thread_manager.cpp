@@ -3,6 +3,8 @@
 #include <cassert>
 #include <iostream>
 #include "tcp_session.h"
+#include "load_balancer.h"
+#include "message_filter.h"
 #include "io_service_thread.h"
 #include "tcp_session_handler.h"
 
@@ -11,8 +13,13 @@ namespace eddyserver
     static const size_t kMainThreadIndex = 0;
     static_assert(kMainThreadIndex == 0, "kMainThreadIndex must be greater than 0");
 
-    IOServiceThreadManager::IOServiceThreadManager(size_t thread_num)
-        : id_generator_(1)
+    IOServiceThreadManager::IOServiceThreadManager(size_t thread_num,
+        bool shard_mode,
+        const LoadBalancerPointer &balancer)
+        : shard_mode_(shard_mode)
+        , balancer_(balancer)
+        , rebalance_threshold_(0)
+        , rebalance_interval_(0)
     {
         assert(thread_num > kMainThreadIndex);
         if (thread_num == kMainThreadIndex)
@@ -20,12 +27,33 @@ namespace eddyserver
             throw std::runtime_error("thread number can not be less than 1!");
         }
 
+        // 线程id作为Session ID的标签，每个线程分配互不冲突的Session ID
+        if (thread_num > SlotMap<SessionHandlePointer>::kMaxTag)
+        {
+            throw std::runtime_error("thread number can not be greater than 255!");
+        }
+
         threads_.resize(thread_num);
-        thread_load_.resize(thread_num);
         for (size_t i = 0; i < threads_.size(); ++i)
         {
-            threads_[i] = std::make_shared<IOServiceThread>(i + 1, *this);
+            threads_[i] = std::make_shared<IOServiceThread>(static_cast<IOThreadID>(i + 1), *this);
         }
+
+        // 有IO线程时主线程不管辖Session
+        std::vector<ThreadPointer> candidates;
+        for (size_t i = 0; i < threads_.size(); ++i)
+        {
+            if (i != kMainThreadIndex || threads_.size() == 1)
+            {
+                candidates.push_back(threads_[i]);
+            }
+        }
+
+        if (balancer_ == nullptr)
+        {
+            balancer_ = std::make_shared<LeastSessionsBalancer>();
+        }
+        balancer_->init(candidates);
     }
 
     IOServiceThreadManager::~IOServiceThreadManager()
@@ -84,6 +112,12 @@ namespace eddyserver
         return threads_[kMainThreadIndex];
     }
 
+    // 获取SessionHandler运行的线程
+    ThreadPointer& IOServiceThreadManager::get_handler_thread(ThreadPointer &io_thread)
+    {
+        return shard_mode_ ? io_thread : threads_[kMainThreadIndex];
+    }
+
     // 获取负载最小的线程
     ThreadPointer& IOServiceThreadManager::get_min_load_thread()
     {
@@ -94,25 +128,37 @@ namespace eddyserver
 
         size_t min_load_index = kMainThreadIndex;
         size_t min_load_value = std::numeric_limits<size_t>::max();
-        for (size_t i = 0; i < thread_load_.size(); ++i)
+        for (size_t i = 0; i < threads_.size(); ++i)
         {
-            if (i != kMainThreadIndex && thread_load_[i] < min_load_value)
+            if (i == kMainThreadIndex)
+            {
+                continue;
+            }
+
+            const size_t load = threads_[i]->get_load();
+            if (load < min_load_value)
             {
                 min_load_index = i;
+                min_load_value = load;
             }
         }
         return threads_[min_load_index];
     }
 
+    // 按负载均衡策略选择线程
+    ThreadPointer IOServiceThreadManager::select_thread(const asio::ip::tcp::endpoint *remote_endpoint)
+    {
+        return balancer_->select(remote_endpoint);
+    }
+
     // 根据线程id获取线程
     ThreadPointer IOServiceThreadManager::get_thread(IOThreadID id)
     {
-        for (size_t i = 0; i < threads_.size(); ++i)
+        // 线程id从1开始顺序分配
+        if (id > 0 && id <= threads_.size())
         {
-            if (threads_[i]->get_id() == id)
-            {
-                return threads_[i];
-            }
+            assert(threads_[id - 1]->get_id() == id);
+            return threads_[id - 1];
         }
         return ThreadPointer();
     }
@@ -120,76 +166,338 @@ namespace eddyserver
     // Session连接
     void IOServiceThreadManager::on_session_connected(SessionPointer &session_ptr, SessionHandlePointer &handler_ptr)
     {
-        uint32_t session_id = 0;
-        if (!id_generator_.get(session_id))
+        ThreadPointer &io_thread = session_ptr->get_io_thread();
+        ++io_thread->load_;
+
+        // 保留首个Session的过滤器，供非IO线程广播时编码帧
+        {
+            std::lock_guard<std::mutex> lock(frame_filter_mutex_);
+            if (frame_filter_ == nullptr)
+            {
+                frame_filter_ = session_ptr->get_message_filter();
+            }
+        }
+
+        if (shard_mode_)
         {
-            throw std::runtime_error("generator session id fail!");
+            if (io_thread->running_in_this_thread())
+            {
+                connect_session(session_ptr, handler_ptr);
+            }
+            else
+            {
+                io_thread->post(std::bind(&IOServiceThreadManager::connect_session, this, session_ptr, handler_ptr));
+            }
+        }
+        else if (io_thread->running_in_this_thread() && !get_main_thread()->running_in_this_thread())
+        {
+            // 在IO线程中接受的连接转到主线程处理
+            get_main_thread()->post(std::bind(&IOServiceThreadManager::connect_session, this, session_ptr, handler_ptr));
+        }
+        else
+        {
+            connect_session(session_ptr, handler_ptr);
         }
+    }
+
+    // 连接Session
+    void IOServiceThreadManager::connect_session(SessionPointer session_ptr, SessionHandlePointer handler_ptr)
+    {
+        ThreadPointer &io_thread = session_ptr->get_io_thread();
+        ThreadPointer &handler_thread = get_handler_thread(io_thread);
 
+        TCPSessionID session_id = handler_thread->add_session_handler(handler_ptr, io_thread->get_id());
         handler_ptr->init(session_id,
-            session_ptr->get_io_thread()->get_id(),
+            io_thread->get_id(),
             this,
+            session_ptr,
             session_ptr->get_socket().remote_endpoint());
 
-        session_handler_map_.insert(std::make_pair(session_id, handler_ptr));
-        session_ptr->get_io_thread()->post(std::bind(&TCPSession::init, session_ptr, session_id));
-        handler_ptr->on_connected();
-
-        IOThreadID tid = handler_ptr->get_thread_id();
-        assert(tid > 0 && tid <= thread_load_.size());
-        if (tid > 0 && tid <= thread_load_.size())
+        if (handler_thread == io_thread)
         {
-            ++thread_load_[tid - 1];
+            session_ptr->init(session_id);
         }
+        else
+        {
+            io_thread->post(std::bind(&TCPSession::init, session_ptr, session_id));
+        }
+        handler_ptr->on_connected();
     }
 
     // Session关闭
-    void IOServiceThreadManager::on_session_closed(TCPSessionID id)
+    void IOServiceThreadManager::on_session_closed(TCPSessionID id, IOThreadID tid)
     {
         assert(id > 0);
-        SessionHandlerMap::iterator found = session_handler_map_.find(id);
-        if (found != session_handler_map_.end())
+        ThreadPointer io_thread = get_thread(tid);
+        assert(io_thread != nullptr);
+        if (io_thread == nullptr)
         {
-            SessionHandlePointer handler_ptr = found->second;
-            IOThreadID tid = handler_ptr->get_thread_id();
-            if (handler_ptr != nullptr)
+            return;
+        }
+
+        ThreadPointer &handler_thread = get_handler_thread(io_thread);
+        SessionHandlePointer handler_ptr = handler_thread->remove_session_handler(id);
+        if (handler_ptr != nullptr)
+        {
+            handler_ptr->on_closed();
+            handler_ptr->dispose();
+        }
+
+        assert(io_thread->load_ > 0);
+        --io_thread->load_;
+    }
+
+    // 迁移Session到其它IO线程
+    void IOServiceThreadManager::migrate_session(IOThreadID tid, TCPSessionID id, IOThreadID target_tid)
+    {
+        ThreadPointer source = get_thread(tid);
+        ThreadPointer target = get_thread(target_tid);
+        if (source == nullptr || target == nullptr || source == target)
+        {
+            return;
+        }
+        source->post(std::bind(&IOServiceThreadManager::start_migrate_session, this, source, id, target));
+    }
+
+    // 开始迁移Session
+    void IOServiceThreadManager::start_migrate_session(ThreadPointer source, TCPSessionID id, ThreadPointer target)
+    {
+        SessionPointer session_ptr = source->get_session_queue().get(id);
+        if (session_ptr != nullptr)
+        {
+            session_ptr->migrate(target);
+        }
+    }
+
+    // Session迁移
+    void IOServiceThreadManager::on_session_migrating(TCPSessionID id, ThreadPointer &source, ThreadPointer &target)
+    {
+        assert(source->load_ > 0);
+        --source->load_;
+        ++target->load_;
+
+        if (shard_mode_)
+        {
+            // SessionHandler随Session迁移，先于Session到达目标线程
+            SessionHandlePointer handler_ptr = source->detach_session_handler(id);
+            target->post(std::bind(&IOServiceThreadManager::on_session_migrated, this, id, target->get_id(), handler_ptr));
+        }
+        else
+        {
+            get_main_thread()->post(std::bind(&IOServiceThreadManager::on_session_migrated, this, id, target->get_id(), SessionHandlePointer()));
+        }
+    }
+
+    // 获取Session所属的IO线程id
+    IOThreadID IOServiceThreadManager::get_session_owner(TCPSessionID id) const
+    {
+        const IOThreadID tag = IOServiceThread::SessionHandlerMap::tag_of(id);
+        if (tag == 0 || tag > threads_.size())
+        {
+            return 0;
+        }
+        return threads_[tag - 1]->session_owners_.get(id);
+    }
+
+    // 更新Session所属的IO线程
+    void IOServiceThreadManager::set_session_owner(TCPSessionID id, IOThreadID tid)
+    {
+        const IOThreadID tag = IOServiceThread::SessionHandlerMap::tag_of(id);
+        if (tag > 0 && tag <= threads_.size())
+        {
+            threads_[tag - 1]->session_owners_.update(id, tid);
+        }
+    }
+
+    // Session迁移完成
+    void IOServiceThreadManager::on_session_migrated(TCPSessionID id, IOThreadID tid, SessionHandlePointer handler_ptr)
+    {
+        ThreadPointer io_thread = get_thread(tid);
+        ThreadPointer &handler_thread = get_handler_thread(io_thread);
+        if (handler_ptr != nullptr)
+        {
+            handler_thread->attach_session_handler(id, handler_ptr);
+        }
+        else
+        {
+            handler_ptr = handler_thread->get_session_handler(id);
+        }
+
+        if (handler_ptr != nullptr)
+        {
+            handler_ptr->thread_id_ = tid;
+            handler_ptr->relocate_groups();
+        }
+    }
+
+    // 开启自动均衡
+    void IOServiceThreadManager::enable_auto_rebalance(uint32_t threshold, std::chrono::milliseconds interval)
+    {
+        const bool enabled = rebalance_interval_.count() > 0;
+        rebalance_threshold_ = threshold;
+        rebalance_interval_ = interval.count() > 0 ? interval : std::chrono::milliseconds(1);
+        if (!enabled)
+        {
+            get_main_thread()->post(std::bind(&IOServiceThreadManager::handle_rebalance, this));
+        }
+    }
+
+    // 处理自动均衡
+    void IOServiceThreadManager::handle_rebalance()
+    {
+        get_main_thread()->get_timing_wheel().add(rebalance_interval_,
+            std::bind(&IOServiceThreadManager::handle_rebalance, this));
+
+        // 至少需要两个IO线程
+        if (threads_.size() <= 2)
+        {
+            return;
+        }
+
+        size_t busiest = kMainThreadIndex + 1;
+        size_t idlest = kMainThreadIndex + 1;
+        for (size_t i = kMainThreadIndex + 1; i < threads_.size(); ++i)
+        {
+            if (threads_[i]->get_busy_ratio() > threads_[busiest]->get_busy_ratio())
             {
-                handler_ptr->on_closed();
-                handler_ptr->dispose();
+                busiest = i;
             }
-            session_handler_map_.erase(found);
-
-            assert(tid > 0 && tid <= thread_load_.size());
-            if (tid > 0 && tid <= thread_load_.size())
+            if (threads_[i]->get_busy_ratio() < threads_[idlest]->get_busy_ratio())
             {
-                assert(thread_load_[tid - 1] > 0);
-                if (thread_load_[tid - 1] > 0)
-                {
-                    --thread_load_[tid - 1];
-                }
+                idlest = i;
             }
         }
 
-        if (id > 0)
+        if (threads_[busiest]->get_busy_ratio() - threads_[idlest]->get_busy_ratio() > rebalance_threshold_ &&
+            threads_[busiest]->get_load() > 1)
+        {
+            threads_[busiest]->post(std::bind(&IOServiceThreadManager::rebalance_thread, this, threads_[busiest], threads_[idlest]));
+        }
+    }
+
+    // 均衡线程
+    void IOServiceThreadManager::rebalance_thread(ThreadPointer source, ThreadPointer target)
+    {
+        // 迁移自上次均衡以来流量最大的Session
+        SessionPointer hottest;
+        uint64_t hottest_bytes = 0;
+        source->get_session_queue().for_each([&](const SessionPointer &session_ptr)
+        {
+            const uint64_t bytes = session_ptr->take_recent_bytes();
+            if (bytes > hottest_bytes && !session_ptr->is_migrating())
+            {
+                hottest = session_ptr;
+                hottest_bytes = bytes;
+            }
+        });
+
+        if (hottest != nullptr && source->get_session_queue().size() > 1)
         {
-            id_generator_.put(id);
+            hottest->migrate(target);
         }
     }
 
     // 获取Session数量
     size_t IOServiceThreadManager::get_session_count() const
     {
-        return session_handler_map_.size();
+        size_t count = 0;
+        for (size_t i = 0; i < threads_.size(); ++i)
+        {
+            count += threads_[i]->get_load();
+        }
+        return count;
     }
 
     // 获取Session处理器
     SessionHandlePointer IOServiceThreadManager::get_session_handler(TCPSessionID id) const
     {
-        SessionHandlerMap::const_iterator found = session_handler_map_.find(id);
-        if (found != session_handler_map_.end())
+        return threads_[kMainThreadIndex]->get_session_handler(id);
+    }
+
+    // 广播消息
+    void IOServiceThreadManager::broadcast(const std::vector<TCPSessionID> &session_ids, const NetMessage &message)
+    {
+        if (session_ids.empty() || message.empty())
+        {
+            return;
+        }
+
+        IOServiceThread *current = IOServiceThread::current_thread();
+        if (current != nullptr && &current->get_thread_manager() != this)
         {
-            return found->second;
+            current = nullptr;
+        }
+
+        NetMessage frame;
+        const std::type_info *frame_filter = nullptr;
+        if (current == nullptr)
+        {
+            // 无法访问Session，分组前先编码，避免每个IO线程各自编码一次
+            MessageFilterPointer filter_ptr;
+            {
+                std::lock_guard<std::mutex> lock(frame_filter_mutex_);
+                filter_ptr = frame_filter_;
+            }
+            if (filter_ptr != nullptr && filter_ptr->write_frame(message, frame))
+            {
+                frame_filter = &typeid(*filter_ptr);
+            }
+        }
+
+        std::vector<IOServiceThread::BroadcastBatchPointer> batches(threads_.size());
+        for (size_t i = 0; i < session_ids.size(); ++i)
+        {
+            const TCPSessionID id = session_ids[i];
+            SessionPointer session_ptr;
+            SessionHandlePointer handler_ptr = current != nullptr ? current->get_session_handler(id) : SessionHandlePointer();
+            if (handler_ptr != nullptr)
+            {
+                session_ptr = handler_ptr->session_.lock();
+                if (session_ptr == nullptr)
+                {
+                    continue;
+                }
+
+                session_ptr->write_frame(message, frame, frame_filter);
+
+                // 经由信箱发送，保证与send投递的消息顺序一致
+                if (!session_ptr->push_frame(message, frame, frame_filter))
+                {
+                    continue;
+                }
+            }
+
+            const IOThreadID tid = session_ptr != nullptr ?
+                session_ptr->get_owner_thread()->get_id() : get_session_owner(id);
+            if (tid == 0 || tid > threads_.size())
+            {
+                continue;
+            }
+
+            IOServiceThread::BroadcastBatchPointer &batch = batches[tid - 1];
+            if (batch == nullptr)
+            {
+                batch = std::make_shared<IOServiceThread::BroadcastBatch>(message);
+            }
+
+            if (session_ptr != nullptr)
+            {
+                batch->sessions.push_back(std::move(session_ptr));
+            }
+            else
+            {
+                batch->session_ids.push_back(id);
+            }
+        }
+
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            if (batches[i] != nullptr)
+            {
+                batches[i]->frame = frame;
+                batches[i]->frame_filter = frame_filter;
+                threads_[i]->post(std::bind(&IOServiceThread::handle_broadcast, threads_[i].get(), batches[i]));
+            }
         }
-        return SessionHandlePointer();
     }
 }
@@ -1,19 +1,28 @@
 ﻿#ifndef __IO_SERVICE_THREAD_MANAGER_H__
 #define __IO_SERVICE_THREAD_MANAGER_H__
 
+#include <mutex>
 #include <vector>
-#include <unordered_map>
+#include <chrono>
+#include <asio/ip/tcp.hpp>
 #include "types.h"
-#include "id_generator.h"
 
 namespace eddyserver
 {
+    class NetMessage;
+
     class IOServiceThreadManager final
     {
-        typedef std::unordered_map<TCPSessionID, SessionHandlePointer> SessionHandlerMap;
-
     public:
-        explicit IOServiceThreadManager(size_t thread_num = 1);
+        /**
+         * 构造函数
+         * @param thread_num 线程数量
+         * @param shard_mode 分片模式，SessionHandler在其Session所属的IO线程中运行
+         * @param balancer 负载均衡策略，为空时使用LeastSessionsBalancer
+         */
+        explicit IOServiceThreadManager(size_t thread_num = 1,
+            bool shard_mode = false,
+            const LoadBalancerPointer &balancer = LoadBalancerPointer());
 
         ~IOServiceThreadManager();
 
@@ -28,16 +37,52 @@ namespace eddyserver
          */
         void stop();
 
+        /**
+         * 是否为分片模式
+         */
+        bool is_shard_mode() const
+        {
+            return shard_mode_;
+        }
+
+        /**
+         * 获取线程数量
+         */
+        size_t get_thread_count() const
+        {
+            return threads_.size();
+        }
+
         /**
          * 获取主线程
          */
         ThreadPointer& get_main_thread();
 
+        /**
+         * 获取SessionHandler运行的线程
+         * @param io_thread Session所属的IO线程
+         */
+        ThreadPointer& get_handler_thread(ThreadPointer &io_thread);
+
         /**
          * 获取负载最小的线程
          */
         ThreadPointer& get_min_load_thread();
 
+        /**
+         * 获取负载均衡策略
+         */
+        const LoadBalancerPointer& get_load_balancer() const
+        {
+            return balancer_;
+        }
+
+        /**
+         * 按负载均衡策略为新Session选择线程
+         * @param remote_endpoint 对端地址，未知时为nullptr
+         */
+        ThreadPointer select_thread(const asio::ip::tcp::endpoint *remote_endpoint = nullptr);
+
         /**
          * 根据线程id获取线程
          */
@@ -45,13 +90,59 @@ namespace eddyserver
 
         /**
          * Session连接
+         * 在IO线程中接受的连接会转到SessionHandler运行的线程处理
          */
         void on_session_connected(SessionPointer &session_ptr, SessionHandlePointer &handler);
 
         /**
          * Session关闭
+         * 在SessionHandler运行的线程中调用
+         * @param id Session ID
+         * @param tid Session所属的IO线程id
          */
-        void on_session_closed(TCPSessionID id);
+        void on_session_closed(TCPSessionID id, IOThreadID tid);
+
+        /**
+         * 迁移Session到其它IO线程
+         * 可在任意线程调用，socket、缓存、定时器和队列位置转移到目标线程，不丢失数据
+         * 分片模式下SessionHandler一同迁移，tid与Session当前所属线程不符时忽略
+         * @param tid Session当前所属的IO线程id
+         * @param id Session ID
+         * @param target_tid 目标IO线程id
+         */
+        void migrate_session(IOThreadID tid, TCPSessionID id, IOThreadID target_tid);
+
+        /**
+         * Session迁移
+         * 在Session原IO线程中调用
+         * @param id Session ID
+         * @param source 原IO线程
+         * @param target 目标IO线程
+         */
+        void on_session_migrating(TCPSessionID id, ThreadPointer &source, ThreadPointer &target);
+
+        /**
+         * 获取Session所属的IO线程id
+         * 可在任意线程调用，查询分配Session ID的线程记录的所在线程表
+         * @return Session已关闭或ID无效时返回0
+         */
+        IOThreadID get_session_owner(TCPSessionID id) const;
+
+        /**
+         * 更新Session所属的IO线程
+         * 在Session原IO线程中调用，需在Session迁移完成的请求投递到目标线程之后
+         */
+        void set_session_owner(TCPSessionID id, IOThreadID tid);
+
+        /**
+         * 开启自动均衡
+         * 定期比较IO线程的繁忙程度，差值超过阈值时将最繁忙线程中流量最大的Session迁移到最空闲的线程
+         * 在run之前调用
+         * @param threshold 繁忙程度差值阈值（千分比）
+         * @param interval 检查间隔
+         */
+        void enable_auto_rebalance(uint32_t threshold = 200,
+            std::chrono::milliseconds interval = std::chrono::milliseconds(5000));
 
         /**
          * 获取Session数量
@@ -60,18 +151,63 @@ namespace eddyserver
 
         /**
          * 获取Session处理器
+         * 只能获取在主线程中运行的SessionHandler
          */
         SessionHandlePointer get_session_handler(TCPSessionID id) const;
 
+        /**
+         * 广播消息
+         * 消息只编码一次，按Session所属的IO线程分组，每个线程投递一个批次，各Session发送同一份帧
+         * 在SessionHandler运行的线程中调用时经由Session的发送信箱，否则按所在线程表直接投递到Session所属的线程
+         * 不在IO线程中调用时使用首个连接的Session的过滤器编码，同类过滤器的Session共享此帧
+         * @param session_ids Session ID列表
+         * @param message 消息
+         */
+        void broadcast(const std::vector<TCPSessionID> &session_ids, const NetMessage &message);
+
+    private:
+        /**
+         * 连接Session
+         * 在SessionHandler运行的线程中调用
+         */
+        void connect_session(SessionPointer session_ptr, SessionHandlePointer handler_ptr);
+
+        /**
+         * 开始迁移Session
+         * 在Session原IO线程中调用
+         */
+        void start_migrate_session(ThreadPointer source, TCPSessionID id, ThreadPointer target);
+
+        /**
+         * Session迁移完成
+         * 在SessionHandler运行的线程中调用，更新SessionHandler所属的线程
+         */
+        void on_session_migrated(TCPSessionID id, IOThreadID tid, SessionHandlePointer handler_ptr);
+
+        /**
+         * 处理自动均衡
+         * 在主线程中定期调用
+         */
+        void handle_rebalance();
+
+        /**
+         * 均衡线程
+         * 在原IO线程中调用，迁移流量最大的Session
+         */
+        void rebalance_thread(ThreadPointer source, ThreadPointer target);
+
     private:
         IOServiceThreadManager(const IOServiceThreadManager&) = delete;
         IOServiceThreadManager& operator= (const IOServiceThreadManager&) = delete;
 
     private:
+        const bool                  shard_mode_;
         std::vector<ThreadPointer>  threads_;
-        std::vector<size_t>         thread_load_;
-        SessionHandlerMap           session_handler_map_;
-        IDGenerator<uint32_t>       id_generator_;
+        LoadBalancerPointer         balancer_;
+        uint32_t                    rebalance_threshold_;
+        std::chrono::milliseconds   rebalance_interval_;
+        std::mutex                  frame_filter_mutex_;
+        MessageFilterPointer        frame_filter_;
     };
 }
 
@@ -0,0 +1,173 @@
+﻿#include "load_balancer.h"
+#include <random>
+#include <limits>
+#include <cassert>
+#include <algorithm>
+#include "io_service_thread.h"
+
+namespace eddyserver
+{
+    namespace balancer_stuff
+    {
+        /**
+         * FNV-1a哈希
+         */
+        inline uint32_t Hash(const uint8_t *data, size_t size)
+        {
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash ^= data[i];
+                hash *= 16777619u;
+            }
+
+            // 打散低位，使环上的节点分布更均匀
+            hash ^= hash >> 16;
+            hash *= 0x85ebca6bu;
+            hash ^= hash >> 13;
+            hash *= 0xc2b2ae35u;
+            hash ^= hash >> 16;
+            return hash;
+        }
+
+        /**
+         * 地址哈希
+         * 只使用IP地址，同一主机的不同端口落在同一线程
+         */
+        inline uint32_t Hash(const asio::ip::address &address)
+        {
+            if (address.is_v4())
+            {
+                const asio::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+                return Hash(bytes.data(), bytes.size());
+            }
+            const asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+            return Hash(bytes.data(), bytes.size());
+        }
+
+        /**
+         * 选择Session最少的线程
+         */
+        inline const ThreadPointer& LeastSessions(const std::vector<ThreadPointer> &threads)
+        {
+            assert(!threads.empty());
+            size_t min_load_index = 0;
+            size_t min_load_value = std::numeric_limits<size_t>::max();
+            for (size_t i = 0; i < threads.size(); ++i)
+            {
+                const size_t load = threads[i]->get_load();
+                if (load < min_load_value)
+                {
+                    min_load_index = i;
+                    min_load_value = load;
+                }
+            }
+            return threads[min_load_index];
+        }
+
+        /**
+         * 线程局部随机数生成器
+         */
+        inline std::minstd_rand& RandomEngine()
+        {
+            thread_local std::minstd_rand engine(std::random_device{}());
+            return engine;
+        }
+    }
+
+    // 初始化
+    void LoadBalancer::init(const std::vector<ThreadPointer> &threads)
+    {
+        threads_ = threads;
+    }
+
+    // 最少Session
+    ThreadPointer LeastSessionsBalancer::select(const asio::ip::tcp::endpoint *remote_endpoint)
+    {
+        return balancer_stuff::LeastSessions(threads_);
+    }
+
+    LeastTrafficBalancer::LeastTrafficBalancer(Metric metric)
+        : metric_(metric)
+    {
+    }
+
+    // 最低流量
+    ThreadPointer LeastTrafficBalancer::select(const asio::ip::tcp::endpoint *remote_endpoint)
+    {
+        assert(!threads_.empty());
+        size_t min_index = 0;
+        std::pair<uint64_t, size_t> min_value(std::numeric_limits<uint64_t>::max(), std::numeric_limits<size_t>::max());
+        for (size_t i = 0; i < threads_.size(); ++i)
+        {
+            const uint64_t rate = metric_ == kBytes ? threads_[i]->get_byte_rate() : threads_[i]->get_message_rate();
+            const std::pair<uint64_t, size_t> value(rate, threads_[i]->get_load());
+            if (value < min_value)
+            {
+                min_index = i;
+                min_value = value;
+            }
+        }
+        return threads_[min_index];
+    }
+
+    // 二选一
+    ThreadPointer PowerOfTwoChoicesBalancer::select(const asio::ip::tcp::endpoint *remote_endpoint)
+    {
+        assert(!threads_.empty());
+        if (threads_.size() == 1)
+        {
+            return threads_.front();
+        }
+
+        std::minstd_rand &engine = balancer_stuff::RandomEngine();
+        const size_t first = engine() % threads_.size();
+        size_t second = engine() % (threads_.size() - 1);
+        if (second >= first)
+        {
+            ++second;
+        }
+        return threads_[first]->get_load() <= threads_[second]->get_load() ? threads_[first] : threads_[second];
+    }
+
+    ConsistentHashBalancer::ConsistentHashBalancer(size_t virtual_nodes)
+        : virtual_nodes_(virtual_nodes > 0 ? virtual_nodes : 1)
+    {
+    }
+
+    // 初始化哈希环
+    void ConsistentHashBalancer::init(const std::vector<ThreadPointer> &threads)
+    {
+        LoadBalancer::init(threads);
+
+        ring_.clear();
+        ring_.reserve(threads_.size() * virtual_nodes_);
+        for (size_t i = 0; i < threads_.size(); ++i)
+        {
+            for (uint32_t replica = 0; replica < virtual_nodes_; ++replica)
+            {
+                const uint32_t key[2] = { threads_[i]->get_id(), replica };
+                ring_.push_back(std::make_pair(balancer_stuff::Hash(reinterpret_cast<const uint8_t*>(key), sizeof(key)), i));
+            }
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+
+    // 一致性哈希
+    ThreadPointer ConsistentHashBalancer::select(const asio::ip::tcp::endpoint *remote_endpoint)
+    {
+        if (remote_endpoint == nullptr || ring_.empty())
+        {
+            return balancer_stuff::LeastSessions(threads_);
+        }
+
+        const uint32_t hash = balancer_stuff::Hash(remote_endpoint->address());
+        std::vector<std::pair<uint32_t, size_t>>::const_iterator found =
+            std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(hash, size_t(0)));
+        if (found == ring_.end())
+        {
+            found = ring_.begin();
+        }
+        return threads_[found->second];
+    }
+}
@@ -0,0 +1,121 @@
+﻿#ifndef __LOAD_BALANCER_H__
+#define __LOAD_BALANCER_H__
+
+#include <vector>
+#include <utility>
+#include <asio/ip/tcp.hpp>
+#include "types.h"
+
+namespace eddyserver
+{
+    /**
+     * 负载均衡策略
+     * 为新Session选择所属的IO线程
+     */
+    class LoadBalancer
+    {
+    public:
+        virtual ~LoadBalancer() = default;
+
+    public:
+        /**
+         * 初始化
+         * 由线程管理器调用，设置候选线程
+         * @param threads 候选线程列表
+         */
+        virtual void init(const std::vector<ThreadPointer> &threads);
+
+        /**
+         * 是否需要对端地址
+         * 需要时TCPServer先在主线程接受连接，再选择线程
+         */
+        virtual bool needs_remote_endpoint() const
+        {
+            return false;
+        }
+
+        /**
+         * 选择线程
+         * 可在任意线程调用
+         * @param remote_endpoint 对端地址，未知时为nullptr
+         */
+        virtual ThreadPointer select(const asio::ip::tcp::endpoint *remote_endpoint) = 0;
+
+    protected:
+        std::vector<ThreadPointer> threads_;
+    };
+
+    /**
+     * 最少Session
+     */
+    class LeastSessionsBalancer : public LoadBalancer
+    {
+    public:
+        virtual ThreadPointer select(const asio::ip::tcp::endpoint *remote_endpoint) override;
+    };
+
+    /**
+     * 最低流量
+     * 按线程最近每秒的字节数或消息数选择，相同时选择Session最少的线程
+     */
+    class LeastTrafficBalancer : public LoadBalancer
+    {
+    public:
+        enum Metric
+        {
+            kBytes,
+            kMessages,
+        };
+
+    public:
+        explicit LeastTrafficBalancer(Metric metric = kBytes);
+
+    public:
+        virtual ThreadPointer select(const asio::ip::tcp::endpoint *remote_endpoint) override;
+
+    private:
+        const Metric metric_;
+    };
+
+    /**
+     * 二选一
+     * 随机选择两个线程，取Session较少的一个
+     * 不需要遍历全部线程，也避免大量连接同时涌向同一线程
+     */
+    class PowerOfTwoChoicesBalancer : public LoadBalancer
+    {
+    public:
+        virtual ThreadPointer select(const asio::ip::tcp::endpoint *remote_endpoint) override;
+    };
+
+    /**
+     * 一致性哈希
+     * 按对端IP地址选择线程，同一地址的连接落在同一线程
+     * 对端地址未知时选择Session最少的线程
+     */
+    class ConsistentHashBalancer : public LoadBalancer
+    {
+    public:
+        /**
+         * 构造函数
+         * @param virtual_nodes 每个线程的虚拟节点数量
+         */
+        explicit ConsistentHashBalancer(size_t virtual_nodes = 64);
+
+    public:
+        virtual void init(const std::vector<ThreadPointer> &threads) override;
+
+        virtual bool needs_remote_endpoint() const override
+        {
+            return true;
+        }
+
+        virtual ThreadPointer select(const asio::ip::tcp::endpoint *remote_endpoint) override;
+
+    private:
+        const size_t                                virtual_nodes_;
+        std::vector<std::pair<uint32_t, size_t>>    ring_;
+    };
+}
+
+#endif
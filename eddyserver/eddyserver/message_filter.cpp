@@ -1,18 +1,26 @@
 ﻿#include "message_filter.h"
 #include <numeric>
+#include <cstring>
 #include <asio/ip/address_v4.hpp>
 #include "net_message.h"
 
 namespace eddyserver
 {
-    MessageFilter::MessageFilter()
-        : header_read_(false)
+    MessageFilter::MessageFilter(bool streaming)
+        : header_(0)
+        , header_read_(false)
+        , error_(false)
+        , streaming_(streaming)
     {
     }
 
     // 获取欲读取数据大小
     size_t MessageFilter::bytes_wanna_read()
     {
+        if (streaming_)
+        {
+            return MessageFilterInterface::stream_bytes();
+        }
         return header_read_ ? header_ : MessageFilter::header_size;
     }
 
@@ -23,9 +31,9 @@ namespace eddyserver
         {
             return 0;
         }
-        return std::accumulate(messages_to_be_sent.begin(), messages_to_be_sent.end(), 0, [](size_t sum, const NetMessage &message)
+        return std::accumulate(messages_to_be_sent.begin(), messages_to_be_sent.end(), size_t(0), [](size_t sum, const NetMessage &message)
         {
-            return sum + MessageFilter::header_size + message.readable();
+            return message.readable() > kMaxMessageSize ? sum : sum + MessageFilter::header_size + message.readable();
         });
     }
 
@@ -49,6 +57,29 @@ namespace eddyserver
         }
     }
 
+    // 流式读取数据
+    size_t MessageFilter::read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+    {
+        size_t bytes = 0;
+        while (size - bytes >= MessageFilter::header_size)
+        {
+            MessageHeader header = 0;
+            memcpy(&header, data + bytes, MessageFilter::header_size);
+            header = ntohs(header);
+            if (size - bytes - MessageFilter::header_size < header)
+            {
+                break;
+            }
+
+            bytes += MessageFilter::header_size;
+            NetMessage new_message(header);
+            new_message.write(data + bytes, header);
+            messages_received.push_back(std::move(new_message));
+            bytes += header;
+        }
+        return bytes;
+    }
+
     // 写入数据
     size_t MessageFilter::write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer)
     {
@@ -56,6 +87,12 @@ namespace eddyserver
         for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
         {
             const NetMessage &message = messages_to_be_sent[i];
+            if (message.readable() > kMaxMessageSize)
+            {
+                error_ = true;
+                continue;
+            }
+
             MessageHeader header = htons(static_cast<MessageHeader>(message.readable()));
             buffer.insert(buffer.end(),
                 reinterpret_cast<const uint8_t*>(&header),
@@ -65,4 +102,100 @@ namespace eddyserver
         }
         return bytes;
     }
+
+    // 是否可以在消息体前直接写入消息头
+    bool MessageFilter::in_place(const NetMessage &message)
+    {
+        return message.prependable() >= MessageFilter::header_size && !message.is_shared();
+    }
+
+    // 聚集写入数据
+    size_t MessageFilter::write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+    {
+        // 先确定缓存区大小，避免写入过程中重新分配导致缓冲区失效
+        size_t headers_size = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            const NetMessage &message = messages_to_be_sent[i];
+            if (message.readable() > kMaxMessageSize)
+            {
+                continue;
+            }
+
+            if (message.readable() < kGatherThreshold)
+            {
+                headers_size += MessageFilter::header_size + message.readable();
+            }
+            else if (!in_place(message))
+            {
+                headers_size += MessageFilter::header_size;
+            }
+        }
+        headers.resize(headers_size);
+
+        size_t bytes = 0;
+        size_t offset = 0;
+        size_t chunk_begin = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            NetMessage &message = messages_to_be_sent[i];
+            const NetMessage &content = message;
+            if (message.readable() > kMaxMessageSize)
+            {
+                error_ = true;
+                continue;
+            }
+
+            MessageHeader header = htons(static_cast<MessageHeader>(message.readable()));
+            bytes += MessageFilter::header_size + message.readable();
+
+            if (message.readable() >= kGatherThreshold && in_place(message))
+            {
+                // 消息头直接写入消息体前的头部空间，整条消息作为一个缓冲区
+                message.prepend(&header, MessageFilter::header_size);
+                if (offset > chunk_begin)
+                {
+                    buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                    chunk_begin = offset;
+                }
+                buffers.push_back(asio::buffer(content.data(), content.readable()));
+                continue;
+            }
+
+            memcpy(headers.data() + offset, &header, MessageFilter::header_size);
+            offset += MessageFilter::header_size;
+
+            if (message.readable() < kGatherThreshold)
+            {
+                memcpy(headers.data() + offset, content.data(), content.readable());
+                offset += content.readable();
+            }
+            else
+            {
+                buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                buffers.push_back(asio::buffer(content.data(), content.readable()));
+                chunk_begin = offset;
+            }
+        }
+
+        if (offset > chunk_begin)
+        {
+            buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+        }
+        return bytes;
+    }
+
+    // 编码广播帧
+    bool MessageFilter::write_frame(const NetMessage &message, NetMessage &frame) const
+    {
+        if (message.readable() > kMaxMessageSize)
+        {
+            return false;
+        }
+
+        MessageHeader header = htons(static_cast<MessageHeader>(message.readable()));
+        frame = message;
+        frame.prepend(&header, MessageFilter::header_size);
+        return true;
+    }
 }
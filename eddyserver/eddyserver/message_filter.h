@@ -5,10 +5,12 @@
 #include <vector>
 #include <cstdint>
 #include <cstddef>
+#include <asio/buffer.hpp>
 
 namespace eddyserver
 {
     class NetMessage;
+    class ChainedMessage;
 
     /**
      * 消息过滤器接口
@@ -17,6 +19,7 @@ namespace eddyserver
     {
     public:
         typedef std::vector<uint8_t> ByteArrray;
+        typedef std::vector<asio::const_buffer> BufferSequence;
 
     public:
         MessageFilterInterface() = default;
@@ -30,6 +33,15 @@ namespace eddyserver
             return std::numeric_limits<size_t>::max();
         }
 
+        /**
+         * 表示流式读取
+         * Session将数据批量读入接收缓存，由read_stream一次解析所有完整消息
+         */
+        static size_t stream_bytes()
+        {
+            return std::numeric_limits<size_t>::max() - 1;
+        }
+
     public:
         /**
          * 获取欲读取数据大小
@@ -51,6 +63,19 @@ namespace eddyserver
          */
         virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received) = 0;
 
+        /**
+         * 流式读取数据
+         * 解析data中所有完整的消息，不完整的消息由Session保留到下次读取
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+        {
+            return 0;
+        }
+
         /**
          * 写入数据
          * 将param1 messages_to_be_sent的消息列表写入param2 buffer中
@@ -60,6 +85,87 @@ namespace eddyserver
          */
         virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer) = 0;
 
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const
+        {
+            return false;
+        }
+
+        /**
+         * 聚集写入数据
+         * 消息头写入param2 headers，消息体不拷贝，由param3 buffers按顺序引用
+         * 独占缓冲块的消息可通过NetMessage::prepend直接在消息体前写入消息头
+         * 写入完成前messages_to_be_sent和headers必须保持不变
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+        {
+            return 0;
+        }
+
+        /**
+         * 编码广播帧
+         * 将一条消息编码为可直接发送的字节，广播时使用同类过滤器的Session共享同一帧
+         * 帧只能依赖消息内容，不能读写过滤器状态，可能在任意线程调用
+         * @param message 消息
+         * @param frame 编码后的帧
+         * @return 是否支持，不支持时广播逐个Session写入
+         */
+        virtual bool write_frame(const NetMessage &message, NetMessage &frame) const
+        {
+            return false;
+        }
+
+        /**
+         * 取出读取完成的链式消息
+         * 超过单个缓冲块的消息由read_stream逐块读入链式消息，读完一条后read_stream立即返回
+         * Session取出后从返回的位置继续解析
+         * @param message 链式消息
+         * @return 是否有读取完成的链式消息
+         */
+        virtual bool take_chained_message(ChainedMessage &message)
+        {
+            return false;
+        }
+
+        /**
+         * 编码链式消息的消息头
+         * 消息体各块不拷贝，由Session紧跟在消息头后发送
+         * 只能依赖消息内容，不能读写过滤器状态
+         * @param message 链式消息
+         * @param header 编码后的消息头
+         * @return 是否支持，不支持时合并为连续的消息发送
+         */
+        virtual bool write_chain_header(const ChainedMessage &message, NetMessage &header) const
+        {
+            return false;
+        }
+
+        /**
+         * 是否需要重新解析已接收的数据
+         * 写入改变了读取的协议且有暂缓解析的数据时返回true并重置，如HTTP升级为WebSocket
+         * Session在写入完成后取消读操作，重新解析缓存中尚未解析的数据，不必等待新的数据到达
+         */
+        virtual bool take_read_resumed()
+        {
+            return false;
+        }
+
+        /**
+         * 是否出错
+         * 读取到无法解析或违反协议的数据时返回true，Session分发已读取的消息后关闭连接
+         * 写入无法编码的消息时返回true，Session发送已编码的消息后关闭连接
+         */
+        virtual bool has_error() const
+        {
+            return false;
+        }
+
     private:
         MessageFilterInterface(const MessageFilterInterface&) = delete;
         MessageFilterInterface& operator= (const MessageFilterInterface&) = delete;
@@ -67,6 +173,8 @@ namespace eddyserver
 
     /**
      * 消息过滤器默认实现
+     * 消息头为2字节长度，消息体不能超过65535字节，更大的消息使用VarintMessageFilter（见basic_message_filter.h）
+     * 写入超过65535字节的消息时丢弃该消息并标记出错，不会截断长度破坏后续消息的边界
      */
     class MessageFilter : public MessageFilterInterface
     {
@@ -74,8 +182,18 @@ namespace eddyserver
         typedef uint16_t MessageHeader;
         static const size_t header_size = sizeof(MessageHeader);
 
+        /* 聚集写入时小于此大小的消息体直接拷贝到消息头缓存区，不小于时优先在消息体前写入消息头 */
+        static const size_t kGatherThreshold = 256;
+
+        /* 消息体最大长度 */
+        static const size_t kMaxMessageSize = 0xFFFF;
+
     public:
-        MessageFilter();
+        /**
+         * 构造函数
+         * @param streaming 是否使用流式读取
+         */
+        explicit MessageFilter(bool streaming = false);
 
     public:
         /**
@@ -98,6 +216,16 @@ namespace eddyserver
          */
         virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received);
 
+        /**
+         * 流式读取数据
+         * 解析data中所有完整的消息，不完整的消息由Session保留到下次读取
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received);
+
         /**
          * 写入数据
          * 将param1 messages_to_be_sent的消息列表写入param2 buffer中
@@ -107,9 +235,55 @@ namespace eddyserver
          */
         virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer);
 
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const
+        {
+            return true;
+        }
+
+        /**
+         * 聚集写入数据
+         * 消息头写入param2 headers，消息体不拷贝，由param3 buffers按顺序引用
+         * 独占缓冲块的消息可通过NetMessage::prepend直接在消息体前写入消息头
+         * 写入完成前messages_to_be_sent和headers必须保持不变
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers);
+
+        /**
+         * 编码广播帧
+         * 将一条消息编码为可直接发送的字节，广播时使用同类过滤器的Session共享同一帧
+         * @param message 消息
+         * @param frame 编码后的帧
+         * @return 是否支持，消息超长时不支持，由各Session写入时丢弃
+         */
+        virtual bool write_frame(const NetMessage &message, NetMessage &frame) const;
+
+        /**
+         * 是否出错
+         * 写入过超长的消息时返回true
+         */
+        virtual bool has_error() const
+        {
+            return error_;
+        }
+
+    private:
+        /**
+         * 是否可以在消息体前直接写入消息头
+         */
+        static bool in_place(const NetMessage &message);
+
     private:
         MessageHeader		header_;
         bool				header_read_;
+        bool                error_;
+        const bool          streaming_;
     };
 }
 
@@ -0,0 +1,125 @@
+﻿#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <new>
+#include <atomic>
+#include <utility>
+#include <cstddef>
+#include "buffer_pool.h"
+
+namespace eddyserver
+{
+    /**
+     * 无锁多生产者单消费者队列
+     * 生产者以CAS入队，消费者一次取出全部元素
+     * 节点从BufferPool分配，释放后归还给入队的线程复用，稳定状态下入队不分配内存
+     */
+    template <typename T>
+    class MPSCQueue final
+    {
+        struct Node
+        {
+            T       value;
+            Node*   next;
+
+            template <typename U>
+            explicit Node(U &&v)
+                : value(std::forward<U>(v))
+                , next(nullptr)
+            {
+            }
+        };
+
+        static_assert(alignof(Node) <= alignof(BufferBlock), "node must fit the alignment of pooled blocks");
+
+    public:
+        MPSCQueue()
+            : head_(nullptr)
+        {
+        }
+
+        ~MPSCQueue()
+        {
+            consume_all([](T&) {});
+        }
+
+    public:
+        /**
+         * 是否为空
+         */
+        bool empty() const
+        {
+            return head_.load(std::memory_order_acquire) == nullptr;
+        }
+
+        /**
+         * 入队
+         * 可在任意线程调用
+         * @return 队列是否由空变为非空
+         */
+        template <typename U>
+        bool push(U &&value)
+        {
+            Node *node = new (BufferPool::allocate(sizeof(Node))->data()) Node(std::forward<U>(value));
+            Node *head = head_.load(std::memory_order_relaxed);
+            do
+            {
+                node->next = head;
+            } while (!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+            return head == nullptr;
+        }
+
+        /**
+         * 取出全部元素
+         * 可在任意线程调用，按入队顺序回调，多个线程同时调用时各自取出不同的元素
+         * 元素移出后先释放节点再回调，回调中引发的下一次入队可以复用刚释放的节点
+         * @param cb 回调函数
+         * @return 元素数量
+         */
+        template <typename Function>
+        size_t consume_all(Function &&cb)
+        {
+            Node *head = head_.exchange(nullptr, std::memory_order_acquire);
+
+            Node *first = nullptr;
+            while (head != nullptr)
+            {
+                Node *next = head->next;
+                head->next = first;
+                first = head;
+                head = next;
+            }
+
+            size_t count = 0;
+            while (first != nullptr)
+            {
+                Node *next = first->next;
+                T value(std::move(first->value));
+                destroy(first);
+                cb(value);
+                first = next;
+                ++count;
+            }
+            return count;
+        }
+
+    private:
+        /**
+         * 销毁节点，缓冲块归还给分配它的线程
+         */
+        static void destroy(Node *node)
+        {
+            node->~Node();
+            BufferPool::release(reinterpret_cast<BufferBlock*>(node) - 1);
+        }
+
+    private:
+        MPSCQueue(const MPSCQueue&) = delete;
+        MPSCQueue& operator= (const MPSCQueue&) = delete;
+
+    private:
+        std::atomic<Node*> head_;
+    };
+}
+
+#endif
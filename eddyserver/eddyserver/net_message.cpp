@@ -3,82 +3,74 @@
 namespace eddyserver
 {
     NetMessage::NetMessage()
-        : reader_pos_(0)
+        : buffer_(nullptr)
+        , reader_pos_(0)
         , writer_pos_(0)
-        , is_dynmic_(false)
     {
     }
 
     NetMessage::NetMessage(size_t size)
-        : reader_pos_(0)
+        : buffer_(nullptr)
+        , reader_pos_(0)
         , writer_pos_(0)
-        , is_dynmic_(false)
     {
         ensure_writable_bytes(size);
     }
 
+    NetMessage::NetMessage(size_t size, size_t headroom)
+        : buffer_(nullptr)
+        , reader_pos_(0)
+        , writer_pos_(0)
+    {
+        make_space(headroom, size);
+    }
+
     NetMessage::NetMessage(const char *data, size_t size)
-        : reader_pos_(0)
+        : buffer_(nullptr)
+        , reader_pos_(0)
         , writer_pos_(0)
-        , is_dynmic_(false)
     {
         write(data, size);
     }
 
     NetMessage::NetMessage(const NetMessage &other)
-        : is_dynmic_(other.is_dynmic())
+        : buffer_(other.buffer_)
         , reader_pos_(other.reader_pos_)
         , writer_pos_(other.writer_pos_)
     {
-        if (!other.is_dynmic())
-        {
-            memcpy(static_data_, other.static_data_, kDynamicThreshold);
-        }
-        else
+        if (buffer_ != nullptr)
         {
-            dynamic_data_ = std::make_unique<DynamicVector>();
-            *dynamic_data_ = *other.dynamic_data_;
+            BufferPool::retain(buffer_);
         }
     }
 
     NetMessage::NetMessage(NetMessage &&other)
-        : is_dynmic_(other.is_dynmic_)
+        : buffer_(other.buffer_)
         , reader_pos_(other.reader_pos_)
         , writer_pos_(other.writer_pos_)
     {
-        if (!other.is_dynmic())
-        {
-            memcpy(static_data_, other.static_data_, kDynamicThreshold);
-        }
-        else
-        {
-            dynamic_data_ = std::move(other.dynamic_data_);
-        }
-
+        other.buffer_ = nullptr;
         other.reader_pos_ = 0;
         other.writer_pos_ = 0;
-        other.is_dynmic_ = false;
+    }
+
+    NetMessage::~NetMessage()
+    {
+        release();
     }
 
     NetMessage& NetMessage::operator= (NetMessage &&rhs)
     {
         if (std::addressof(rhs) != this)
         {
-            is_dynmic_ = rhs.is_dynmic();
+            release();
+            buffer_ = rhs.buffer_;
             reader_pos_ = rhs.reader_pos_;
             writer_pos_ = rhs.writer_pos_;
-            if (!rhs.is_dynmic())
-            {
-                memcpy(static_data_, rhs.static_data_, kDynamicThreshold);
-            }
-            else
-            {
-                dynamic_data_ = std::move(rhs.dynamic_data_);
-            }
 
+            rhs.buffer_ = nullptr;
             rhs.reader_pos_ = 0;
             rhs.writer_pos_ = 0;
-            rhs.is_dynmic_ = false;
         }
         return *this;
     }
@@ -87,21 +79,14 @@ namespace eddyserver
     {
         if (std::addressof(rhs) != this)
         {
-            is_dynmic_ = rhs.is_dynmic();
-            reader_pos_ = rhs.reader_pos_;
-            writer_pos_ = rhs.writer_pos_;
-            if (!rhs.is_dynmic())
+            if (rhs.buffer_ != nullptr)
             {
-                memcpy(static_data_, rhs.static_data_, kDynamicThreshold);
-            }
-            else
-            {          
-                if (dynamic_data_ == nullptr)
-                {
-                    dynamic_data_ = std::make_unique<DynamicVector>();
-                }
-                *dynamic_data_ = *rhs.dynamic_data_;
+                BufferPool::retain(rhs.buffer_);
             }
+            release();
+            buffer_ = rhs.buffer_;
+            reader_pos_ = rhs.reader_pos_;
+            writer_pos_ = rhs.writer_pos_;
         }
         return *this;
     }
@@ -109,62 +94,73 @@ namespace eddyserver
     // 交换数据
     void NetMessage::swap(NetMessage &other)
     {
-        if (std::addressof(other) != this)
+        std::swap(buffer_, other.buffer_);
+        std::swap(reader_pos_, other.reader_pos_);
+        std::swap(writer_pos_, other.writer_pos_);
+    }
+
+    // 获取数据地址
+    uint8_t* NetMessage::data()
+    {
+        if (buffer_ == nullptr)
+        {
+            return const_cast<uint8_t*>(empty_data());
+        }
+
+        if (is_shared())
+        {
+            make_space(kDefaultHeadroom, 0);
+        }
+        return buffer_->data() + reader_pos_;
+    }
+
+    // 空消息的数据地址
+    const uint8_t* NetMessage::empty_data()
+    {
+        static const uint8_t empty[1] = { 0 };
+        return empty;
+    }
+
+    // 释放缓冲块
+    void NetMessage::release()
+    {
+        if (buffer_ != nullptr)
         {
-            dynamic_data_.swap(other.dynamic_data_);
-            std::swap(is_dynmic_, other.is_dynmic_);
-            std::swap(reader_pos_, other.reader_pos_);
-            std::swap(writer_pos_, other.writer_pos_);
-            std::swap(static_data_, other.static_data_);
+            BufferPool::release(buffer_);
+            buffer_ = nullptr;
         }
     }
 
     // 清空
     void NetMessage::clear()
     {
-        reader_pos_ = 0;
-        writer_pos_ = 0;
-        if (is_dynmic())
+        if (is_shared())
         {
-            dynamic_data_->clear();
+            release();
         }
+        retrieve_all();
     }
 
     // 设为动态数组
     void NetMessage::set_dynamic()
     {
-        assert(!is_dynmic());
-        if (!is_dynmic())
-        {
-            is_dynmic_ = true;
-            const size_t content_size = readable();
-            dynamic_data_ = std::make_unique<DynamicVector>(content_size);
-            dynamic_data_->insert(dynamic_data_->begin(), static_data_ + reader_pos_, static_data_ + writer_pos_);
-            reader_pos_ = 0;
-            writer_pos_ = content_size;
-            assert(content_size == readable());
-        }
+        reserve(kDynamicThreshold * 2);
     }
 
     // 设置容量大小
     void NetMessage::reserve(size_t size)
     {
-        if (!is_dynmic())
+        if (capacity() - reader_pos_ < size || is_shared())
         {
-            if (size <= kDynamicThreshold)
-            {
-                return;
-            }
-            set_dynamic();
+            make_space(kDefaultHeadroom, size > readable() ? size - readable() : 0);
         }
-        dynamic_data_->reserve(size);
     }
 
     // 获取全部
     void NetMessage::retrieve_all()
     {
-        reader_pos_ = 0;
-        writer_pos_ = 0;
+        reader_pos_ = buffer_ != nullptr ? kDefaultHeadroom : 0;
+        writer_pos_ = reader_pos_;
     }
 
     // 获取数据
@@ -184,62 +180,92 @@ namespace eddyserver
     // 写入数据大小
     void NetMessage::has_written(size_t size)
     {
+        assert(!is_shared());
         assert(writeable() >= size);
         writer_pos_ += size;
     }
 
     // 分配空间
-    void NetMessage::make_space(size_t size)
+    void NetMessage::make_space(size_t headroom, size_t size)
     {
-        if (writeable() + prependable() < size)
-        {
-            if (!is_dynmic())
-            {
-                set_dynamic();
-            }
-            dynamic_data_->resize(writer_pos_ + size);
-        }
-        else
+        const size_t content_size = readable();
+        if (buffer_ != nullptr && !is_shared())
         {
-            if (!is_dynmic())
+            if (prependable() >= headroom && writeable() >= size)
             {
-                memmove(static_data_, static_data_ + reader_pos_, writer_pos_ - reader_pos_);
+                return;
             }
-            else
+
+            // 独占的缓冲块空间足够时移动数据，保留所需的头部空间
+            if (capacity() >= headroom + content_size + size)
             {
-                memmove(dynamic_data_->data(), dynamic_data_->data() + reader_pos_, writer_pos_ - reader_pos_);
+                memmove(buffer_->data() + headroom, buffer_->data() + reader_pos_, content_size);
+                reader_pos_ = headroom;
+                writer_pos_ = headroom + content_size;
+                return;
             }
+        }
 
-            const size_t readable_size = readable();
-            reader_pos_ = 0;
-            writer_pos_ = readable_size;
-            assert(readable_size == readable());
+        BufferBlock *block = BufferPool::allocate(headroom + content_size + size);
+        if (content_size > 0)
+        {
+            memcpy(block->data() + headroom, buffer_->data() + reader_pos_, content_size);
         }
+        release();
+        buffer_ = block;
+        reader_pos_ = headroom;
+        writer_pos_ = headroom + content_size;
     }
 
     // 确保可写字节
     void NetMessage::ensure_writable_bytes(size_t size)
     {
-        if (writeable() < size)
+        if (buffer_ == nullptr || writeable() < size || is_shared())
         {
-            make_space(size);
+            // 独占的缓冲块增长时保留已预留的头部空间，之后在消息体前写入消息头不需要再移动数据
+            size_t headroom = kDefaultHeadroom;
+            if (buffer_ != nullptr && !is_shared() && prependable() > headroom)
+            {
+                headroom = prependable();
+            }
+            make_space(headroom, size);
         }
         assert(writeable() >= size);
     }
 
+    // 确保头部空间
+    void NetMessage::reserve_headroom(size_t size)
+    {
+        if (buffer_ == nullptr || prependable() < size || is_shared())
+        {
+            make_space(size, 0);
+        }
+        assert(prependable() >= size);
+    }
+
+    // 确保头部和尾部空间
+    void NetMessage::reserve_room(size_t headroom, size_t tailroom)
+    {
+        if (buffer_ == nullptr || prependable() < headroom || writeable() < tailroom || is_shared())
+        {
+            make_space(headroom, tailroom);
+        }
+        assert(prependable() >= headroom && writeable() >= tailroom);
+    }
+
     // 读取字符串
     std::string NetMessage::read_string()
     {
         assert(readable() > 0);
-        const uint8_t *eos = data();
+        const uint8_t *eos = peek();
         while (*eos++);
-        size_t lenght = eos - data() - 1;
+        size_t lenght = eos - peek() - 1;
         assert(readable() >= lenght);
         std::string value;
         if (lenght > 0)
         {
             value.resize(lenght);
-            memcpy(const_cast<char*>(value.data()), data(), lenght);
+            memcpy(const_cast<char*>(value.data()), peek(), lenght);
             retrieve(lenght);
         }
         return value;
@@ -248,16 +274,16 @@ namespace eddyserver
     void NetMessage::read_string(std::string *out_value)
     {
         assert(readable() > 0);
-        const uint8_t *eos = data();
+        const uint8_t *eos = peek();
         while (*eos++);
-        size_t lenght = eos - data() - 1;
+        size_t lenght = eos - peek() - 1;
         assert(readable() >= lenght);
 
         out_value->clear();
         if (lenght > 0)
         {
             out_value->resize(lenght);
-            memcpy(const_cast<char*>(out_value->data()), data(), lenght);
+            memcpy(const_cast<char*>(out_value->data()), peek(), lenght);
             retrieve(lenght);
         }
     }
@@ -267,13 +293,13 @@ namespace eddyserver
     {
         assert(readable() >= sizeof(uint32_t));
         uint32_t lenght = 0;
-        memcpy(&lenght, data(), sizeof(uint32_t));
+        memcpy(&lenght, peek(), sizeof(uint32_t));
         retrieve(sizeof(uint32_t));
         std::string value;
         if (lenght > 0)
         {
             value.resize(lenght);
-            memcpy(const_cast<char*>(value.data()), data(), lenght);
+            memcpy(const_cast<char*>(value.data()), peek(), lenght);
             retrieve(lenght);
         }
         return value;
@@ -283,14 +309,14 @@ namespace eddyserver
     {
         assert(readable() >= sizeof(uint32_t));
         uint32_t lenght = 0;
-        memcpy(&lenght, data(), sizeof(uint32_t));
+        memcpy(&lenght, peek(), sizeof(uint32_t));
         retrieve(sizeof(uint32_t));
 
         out_value->clear();
         if (lenght > 0)
         {
             out_value->resize(lenght);
-            memcpy(const_cast<char*>(out_value->data()), data(), lenght);
+            memcpy(const_cast<char*>(out_value->data()), peek(), lenght);
             retrieve(lenght);
         }
     }
@@ -298,17 +324,13 @@ namespace eddyserver
     // 写入数据
     size_t NetMessage::write(const void *data, size_t size)
     {
-        ensure_writable_bytes(size);
-        if (!is_dynmic())
-        {
-            memcpy(static_data_ + writer_pos_, data, size);
-        }
-        else
+        if (size == 0)
         {
-            dynamic_data_->insert(dynamic_data_->begin() + writer_pos_,
-                reinterpret_cast<const uint8_t*>(data),
-                reinterpret_cast<const uint8_t*>(data)+size);
+            return 0;
         }
+
+        ensure_writable_bytes(size);
+        memcpy(buffer_->data() + writer_pos_, data, size);
         has_written(size);
         return size;
     }
@@ -328,4 +350,21 @@ namespace eddyserver
         write_pod<uint32_t>(value.size());
         write_string(value);
     }
+
+    // 在数据前写入
+    void NetMessage::prepend(const void *data, size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+
+        // 需要移动数据时多预留默认头部空间，供后续继续写入
+        if (buffer_ == nullptr || prependable() < size || is_shared())
+        {
+            make_space(size + kDefaultHeadroom, 0);
+        }
+        reader_pos_ -= size;
+        memcpy(buffer_->data() + reader_pos_, data, size);
+    }
 }
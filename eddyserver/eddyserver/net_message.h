@@ -7,18 +7,28 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <type_traits>
+#include "buffer_pool.h"
 
 namespace eddyserver
 {
+    /**
+     * 网络消息
+     * 数据存放在BufferPool分配的引用计数缓冲块中，移动和拷贝只复制指针
+     * 多个消息共享缓冲块时，写入前先复制一份独占的缓冲块（写时复制）
+     * 读取只移动自身的读位置，不会影响共享缓冲块的其它消息
+     * 数据前预留头部空间，过滤器可直接在数据前写入消息头
+     */
     class NetMessage
     {
-        typedef std::vector<uint8_t> DynamicVector;
-
     public:
         /* 动态临界值 */
         static const size_t kDynamicThreshold = 128;
         static_assert(NetMessage::kDynamicThreshold >= 0, "kDynamicThreshold must be greater than 0");
 
+        /* 默认头部空间，分配、整理和复制缓冲块时预留 */
+        static const size_t kDefaultHeadroom = 8;
+
     public:
         NetMessage();
 
@@ -29,6 +39,14 @@ namespace eddyserver
          */
         explicit NetMessage(size_t size);
 
+        /**
+         * 构造函数
+         * 预先分配内存并预留头部空间
+         * @param size 内存大小
+         * @param headroom 头部空间大小
+         */
+        NetMessage(size_t size, size_t headroom);
+
         /**
          * 构造函数
          * 将data指针后的size大小的内存写入message
@@ -39,6 +57,7 @@ namespace eddyserver
 
         /**
          * 拷贝构造函数
+         * 共享缓冲块
          */
         NetMessage(const NetMessage &other);
 
@@ -47,6 +66,8 @@ namespace eddyserver
          */
         NetMessage(NetMessage &&other);
 
+        ~NetMessage();
+
         /**
          * 重载赋值运算符
          */
@@ -61,10 +82,19 @@ namespace eddyserver
     public:
         /**
          * 是否是动态数组
+         * 容量超过kDynamicThreshold时为真
          */
         bool is_dynmic() const
         {
-            return is_dynmic_;
+            return capacity() > kDynamicThreshold;
+        }
+
+        /**
+         * 是否与其它消息共享缓冲块
+         */
+        bool is_shared() const
+        {
+            return buffer_ != nullptr && buffer_->refs.load(std::memory_order_acquire) > 1;
         }
 
         /**
@@ -88,7 +118,7 @@ namespace eddyserver
          */
         size_t writeable() const
         {
-            return (is_dynmic() ? dynamic_data_->size() : kDynamicThreshold) - writer_pos_;
+            return capacity() - writer_pos_;
         }
 
         /**
@@ -96,7 +126,7 @@ namespace eddyserver
          */
         size_t capacity() const
         {
-            return is_dynmic() ? dynamic_data_->capacity() : kDynamicThreshold;
+            return buffer_ != nullptr ? buffer_->capacity : 0;
         }
 
         /**
@@ -109,15 +139,13 @@ namespace eddyserver
 
         /**
          * 获取数据地址
+         * 非const版本用于写入，共享缓冲块时先复制
          */
-        uint8_t* data()
-        {
-            return (is_dynmic() ? dynamic_data_->data() : static_data_) + reader_pos_;
-        }
+        uint8_t* data();
 
         const uint8_t* data() const
         {
-            return (is_dynmic() ? dynamic_data_->data() : static_data_) + reader_pos_;
+            return buffer_ != nullptr ? buffer_->data() + reader_pos_ : empty_data();
         }
 
     public:
@@ -128,6 +156,7 @@ namespace eddyserver
 
         /**
          * 设为动态数组
+         * 容量扩展到kDynamicThreshold以上
          */
         void set_dynamic();
 
@@ -156,20 +185,46 @@ namespace eddyserver
 
         /**
          * 确保可写字节
+         * 独占的缓冲块增长或移动数据时保留已有的头部空间
          * @param size 数据大小
          */
         void ensure_writable_bytes(size_t size);
 
+        /**
+         * 确保头部空间
+         * 头部空间不足时移动数据
+         * @param size 头部空间大小
+         */
+        void reserve_headroom(size_t size);
+
+        /**
+         * 确保头部和尾部空间
+         * 空间足够且独占缓冲块时不移动数据，否则最多移动或复制一次
+         * @param headroom 头部空间大小
+         * @param tailroom 尾部空间大小
+         */
+        void reserve_room(size_t headroom, size_t tailroom);
+
+        /**
+         * 丢弃尾部数据（只会移动写位置）
+         * @param size 保留的数据大小
+         */
+        void truncate(size_t size)
+        {
+            assert(readable() >= size);
+            writer_pos_ = reader_pos_ + size;
+        }
+
         /**
          * 读取POD类型
          */
         template <typename Type>
         Type read_pod()
         {
-            static_assert(std::is_pod<Type>::value, "expects an POD type");
+            static_assert(std::is_trivially_copyable<Type>::value, "expects a trivially copyable type");
             assert(readable() >= sizeof(Type));
             Type value = 0;
-            memcpy(&value, data(), sizeof(Type));
+            memcpy(&value, peek(), sizeof(Type));
             retrieve(sizeof(Type));
             return value;
         }
@@ -199,7 +254,7 @@ namespace eddyserver
         template <typename Type>
         void write_pod(Type value)
         {
-            static_assert(std::is_pod<Type>::value, "expects an POD type");
+            static_assert(std::is_trivially_copyable<Type>::value, "expects a trivially copyable type");
             write(&value, sizeof(Type));
         }
 
@@ -213,19 +268,56 @@ namespace eddyserver
          */
         void write_lenght_and_string(const std::string &value);
 
+        /**
+         * 在数据前写入
+         * 头部空间足够且独占缓冲块时直接写入，不移动数据
+         * @param data 数据地址
+         * @param size 数据大小
+         */
+        void prepend(const void *data, size_t size);
+
+        /**
+         * 在数据前写入POD类型
+         */
+        template <typename Type>
+        void prepend_pod(Type value)
+        {
+            static_assert(std::is_trivially_copyable<Type>::value, "expects a trivially copyable type");
+            prepend(&value, sizeof(Type));
+        }
+
     private:
         /**
          * 分配空间
+         * 确保独占缓冲块，头部至少有headroom字节，尾部至少有size字节可写
+         * @param headroom 头部空间大小
          * @param size 数据大小
          */
-        void make_space(size_t size);
+        void make_space(size_t headroom, size_t size);
+
+        /**
+         * 读取位置的数据地址
+         * 只读访问，共享缓冲块时不会复制
+         */
+        const uint8_t* peek() const
+        {
+            return data();
+        }
+
+        /**
+         * 释放缓冲块
+         */
+        void release();
+
+        /**
+         * 空消息的数据地址
+         */
+        static const uint8_t* empty_data();
 
     private:
-        bool                            is_dynmic_;
-        size_t                          reader_pos_;
-        size_t                          writer_pos_;
-        std::unique_ptr<DynamicVector>  dynamic_data_;
-        uint8_t                         static_data_[kDynamicThreshold];
+        BufferBlock*    buffer_;
+        size_t          reader_pos_;
+        size_t          writer_pos_;
     };
 
     typedef std::vector<NetMessage> NetMessageVector;
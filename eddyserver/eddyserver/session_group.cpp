@@ -0,0 +1,174 @@
+﻿#include "session_group.h"
+#include <cassert>
+#include "tcp_session.h"
+#include "net_message.h"
+#include "io_service_thread.h"
+#include "tcp_session_handler.h"
+#include "io_service_thread_manager.h"
+
+namespace eddyserver
+{
+    SessionGroup::SessionGroup(IOServiceThreadManager &manager)
+        : manager_(manager)
+        , size_(0)
+        , members_(manager.get_thread_count())
+    {
+    }
+
+    // 获取成员数量
+    size_t SessionGroup::size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    // 添加成员
+    bool SessionGroup::add(const SessionHandlePointer &handler_ptr)
+    {
+        if (handler_ptr == nullptr || handler_ptr->is_closed() || contains(handler_ptr))
+        {
+            return false;
+        }
+
+        SessionPointer session_ptr = handler_ptr->session_.lock();
+        if (session_ptr == nullptr)
+        {
+            return false;
+        }
+
+        assert(handler_ptr->get_thread_id() > 0 && handler_ptr->get_thread_id() <= members_.size());
+        std::unique_ptr<SessionGroupMembership> membership(new SessionGroupMembership());
+        membership->group = shared_from_this();
+        membership->thread_index = handler_ptr->get_thread_id() - 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<Member> &members = members_[membership->thread_index];
+            membership->position = members.size();
+            members.push_back(Member{ std::move(session_ptr), handler_ptr->get_session_id(), membership.get() });
+            ++size_;
+        }
+        handler_ptr->groups_.push_back(std::move(membership));
+        return true;
+    }
+
+    // 移除成员
+    bool SessionGroup::remove(const SessionHandlePointer &handler_ptr)
+    {
+        if (handler_ptr == nullptr)
+        {
+            return false;
+        }
+
+        std::vector<std::unique_ptr<SessionGroupMembership>> &groups = handler_ptr->groups_;
+        const size_t index = handler_ptr->find_group(this);
+        if (index == groups.size())
+        {
+            return false;
+        }
+
+        remove_member(groups[index].get());
+        groups[index] = std::move(groups.back());
+        groups.pop_back();
+        return true;
+    }
+
+    // 是否为成员
+    bool SessionGroup::contains(const SessionHandlePointer &handler_ptr) const
+    {
+        if (handler_ptr == nullptr)
+        {
+            return false;
+        }
+
+        return handler_ptr->find_group(this) != handler_ptr->groups_.size();
+    }
+
+    // 组播消息
+    void SessionGroup::multicast(const NetMessage &message, TCPSessionID exclude)
+    {
+        if (message.empty())
+        {
+            return;
+        }
+
+        NetMessage frame;
+        const std::type_info *frame_filter = nullptr;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < members_.size(); ++i)
+        {
+            // 经由信箱发送，只唤醒信箱由空变为非空的Session
+            IOServiceThread::BroadcastBatchPointer batch;
+            const std::vector<Member> &members = members_[i];
+            for (size_t j = 0; j < members.size(); ++j)
+            {
+                const Member &member = members[j];
+                if (member.session_id == exclude)
+                {
+                    continue;
+                }
+
+                member.session->write_frame(message, frame, frame_filter);
+                if (member.session->push_frame(message, frame, frame_filter))
+                {
+                    if (batch == nullptr)
+                    {
+                        batch = std::make_shared<IOServiceThread::BroadcastBatch>(message);
+                    }
+                    batch->sessions.push_back(member.session);
+                }
+            }
+
+            if (batch != nullptr)
+            {
+                ThreadPointer io_thread = manager_.get_thread(static_cast<IOThreadID>(i + 1));
+                io_thread->post(std::bind(&IOServiceThread::handle_broadcast, io_thread.get(), batch));
+            }
+        }
+    }
+
+    // 移除成员关系
+    void SessionGroup::remove_member(SessionGroupMembership *membership)
+    {
+        // 在锁外释放Session
+        SessionPointer session_ptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            session_ptr = take_member(membership).session;
+            --size_;
+        }
+    }
+
+    // 转移成员到新的IO线程分组
+    void SessionGroup::relocate_member(SessionGroupMembership *membership, IOThreadID tid)
+    {
+        assert(tid > 0 && tid <= members_.size());
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (membership->thread_index == tid - 1)
+        {
+            return;
+        }
+
+        Member member = take_member(membership);
+        std::vector<Member> &members = members_[tid - 1];
+        membership->thread_index = tid - 1;
+        membership->position = members.size();
+        members.push_back(std::move(member));
+    }
+
+    // 从分组中移除成员
+    SessionGroup::Member SessionGroup::take_member(SessionGroupMembership *membership)
+    {
+        std::vector<Member> &members = members_[membership->thread_index];
+        const size_t position = membership->position;
+        assert(position < members.size() && members[position].membership == membership);
+
+        Member member = std::move(members[position]);
+        if (position + 1 != members.size())
+        {
+            members[position] = std::move(members.back());
+            members[position].membership->position = position;
+        }
+        members.pop_back();
+        return member;
+    }
+}
@@ -0,0 +1,121 @@
+﻿#ifndef __SESSION_GROUP_H__
+#define __SESSION_GROUP_H__
+
+#include <mutex>
+#include <vector>
+#include "types.h"
+
+namespace eddyserver
+{
+    class NetMessage;
+    class SessionGroup;
+    class IOServiceThreadManager;
+
+    /**
+     * Session组成员关系
+     * 由SessionHandler持有，记录成员在组中的位置，移除时无需查找
+     * 位置只在组的锁内读写
+     */
+    struct SessionGroupMembership
+    {
+        std::weak_ptr<SessionGroup> group;
+        size_t                      thread_index;
+        size_t                      position;
+    };
+
+    /**
+     * Session组
+     * 成员按所属的IO线程分组紧凑存放，移除时与末尾元素交换
+     * Session关闭时自动退出所有组，迁移时自动转到新线程的分组
+     * 组播只编码一次，每个IO线程投递一次
+     * 须通过std::make_shared创建，可在任意线程组播
+     */
+    class SessionGroup final : public std::enable_shared_from_this<SessionGroup>
+    {
+        friend class TCPSessionHandler;
+
+        /**
+         * 组成员
+         */
+        struct Member
+        {
+            SessionPointer          session;
+            TCPSessionID            session_id;
+            SessionGroupMembership* membership;
+        };
+
+    public:
+        explicit SessionGroup(IOServiceThreadManager &manager);
+
+    public:
+        /**
+         * 获取成员数量
+         */
+        size_t size() const;
+
+        /**
+         * 是否为空
+         */
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        /**
+         * 添加成员
+         * 在SessionHandler运行的线程中调用
+         * @return 是否添加，已是成员或已关闭时返回false
+         */
+        bool add(const SessionHandlePointer &handler_ptr);
+
+        /**
+         * 移除成员
+         * 在SessionHandler运行的线程中调用
+         * @return 是否移除，不是成员时返回false
+         */
+        bool remove(const SessionHandlePointer &handler_ptr);
+
+        /**
+         * 是否为成员
+         * 在SessionHandler运行的线程中调用
+         */
+        bool contains(const SessionHandlePointer &handler_ptr) const;
+
+        /**
+         * 组播消息
+         * 消息只编码一次，每个IO线程投递一次，与send投递的消息保持顺序
+         * @param message 消息
+         * @param exclude 不发送的Session ID，通常为发送者
+         */
+        void multicast(const NetMessage &message, TCPSessionID exclude = 0);
+
+    private:
+        /**
+         * 移除成员关系
+         */
+        void remove_member(SessionGroupMembership *membership);
+
+        /**
+         * 转移成员到新的IO线程分组
+         */
+        void relocate_member(SessionGroupMembership *membership, IOThreadID tid);
+
+        /**
+         * 从分组中移除成员
+         * 须持有锁
+         */
+        Member take_member(SessionGroupMembership *membership);
+
+    private:
+        SessionGroup(const SessionGroup&) = delete;
+        SessionGroup& operator= (const SessionGroup&) = delete;
+
+    private:
+        IOServiceThreadManager&             manager_;
+        mutable std::mutex                  mutex_;
+        size_t                              size_;
+        std::vector<std::vector<Member>>    members_;
+    };
+}
+
+#endif
@@ -0,0 +1,197 @@
+﻿#ifndef __SESSION_OWNER_TABLE_H__
+#define __SESSION_OWNER_TABLE_H__
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include "types.h"
+#include "slot_map.h"
+
+namespace eddyserver
+{
+    /**
+     * Session所在线程表
+     * 记录分配线程分配的每个Session ID当前所在的IO线程，可在任意线程查询
+     * 按槽位索引分块存放，每项为代数和线程id，过期的ID查不到线程
+     * 只有分配线程添加和移除，迁移时由迁出线程更新
+     */
+    class SessionOwnerTable final
+    {
+        typedef SlotMap<SessionHandlePointer> KeyLayout;
+
+    public:
+        /* 每块的项数 */
+        static const size_t kChunkBits = 12;
+        static const size_t kChunkSize = size_t(1) << kChunkBits;
+
+        /* 最大块数，每个线程最多记录kChunkSize * kMaxChunks个槽位 */
+        static const size_t kMaxChunks = 4096;
+
+    public:
+        SessionOwnerTable()
+        {
+            for (size_t i = 0; i < kMaxChunks; ++i)
+            {
+                chunks_[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~SessionOwnerTable()
+        {
+            for (size_t i = 0; i < kMaxChunks; ++i)
+            {
+                delete[] chunks_[i].load(std::memory_order_relaxed);
+            }
+        }
+
+    public:
+        /**
+         * 添加Session ID
+         * 只能在分配线程中调用
+         * @param id Session ID
+         * @param owner 所在线程
+         */
+        void insert(TCPSessionID id, IOThreadID owner)
+        {
+            const size_t index = index_of(id);
+            assert(index / kChunkSize < kMaxChunks);
+            if (index / kChunkSize >= kMaxChunks)
+            {
+                return;
+            }
+
+            std::atomic<uint32_t> *chunk = chunks_[index / kChunkSize].load(std::memory_order_relaxed);
+            if (chunk == nullptr)
+            {
+                chunk = new std::atomic<uint32_t>[kChunkSize];
+                for (size_t i = 0; i < kChunkSize; ++i)
+                {
+                    chunk[i].store(0, std::memory_order_relaxed);
+                }
+                chunks_[index / kChunkSize].store(chunk, std::memory_order_release);
+            }
+            chunk[index % kChunkSize].store(make_entry(id, owner), std::memory_order_release);
+        }
+
+        /**
+         * 更新所在线程
+         * 可在任意线程调用，Session ID已过期时不更新
+         */
+        void update(TCPSessionID id, IOThreadID owner)
+        {
+            std::atomic<uint32_t> *entry = find(id);
+            if (entry == nullptr)
+            {
+                return;
+            }
+
+            uint32_t expected = entry->load(std::memory_order_relaxed);
+            while (entry_generation_of(expected) == generation_of(id))
+            {
+                if (entry->compare_exchange_weak(expected, make_entry(id, owner), std::memory_order_release, std::memory_order_relaxed))
+                {
+                    return;
+                }
+            }
+        }
+
+        /**
+         * 移除Session ID
+         * 只能在分配线程中调用
+         */
+        void erase(TCPSessionID id)
+        {
+            std::atomic<uint32_t> *entry = find(id);
+            if (entry == nullptr)
+            {
+                return;
+            }
+
+            uint32_t expected = entry->load(std::memory_order_relaxed);
+            while (entry_generation_of(expected) == generation_of(id))
+            {
+                if (entry->compare_exchange_weak(expected, 0, std::memory_order_release, std::memory_order_relaxed))
+                {
+                    return;
+                }
+            }
+        }
+
+        /**
+         * 获取所在线程
+         * 可在任意线程调用
+         * @return Session ID无效或已过期时返回0
+         */
+        IOThreadID get(TCPSessionID id) const
+        {
+            const std::atomic<uint32_t> *entry = const_cast<SessionOwnerTable*>(this)->find(id);
+            if (entry == nullptr)
+            {
+                return 0;
+            }
+
+            const uint32_t value = entry->load(std::memory_order_acquire);
+            return entry_generation_of(value) == generation_of(id) ? value & KeyLayout::kMaxTag : 0;
+        }
+
+    private:
+        /**
+         * 获取槽位索引
+         */
+        static size_t index_of(TCPSessionID id)
+        {
+            return static_cast<uint32_t>(id);
+        }
+
+        /**
+         * 获取项中的代数
+         * 空项为0，Session ID中的代数不为0
+         */
+        static uint32_t entry_generation_of(uint32_t entry)
+        {
+            return entry >> KeyLayout::kTagBits;
+        }
+
+        /**
+         * 获取Session ID中的代数
+         */
+        static uint32_t generation_of(TCPSessionID id)
+        {
+            return static_cast<uint32_t>(id >> KeyLayout::kIndexBits) & ((1u << KeyLayout::kGenerationBits) - 1);
+        }
+
+        /**
+         * 生成项
+         */
+        static uint32_t make_entry(TCPSessionID id, IOThreadID owner)
+        {
+            assert(owner <= KeyLayout::kMaxTag);
+            return (generation_of(id) << KeyLayout::kTagBits) | owner;
+        }
+
+        /**
+         * 查找项
+         */
+        std::atomic<uint32_t>* find(TCPSessionID id)
+        {
+            const size_t index = index_of(id);
+            if (index / kChunkSize >= kMaxChunks)
+            {
+                return nullptr;
+            }
+
+            std::atomic<uint32_t> *chunk = chunks_[index / kChunkSize].load(std::memory_order_acquire);
+            return chunk != nullptr ? &chunk[index % kChunkSize] : nullptr;
+        }
+
+    private:
+        SessionOwnerTable(const SessionOwnerTable&) = delete;
+        SessionOwnerTable& operator= (const SessionOwnerTable&) = delete;
+
+    private:
+        std::atomic<std::atomic<uint32_t>*> chunks_[kMaxChunks];
+    };
+}
+
+#endif
@@ -0,0 +1,181 @@
+﻿#include "simd.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EDDY_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(EDDY_SIMD_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EDDY_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace eddyserver
+{
+    namespace simd_stuff
+    {
+        typedef SIMD::Implementation Dispatch;
+
+        // 最低位的1的位置
+        inline size_t CountTrailingZeros(uint32_t mask)
+        {
+#ifdef _MSC_VER
+            unsigned long index = 0;
+            _BitScanForward(&index, mask);
+            return index;
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        // 逐字节查找
+        const uint8_t* FindByteScalar(const uint8_t *begin, const uint8_t *end, uint8_t value)
+        {
+            while (begin < end && *begin != value)
+            {
+                ++begin;
+            }
+            return begin;
+        }
+
+        // 逐字节异或
+        void MaskBytesScalar(uint8_t *data, size_t size, const uint8_t *key)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                data[i] ^= key[i & 3];
+            }
+        }
+
+#ifdef EDDY_SIMD_SSE2
+        // 每次比较16字节
+        const uint8_t* FindByteSSE2(const uint8_t *begin, const uint8_t *end, uint8_t value)
+        {
+            const __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+            while (end - begin >= 16)
+            {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+                const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+                if (mask != 0)
+                {
+                    return begin + CountTrailingZeros(mask);
+                }
+                begin += 16;
+            }
+            return FindByteScalar(begin, end, value);
+        }
+
+        // 每次异或16字节，16是4的倍数，掩码的相位不变
+        void MaskBytesSSE2(uint8_t *data, size_t size, const uint8_t *key)
+        {
+            int32_t pattern = 0;
+            memcpy(&pattern, key, sizeof(pattern));
+            const __m128i mask = _mm_set1_epi32(pattern);
+            size_t i = 0;
+            for (; i + 16 <= size; i += 16)
+            {
+                __m128i *chunk = reinterpret_cast<__m128i*>(data + i);
+                _mm_storeu_si128(chunk, _mm_xor_si128(_mm_loadu_si128(chunk), mask));
+            }
+            MaskBytesScalar(data + i, size - i, key);
+        }
+#endif
+
+#ifdef EDDY_SIMD_AVX2
+        // 每次比较32字节
+        __attribute__((target("avx2")))
+        const uint8_t* FindByteAVX2(const uint8_t *begin, const uint8_t *end, uint8_t value)
+        {
+            const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+            while (end - begin >= 32)
+            {
+                const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+                const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+                if (mask != 0)
+                {
+                    return begin + CountTrailingZeros(mask);
+                }
+                begin += 32;
+            }
+            return FindByteSSE2(begin, end, value);
+        }
+
+        // 每次异或32字节
+        __attribute__((target("avx2")))
+        void MaskBytesAVX2(uint8_t *data, size_t size, const uint8_t *key)
+        {
+            int32_t pattern = 0;
+            memcpy(&pattern, key, sizeof(pattern));
+            const __m256i mask = _mm256_set1_epi32(pattern);
+            size_t i = 0;
+            for (; i + 32 <= size; i += 32)
+            {
+                __m256i *chunk = reinterpret_cast<__m256i*>(data + i);
+                _mm256_storeu_si256(chunk, _mm256_xor_si256(_mm256_loadu_si256(chunk), mask));
+            }
+            MaskBytesSSE2(data + i, size - i, key);
+        }
+#endif
+
+        // 列出CPU支持的实现，从快到慢
+        std::vector<Dispatch> Supported()
+        {
+            std::vector<Dispatch> supported;
+#ifdef EDDY_SIMD_AVX2
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                supported.push_back(Dispatch{ "avx2", &FindByteAVX2, &MaskBytesAVX2 });
+            }
+#endif
+
+#ifdef EDDY_SIMD_SSE2
+            supported.push_back(Dispatch{ "sse2", &FindByteSSE2, &MaskBytesSSE2 });
+#endif
+            supported.push_back(Dispatch{ "scalar", &FindByteScalar, &MaskBytesScalar });
+            return supported;
+        }
+
+        // 按CPU选择实现
+        Dispatch Select()
+        {
+            return Supported().front();
+        }
+
+        // 获取选用的实现
+        const Dispatch& GetDispatch()
+        {
+            static const Dispatch dispatch = Select();
+            return dispatch;
+        }
+    }
+
+    // 获取当前CPU支持的全部实现
+    std::vector<SIMD::Implementation> SIMD::implementations()
+    {
+        return simd_stuff::Supported();
+    }
+
+    // 获取选用的指令集
+    const char* SIMD::instruction_set()
+    {
+        return simd_stuff::GetDispatch().instruction_set;
+    }
+
+    // 查找字节
+    const uint8_t* SIMD::find_byte(const uint8_t *begin, const uint8_t *end, uint8_t value)
+    {
+        return simd_stuff::GetDispatch().find_byte(begin, end, value);
+    }
+
+    // 按4字节掩码就地异或
+    void SIMD::mask_bytes(uint8_t *data, size_t size, const uint8_t key[4])
+    {
+        simd_stuff::GetDispatch().mask_bytes(data, size, key);
+    }
+}
@@ -0,0 +1,67 @@
+﻿#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace eddyserver
+{
+    /**
+     * 向量化的字节处理
+     * 首次调用时按CPU支持的指令集选择AVX2、SSE2或逐字节实现，之后不再检测
+     * AVX2通过函数级的目标属性编译，不需要全局的编译选项
+     */
+    class SIMD final
+    {
+    public:
+        typedef const uint8_t* (*FindByteFunction)(const uint8_t*, const uint8_t*, uint8_t);
+        typedef void (*MaskBytesFunction)(uint8_t*, size_t, const uint8_t*);
+
+        /**
+         * 一种指令集的实现
+         */
+        struct Implementation
+        {
+            const char*         instruction_set;
+            FindByteFunction    find_byte;
+            MaskBytesFunction   mask_bytes;
+        };
+
+    public:
+        /**
+         * 获取当前CPU支持的全部实现
+         * 首项为选用的实现，逐字节实现总在末尾，用于测试各实现结果一致和比较性能
+         */
+        static std::vector<Implementation> implementations();
+
+        /**
+         * 获取选用的指令集
+         * @return "avx2"、"sse2"或"scalar"
+         */
+        static const char* instruction_set();
+
+        /**
+         * 查找字节
+         * @param begin 起始地址
+         * @param end 结束地址
+         * @param value 要查找的字节
+         * @return 第一个等于value的字节地址，没有时返回end
+         */
+        static const uint8_t* find_byte(const uint8_t *begin, const uint8_t *end, uint8_t value);
+
+        /**
+         * 按4字节掩码就地异或
+         * 第i个字节与key[i % 4]异或，用于WebSocket的掩码和解码
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param key 4字节掩码
+         */
+        static void mask_bytes(uint8_t *data, size_t size, const uint8_t key[4]);
+
+    private:
+        SIMD() = delete;
+    };
+}
+
+#endif
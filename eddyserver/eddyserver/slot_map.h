@@ -0,0 +1,188 @@
+﻿#ifndef __SLOT_MAP_H__
+#define __SLOT_MAP_H__
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace eddyserver
+{
+    /**
+     * 分代槽位表
+     * 键由标签、代数和槽位索引组成，查找为一次数组索引加一次比较
+     * 槽位释放后代数递增，过期的键不会指向新的元素
+     * 标签用于区分不同的槽位表，使多个线程各自分配互不冲突的键
+     */
+    template <typename T>
+    class SlotMap final
+    {
+        struct Slot
+        {
+            T           value;
+            uint32_t    generation;
+            uint32_t    next_free;
+            bool        occupied;
+        };
+
+    public:
+        typedef uint64_t Key;
+
+        /* 键的组成：| 标签 8位 | 代数 24位 | 槽位索引 32位 | */
+        static const size_t   kIndexBits = 32;
+        static const size_t   kGenerationBits = 24;
+        static const size_t   kTagBits = 8;
+        static const uint32_t kMaxTag = (1u << kTagBits) - 1;
+
+    public:
+        /**
+         * 构造函数
+         * @param tag 标签
+         */
+        explicit SlotMap(uint32_t tag = 0)
+            : tag_(tag)
+            , size_(0)
+            , free_head_(kInvalidIndex)
+        {
+            assert(tag <= kMaxTag);
+        }
+
+    public:
+        /**
+         * 获取键的标签
+         */
+        static uint32_t tag_of(Key key)
+        {
+            return static_cast<uint32_t>(key >> (kIndexBits + kGenerationBits));
+        }
+
+        /**
+         * 获取标签
+         */
+        uint32_t tag() const
+        {
+            return tag_;
+        }
+
+        /**
+         * 获取元素数量
+         */
+        size_t size() const
+        {
+            return size_;
+        }
+
+        /**
+         * 是否为空
+         */
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        /**
+         * 插入元素
+         * @param value 元素
+         * @return 键，不会为0
+         */
+        template <typename U>
+        Key insert(U &&value)
+        {
+            uint32_t index = free_head_;
+            if (index != kInvalidIndex)
+            {
+                free_head_ = slots_[index].next_free;
+            }
+            else
+            {
+                index = static_cast<uint32_t>(slots_.size());
+                slots_.push_back(Slot());
+                slots_[index].generation = 1;
+            }
+
+            Slot &slot = slots_[index];
+            slot.value = std::forward<U>(value);
+            slot.next_free = kInvalidIndex;
+            slot.occupied = true;
+            ++size_;
+            return make_key(slot.generation, index);
+        }
+
+        /**
+         * 获取元素
+         * @param key 键
+         * @return 键无效或已过期时返回nullptr
+         */
+        T* get(Key key)
+        {
+            const uint32_t index = static_cast<uint32_t>(key);
+            if (index >= slots_.size() || key != make_key(slots_[index].generation, index) || !slots_[index].occupied)
+            {
+                return nullptr;
+            }
+            return &slots_[index].value;
+        }
+
+        const T* get(Key key) const
+        {
+            return const_cast<SlotMap*>(this)->get(key);
+        }
+
+        /**
+         * 移除元素
+         * @param key 键
+         * @return 是否成功
+         */
+        bool erase(Key key)
+        {
+            if (get(key) == nullptr)
+            {
+                return false;
+            }
+
+            const uint32_t index = static_cast<uint32_t>(key);
+            Slot &slot = slots_[index];
+            slot.value = T();
+            slot.occupied = false;
+
+            // 代数回绕时跳过0，保证键不为0
+            slot.generation = (slot.generation + 1) & kGenerationMask;
+            if (slot.generation == 0)
+            {
+                slot.generation = 1;
+            }
+
+            slot.next_free = free_head_;
+            free_head_ = index;
+            --size_;
+            return true;
+        }
+
+    private:
+        static const uint32_t kInvalidIndex = 0xffffffff;
+        static const uint32_t kGenerationMask = (1u << kGenerationBits) - 1;
+
+        /**
+         * 生成键
+         */
+        Key make_key(uint32_t generation, uint32_t index) const
+        {
+            return (static_cast<Key>(tag_) << (kIndexBits + kGenerationBits)) |
+                (static_cast<Key>(generation) << kIndexBits) |
+                index;
+        }
+
+    private:
+        SlotMap(const SlotMap&) = delete;
+        SlotMap& operator= (const SlotMap&) = delete;
+
+    private:
+        const uint32_t      tag_;
+        size_t              size_;
+        uint32_t            free_head_;
+        std::vector<Slot>   slots_;
+    };
+}
+
+#endif
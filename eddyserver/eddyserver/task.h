@@ -0,0 +1,216 @@
+﻿#ifndef __TASK_H__
+#define __TASK_H__
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace eddyserver
+{
+    /**
+     * 任务
+     * 只能移动的无参可调用对象，用于替代std::function<void()>
+     * 不超过kInlineSize字节的可调用对象直接存放在内部，不分配堆内存
+     */
+    class Task final
+    {
+        /**
+         * 类型相关的操作
+         */
+        struct Operations
+        {
+            void (*invoke)(void *storage);
+            void (*move)(void *dst, void *src);
+            void (*destroy)(void *storage);
+        };
+
+        /**
+         * 内部存放的可调用对象
+         */
+        template <typename Function>
+        struct InlineOperations
+        {
+            static void invoke(void *storage)
+            {
+                (*static_cast<Function*>(storage))();
+            }
+
+            static void move(void *dst, void *src)
+            {
+                new (dst) Function(std::move(*static_cast<Function*>(src)));
+                static_cast<Function*>(src)->~Function();
+            }
+
+            static void destroy(void *storage)
+            {
+                static_cast<Function*>(storage)->~Function();
+            }
+
+            static const Operations table;
+        };
+
+        /**
+         * 堆上存放的可调用对象
+         */
+        template <typename Function>
+        struct HeapOperations
+        {
+            static void invoke(void *storage)
+            {
+                (**static_cast<Function**>(storage))();
+            }
+
+            static void move(void *dst, void *src)
+            {
+                *static_cast<Function**>(dst) = *static_cast<Function**>(src);
+            }
+
+            static void destroy(void *storage)
+            {
+                delete *static_cast<Function**>(storage);
+            }
+
+            static const Operations table;
+        };
+
+    public:
+        static const size_t kInlineSize = 48;
+
+        /**
+         * 可调用对象是否可以存放在内部
+         */
+        template <typename Function>
+        struct IsInline
+        {
+            static const bool value = sizeof(Function) <= kInlineSize &&
+                alignof(Function) <= alignof(std::max_align_t) &&
+                std::is_nothrow_move_constructible<Function>::value;
+        };
+
+    public:
+        Task() noexcept
+            : operations_(nullptr)
+        {
+        }
+
+        Task(std::nullptr_t) noexcept
+            : operations_(nullptr)
+        {
+        }
+
+        template <typename Function,
+            typename = typename std::enable_if<!std::is_same<typename std::decay<Function>::type, Task>::value>::type>
+        Task(Function &&func)
+            : operations_(nullptr)
+        {
+            typedef typename std::decay<Function>::type FunctionType;
+            construct<FunctionType>(std::forward<Function>(func), std::integral_constant<bool, IsInline<FunctionType>::value>());
+        }
+
+        Task(Task &&other) noexcept
+            : operations_(other.operations_)
+        {
+            if (operations_ != nullptr)
+            {
+                operations_->move(&storage_, &other.storage_);
+                other.operations_ = nullptr;
+            }
+        }
+
+        Task& operator= (Task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                if (other.operations_ != nullptr)
+                {
+                    other.operations_->move(&storage_, &other.storage_);
+                    operations_ = other.operations_;
+                    other.operations_ = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        ~Task()
+        {
+            reset();
+        }
+
+    public:
+        /**
+         * 是否为空
+         */
+        explicit operator bool() const noexcept
+        {
+            return operations_ != nullptr;
+        }
+
+        /**
+         * 执行任务
+         */
+        void operator() ()
+        {
+            if (operations_ == nullptr)
+            {
+                throw std::bad_function_call();
+            }
+            operations_->invoke(&storage_);
+        }
+
+        /**
+         * 清空任务
+         */
+        void reset() noexcept
+        {
+            if (operations_ != nullptr)
+            {
+                operations_->destroy(&storage_);
+                operations_ = nullptr;
+            }
+        }
+
+    private:
+        template <typename FunctionType, typename Function>
+        void construct(Function &&func, std::true_type)
+        {
+            new (&storage_) FunctionType(std::forward<Function>(func));
+            operations_ = &InlineOperations<FunctionType>::table;
+        }
+
+        template <typename FunctionType, typename Function>
+        void construct(Function &&func, std::false_type)
+        {
+            *reinterpret_cast<FunctionType**>(&storage_) = new FunctionType(std::forward<Function>(func));
+            operations_ = &HeapOperations<FunctionType>::table;
+        }
+
+    private:
+        Task(const Task&) = delete;
+        Task& operator= (const Task&) = delete;
+
+    private:
+        typename std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type storage_;
+        const Operations*                                                           operations_;
+    };
+
+    template <typename Function>
+    const Task::Operations Task::InlineOperations<Function>::table =
+    {
+        &Task::InlineOperations<Function>::invoke,
+        &Task::InlineOperations<Function>::move,
+        &Task::InlineOperations<Function>::destroy,
+    };
+
+    template <typename Function>
+    const Task::Operations Task::HeapOperations<Function>::table =
+    {
+        &Task::HeapOperations<Function>::invoke,
+        &Task::HeapOperations<Function>::move,
+        &Task::HeapOperations<Function>::destroy,
+    };
+}
+
+#endif
@@ -20,9 +20,10 @@ namespace eddyserver
     void TCPClient::connect(asio::ip::tcp::endpoint &endpoint,
         asio::error_code &error_code)
 	{
+		ThreadPointer td = io_thread_manager_.select_thread(&endpoint);
 		MessageFilterPointer filter_ptr = message_filter_creator_();
         SessionPointer session_ptr = std::make_shared<TCPSession>(
-            io_thread_manager_.get_min_load_thread(), filter_ptr);
+            td, filter_ptr);
 		session_ptr->get_socket().connect(endpoint, error_code);
         handle_connect(session_ptr, error_code);
 	}
@@ -31,9 +32,10 @@ namespace eddyserver
     void TCPClient::async_connect(asio::ip::tcp::endpoint &endpoint,
         const std::function<void(asio::error_code)> &cb)
 	{
+		ThreadPointer td = io_thread_manager_.select_thread(&endpoint);
 		MessageFilterPointer filter_ptr = message_filter_creator_();
         SessionPointer session_ptr = std::make_shared<TCPSession>(
-            io_thread_manager_.get_min_load_thread(), filter_ptr);
+            td, filter_ptr);
         session_ptr->get_socket().async_connect(endpoint,
             std::bind(&TCPClient::handle_async_connect, this, session_ptr, cb, std::placeholders::_1));
 	}
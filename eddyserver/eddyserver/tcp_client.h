@@ -6,6 +6,7 @@
 
 namespace eddyserver
 {
+    class ConnectAwaiter;
     class IOServiceThreadManager;
 
     class TCPClient final
@@ -28,6 +29,14 @@ namespace eddyserver
         void async_connect(asio::ip::tcp::endpoint &endpoint,
             const std::function<void(asio::error_code)> &cb);
 
+#if defined(__cpp_impl_coroutine)
+        /**
+         * 发起异步连接请求
+         * 用于协程，co_await得到连接结果，定义在coroutine.h
+         */
+        ConnectAwaiter async_connect(const asio::ip::tcp::endpoint &endpoint);
+#endif
+
     private:
         /**
          * 处理连接结果
@@ -1,49 +1,244 @@
 ﻿#include "tcp_server.h"
+#include <cerrno>
 #include <iostream>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 #include "tcp_session.h"
+#include "load_balancer.h"
 #include "io_service_thread.h"
 #include "tcp_session_handler.h"
 #include "io_service_thread_manager.h"
 
 namespace eddyserver
 {
+    namespace server_stuff
+    {
+        /* 资源耗尽时重新接受连接的延迟 */
+        static const std::chrono::milliseconds kAcceptRetryDelay(100);
+
+        /**
+         * 是否为资源耗尽的错误
+         * 此时立即重试会再次失败，接收器持续就绪导致空转
+         */
+        inline bool IsResourceExhausted(const asio::error_code &error_code)
+        {
+            if (error_code == asio::error::no_descriptors || error_code == asio::error::no_buffer_space
+                || error_code == asio::error::no_memory)
+            {
+                return true;
+            }
+#if !defined(_WIN32)
+            return error_code.category() == asio::error::get_system_category() && error_code.value() == ENFILE;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         * 关闭已从套接字上释放的句柄
+         */
+        inline void CloseHandle(asio::ip::tcp::socket::native_handle_type handle)
+        {
+#if defined(_WIN32)
+            ::closesocket(handle);
+#else
+            ::close(handle);
+#endif
+        }
+
+#ifdef SO_REUSEPORT
+        /**
+         * SO_REUSEPORT选项
+         * 按asio的SettableSocketOption要求实现，用法与asio::socket_base::reuse_address相同
+         */
+        class ReusePort
+        {
+        public:
+            explicit ReusePort(bool enabled)
+                : value_(enabled ? 1 : 0)
+            {
+            }
+
+        public:
+            template <typename Protocol>
+            int level(const Protocol&) const
+            {
+                return SOL_SOCKET;
+            }
+
+            template <typename Protocol>
+            int name(const Protocol&) const
+            {
+                return SO_REUSEPORT;
+            }
+
+            template <typename Protocol>
+            const int* data(const Protocol&) const
+            {
+                return &value_;
+            }
+
+            template <typename Protocol>
+            size_t size(const Protocol&) const
+            {
+                return sizeof(value_);
+            }
+
+        private:
+            int value_;
+        };
+#endif
+    }
+
     TCPServer::TCPServer(asio::ip::tcp::endpoint &endpoint,
         IOServiceThreadManager &io_thread_manager,
         const SessionHandlerCreator &handler_creator,
         const MessageFilterCreator &filter_creator,
-        uint32_t keep_alive_time)
+        uint32_t keep_alive_time,
+        bool reuse_port)
         : keep_alive_time_(keep_alive_time)
+#ifdef SO_REUSEPORT
+        , reuse_port_(reuse_port)
+#else
+        , reuse_port_(false)
+#endif
         , io_thread_manager_(io_thread_manager)
         , session_handler_creator_(handler_creator)
         , message_filter_creator_(filter_creator)
-        , acceptor_(io_thread_manager.get_main_thread()->get_io_service(), endpoint)
     {
+        if (!reuse_port_)
+        {
+            create_acceptor(io_thread_manager_.get_main_thread(), endpoint, false);
+        }
+        else
+        {
+            // 有IO线程时主线程不参与接受连接
+            const size_t first_thread = io_thread_manager_.get_thread_count() > 1 ? 2 : 1;
+            asio::ip::tcp::endpoint local_endpoint = endpoint;
+            for (size_t i = first_thread; i <= io_thread_manager_.get_thread_count(); ++i)
+            {
+                ThreadPointer thread_ptr = io_thread_manager_.get_thread(static_cast<IOThreadID>(i));
+                create_acceptor(thread_ptr, local_endpoint, true);
+
+                // 端口为0时其余接收器使用首个接收器绑定的端口
+                local_endpoint = acceptors_.front()->local_endpoint();
+            }
+        }
+
+        for (size_t i = 0; i < acceptors_.size(); ++i)
+        {
+            start_accept(i);
+        }
+    }
+
+    // 创建接收器
+    void TCPServer::create_acceptor(ThreadPointer &thread_ptr, const asio::ip::tcp::endpoint &endpoint, bool reuse_port)
+    {
+        AcceptorPointer acceptor = std::make_unique<asio::ip::tcp::acceptor>(thread_ptr->get_io_service());
+        acceptor->open(endpoint.protocol());
+        acceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (reuse_port)
+        {
+            acceptor->set_option(server_stuff::ReusePort(true));
+        }
+#endif
+        acceptor->bind(endpoint);
+        acceptor->listen();
+
+        acceptors_.push_back(std::move(acceptor));
+        acceptor_threads_.push_back(thread_ptr);
+    }
+
+    // 开始接受连接
+    void TCPServer::start_accept(size_t index)
+    {
+        if (!reuse_port_ && io_thread_manager_.get_load_balancer()->needs_remote_endpoint())
+        {
+            // 对端地址在接受连接后才能得到，先接受到接收器所在线程的套接字
+            SocketPointer socket_ptr = std::make_shared<asio::ip::tcp::socket>(acceptor_threads_[index]->get_io_service());
+            acceptors_[index]->async_accept(*socket_ptr,
+                std::bind(&TCPServer::handle_accept_socket, this, index, socket_ptr, std::placeholders::_1));
+            return;
+        }
+
+        // 多接收器模式下新连接由接受它的线程管辖
+        ThreadPointer td = reuse_port_ ? acceptor_threads_[index] : io_thread_manager_.select_thread();
         MessageFilterPointer filter_ptr = message_filter_creator_();
-        acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
         SessionPointer session_ptr = std::make_shared<TCPSession>(
-            io_thread_manager_.get_min_load_thread(), filter_ptr, keep_alive_time_);
-        acceptor_.async_accept(session_ptr->get_socket(),
-            std::bind(&TCPServer::handle_accept, this, session_ptr, std::placeholders::_1));
+            td, filter_ptr, keep_alive_time_);
+        acceptors_[index]->async_accept(session_ptr->get_socket(),
+            std::bind(&TCPServer::handle_accept, this, index, session_ptr, std::placeholders::_1));
     }
 
     // 处理接受事件
-    void TCPServer::handle_accept(SessionPointer session_ptr, asio::error_code error_code)
+    void TCPServer::handle_accept(size_t index, SessionPointer session_ptr, asio::error_code error_code)
     {
         if (error_code)
         {
-            std::cerr << error_code.message() << std::endl;
-            assert(false);
+            // 接收器关闭时停止，其余错误只影响这一个连接
+            if (error_code != asio::error::operation_aborted)
+            {
+                restart_accept(index, error_code);
+            }
             return;
         }
 
         SessionHandlePointer handle_ptr = session_handler_creator_();
         io_thread_manager_.on_session_connected(session_ptr, handle_ptr);
+        start_accept(index);
+    }
+
+    // 处理接受事件
+    void TCPServer::handle_accept_socket(size_t index, SocketPointer socket_ptr, asio::error_code error_code)
+    {
+        if (error_code)
+        {
+            if (error_code != asio::error::operation_aborted)
+            {
+                restart_accept(index, error_code);
+            }
+            return;
+        }
 
-        ThreadPointer td = io_thread_manager_.get_min_load_thread();
+        asio::error_code remote_error_code;
+        const asio::ip::tcp::endpoint remote_endpoint = socket_ptr->remote_endpoint(remote_error_code);
+        ThreadPointer td = io_thread_manager_.select_thread(remote_error_code ? nullptr : &remote_endpoint);
         MessageFilterPointer filter_ptr = message_filter_creator_();
-        SessionPointer new_session_ptr = std::make_shared<TCPSession>(
+        SessionPointer session_ptr = std::make_shared<TCPSession>(
             td, filter_ptr, keep_alive_time_);
-        acceptor_.async_accept(new_session_ptr->get_socket(),
-            std::bind(&TCPServer::handle_accept, this, new_session_ptr, std::placeholders::_1));
+
+        // 从原io_service注销后注册到所选线程的io_service
+        const asio::ip::tcp::socket::protocol_type protocol = acceptors_[index]->local_endpoint().protocol();
+        asio::ip::tcp::socket::native_handle_type handle = socket_ptr->release(error_code);
+        if (error_code)
+        {
+            restart_accept(index, error_code);
+            return;
+        }
+
+        // 句柄已脱离原套接字，注册失败时需要自行关闭
+        session_ptr->get_socket().assign(protocol, handle, error_code);
+        if (error_code)
+        {
+            server_stuff::CloseHandle(handle);
+            restart_accept(index, error_code);
+            return;
+        }
+        handle_accept(index, session_ptr, error_code);
+    }
+
+    // 接受连接出错后重新开始接受
+    void TCPServer::restart_accept(size_t index, const asio::error_code &error_code)
+    {
+        std::cerr << error_code.message() << std::endl;
+        if (server_stuff::IsResourceExhausted(error_code))
+        {
+            acceptor_threads_[index]->get_timing_wheel().add(server_stuff::kAcceptRetryDelay,
+                std::bind(&TCPServer::start_accept, this, index));
+            return;
+        }
+        start_accept(index);
     }
 }
@@ -1,6 +1,7 @@
 ﻿#ifndef __TCP_SERVER_H__
 #define __TCP_SERVER_H__
 
+#include <vector>
 #include <asio.hpp>
 #include "types.h"
 
@@ -8,14 +9,36 @@ namespace eddyserver
 {
     class IOServiceThreadManager;
 
+    /**
+     * TCP服务器
+     * 默认由主线程的接收器接受连接，按线程管理器的负载均衡策略为新Session选择IO线程
+     * 多接收器模式下每个IO线程各自接受连接，新Session由接受它的线程管辖，负载均衡策略不生效
+     * 接受连接出错时记录错误并继续接受，只有接收器关闭时停止
+     * 文件描述符或内存耗尽时等待一段时间再接受，避免空转
+     */
     class TCPServer final
     {
+        typedef std::unique_ptr<asio::ip::tcp::acceptor> AcceptorPointer;
+        typedef std::shared_ptr<asio::ip::tcp::socket>   SocketPointer;
+
     public:
+        /**
+         * 构造函数
+         * @param endpoint 监听端点
+         * @param io_thread_manager 线程管理器
+         * @param handler_creator SessionHandler创建器
+         * @param filter_creator 消息过滤器创建器
+         * @param keep_alive_time Session存活时间（秒）
+         * @param reuse_port 多接收器模式，每个IO线程使用SO_REUSEPORT监听同一端点
+         *                   此模式下创建器会在IO线程中调用，需保证线程安全
+         *                   连接由内核分配，不使用线程管理器的负载均衡策略
+         */
         TCPServer(asio::ip::tcp::endpoint &endpoint,
             IOServiceThreadManager &io_thread_manager,
             const SessionHandlerCreator &handler_creator,
             const MessageFilterCreator &filter_creator,
-            uint32_t keep_alive_time = 0);
+            uint32_t keep_alive_time = 0,
+            bool reuse_port = false);
 
     public:
         /**
@@ -23,25 +46,49 @@ namespace eddyserver
          */
         asio::ip::tcp::endpoint get_local_endpoint() const
         {
-            return acceptor_.local_endpoint();
+            return acceptors_.front()->local_endpoint();
         }
 
     private:
+        /**
+         * 创建接收器
+         */
+        void create_acceptor(ThreadPointer &thread_ptr, const asio::ip::tcp::endpoint &endpoint, bool reuse_port);
+
+        /**
+         * 开始接受连接
+         */
+        void start_accept(size_t index);
+
+        /**
+         * 处理接受事件
+         */
+        void handle_accept(size_t index, SessionPointer session_ptr, asio::error_code error_code);
+
         /**
          * 处理接受事件
+         * 按对端地址选择线程，再将套接字转移到所选线程
+         */
+        void handle_accept_socket(size_t index, SocketPointer socket_ptr, asio::error_code error_code);
+
+        /**
+         * 接受连接出错后重新开始接受
+         * 资源耗尽时由接收器所在线程的时间轮延迟重试
          */
-        void handle_accept(SessionPointer session_ptr, asio::error_code error_code);
+        void restart_accept(size_t index, const asio::error_code &error_code);
 
     private:
         TCPServer(const TCPServer&) = delete;
         TCPServer& operator= (const TCPServer&) = delete;
 
     private:
-        const uint32_t          keep_alive_time_;
-        asio::ip::tcp::acceptor acceptor_;
-        IOServiceThreadManager& io_thread_manager_;
-        SessionHandlerCreator   session_handler_creator_;
-        MessageFilterCreator    message_filter_creator_;
+        const uint32_t               keep_alive_time_;
+        const bool                   reuse_port_;
+        std::vector<AcceptorPointer> acceptors_;
+        std::vector<ThreadPointer>   acceptor_threads_;
+        IOServiceThreadManager&      io_thread_manager_;
+        SessionHandlerCreator        session_handler_creator_;
+        MessageFilterCreator         message_filter_creator_;
     };
 }
 
@@ -1,4 +1,5 @@
 ﻿#include "tcp_session.h"
+#include <cstring>
 #include <iostream>
 #include <asio/read.hpp>
 #include <asio/write.hpp>
@@ -11,71 +12,54 @@ namespace eddyserver
 {
     namespace session_stuff
     {
-        typedef std::shared_ptr< std::vector<NetMessage> > NetMessageVecPointer;
-
         /**
-         * 发送消息列表到SessionHandler
+         * 缓冲区序列引用
+         * 避免异步写入时拷贝整个缓冲区序列
          */
-        void SendMessageListToHandler(IOServiceThreadManager &manager,
-            TCPSessionID id,
-            NetMessageVecPointer messages_received)
+        class BufferSequenceRef
         {
-            SessionHandlePointer handler_ptr = manager.get_session_handler(id);
-            if (handler_ptr != nullptr)
+        public:
+            typedef asio::const_buffer value_type;
+            typedef std::vector<asio::const_buffer>::const_iterator const_iterator;
+
+        public:
+            explicit BufferSequenceRef(const std::vector<asio::const_buffer> &buffers)
+                : buffers_(&buffers)
             {
-                for (size_t i = 0; i < messages_received->size(); ++i)
-                {
-                    handler_ptr->on_message(messages_received->at(i));
-                }
             }
-        }
 
-        /**
-         * 投递消息列表到主线程操作
-         */
-        void PackMessageList(SessionPointer session_ptr)
-        {
-            if (!session_ptr->get_messages_received().empty())
+            const_iterator begin() const
             {
-                NetMessageVecPointer messages_received = std::make_shared< std::vector<NetMessage> >();
-                *messages_received = std::move(session_ptr->get_messages_received());
-                session_ptr->get_io_thread()->get_thread_manager().get_main_thread()->post(std::bind(
-                    SendMessageListToHandler,
-                    std::ref(session_ptr->get_io_thread()->get_thread_manager()),
-                    session_ptr->get_id(),
-                    messages_received
-                ));
+                return buffers_->begin();
             }
-        }
 
-        /**
-         * 直接发送消息列表到SessionHandler
-         */
-        void SendMessageListDirectly(SessionPointer session_ptr)
-        {
-            SessionHandlePointer handler_ptr = session_ptr->get_io_thread()->get_thread_manager().get_session_handler(session_ptr->get_id());
-            if (handler_ptr != nullptr)
+            const_iterator end() const
             {
-                std::vector<NetMessage> &messages_received = session_ptr->get_messages_received();
-                for (size_t i = 0; i < messages_received.size(); ++i)
-                {
-                    handler_ptr->on_message(messages_received[i]);
-                }
-                messages_received.clear();
+                return buffers_->end();
             }
-        }
+
+        private:
+            const std::vector<asio::const_buffer> *buffers_;
+        };
     }
 
     TCPSession::TCPSession(ThreadPointer &td, MessageFilterPointer &filter, uint32_t keep_alive_time)
         : closed_(true)
+        , migrating_(false)
+        , read_resumed_(false)
+        , num_read_handlers_(0)
+        , num_write_handlers_(0)
         , session_id_(0)
+        , socket_(std::make_unique<SocketType>(td->get_io_service()))
         , io_thread_(td)
+        , owner_thread_(td.get())
+        , recent_bytes_(0)
+        , close_timer_(0)
+        , keep_alive_timer_(0)
         , msg_filter_(filter)
-        , num_read_handlers_(0)
-        , num_write_handlers_(0)
-        , socket_(td->get_io_service())
+        , bytes_wanna_read_(0)
+        , bytes_received_(0)
         , keep_alive_time_(keep_alive_time)
-        , close_timer_(td->get_io_service())
     {
     }
 
@@ -88,29 +72,61 @@ namespace eddyserver
         session_id_ = id;
         SessionPointer self = shared_from_this();
         io_thread_->get_session_queue().add(self);
-        last_activity_time_ = std::chrono::steady_clock::now();
+        last_activity_time_ = io_thread_->get_timing_wheel().now();
+        if (keep_alive_time_.count() > 0)
+        {
+            keep_alive_timer_ = io_thread_->get_timing_wheel().add(keep_alive_time_,
+                std::bind(&TCPSession::handle_keep_alive, shared_from_this()));
+        }
 
         asio::ip::tcp::no_delay option(true);
-        socket_.set_option(option);
+        socket_->set_option(option);
+
+        start_read();
+    }
 
-        size_t bytes_wanna_read = msg_filter_->bytes_wanna_read();
-        if (bytes_wanna_read == 0)
+    // 发起读操作
+    void TCPSession::start_read()
+    {
+        // 迁移时被取消的定长读取保留已读取的部分，继续读取剩余数据
+        if (bytes_received_ == 0 || bytes_wanna_read_ == MessageFilterInterface::stream_bytes())
+        {
+            bytes_wanna_read_ = msg_filter_->bytes_wanna_read();
+        }
+        if (bytes_wanna_read_ == 0)
         {
             return;
         }
 
         ++num_read_handlers_;
-        if (bytes_wanna_read == MessageFilterInterface::any_bytes())
+        if (bytes_wanna_read_ == MessageFilterInterface::stream_bytes())
+        {
+            if (buffer_receiving_.size() < kStreamBufferSize)
+            {
+                buffer_receiving_.resize(kStreamBufferSize);
+            }
+            else if (bytes_received_ == buffer_receiving_.size())
+            {
+                // 缓存已满但仍不足一条完整消息
+                buffer_receiving_.resize(buffer_receiving_.size() * 2);
+            }
+            socket_->async_read_some(asio::buffer(buffer_receiving_.data() + bytes_received_, buffer_receiving_.size() - bytes_received_),
+                make_alloc_handler(read_memory_,
+                    std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+        }
+        else if (bytes_wanna_read_ == MessageFilterInterface::any_bytes())
         {
             buffer_receiving_.resize(NetMessage::kDynamicThreshold);
-            socket_.async_read_some(asio::buffer(buffer_receiving_.data(), buffer_receiving_.size()),
-                std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            socket_->async_read_some(asio::buffer(buffer_receiving_.data(), buffer_receiving_.size()),
+                make_alloc_handler(read_memory_,
+                    std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
         }
         else
         {
-            buffer_receiving_.resize(bytes_wanna_read);
-            asio::async_read(socket_, asio::buffer(buffer_receiving_.data(), bytes_wanna_read),
-                std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            buffer_receiving_.resize(bytes_wanna_read_);
+            asio::async_read(*socket_, asio::buffer(buffer_receiving_.data() + bytes_received_, bytes_wanna_read_ - bytes_received_),
+                make_alloc_handler(read_memory_,
+                    std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
         }
     }
 
@@ -124,36 +140,44 @@ namespace eddyserver
 
         if (io_thread_->get_session_queue().get(get_id()) != nullptr)
         {
-            io_thread_->get_thread_manager().get_main_thread()->post(
-                std::bind(&IOServiceThreadManager::on_session_closed, &io_thread_->get_thread_manager(), get_id()));
+            IOServiceThreadManager &manager = io_thread_->get_thread_manager();
+            manager.get_handler_thread(io_thread_)->post(
+                std::bind(&IOServiceThreadManager::on_session_closed, &manager, get_id(), io_thread_->get_id()));
 
             asio::error_code error_code;
-            socket_.shutdown(asio::ip::tcp::socket::shutdown_send, error_code);
+            socket_->shutdown(asio::ip::tcp::socket::shutdown_send, error_code);
             if (error_code && error_code != asio::error::not_connected)
             {
                 std::cerr << error_code.message() << std::endl;
             }
             io_thread_->get_session_queue().remove(get_id());
 
+            if (keep_alive_timer_ != 0)
+            {
+                io_thread_->get_timing_wheel().cancel(keep_alive_timer_);
+                keep_alive_timer_ = 0;
+            }
+
             buffer_receiving_.resize(NetMessage::kDynamicThreshold);
-            socket_.async_read_some(asio::buffer(buffer_receiving_.data(), buffer_receiving_.size()),
-                std::bind(&TCPSession::handle_safe_close, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            socket_->async_read_some(asio::buffer(buffer_receiving_.data(), buffer_receiving_.size()),
+                make_alloc_handler(close_memory_,
+                    std::bind(&TCPSession::handle_safe_close, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
 
-            close_timer_.expires_from_now(std::chrono::seconds(5));
-            close_timer_.async_wait([=](asio::error_code error)
-            {
-                if (error != asio::error::operation_aborted)
-                {
-                    socket_.cancel();
-                    socket_.close();
-                }
-            });
+            close_timer_ = io_thread_->get_timing_wheel().add(std::chrono::seconds(5),
+                std::bind(&TCPSession::handle_close_timeout, shared_from_this()));
         }
     }
 
     // 关闭会话
     void TCPSession::close()
     {
+        IOServiceThread *owner_thread = get_owner_thread();
+        if (!owner_thread->running_in_this_thread())
+        {
+            owner_thread->post(std::bind(&TCPSession::close, shared_from_this()));
+            return;
+        }
+
         if (closed_)
         {
             return;
@@ -162,14 +186,27 @@ namespace eddyserver
         hanlde_close();
     }
 
-    // 检查Session存活
-    bool TCPSession::check_keep_alive()
+    // 处理存活检查
+    void TCPSession::handle_keep_alive()
     {
-        if (keep_alive_time_.count() == 0)
+        keep_alive_timer_ = 0;
+        if (closed_)
         {
-            return true;
+            return;
+        }
+
+        // 期间有活动则按剩余时间重新计时
+        TimingWheel &timing_wheel = io_thread_->get_timing_wheel();
+        TimingWheel::TimePoint expire_time = last_activity_time_ + keep_alive_time_;
+        if (timing_wheel.now() >= expire_time)
+        {
+            close();
+            return;
         }
-        return std::chrono::steady_clock::now() - last_activity_time_ < keep_alive_time_;
+
+        keep_alive_timer_ = timing_wheel.add(
+            std::chrono::duration_cast<std::chrono::milliseconds>(expire_time - timing_wheel.now()),
+            std::bind(&TCPSession::handle_keep_alive, shared_from_this()));
     }
 
     // 投递消息列表
@@ -180,21 +217,255 @@ namespace eddyserver
             return;
         }
 
-        size_t bytes_wanna_write = msg_filter_->bytes_wanna_write(messages);
-        if (bytes_wanna_write == 0)
+        io_thread_->add_traffic(0, messages.size());
+        if (msg_filter_->supports_gather_write())
+        {
+            messages_to_be_sent_.insert(messages_to_be_sent_.end(), messages.begin(), messages.end());
+        }
+        else
+        {
+            size_t bytes_wanna_write = msg_filter_->bytes_wanna_write(messages);
+            if (bytes_wanna_write == 0)
+            {
+                close_on_write_error();
+                return;
+            }
+
+            buffer_to_be_sent_.reserve(buffer_to_be_sent_.size() + bytes_wanna_write);
+            msg_filter_->write(messages, buffer_to_be_sent_);
+        }
+
+        if (num_write_handlers_ == 0)
+        {
+            start_write();
+        }
+    }
+
+    void TCPSession::post_message_list(std::vector<NetMessage> &&messages)
+    {
+        if (closed_ || messages.empty())
+        {
+            return;
+        }
+
+        if (!msg_filter_->supports_gather_write())
+        {
+            post_message_list(static_cast<const std::vector<NetMessage>&>(messages));
+            return;
+        }
+
+        io_thread_->add_traffic(0, messages.size());
+
+        if (messages_to_be_sent_.empty())
+        {
+            messages_to_be_sent_.swap(messages);
+        }
+        else
+        {
+            messages_to_be_sent_.insert(messages_to_be_sent_.end(),
+                std::make_move_iterator(messages.begin()), std::make_move_iterator(messages.end()));
+        }
+
+        if (num_write_handlers_ == 0)
+        {
+            start_write();
+        }
+    }
+
+    // 投递消息到发送信箱
+    void TCPSession::push_message(const NetMessage &message)
+    {
+        if (mailbox_.push(MailboxMessage(message, false)))
+        {
+            get_owner_thread()->post(make_alloc_handler(mailbox_memory_,
+                std::bind(&TCPSession::handle_mailbox, shared_from_this())));
+        }
+    }
+
+    // 投递链式消息到发送信箱
+    void TCPSession::push_chain(const ChainedMessage &message)
+    {
+        if (mailbox_.push(MailboxMessage(message)))
+        {
+            get_owner_thread()->post(make_alloc_handler(mailbox_memory_,
+                std::bind(&TCPSession::handle_mailbox, shared_from_this())));
+        }
+    }
+
+    // 编码广播帧
+    void TCPSession::write_frame(const NetMessage &message, NetMessage &frame, const std::type_info *&frame_filter) const
+    {
+        if (frame_filter == nullptr && msg_filter_->write_frame(message, frame))
+        {
+            frame_filter = &typeid(*msg_filter_);
+        }
+    }
+
+    // 投递广播帧到发送信箱
+    bool TCPSession::push_frame(const NetMessage &message, const NetMessage &frame, const std::type_info *frame_filter)
+    {
+        const bool framed = frame_filter != nullptr && typeid(*msg_filter_) == *frame_filter;
+        return mailbox_.push(MailboxMessage(framed ? frame : message, framed));
+    }
+
+    // 处理发送信箱
+    void TCPSession::handle_mailbox()
+    {
+        // 迁移前投递到原线程的请求转到新线程处理
+        IOServiceThread *owner_thread = get_owner_thread();
+        if (!owner_thread->running_in_this_thread())
+        {
+            owner_thread->post(make_alloc_handler(mailbox_memory_,
+                std::bind(&TCPSession::handle_mailbox, shared_from_this())));
+            return;
+        }
+
+        mailbox_.consume_all([this](MailboxMessage &item)
+        {
+            if (item.chain != nullptr)
+            {
+                post_message_list(std::move(messages_from_mailbox_));
+                messages_from_mailbox_.clear();
+                post_chain(*item.chain);
+            }
+            else if (item.framed)
+            {
+                post_message_list(std::move(messages_from_mailbox_));
+                messages_from_mailbox_.clear();
+                post_frame(item.message);
+            }
+            else
+            {
+                messages_from_mailbox_.push_back(std::move(item.message));
+            }
+        });
+
+        post_message_list(std::move(messages_from_mailbox_));
+        messages_from_mailbox_.clear();
+    }
+
+    // 投递广播帧
+    void TCPSession::post_frame(const NetMessage &frame)
+    {
+        if (closed_)
+        {
+            return;
+        }
+
+        flush_to_frames();
+        io_thread_->add_traffic(0, 1);
+        frames_to_be_sent_.push_back(frame);
+
+        if (num_write_handlers_ == 0)
+        {
+            start_write();
+        }
+    }
+
+    // 投递链式消息
+    void TCPSession::post_chain(const ChainedMessage &message)
+    {
+        if (closed_)
+        {
+            return;
+        }
+
+        NetMessage header;
+        if (!msg_filter_->write_chain_header(message, header))
+        {
+            post_message_list(NetMessageVector(1, message.flatten()));
+            return;
+        }
+
+        flush_to_frames();
+        io_thread_->add_traffic(0, 1);
+        frames_to_be_sent_.push_back(std::move(header));
+        for (size_t i = 0; i < message.chunk_count(); ++i)
+        {
+            frames_to_be_sent_.push_back(message.chunk(i));
+        }
+
+        if (num_write_handlers_ == 0)
+        {
+            start_write();
+        }
+    }
+
+    // 编码尚未发送的消息为帧
+    void TCPSession::flush_to_frames()
+    {
+        if (!messages_to_be_sent_.empty())
+        {
+            msg_filter_->write(messages_to_be_sent_, buffer_to_be_sent_);
+            messages_to_be_sent_.clear();
+        }
+        if (!buffer_to_be_sent_.empty())
+        {
+            frames_to_be_sent_.emplace_back(reinterpret_cast<const char*>(buffer_to_be_sent_.data()), buffer_to_be_sent_.size());
+            buffer_to_be_sent_.clear();
+        }
+    }
+
+    // 分发收到的消息到SessionHandler
+    void TCPSession::handle_dispatch()
+    {
+        SessionHandlePointer handler_ptr = io_thread_->get_session_handler(get_id());
+        if (handler_ptr != nullptr)
+        {
+            handler_ptr->dispatch(messages_received_, chains_received_);
+        }
+        messages_received_.clear();
+        chains_received_.clear();
+    }
+
+    // 发起写操作
+    void TCPSession::start_write()
+    {
+        assert(num_write_handlers_ == 0);
+        if (migrating_)
         {
             return;
         }
 
-        buffer_to_be_sent_.reserve(buffer_to_be_sent_.size() + bytes_wanna_write);
-        msg_filter_->write(messages, buffer_to_be_sent_);
+        if (!frames_to_be_sent_.empty())
+        {
+            // 广播帧由多个Session共享，缓冲区序列只引用不修改
+            frames_sending_.swap(frames_to_be_sent_);
+            for (size_t i = 0; i < frames_sending_.size(); ++i)
+            {
+                const NetMessage &frame = frames_sending_[i];
+                buffers_sending_.push_back(asio::buffer(frame.data(), frame.readable()));
+            }
 
-        if (buffer_sending_.empty())
+            ++num_write_handlers_;
+            asio::async_write(*socket_, session_stuff::BufferSequenceRef(buffers_sending_),
+                make_alloc_handler(write_memory_,
+                    std::bind(&TCPSession::hanlde_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+        }
+        else if (!messages_to_be_sent_.empty())
+        {
+            // 写入完成前保持消息存活，缓冲区序列直接引用消息体
+            messages_sending_.swap(messages_to_be_sent_);
+            msg_filter_->write_gather(messages_sending_, buffer_sending_, buffers_sending_);
+            if (buffers_sending_.empty())
+            {
+                messages_sending_.clear();
+                close_on_write_error();
+                return;
+            }
+
+            ++num_write_handlers_;
+            asio::async_write(*socket_, session_stuff::BufferSequenceRef(buffers_sending_),
+                make_alloc_handler(write_memory_,
+                    std::bind(&TCPSession::hanlde_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+        }
+        else if (!buffer_to_be_sent_.empty())
         {
             ++num_write_handlers_;
             buffer_sending_.swap(buffer_to_be_sent_);
-            asio::async_write(socket_, asio::buffer(buffer_sending_.data(), bytes_wanna_write),
-                std::bind(&TCPSession::hanlde_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            asio::async_write(*socket_, asio::buffer(buffer_sending_.data(), buffer_sending_.size()),
+                make_alloc_handler(write_memory_,
+                    std::bind(&TCPSession::hanlde_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
         }
     }
 
@@ -204,6 +475,24 @@ namespace eddyserver
         --num_read_handlers_;
         assert(num_read_handlers_ >= 0);
 
+        if (migrating_ && !closed_ && error_code == asio::error::operation_aborted)
+        {
+            // 迁移取消的读操作，保留已读取的数据
+            bytes_received_ += bytes_transferred;
+            try_migrate();
+            return;
+        }
+
+        // 为重新解析取消的读操作，按正常完成处理已读取的数据
+        if (read_resumed_)
+        {
+            read_resumed_ = false;
+            if (!closed_ && error_code == asio::error::operation_aborted)
+            {
+                error_code.clear();
+            }
+        }
+
         if (error_code || closed_)
         {
             closed_ = true;
@@ -211,49 +500,83 @@ namespace eddyserver
             return;
         }
 
-        bool wanna_post = messages_received_.empty();
-        size_t bytes_read = msg_filter_->read(buffer_receiving_, messages_received_);
-        assert(bytes_read == bytes_transferred);
-        if (bytes_read != bytes_transferred)
+        // 上一次投递走的列表在读取之前才换回，给处理线程归还列表留出时间
+        if (messages_received_.capacity() == 0)
         {
-            std::cerr << "bytes_read: " << bytes_read << " bytes_transferred: " << bytes_transferred << std::endl;
+            io_thread_->reuse_message_list(messages_received_);
         }
 
-        buffer_receiving_.clear();
-        wanna_post = wanna_post && !messages_received_.empty();
+        bool wanna_post = messages_received_.empty() && chains_received_.empty();
+        const size_t num_messages = messages_received_.size() + chains_received_.size();
+        if (bytes_wanna_read_ == MessageFilterInterface::stream_bytes())
+        {
+            bytes_received_ += bytes_transferred;
+            size_t bytes_read = msg_filter_->read_stream(buffer_receiving_.data(), bytes_received_, messages_received_);
+
+            // 读完一条链式消息时过滤器立即返回，取出后继续解析剩余的数据
+            ChainedMessage chain;
+            while (msg_filter_->take_chained_message(chain))
+            {
+                chains_received_.push_back(ReceivedChain{ messages_received_.size(), std::move(chain) });
+                bytes_read += msg_filter_->read_stream(buffer_receiving_.data() + bytes_read, bytes_received_ - bytes_read, messages_received_);
+            }
+            assert(bytes_read <= bytes_received_);
+            bytes_received_ -= bytes_read;
+
+            // 将不完整的消息移到缓存头部
+            if (bytes_read > 0 && bytes_received_ > 0)
+            {
+                memmove(buffer_receiving_.data(), buffer_receiving_.data() + bytes_read, bytes_received_);
+            }
+        }
+        else
+        {
+            bytes_transferred += bytes_received_;
+            bytes_received_ = 0;
+            size_t bytes_read = msg_filter_->read(buffer_receiving_, messages_received_);
+            assert(bytes_read == bytes_transferred);
+            if (bytes_read != bytes_transferred)
+            {
+                std::cerr << "bytes_read: " << bytes_read << " bytes_transferred: " << bytes_transferred << std::endl;
+            }
+            buffer_receiving_.clear();
+        }
+
+        recent_bytes_ += bytes_transferred;
+        io_thread_->add_traffic(bytes_transferred, messages_received_.size() + chains_received_.size() - num_messages);
+        wanna_post = wanna_post && (!messages_received_.empty() || !chains_received_.empty());
 
         if (wanna_post)
         {
-            if (io_thread_->get_id() == io_thread_->get_thread_manager().get_main_thread()->get_id())
+            ThreadPointer &handler_thread = io_thread_->get_thread_manager().get_handler_thread(io_thread_);
+            if (handler_thread == io_thread_)
             {
-                io_thread_->post(std::bind(session_stuff::SendMessageListDirectly, shared_from_this()));
+                io_thread_->post(make_alloc_handler(dispatch_memory_,
+                    std::bind(&TCPSession::handle_dispatch, shared_from_this())));
             }
             else
             {
-                io_thread_->post(std::bind(session_stuff::PackMessageList, shared_from_this()));
+                handler_thread->post_messages(*io_thread_, get_id(), std::move(messages_received_), std::move(chains_received_));
+                messages_received_.clear();
+                chains_received_.clear();
             }
-            last_activity_time_ = std::chrono::steady_clock::now();
+            last_activity_time_ = io_thread_->get_timing_wheel().now();
         }
 
-        size_t bytes_wanna_read = msg_filter_->bytes_wanna_read();
-        if (bytes_wanna_read == 0)
+        // 已读取的消息先于关闭事件投递
+        if (msg_filter_->has_error())
         {
+            closed_ = true;
+            hanlde_close();
             return;
         }
 
-        ++num_read_handlers_;
-        if (bytes_wanna_read == MessageFilterInterface::any_bytes())
-        {
-            buffer_receiving_.resize(NetMessage::kDynamicThreshold);
-            socket_.async_read_some(asio::buffer(&*buffer_receiving_.begin(), buffer_receiving_.size()),
-                std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
-        }
-        else
+        if (migrating_)
         {
-            buffer_receiving_.resize(bytes_wanna_read);
-            asio::async_read(socket_, asio::buffer(buffer_receiving_.data(), bytes_wanna_read),
-                std::bind(&TCPSession::handle_read, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            try_migrate();
+            return;
         }
+        start_read();
     }
 
     // 处理写
@@ -269,17 +592,54 @@ namespace eddyserver
             return;
         }
 
+        recent_bytes_ += bytes_transferred;
+        io_thread_->add_traffic(bytes_transferred, 0);
         buffer_sending_.clear();
+        buffers_sending_.clear();
+        messages_sending_.clear();
+        frames_sending_.clear();
+
+        if (close_on_write_error())
+        {
+            return;
+        }
+
+        // 写入改变了读取的协议，取消读操作，在读取的回调中重新解析暂缓的数据
+        if (!migrating_ && num_read_handlers_ > 0 && msg_filter_->take_read_resumed())
+        {
+            read_resumed_ = true;
+            cancel_read();
+        }
 
-        if (buffer_to_be_sent_.empty())
+        // 写入完成后再取消读取，避免丢失已部分写入的数据
+        if (migrating_)
         {
+            cancel_read();
+            try_migrate();
             return;
         }
+        start_write();
+    }
 
-        ++num_write_handlers_;
-        buffer_sending_.swap(buffer_to_be_sent_);
-        asio::async_write(socket_, asio::buffer(buffer_sending_.data(), buffer_sending_.size()),
-            std::bind(&TCPSession::hanlde_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    // 写入了无法编码的消息时关闭连接，此前已编码的消息先发送完成
+    bool TCPSession::close_on_write_error()
+    {
+        if (closed_ || num_write_handlers_ > 0 || !msg_filter_->has_error())
+        {
+            return false;
+        }
+
+        closed_ = true;
+        hanlde_close();
+        return true;
+    }
+
+    // 处理关闭超时
+    void TCPSession::handle_close_timeout()
+    {
+        close_timer_ = 0;
+        socket_->cancel();
+        socket_->close();
     }
 
     // 处理安全关闭
@@ -289,15 +649,136 @@ namespace eddyserver
         {        
             if (error_code != asio::error::operation_aborted)
             {
-                close_timer_.cancel();
-                socket_.close();
+                io_thread_->get_timing_wheel().cancel(close_timer_);
+                close_timer_ = 0;
+                socket_->close();
             }        
         }
         else
         {
             buffer_receiving_.resize(NetMessage::kDynamicThreshold);
-            socket_.async_read_some(asio::buffer(buffer_receiving_.data(), buffer_receiving_.size()),
-                std::bind(&TCPSession::handle_safe_close, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            socket_->async_read_some(asio::buffer(buffer_receiving_.data(), buffer_receiving_.size()),
+                make_alloc_handler(close_memory_,
+                    std::bind(&TCPSession::handle_safe_close, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+        }
+    }
+
+    // 迁移到其它IO线程
+    void TCPSession::migrate(ThreadPointer target)
+    {
+        if (closed_ || migrating_ || target == nullptr || target == io_thread_)
+        {
+            return;
         }
+
+        migrating_ = true;
+        migrate_target_ = target;
+        if (num_write_handlers_ == 0)
+        {
+            cancel_read();
+        }
+        try_migrate();
+    }
+
+    // 取消读操作
+    void TCPSession::cancel_read()
+    {
+        if (num_read_handlers_ > 0)
+        {
+            asio::error_code error_code;
+            socket_->cancel(error_code);
+        }
+    }
+
+    // 尝试迁移
+    void TCPSession::try_migrate()
+    {
+        if (num_read_handlers_ > 0 || num_write_handlers_ > 0)
+        {
+            return;
+        }
+
+        // 排在已投递的消息分发之后执行
+        io_thread_->post(std::bind(&TCPSession::handle_migrate, shared_from_this()));
+    }
+
+    // 处理迁移
+    void TCPSession::handle_migrate()
+    {
+        ThreadPointer target = std::move(migrate_target_);
+        migrate_target_.reset();
+        if (closed_)
+        {
+            migrating_ = false;
+            return;
+        }
+
+        asio::error_code error_code;
+        asio::ip::tcp::socket::native_handle_type handle = socket_->native_handle();
+        const asio::ip::tcp::socket::protocol_type protocol = socket_->local_endpoint(error_code).protocol();
+        if (!error_code)
+        {
+            handle = socket_->release(error_code);
+        }
+
+        if (error_code)
+        {
+            // 无法转移时留在原线程继续读写
+            std::cerr << error_code.message() << std::endl;
+            migrating_ = false;
+            start_read();
+            start_write();
+            return;
+        }
+
+        if (keep_alive_timer_ != 0)
+        {
+            io_thread_->get_timing_wheel().cancel(keep_alive_timer_);
+            keep_alive_timer_ = 0;
+        }
+        io_thread_->get_session_queue().remove(get_id());
+        io_thread_->get_thread_manager().on_session_migrating(get_id(), io_thread_, target);
+
+        io_thread_ = target;
+        io_thread_->post(std::bind(&TCPSession::handle_migrated, shared_from_this(), protocol, handle));
+        owner_thread_.store(io_thread_.get(), std::memory_order_release);
+
+        // 按所在线程表投递的广播排在handle_migrated之后
+        io_thread_->get_thread_manager().set_session_owner(get_id(), io_thread_->get_id());
+    }
+
+    // 处理迁移完成
+    void TCPSession::handle_migrated(asio::ip::tcp::socket::protocol_type protocol, asio::ip::tcp::socket::native_handle_type handle)
+    {
+        assert(io_thread_->running_in_this_thread());
+        migrating_ = false;
+        SessionPointer self = shared_from_this();
+        io_thread_->get_session_queue().add(self);
+
+        asio::error_code error_code;
+        socket_ = std::make_unique<SocketType>(io_thread_->get_io_service());
+        socket_->assign(protocol, handle, error_code);
+        if (error_code)
+        {
+            std::cerr << error_code.message() << std::endl;
+            close();
+            return;
+        }
+
+        // 存活检查按剩余时间计时
+        if (keep_alive_time_.count() > 0)
+        {
+            TimingWheel &timing_wheel = io_thread_->get_timing_wheel();
+            TimingWheel::TimePoint expire_time = last_activity_time_ + keep_alive_time_;
+            std::chrono::milliseconds delay(0);
+            if (expire_time > timing_wheel.now())
+            {
+                delay = std::chrono::duration_cast<std::chrono::milliseconds>(expire_time - timing_wheel.now());
+            }
+            keep_alive_timer_ = timing_wheel.add(delay, std::bind(&TCPSession::handle_keep_alive, shared_from_this()));
+        }
+
+        start_read();
+        start_write();
     }
 }
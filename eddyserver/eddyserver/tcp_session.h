@@ -1,21 +1,56 @@
 ﻿#ifndef __TCP_SESSION_H__
 #define __TCP_SESSION_H__
 
+#include <atomic>
 #include <chrono>
+#include <typeinfo>
 #include <asio/ip/tcp.hpp>
 #include "types.h"
 #include "net_message.h"
+#include "mpsc_queue.h"
+#include "chained_message.h"
+#include "timing_wheel.h"
+#include "handler_allocator.h"
 
 namespace eddyserver
 {
     class TCPSession final : public std::enable_shared_from_this< TCPSession >
     {
+        friend class SessionGroup;
         friend class IOServiceThread;
         friend class IOServiceThreadManager;
 
         typedef asio::ip::tcp::socket SocketType;
         typedef std::chrono::steady_clock::time_point TimePoint;
 
+        /**
+         * 信箱中的消息
+         * 广播帧已由过滤器编码，直接发送
+         * 链式消息不为空时按链式消息发送
+         */
+        struct MailboxMessage
+        {
+            NetMessage                      message;
+            bool                            framed;
+            std::unique_ptr<ChainedMessage> chain;
+
+            MailboxMessage(const NetMessage &msg, bool is_framed)
+                : message(msg)
+                , framed(is_framed)
+            {
+            }
+
+            explicit MailboxMessage(const ChainedMessage &chained_message)
+                : framed(false)
+                , chain(std::make_unique<ChainedMessage>(chained_message))
+            {
+            }
+        };
+
+    public:
+        /* 流式读取缓存初始大小 */
+        static const size_t kStreamBufferSize = 16 * 1024;
+
     public:
         TCPSession(ThreadPointer &td, MessageFilterPointer &filter, uint32_t keep_alive_time = 0);
 
@@ -25,7 +60,7 @@ namespace eddyserver
          */
         SocketType& get_socket()
         {
-            return socket_;
+            return *socket_;
         }
 
         /**
@@ -36,14 +71,41 @@ namespace eddyserver
             return session_id_;
         }
 
+        /**
+         * 获取消息过滤器
+         * 过滤器在构造时确定，可在任意线程调用write_frame
+         */
+        const MessageFilterPointer& get_message_filter() const
+        {
+            return msg_filter_;
+        }
+
         /**
          * 获取线程
+         * 只能在Session所属的IO线程中调用
          */
         ThreadPointer& get_io_thread()
         {
             return io_thread_;
         }
 
+        /**
+         * 获取所属的IO线程
+         * 可在任意线程调用，迁移后返回新的线程
+         */
+        IOServiceThread* get_owner_thread() const
+        {
+            return owner_thread_.load(std::memory_order_acquire);
+        }
+
+        /**
+         * 是否正在迁移
+         */
+        bool is_migrating() const
+        {
+            return migrating_;
+        }
+
         /**
          * 获取收到的消息列表
          */
@@ -56,12 +118,34 @@ namespace eddyserver
          * 投递消息列表
          */
         void post_message_list(const std::vector<NetMessage> &messages);
+        void post_message_list(std::vector<NetMessage> &&messages);
+
+        /**
+         * 投递消息到发送信箱
+         * 可在任意线程调用，信箱由空变为非空时唤醒IO线程
+         */
+        void push_message(const NetMessage &message);
+
+        /**
+         * 投递链式消息到发送信箱
+         * 可在任意线程调用，各块不拷贝，按顺序紧跟在消息头后发送
+         */
+        void push_chain(const ChainedMessage &message);
 
         /**
          * 关闭Session
+         * 不在所属的IO线程中调用时转到所属的IO线程执行
          */
         void close();
 
+        /**
+         * 迁移到其它IO线程
+         * 在所属的IO线程中调用，等待写入完成并取消读取后转移socket
+         * 已读取的数据和待发送的消息随Session一起迁移
+         * @param target 目标IO线程
+         */
+        void migrate(ThreadPointer target);
+
     private:
         /**
          * 初始化
@@ -69,11 +153,70 @@ namespace eddyserver
         void init(TCPSessionID id);
 
         /**
-         * 检查Session存活
+         * 处理存活检查
          */
-        bool check_keep_alive();
+        void handle_keep_alive();
 
     private:
+        /**
+         * 发起读操作
+         */
+        void start_read();
+
+        /**
+         * 发起写操作
+         */
+        void start_write();
+
+        /**
+         * 处理发送信箱
+         */
+        void handle_mailbox();
+
+        /**
+         * 编码广播帧
+         * 还没有编码时使用此Session的过滤器编码，过滤器编码时不读写自身状态，可在任意线程调用
+         * @param message 消息
+         * @param frame 编码后的帧
+         * @param frame_filter 编码帧的过滤器类型，编码成功后更新
+         */
+        void write_frame(const NetMessage &message, NetMessage &frame, const std::type_info *&frame_filter) const;
+
+        /**
+         * 投递广播帧到发送信箱
+         * 过滤器与编码帧的过滤器同类时发送共享的帧，否则按普通消息发送
+         * 可在任意线程调用，由调用者唤醒IO线程
+         * @param message 消息
+         * @param frame 编码后的帧
+         * @param frame_filter 编码帧的过滤器类型，未编码时为nullptr
+         * @return 信箱是否由空变为非空
+         */
+        bool push_frame(const NetMessage &message, const NetMessage &frame, const std::type_info *frame_filter);
+
+        /**
+         * 投递广播帧
+         * 先编码尚未发送的消息，保证发送顺序
+         */
+        void post_frame(const NetMessage &frame);
+
+        /**
+         * 投递链式消息
+         * 消息头和各块作为帧依次发送，过滤器不支持时合并为连续的消息
+         */
+        void post_chain(const ChainedMessage &message);
+
+        /**
+         * 编码尚未发送的消息为帧
+         * 发送广播帧或链式消息前调用，保证发送顺序
+         */
+        void flush_to_frames();
+
+        /**
+         * 分发收到的消息到SessionHandler
+         * SessionHandler与Session在同一线程时使用
+         */
+        void handle_dispatch();
+
         /**
          * 处理读
          */
@@ -89,30 +232,96 @@ namespace eddyserver
          */
         void hanlde_close();
 
+        /**
+         * 写入出错时关闭
+         * @return 是否已关闭
+         */
+        bool close_on_write_error();
+
+        /**
+         * 处理关闭超时
+         */
+        void handle_close_timeout();
+
         /**
          * 处理安全关闭
          */
         void handle_safe_close(asio::error_code error_code, size_t bytes_transferred);
 
+        /**
+         * 取消读操作
+         */
+        void cancel_read();
+
+        /**
+         * 尝试迁移
+         * 没有未完成的读写操作时开始转移
+         */
+        void try_migrate();
+
+        /**
+         * 处理迁移
+         * 在原IO线程中从队列、时间轮和io_service中移除
+         */
+        void handle_migrate();
+
+        /**
+         * 处理迁移完成
+         * 在目标IO线程中接管socket并恢复读写
+         */
+        void handle_migrated(asio::ip::tcp::socket::protocol_type protocol, asio::ip::tcp::socket::native_handle_type handle);
+
+        /**
+         * 取出最近收发的字节数
+         * 供自动均衡挑选迁移的Session
+         */
+        uint64_t take_recent_bytes()
+        {
+            uint64_t bytes = recent_bytes_;
+            recent_bytes_ = 0;
+            return bytes;
+        }
+
     private:
         TCPSession(const TCPSession&) = delete;
         TCPSession& operator= (const TCPSession&) = delete;
 
     private:
         bool                        closed_;
+        bool                        migrating_;
+        bool                        read_resumed_;
         int                         num_read_handlers_;
         int                         num_write_handlers_;
         TCPSessionID                session_id_;
-        SocketType                  socket_;
+        std::unique_ptr<SocketType> socket_;
         ThreadPointer               io_thread_;
-        asio::steady_timer          close_timer_;
+        ThreadPointer               migrate_target_;
+        std::atomic<IOServiceThread*> owner_thread_;
+        uint64_t                    recent_bytes_;
+        TimingWheel::TimerID        close_timer_;
+        TimingWheel::TimerID        keep_alive_timer_;
         MessageFilterPointer        msg_filter_;
         TimePoint                   last_activity_time_;
+        size_t                      bytes_wanna_read_;
+        size_t                      bytes_received_;
         std::vector<uint8_t>        buffer_receiving_;
         std::vector<uint8_t>        buffer_sending_;
         std::vector<uint8_t>        buffer_to_be_sent_;
+        std::vector<asio::const_buffer> buffers_sending_;
+        NetMessageVector            messages_sending_;
+        NetMessageVector            frames_sending_;
+        NetMessageVector            frames_to_be_sent_;
+        NetMessageVector            messages_to_be_sent_;
         NetMessageVector            messages_received_;
+        ReceivedChainVector         chains_received_;
+        NetMessageVector            messages_from_mailbox_;
+        MPSCQueue<MailboxMessage>   mailbox_;
         const std::chrono::seconds  keep_alive_time_;
+        HandlerMemory               read_memory_;
+        HandlerMemory               write_memory_;
+        HandlerMemory               close_memory_;
+        HandlerMemory               dispatch_memory_;
+        HandlerMemory               mailbox_memory_;
     };
 }
 
@@ -1,86 +1,30 @@
 ﻿#include "tcp_session_handler.h"
 #include "net_message.h"
 #include "tcp_session.h"
+#include "session_group.h"
 #include "io_service_thread.h"
 #include "io_service_thread_manager.h"
 
 namespace eddyserver
 {
-	namespace session_handler_stuff
+	TCPSessionHandler::TCPSessionHandler()
+		: session_id_(0)
 	{
-		typedef std::shared_ptr< std::vector<NetMessage> > NetMessageVecPointer;
-
-        /**
-         * 关闭Session
-         */
-		void CloseSession(ThreadPointer thread_ptr, TCPSessionID id)
-		{
-			SessionPointer session_ptr = thread_ptr->get_session_queue().get(id);
-			if (session_ptr != nullptr)
-			{
-				session_ptr->close();
-			}
-		}
-
-        /**
-         * 发送消息列表到Session
-         */
-		void SendMessageListToSession(ThreadPointer thread_ptr, TCPSessionID id, NetMessageVecPointer messages)
-		{
-			SessionPointer session_ptr = thread_ptr->get_session_queue().get(id);
-			if (session_ptr != nullptr)
-			{
-				session_ptr->post_message_list(*messages);
-			}
-		}
-
-        /**
-         * 投递消息列表到线程操作
-         */
-		void PackMessageList(SessionHandlePointer session_handle_ptr)
-		{
-			if (!session_handle_ptr->messages_to_be_sent().empty())
-			{
-                ThreadPointer thread_ptr = session_handle_ptr->get_thread_manager()->get_thread(session_handle_ptr->get_thread_id());
-                if (thread_ptr != nullptr)
-                {
-                    NetMessageVecPointer messages_to_be_sent = std::make_shared< std::vector<NetMessage> >();
-                    *messages_to_be_sent = std::move(session_handle_ptr->messages_to_be_sent());
-                    thread_ptr->post(std::bind(
-                        SendMessageListToSession, thread_ptr, session_handle_ptr->get_session_id(), messages_to_be_sent));
-                }
-			}
-		}
-
-        /**
-         * 直接发送消息列表
-         */
-		void SendMessageListDirectly(SessionHandlePointer session_handle_ptr)
-		{
-			ThreadPointer thread_ptr = session_handle_ptr->get_thread_manager()->get_thread(session_handle_ptr->get_thread_id());
-			if (thread_ptr != nullptr)
-			{
-				SessionPointer session_ptr = thread_ptr->get_session_queue().get(session_handle_ptr->get_session_id());
-				if (session_ptr != nullptr)
-				{
-					session_ptr->post_message_list(session_handle_ptr->messages_to_be_sent());
-					session_handle_ptr->messages_to_be_sent().clear();
-				}
-			}
-		}
 	}
 
-	TCPSessionHandler::TCPSessionHandler()
-		: session_id_(0)
+	TCPSessionHandler::~TCPSessionHandler()
 	{
+		leave_groups();
 	}
 
     // 初始化
 	void TCPSessionHandler::init(TCPSessionID sid,
         IOThreadID tid,
         IOServiceThreadManager *manager,
+        const SessionPointer &session_ptr,
         const asio::ip::tcp::endpoint &remote_endpoint)
 	{
+		session_ = session_ptr;
 		thread_id_ = tid;
 		session_id_ = sid;
 		io_thread_manager_ = manager;
@@ -91,8 +35,67 @@ namespace eddyserver
 	void TCPSessionHandler::dispose()
 	{
         session_id_ = 0;
+        session_.reset();
+        leave_groups();
 	}
 
+    // 退出所有Session组
+    void TCPSessionHandler::leave_groups()
+    {
+        for (size_t i = 0; i < groups_.size(); ++i)
+        {
+            std::shared_ptr<SessionGroup> group = groups_[i]->group.lock();
+            if (group != nullptr)
+            {
+                group->remove_member(groups_[i].get());
+            }
+        }
+        groups_.clear();
+    }
+
+    // 更新所在Session组的IO线程分组
+    void TCPSessionHandler::relocate_groups()
+    {
+        size_t i = 0;
+        while (i < groups_.size())
+        {
+            std::shared_ptr<SessionGroup> group = groups_[i]->group.lock();
+            if (group == nullptr)
+            {
+                groups_[i] = std::move(groups_.back());
+                groups_.pop_back();
+                continue;
+            }
+            group->relocate_member(groups_[i].get(), thread_id_);
+            ++i;
+        }
+    }
+
+    // 查找在Session组中的成员关系
+    size_t TCPSessionHandler::find_group(const SessionGroup *group)
+    {
+        size_t found = groups_.size();
+        size_t i = 0;
+        while (i < groups_.size())
+        {
+            // 交换进来的是尚未检查的元素，已找到的下标不受影响
+            std::shared_ptr<SessionGroup> owner = groups_[i]->group.lock();
+            if (owner == nullptr)
+            {
+                groups_[i] = std::move(groups_.back());
+                groups_.pop_back();
+                continue;
+            }
+
+            if (owner.get() == group)
+            {
+                found = i;
+            }
+            ++i;
+        }
+        return found < groups_.size() ? found : groups_.size();
+    }
+
     // 关闭连接
 	void TCPSessionHandler::close()
 	{
@@ -101,12 +104,10 @@ namespace eddyserver
 			return;
 		}
 
-        session_handler_stuff::PackMessageList(shared_from_this());
-
-		ThreadPointer thread_ptr = get_thread_manager()->get_thread(thread_id_);
-		if (thread_ptr != nullptr)
+		SessionPointer session_ptr = session_.lock();
+		if (session_ptr != nullptr)
 		{
-			thread_ptr->post(std::bind(session_handler_stuff::CloseSession, thread_ptr, session_id_));
+			session_ptr->get_owner_thread()->post(std::bind(&TCPSession::close, session_ptr));
 		}
 	}
 
@@ -123,21 +124,51 @@ namespace eddyserver
 			return;
 		}
 
-		bool wanna_send = messages_to_be_sent_.empty();
-		messages_to_be_sent_.push_back(message);
+		SessionPointer session_ptr = session_.lock();
+		if (session_ptr != nullptr)
+		{
+			session_ptr->push_message(message);
+		}
+	}
 
-		if (wanna_send)
+    // 发送链式消息
+	void TCPSessionHandler::send(const ChainedMessage &message)
+	{
+		if (is_closed() || message.empty())
 		{
-			if (thread_id_ == io_thread_manager_->get_main_thread()->get_id())
-			{
-				io_thread_manager_->get_main_thread()->post(
-                    std::bind(session_handler_stuff::SendMessageListDirectly, shared_from_this()));
-			}
-			else
+			return;
+		}
+
+		SessionPointer session_ptr = session_.lock();
+		if (session_ptr != nullptr)
+		{
+			session_ptr->push_chain(message);
+		}
+	}
+
+    // 接收链式消息事件
+	void TCPSessionHandler::on_chained_message(ChainedMessage &message)
+	{
+		NetMessage flat_message = message.flatten();
+		on_message(flat_message);
+	}
+
+    // 分发收到的消息
+	void TCPSessionHandler::dispatch(NetMessageVector &messages, ReceivedChainVector &chains)
+	{
+		size_t next_chain = 0;
+		for (size_t i = 0; i < messages.size(); ++i)
+		{
+			while (next_chain < chains.size() && chains[next_chain].position == i)
 			{
-				io_thread_manager_->get_main_thread()->post(
-                    std::bind(session_handler_stuff::PackMessageList, shared_from_this()));
+				on_chained_message(chains[next_chain++].message);
 			}
+			on_message(messages[i]);
+		}
+
+		while (next_chain < chains.size())
+		{
+			on_chained_message(chains[next_chain++].message);
 		}
 	}
 }
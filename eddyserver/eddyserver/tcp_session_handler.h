@@ -5,18 +5,24 @@
 #include <asio/ip/tcp.hpp>
 #include "types.h"
 #include "net_message.h"
+#include "chained_message.h"
 
 namespace eddyserver
 {
     class IOServiceThreadManager;
+    class SessionGroup;
+    struct SessionGroupMembership;
 
     class TCPSessionHandler : public std::enable_shared_from_this < TCPSessionHandler >
     {
+        friend class TCPSession;
+        friend class SessionGroup;
+        friend class IOServiceThread;
         friend class IOServiceThreadManager;
 
     public:
         TCPSessionHandler();
-        virtual ~TCPSessionHandler() = default;
+        virtual ~TCPSessionHandler();
 
     public:
         /**
@@ -29,6 +35,13 @@ namespace eddyserver
          */
         virtual void on_message(NetMessage &message) = 0;
 
+        /**
+         * 接收链式消息事件
+         * 超过单个缓冲块的消息由过滤器读入链式消息
+         * 默认合并为连续的消息后调用on_message
+         */
+        virtual void on_chained_message(ChainedMessage &message);
+
         /**
          * 关闭事件
          */
@@ -67,14 +80,6 @@ namespace eddyserver
             return io_thread_manager_;
         }
 
-        /**
-         * 获取将被发送的消息列表
-         */ 
-        std::vector<NetMessage>& messages_to_be_sent()
-        {
-            return messages_to_be_sent_;
-        }
-
         /**
          * 获取对端端点信息
          */
@@ -86,9 +91,16 @@ namespace eddyserver
     public:
         /**
          * 发送消息
+         * 消息直接投递到Session的发送信箱
          */
         void send(const NetMessage &message);
 
+        /**
+         * 发送链式消息
+         * 各块不拷贝，紧跟在消息头后依次发送
+         */
+        void send(const ChainedMessage &message);
+
         /**
          * 关闭连接
          */
@@ -106,8 +118,33 @@ namespace eddyserver
         void init(TCPSessionID sid,
             IOThreadID tid,
             IOServiceThreadManager *manager,
+            const SessionPointer &session_ptr,
             const asio::ip::tcp::endpoint &remote_endpoint);
 
+        /**
+         * 分发收到的消息
+         * 链式消息按接收位置插在普通消息之间
+         */
+        void dispatch(NetMessageVector &messages, ReceivedChainVector &chains);
+
+        /**
+         * 退出所有Session组
+         */
+        void leave_groups();
+
+        /**
+         * 更新所在Session组的IO线程分组
+         * 迁移完成后调用，顺带清理已销毁的组留下的成员关系
+         */
+        void relocate_groups();
+
+        /**
+         * 查找在Session组中的成员关系
+         * 顺带清理已销毁的组留下的成员关系，成员关系数量不超过存活的组数
+         * @return 成员关系的下标，不是成员时返回groups_.size()
+         */
+        size_t find_group(const SessionGroup *group);
+
     private:
         TCPSessionHandler(const TCPSessionHandler&) = delete;
         TCPSessionHandler& operator= (const TCPSessionHandler&) = delete;
@@ -117,7 +154,8 @@ namespace eddyserver
         IOThreadID              thread_id_;
         asio::ip::tcp::endpoint remote_endpoint_;
         IOServiceThreadManager* io_thread_manager_;
-        std::vector<NetMessage>     messages_to_be_sent_;
+        SessionWeakPointer      session_;
+        std::vector<std::unique_ptr<SessionGroupMembership>> groups_;
     };
 }
 
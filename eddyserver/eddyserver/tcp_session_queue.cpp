@@ -3,25 +3,60 @@
 
 namespace eddyserver
 {
-    // 获取Session数量
-    size_t TCPSessionQueue::size() const
+    // 查找Session ID对应的位置
+    TCPSessionQueue::Position* TCPSessionQueue::find(TCPSessionID id)
     {
-        return session_queue_.size();
+        const uint32_t tag = KeyLayout::tag_of(id);
+        const uint32_t slot = static_cast<uint32_t>(id);
+        if (tag >= positions_.size() || slot >= positions_[tag].size())
+        {
+            return nullptr;
+        }
+
+        // 槽位复用后代数不同，过期的ID与记录的ID不相等
+        Position &position = positions_[tag][slot];
+        return position.id == id ? &position : nullptr;
+    }
+
+    // 获取Session ID对应的位置
+    TCPSessionQueue::Position& TCPSessionQueue::locate(TCPSessionID id)
+    {
+        const uint32_t tag = KeyLayout::tag_of(id);
+        const uint32_t slot = static_cast<uint32_t>(id);
+        if (tag >= positions_.size())
+        {
+            positions_.resize(tag + 1);
+        }
+        if (slot >= positions_[tag].size())
+        {
+            Position empty = { 0, 0 };
+            positions_[tag].resize(slot + 1, empty);
+        }
+        return positions_[tag][slot];
     }
 
     // 添加Session入队列
     void TCPSessionQueue::add(SessionPointer &session)
     {
-        session_queue_.insert(std::make_pair(session->get_id(), session));
+        const TCPSessionID id = session->get_id();
+        if (id == 0 || find(id) != nullptr)
+        {
+            return;
+        }
+
+        Position &position = locate(id);
+        position.id = id;
+        position.index = sessions_.size();
+        sessions_.push_back(session);
     }
 
     // 通过id获取Session
     SessionPointer TCPSessionQueue::get(TCPSessionID id)
     {
-        auto found = session_queue_.find(id);
-        if (found != session_queue_.end())
+        Position *position = find(id);
+        if (position != nullptr)
         {
-            return found->second;
+            return sessions_[position->index];
         }
         return SessionPointer();
     }
@@ -29,23 +64,33 @@ namespace eddyserver
     // 移除指定id的Session
     void TCPSessionQueue::remove(TCPSessionID id)
     {
-        session_queue_.erase(id);
+        Position *position = find(id);
+        if (position == nullptr)
+        {
+            return;
+        }
+
+        // 末尾元素移到被移除的位置
+        const size_t index = position->index;
+        position->id = 0;
+        if (index + 1 != sessions_.size())
+        {
+            sessions_[index] = std::move(sessions_.back());
+            find(sessions_[index]->get_id())->index = index;
+        }
+        sessions_.pop_back();
     }
 
     // 清空整个队列
     void TCPSessionQueue::clear()
     {
-        session_queue_.clear();
+        sessions_.clear();
+        positions_.clear();
     }
 
     // 遍历Session队列
     void TCPSessionQueue::foreach(const std::function<void(const SessionPointer &session)> &cb)
     {
-        auto itr = session_queue_.begin();
-        while (itr != session_queue_.end())
-        {
-            cb(itr->second);
-            ++itr;
-        }
+        for_each(cb);
     }
 }
@@ -1,13 +1,28 @@
 ﻿#ifndef __TCP_SESSION_QUEUE_H__
 #define __TCP_SESSION_QUEUE_H__
 
-#include <unordered_map>
+#include <vector>
 #include "types.h"
+#include "slot_map.h"
 
 namespace eddyserver
 {
+    /**
+     * Session队列
+     * Session紧凑存放在数组中，移除时与末尾元素交换
+     * Session ID即分配线程SlotMap的键，按标签和槽位索引直接定位位置表，再比较完整的ID排除过期的键
+     * 迁移来的Session标签各不相同，位置表按标签分开存放
+     */
     class TCPSessionQueue final
     {
+        typedef SlotMap<SessionPointer> KeyLayout;
+
+        struct Position
+        {
+            TCPSessionID    id;
+            size_t          index;
+        };
+
     public:
         TCPSessionQueue() = default;
 
@@ -15,7 +30,10 @@ namespace eddyserver
         /**
          * 获取Session数量
          */
-        size_t size() const;
+        size_t size() const
+        {
+            return sessions_.size();
+        }
 
         /**
          * 添加Session入队列
@@ -37,6 +55,20 @@ namespace eddyserver
          */
         void clear();
 
+        /**
+         * 遍历Session队列
+         * 顺序扫描连续内存，回调中不能添加或移除Session
+         * @param cb 回调函数
+         */
+        template <typename Function>
+        void for_each(Function &&cb) const
+        {
+            for (size_t i = 0; i < sessions_.size(); ++i)
+            {
+                cb(sessions_[i]);
+            }
+        }
+
         /**
          * 遍历Session队列
          * @param cb 回调函数
@@ -48,7 +80,20 @@ namespace eddyserver
         TCPSessionQueue& operator= (const TCPSessionQueue&) = delete;
 
     private:
-        std::unordered_map<TCPSessionID, SessionPointer> session_queue_;
+        /**
+         * 查找Session ID对应的位置
+         * @return 不存在时返回nullptr
+         */
+        Position* find(TCPSessionID id);
+
+        /**
+         * 获取Session ID对应的位置，不存在时扩展位置表
+         */
+        Position& locate(TCPSessionID id);
+
+    private:
+        std::vector<SessionPointer>         sessions_;
+        std::vector<std::vector<Position>>  positions_;
     };
 }
 
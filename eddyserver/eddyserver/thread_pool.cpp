@@ -1,10 +1,126 @@
 ﻿#include "thread_pool.h"
+#include <new>
 #include <cassert>
 #include <iostream>
 #include <algorithm>
 
+namespace thread_pool_stuff
+{
+    /* 当前线程运行的工作线程 */
+    thread_local Thread *current_worker = nullptr;
+
+    /* 每个线程的随机窃取次数 */
+    static const size_t kStealAttempts = 2;
+
+    static_assert(alignof(Thread::Callback) <= alignof(eddyserver::BufferBlock), "task must fit the alignment of pooled blocks");
+
+    /**
+     * 创建任务节点
+     * 节点从BufferPool分配，在工作线程中释放后归还给投递的线程复用
+     */
+    Thread::Callback* NewTask(Thread::Callback &&cb)
+    {
+        return new (eddyserver::BufferPool::allocate(sizeof(Thread::Callback))->data()) Thread::Callback(std::move(cb));
+    }
+
+    /**
+     * 销毁任务节点
+     */
+    void DeleteTask(Thread::Callback *task)
+    {
+        task->~Task();
+        eddyserver::BufferPool::release(reinterpret_cast<eddyserver::BufferBlock*>(task) - 1);
+    }
+}
+
+Parker::Parker()
+    : state_(kEmpty)
+{
+}
+
+// 停靠当前线程
+void Parker::park()
+{
+    // 已被唤醒时直接返回
+    int expected = kNotified;
+    if (state_.compare_exchange_strong(expected, kEmpty, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    expected = kEmpty;
+    if (!state_.compare_exchange_strong(expected, kParked, std::memory_order_acq_rel))
+    {
+        // 加锁期间被唤醒
+        state_.store(kEmpty, std::memory_order_release);
+        return;
+    }
+
+    for (;;)
+    {
+        condition_.wait(lock);
+        expected = kNotified;
+        if (state_.compare_exchange_strong(expected, kEmpty, std::memory_order_acquire))
+        {
+            return;
+        }
+    }
+}
+
+// 唤醒线程
+void Parker::unpark()
+{
+    if (state_.exchange(kNotified, std::memory_order_release) == kParked)
+    {
+        // 加锁保证停靠的线程已进入等待
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        condition_.notify_one();
+    }
+}
+
+/************************************************************************/
+/************************************************************************/
+
 Thread::Thread()
-    : finished_(false)
+    : pool_(nullptr)
+    , index_(0)
+    , finished_(false)
+    , sleeping_(false)
+    , load_(0)
+    , random_engine_(std::random_device{}())
+{
+    start();
+}
+
+Thread::Thread(ThreadPool *pool, size_t index)
+    : pool_(pool)
+    , index_(index)
+    , finished_(false)
+    , sleeping_(false)
+    , load_(0)
+    , random_engine_(std::random_device{}())
+{
+}
+
+Thread::~Thread()
+{
+    // 释放未执行的任务
+    Callback *task = nullptr;
+    while ((task = local_tasks_.pop()) != nullptr)
+    {
+        thread_pool_stuff::DeleteTask(task);
+    }
+    inbox_.consume_all([](Callback *pending)
+    {
+        thread_pool_stuff::DeleteTask(pending);
+    });
+}
+
+// 启动线程
+void Thread::start()
 {
     std::function<void()> worker = std::bind(&Thread::run_loop, this);
     thread_ = std::make_unique<std::thread>(std::move(worker));
@@ -14,28 +130,25 @@ Thread::Thread()
 void Thread::join()
 {
     termminiate();
-    thread_->join();
+    if (thread_ != nullptr && thread_->joinable())
+    {
+        thread_->join();
+    }
 }
 
 // 终止线程
 void Thread::termminiate()
 {
-    if (!finished_)
+    if (!finished_.exchange(true))
     {
-        finished_ = true;
-        condition_incoming_task_.notify_one();
+        parker_.unpark();
     }
 }
 
 // 获取负载
 size_t Thread::load() const
 {
-    size_t count = 0;
-    {
-        std::lock_guard<std::mutex> lock(queue_task_mutex_);
-        count = queue_task_.size();
-    }
-    return count;
+    return load_.load(std::memory_order_acquire);
 }
 
 // 等待到空闲
@@ -50,112 +163,199 @@ void Thread::wait_for_idle()
 // 添加任务
 size_t Thread::append(Callback &&cb)
 {
-    size_t size = 0;
-    if (!finished_)
+    if (finished_)
+    {
+        return 0;
+    }
+    return post(thread_pool_stuff::NewTask(std::move(cb)));
+}
+
+// 投递任务到信箱
+size_t Thread::post(Callback *task)
+{
+    const size_t size = ++load_;
+    if (inbox_.push(task))
+    {
+        parker_.unpark();
+    }
+    return size;
+}
+
+// 压入本地队列
+void Thread::push_local(Callback *task)
+{
+    ++load_;
+    local_tasks_.push(task);
+
+    // 有休眠的线程时唤醒它来窃取
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pool_ != nullptr && pool_->num_sleeping_.load(std::memory_order_relaxed) > 0)
+    {
+        pool_->wake_one();
+    }
+}
+
+// 取出信箱中的全部任务放入本地队列
+size_t Thread::drain_inbox(Thread &thief)
+{
+    size_t count = inbox_.consume_all([&thief](Callback *task)
+    {
+        ++thief.load_;
+        thief.local_tasks_.push(task);
+    });
+    load_ -= count;
+    return count;
+}
+
+// 窃取任务
+Thread::Callback* Thread::steal(Thread &thief)
+{
+    Callback *task = local_tasks_.steal();
+    if (task != nullptr)
+    {
+        ++thief.load_;
+        --load_;
+        return task;
+    }
+
+    if (drain_inbox(thief) > 0)
     {
+        return thief.local_tasks_.pop();
+    }
+    return nullptr;
+}
+
+// 查找任务
+Thread::Callback* Thread::find_task()
+{
+    Callback *task = local_tasks_.pop();
+    if (task != nullptr)
+    {
+        return task;
+    }
+
+    if (drain_inbox(*this) > 0)
+    {
+        task = local_tasks_.pop();
+
+        // 一次取出多个任务时唤醒休眠的线程分担
+        if (pool_ != nullptr && !local_tasks_.empty() && pool_->num_sleeping_.load(std::memory_order_relaxed) > 0)
         {
-            std::lock_guard<std::mutex> lock(queue_task_mutex_);
-            queue_task_.push_back(std::forward<Callback>(cb));
-            size = queue_task_.size();
+            pool_->wake_one();
         }
 
-        if (size == 1)
+        if (task != nullptr)
         {
-            condition_incoming_task_.notify_one();
+            return task;
         }
     }
-    return size;
-}
 
-size_t Thread::append(const Callback &cb)
-{
-    size_t size = 0;
-    if (!finished_)
+    if (pool_ == nullptr || pool_->vector_thread_.size() <= 1)
+    {
+        return nullptr;
+    }
+
+    // 随机选择窃取对象，避免多个空闲线程争抢同一个线程
+    const size_t count = pool_->vector_thread_.size();
+    for (size_t i = 0; i < count * thread_pool_stuff::kStealAttempts; ++i)
     {
+        const size_t victim = random_engine_() % count;
+        if (victim == index_)
         {
-            std::lock_guard<std::mutex> lock(queue_task_mutex_);
-            queue_task_.push_back(cb);
-            size = queue_task_.size();
+            continue;
         }
 
-        if (size == 1)
+        task = pool_->vector_thread_[victim]->steal(*this);
+        if (task != nullptr)
         {
-            condition_incoming_task_.notify_one();
+            return task;
         }
     }
-    return size;
+    return nullptr;
+}
+
+// 是否有待执行的任务
+bool Thread::has_task() const
+{
+    return !local_tasks_.empty() || !inbox_.empty();
 }
 
 // 线程循环
 void Thread::run_loop()
 {
+    thread_pool_stuff::current_worker = this;
     while (!finished_)
     {
+        Callback *task = find_task();
+        if (task != nullptr)
         {
-            std::unique_lock<std::mutex> lock(queue_task_mutex_);
-            while (queue_task_.empty())
+            try
             {
-                if (finished_)
-                {
-                    break;
-                }
-                condition_incoming_task_.wait(lock);
+                (*task)();
             }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+            thread_pool_stuff::DeleteTask(task);
+            --load_;
+            if (pool_ != nullptr)
+            {
+                pool_->num_pending_.fetch_sub(1, std::memory_order_release);
+            }
+            continue;
         }
 
-        if (finished_)
+        // 声明休眠后再检查一次，避免错过此前投递的任务
+        sleeping_.store(true, std::memory_order_seq_cst);
+        if (pool_ != nullptr)
         {
-            break;
+            ++pool_->num_sleeping_;
         }
 
-        Callback cb;
+        bool has_task = this->has_task();
+        if (pool_ != nullptr)
         {
-            std::lock_guard<std::mutex> lock(queue_task_mutex_);
-            if (!queue_task_.empty())
+            for (size_t i = 0; i < pool_->vector_thread_.size() && !has_task; ++i)
             {
-                cb = std::move(queue_task_.front());
+                has_task = pool_->vector_thread_[i]->has_task();
             }
         }
 
-        if (cb != nullptr)
+        if (!has_task && !finished_)
         {
-            try
-            {
-                cb();
-            }
-            catch (const std::exception &e)
-            {
-                std::cerr << e.what() << std::endl;
-            }
-            std::lock_guard<std::mutex> lock(queue_task_mutex_);
-            queue_task_.pop_front();
+            parker_.park();
         }
+
+        if (pool_ != nullptr)
+        {
+            --pool_->num_sleeping_;
+        }
+        sleeping_.store(false, std::memory_order_relaxed);
     }
+    thread_pool_stuff::current_worker = nullptr;
 }
 
 /************************************************************************/
 /************************************************************************/
 
-namespace thread_pool_stuff
-{
-    struct min_load_cmp
-    {
-        bool operator() (const ThreadPool::ThreadPointer &lhs,
-            const ThreadPool::ThreadPointer &rhs) const
-        {
-            return lhs->load() < rhs->load();
-        }
-    };
-}
-
 ThreadPool::ThreadPool(size_t thread_num)
+    : next_thread_(0)
+    , num_sleeping_(0)
+    , num_pending_(0)
 {
     assert(thread_num > 0);
     if (thread_num > 0)
     {
         for (size_t i = 0; i < thread_num; ++i)
         {
-            vector_thread_.push_back(std::make_shared<Thread>());
+            vector_thread_.push_back(ThreadPointer(new Thread(this, i)));
+        }
+
+        // 全部创建完成后再启动，工作线程窃取时会遍历线程列表
+        for (size_t i = 0; i < thread_num; ++i)
+        {
+            vector_thread_[i]->start();
         }
     }
 }
@@ -193,9 +393,10 @@ size_t ThreadPool::load(size_t index) const
 // 等待到空闲
 void ThreadPool::wait_for_idle()
 {
-    for (size_t i = 0; i < vector_thread_.size(); ++i)
+    // 各线程的负载会随窃取转移，逐个等待可能在任务转移途中提前返回
+    while (num_pending_.load(std::memory_order_acquire) > 0)
     {
-        vector_thread_[i]->wait_for_idle();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 }
 
@@ -205,25 +406,61 @@ void ThreadPool::append(Thread::Callback &&task)
     assert(!vector_thread_.empty());
     if (!vector_thread_.empty())
     {
-        std::vector<ThreadPointer>::iterator itr;
+        dispatch(thread_pool_stuff::NewTask(std::move(task)));
+    }
+}
+
+// 分发任务
+void ThreadPool::dispatch(Thread::Callback *task)
+{
+    num_pending_.fetch_add(1, std::memory_order_relaxed);
+
+    Thread *current = thread_pool_stuff::current_worker;
+    if (current != nullptr && current->pool_ == this)
+    {
+        current->push_local(task);
+        return;
+    }
+
+    // 优先交给休眠的线程
+    if (num_sleeping_.load(std::memory_order_relaxed) > 0)
+    {
+        for (size_t i = 0; i < vector_thread_.size(); ++i)
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            itr = std::min_element(vector_thread_.begin(), vector_thread_.end(), thread_pool_stuff::min_load_cmp());
+            Thread &thread = *vector_thread_[i];
+            bool expected = true;
+            if (thread.sleeping_.compare_exchange_strong(expected, false))
+            {
+                thread.post(task);
+                thread.parker_.unpark();
+                return;
+            }
         }
-        (*itr)->append(std::forward<Thread::Callback>(task));
+    }
+
+    const size_t index = next_thread_.fetch_add(1, std::memory_order_relaxed) % vector_thread_.size();
+    vector_thread_[index]->post(task);
+
+    // 目标线程繁忙时由休眠的线程窃取
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_sleeping_.load(std::memory_order_relaxed) > 0)
+    {
+        wake_one();
     }
 }
 
-void ThreadPool::append(const Thread::Callback &task)
+// 唤醒一个休眠的线程
+void ThreadPool::wake_one()
 {
-    assert(!vector_thread_.empty());
-    if (!vector_thread_.empty())
+    const size_t start = next_thread_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < vector_thread_.size(); ++i)
     {
-        std::vector<ThreadPointer>::iterator itr;
+        Thread &thread = *vector_thread_[(start + i) % vector_thread_.size()];
+        bool expected = true;
+        if (thread.sleeping_.compare_exchange_strong(expected, false))
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            itr = std::min_element(vector_thread_.begin(), vector_thread_.end(), thread_pool_stuff::min_load_cmp());
+            thread.parker_.unpark();
+            return;
         }
-        (*itr)->append(task);
     }
 }
@@ -1,23 +1,81 @@
 ﻿#ifndef __THREADPOOL_H__
 #define __THREADPOOL_H__
 
-#include <list>
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include <random>
 #include <thread>
 #include <memory>
 #include <functional>
+#include <type_traits>
 #include <condition_variable>
+#include "task.h"
+#include "future.h"
+#include "mpsc_queue.h"
+#include "work_stealing_deque.h"
+
+class ThreadPool;
+
+/**
+ * 线程停靠器
+ * 唤醒先于停靠时停靠立即返回，只有真正需要休眠时才使用互斥量和条件变量
+ */
+class Parker final
+{
+public:
+    Parker();
+
+public:
+    /**
+     * 是否已停靠
+     */
+    bool is_parked() const
+    {
+        return state_.load(std::memory_order_acquire) == kParked;
+    }
+
+    /**
+     * 停靠当前线程
+     * 只能由所属线程调用
+     */
+    void park();
+
+    /**
+     * 唤醒线程
+     * 可在任意线程调用
+     */
+    void unpark();
+
+private:
+    enum State
+    {
+        kEmpty,
+        kParked,
+        kNotified,
+    };
+
+private:
+    Parker(const Parker&) = delete;
+    Parker& operator= (const Parker&) = delete;
+
+private:
+    std::atomic<int>        state_;
+    std::mutex              mutex_;
+    std::condition_variable condition_;
+};
 
 class Thread final
 {
+    friend class ThreadPool;
+
 public:
-    typedef std::function<void()> Callback;
+    typedef eddyserver::Task Callback;
     typedef std::unique_ptr<std::thread> ThreadPointer;
 
 public:
     Thread();
+    ~Thread();
 
 public:
     /**
@@ -32,6 +90,7 @@ public:
 
     /**
      * 获取负载
+     * 排队和正在执行的任务数量
      */
     size_t load() const;
 
@@ -42,11 +101,59 @@ public:
 
     /**
      * 添加任务
+     * 可在任意线程调用，任务进入无锁信箱
      */
     size_t append(Callback &&cb);
-    size_t append(const Callback &cb);
 
 private:
+    /**
+     * 线程池中的工作线程
+     * 由线程池在全部工作线程创建完成后启动
+     */
+    Thread(ThreadPool *pool, size_t index);
+
+    /**
+     * 启动线程
+     */
+    void start();
+
+    /**
+     * 投递任务到信箱
+     */
+    size_t post(Callback *task);
+
+    /**
+     * 压入本地队列
+     * 只能在此线程中调用
+     */
+    void push_local(Callback *task);
+
+    /**
+     * 取出信箱中的全部任务放入本地队列
+     * 可由其它线程代为取出，取出的任务进入调用线程的本地队列
+     * @param thief 取出任务的线程
+     * @return 任务数量
+     */
+    size_t drain_inbox(Thread &thief);
+
+    /**
+     * 窃取任务
+     * 先从本地队列顶部窃取，失败时取走整个信箱
+     * @param thief 窃取任务的线程
+     */
+    Callback* steal(Thread &thief);
+
+    /**
+     * 查找任务
+     * 依次查找本地队列、信箱和随机选择的其它线程
+     */
+    Callback* find_task();
+
+    /**
+     * 是否有待执行的任务
+     */
+    bool has_task() const;
+
     /**
      * 线程循环
      */
@@ -57,15 +164,27 @@ private:
     Thread& operator= (const Thread&) = delete;
 
 private:
-    std::atomic_bool        finished_;
-    ThreadPointer           thread_;
-    std::list<Callback>     queue_task_;
-    mutable std::mutex      queue_task_mutex_;
-    std::condition_variable condition_incoming_task_;
+    ThreadPool*                                 pool_;
+    const size_t                                index_;
+    std::atomic_bool                            finished_;
+    std::atomic_bool                            sleeping_;
+    std::atomic<size_t>                         load_;
+    ThreadPointer                               thread_;
+    eddyserver::WorkStealingDeque<Callback*>    local_tasks_;
+    eddyserver::MPSCQueue<Callback*>            inbox_;
+    Parker                                      parker_;
+    std::minstd_rand                            random_engine_;
 };
 
+/**
+ * 工作窃取线程池
+ * 每个工作线程拥有无锁本地队列和信箱，空闲时随机窃取其它线程的任务
+ * 任务节点从BufferPool分配，稳定状态下添加任务不分配堆内存
+ */
 class ThreadPool final
 {
+    friend class Thread;
+
 public:
     typedef std::shared_ptr<Thread> ThreadPointer;
 
@@ -95,21 +214,54 @@ public:
 
     /**
      * 等待到空闲
+     * 按全池未完成的任务数量判断，任务在线程间窃取转移不影响结果
      */
     void wait_for_idle();
 
     /**
      * 添加任务
+     * 在工作线程中调用时压入其本地队列，否则优先交给休眠的线程，没有休眠的线程时轮流分配
      */
     void append(Thread::Callback &&cb);
-    void append(const Thread::Callback &cb);
+
+    /**
+     * 提交任务
+     * 任务抛出的异常通过Future传递
+     * @param func 无参可调用对象
+     * @return 任务结果的Future，可用then()把后续处理投递回IOServiceThread或主线程
+     */
+    template <typename Function>
+    eddyserver::Future<typename eddyserver::future_stuff::ResultOf<typename std::decay<Function>::type&>::type> submit(Function &&func)
+    {
+        typedef typename eddyserver::future_stuff::ResultOf<typename std::decay<Function>::type&>::type Result;
+        eddyserver::Promise<Result> promise;
+        eddyserver::Future<Result> future = promise.get_future();
+        append([promise = std::move(promise), func = std::forward<Function>(func)]() mutable
+        {
+            eddyserver::future_stuff::Fulfill(promise, func);
+        });
+        return future;
+    }
+
+private:
+    /**
+     * 分发任务
+     */
+    void dispatch(Thread::Callback *task);
+
+    /**
+     * 唤醒一个休眠的线程
+     */
+    void wake_one();
 
 private:
     ThreadPool(const ThreadPool&) = delete;
     ThreadPool& operator= (const ThreadPool&) = delete;
 
 private:
-    mutable std::mutex          mutex_;
+    std::atomic<size_t>         next_thread_;
+    std::atomic<size_t>         num_sleeping_;
+    std::atomic<size_t>         num_pending_;
     std::vector<ThreadPointer>  vector_thread_;
 };
 
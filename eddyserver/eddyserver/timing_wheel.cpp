@@ -0,0 +1,209 @@
+﻿#include "timing_wheel.h"
+#include <cassert>
+
+namespace eddyserver
+{
+    namespace timing_wheel_stuff
+    {
+        static const int32_t kInvalidIndex = -1;
+        static const uint64_t kWheelMask = TimingWheel::kWheelSize - 1;
+
+        /**
+         * 获取指定层的槽位索引
+         */
+        inline size_t SlotIndex(size_t level, uint64_t tick)
+        {
+            return level * TimingWheel::kWheelSize + static_cast<size_t>((tick >> (level * TimingWheel::kWheelBits)) & kWheelMask);
+        }
+    }
+
+    TimingWheel::TimingWheel(std::chrono::milliseconds tick)
+        : tick_(tick.count() > 0 ? tick : std::chrono::milliseconds(1))
+        , start_(std::chrono::steady_clock::now())
+        , now_(start_)
+        , current_tick_(0)
+    {
+        for (size_t i = 0; i < kWheelLevels * kWheelSize; ++i)
+        {
+            slots_[i] = timing_wheel_stuff::kInvalidIndex;
+        }
+    }
+
+    // 添加定时器
+    TimingWheel::TimerID TimingWheel::add(std::chrono::milliseconds delay, Callback cb)
+    {
+        int32_t index = timing_wheel_stuff::kInvalidIndex;
+        if (!free_nodes_.empty())
+        {
+            index = free_nodes_.back();
+            free_nodes_.pop_back();
+        }
+        else
+        {
+            index = static_cast<int32_t>(nodes_.size());
+            nodes_.push_back(Node());
+            nodes_[index].generation = 1;
+
+            // 空闲列表容量跟随节点数，定时器到期归还节点时不再分配内存
+            free_nodes_.reserve(nodes_.capacity());
+        }
+
+        // 不足一个刻度按一个刻度计算
+        uint64_t ticks = 1;
+        if (delay.count() > 0)
+        {
+            ticks = static_cast<uint64_t>((delay.count() + tick_.count() - 1) / tick_.count());
+        }
+
+        Node &node = nodes_[index];
+        node.cb = std::move(cb);
+        node.expire_tick = current_tick_ + ticks;
+        link(index);
+        return (static_cast<uint64_t>(node.generation) << 32) | static_cast<uint32_t>(index);
+    }
+
+    // 取消定时器
+    bool TimingWheel::cancel(TimerID id)
+    {
+        const size_t index = static_cast<uint32_t>(id);
+        const uint32_t generation = static_cast<uint32_t>(id >> 32);
+        if (index >= nodes_.size())
+        {
+            return false;
+        }
+
+        Node &node = nodes_[index];
+        if (node.generation != generation || node.slot == timing_wheel_stuff::kInvalidIndex)
+        {
+            return false;
+        }
+
+        unlink(static_cast<int32_t>(index));
+        node.cb = nullptr;
+        ++node.generation;
+        free_nodes_.push_back(static_cast<int32_t>(index));
+        return true;
+    }
+
+    // 推进时间轮
+    size_t TimingWheel::advance(TimePoint now)
+    {
+        if (now < now_)
+        {
+            return 0;
+        }
+
+        now_ = now;
+        size_t count = 0;
+        const uint64_t target_tick = static_cast<uint64_t>((now - start_) / tick_);
+        while (current_tick_ < target_tick)
+        {
+            count += step();
+        }
+        return count;
+    }
+
+    // 放入槽位
+    void TimingWheel::link(int32_t index)
+    {
+        Node &node = nodes_[index];
+        assert(node.expire_tick >= current_tick_);
+        uint64_t delta = node.expire_tick - current_tick_;
+
+        size_t level = 0;
+        while (level + 1 < kWheelLevels && delta >= (uint64_t(1) << ((level + 1) * kWheelBits)))
+        {
+            ++level;
+        }
+
+        // 超出时间轮范围的定时器先放入最高层的最远槽位，降级时重新计算
+        uint64_t place_tick = node.expire_tick;
+        const uint64_t max_delta = (uint64_t(1) << (kWheelLevels * kWheelBits)) - 1;
+        if (delta > max_delta)
+        {
+            place_tick = current_tick_ + max_delta;
+        }
+
+        const size_t slot = timing_wheel_stuff::SlotIndex(level, place_tick);
+        node.slot = static_cast<int32_t>(slot);
+        node.prev = timing_wheel_stuff::kInvalidIndex;
+        node.next = slots_[slot];
+        if (node.next != timing_wheel_stuff::kInvalidIndex)
+        {
+            nodes_[node.next].prev = index;
+        }
+        slots_[slot] = index;
+    }
+
+    // 移出槽位
+    void TimingWheel::unlink(int32_t index)
+    {
+        Node &node = nodes_[index];
+        assert(node.slot != timing_wheel_stuff::kInvalidIndex);
+        if (node.prev != timing_wheel_stuff::kInvalidIndex)
+        {
+            nodes_[node.prev].next = node.next;
+        }
+        else
+        {
+            slots_[node.slot] = node.next;
+        }
+
+        if (node.next != timing_wheel_stuff::kInvalidIndex)
+        {
+            nodes_[node.next].prev = node.prev;
+        }
+        node.slot = timing_wheel_stuff::kInvalidIndex;
+        node.prev = timing_wheel_stuff::kInvalidIndex;
+        node.next = timing_wheel_stuff::kInvalidIndex;
+    }
+
+    // 降级指定层的槽位
+    void TimingWheel::cascade(size_t level)
+    {
+        const size_t slot = timing_wheel_stuff::SlotIndex(level, current_tick_);
+        int32_t index = slots_[slot];
+        slots_[slot] = timing_wheel_stuff::kInvalidIndex;
+        while (index != timing_wheel_stuff::kInvalidIndex)
+        {
+            int32_t next = nodes_[index].next;
+            link(index);
+            index = next;
+        }
+    }
+
+    // 推进一个时间刻度
+    size_t TimingWheel::step()
+    {
+        ++current_tick_;
+        for (size_t level = 1; level < kWheelLevels; ++level)
+        {
+            if (((current_tick_ >> ((level - 1) * kWheelBits)) & timing_wheel_stuff::kWheelMask) != 0)
+            {
+                break;
+            }
+            cascade(level);
+        }
+
+        size_t count = 0;
+        const size_t slot = timing_wheel_stuff::SlotIndex(0, current_tick_);
+        while (slots_[slot] != timing_wheel_stuff::kInvalidIndex)
+        {
+            const int32_t index = slots_[slot];
+            unlink(index);
+
+            // 先释放节点，回调中可以安全地添加或取消定时器
+            Callback cb = std::move(nodes_[index].cb);
+            nodes_[index].cb = nullptr;
+            ++nodes_[index].generation;
+            free_nodes_.push_back(index);
+
+            ++count;
+            if (cb != nullptr)
+            {
+                cb();
+            }
+        }
+        return count;
+    }
+}
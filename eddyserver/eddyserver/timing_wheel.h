@@ -0,0 +1,133 @@
+﻿#ifndef __TIMING_WHEEL_H__
+#define __TIMING_WHEEL_H__
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+namespace eddyserver
+{
+    /**
+     * 分层时间轮
+     * 添加和取消定时器为O(1)，推进时只处理到期和需要降级的定时器
+     * 非线程安全，只能在所属线程中使用
+     */
+    class TimingWheel final
+    {
+    public:
+        typedef uint64_t                                TimerID;
+        typedef std::function<void()>                   Callback;
+        typedef std::chrono::steady_clock::time_point   TimePoint;
+
+        /* 每层槽位数量 */
+        static const size_t kWheelBits = 6;
+        static const size_t kWheelSize = 1 << kWheelBits;
+
+        /* 层数 */
+        static const size_t kWheelLevels = 4;
+
+    public:
+        /**
+         * 构造函数
+         * @param tick 时间刻度
+         */
+        explicit TimingWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(100));
+
+    public:
+        /**
+         * 获取时间刻度
+         */
+        std::chrono::milliseconds tick() const
+        {
+            return tick_;
+        }
+
+        /**
+         * 获取当前时间
+         * 在每次推进时更新
+         */
+        TimePoint now() const
+        {
+            return now_;
+        }
+
+        /**
+         * 获取定时器数量
+         */
+        size_t size() const
+        {
+            return nodes_.size() - free_nodes_.size();
+        }
+
+    public:
+        /**
+         * 添加定时器
+         * @param delay 延迟时间
+         * @param cb 回调函数
+         * @return 定时器id
+         */
+        TimerID add(std::chrono::milliseconds delay, Callback cb);
+
+        /**
+         * 取消定时器
+         * @param id 定时器id
+         * @return 是否成功
+         */
+        bool cancel(TimerID id);
+
+        /**
+         * 推进时间轮
+         * 执行所有到期的定时器
+         * @param now 当前时间
+         * @return 执行的定时器数量
+         */
+        size_t advance(TimePoint now);
+
+    private:
+        struct Node
+        {
+            Callback    cb;
+            uint64_t    expire_tick;
+            uint32_t    generation;
+            int32_t     slot;
+            int32_t     prev;
+            int32_t     next;
+        };
+
+        /**
+         * 放入槽位
+         */
+        void link(int32_t index);
+
+        /**
+         * 移出槽位
+         */
+        void unlink(int32_t index);
+
+        /**
+         * 降级指定层的槽位
+         */
+        void cascade(size_t level);
+
+        /**
+         * 推进一个时间刻度
+         */
+        size_t step();
+
+    private:
+        TimingWheel(const TimingWheel&) = delete;
+        TimingWheel& operator= (const TimingWheel&) = delete;
+
+    private:
+        const std::chrono::milliseconds tick_;
+        const TimePoint                 start_;
+        TimePoint                       now_;
+        uint64_t                        current_tick_;
+        std::vector<Node>               nodes_;
+        std::vector<int32_t>            free_nodes_;
+        int32_t                         slots_[kWheelLevels * kWheelSize];
+    };
+}
+
+#endif
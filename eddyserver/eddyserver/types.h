@@ -8,15 +8,18 @@
 namespace eddyserver
 {
     typedef uint32_t                                IOThreadID;
-    typedef uint32_t                                TCPSessionID;
+    typedef uint64_t                                TCPSessionID;
 
     class                                           TCPSession;
+    class                                           LoadBalancer;
     class                                           IOServiceThread;
     class                                           TCPSessionHandler;
     class                                           MessageFilterInterface;
 
     typedef std::shared_ptr<TCPSession>             SessionPointer;
+    typedef std::weak_ptr<TCPSession>               SessionWeakPointer;
     typedef std::shared_ptr<IOServiceThread>        ThreadPointer;
+    typedef std::shared_ptr<LoadBalancer>           LoadBalancerPointer;
     typedef std::shared_ptr<TCPSessionHandler>      SessionHandlePointer;
     typedef std::shared_ptr<MessageFilterInterface> MessageFilterPointer;
 
@@ -0,0 +1,468 @@
+﻿#include "websocket_message_filter.h"
+#include <cassert>
+#include <cstring>
+#include "simd.h"
+
+namespace eddyserver
+{
+    namespace websocket_stuff
+    {
+        /* 握手使用的GUID */
+        const char kHandshakeGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+        // 循环左移
+        inline uint32_t RotateLeft(uint32_t value, size_t bits)
+        {
+            return (value << bits) | (value >> (32 - bits));
+        }
+
+        // 处理SHA1的一个64字节分组
+        void Sha1Block(const uint8_t *block, uint32_t state[5])
+        {
+            uint32_t w[80];
+            for (size_t i = 0; i < 16; ++i)
+            {
+                w[i] = (static_cast<uint32_t>(block[i * 4]) << 24)
+                    | (static_cast<uint32_t>(block[i * 4 + 1]) << 16)
+                    | (static_cast<uint32_t>(block[i * 4 + 2]) << 8)
+                    | static_cast<uint32_t>(block[i * 4 + 3]);
+            }
+            for (size_t i = 16; i < 80; ++i)
+            {
+                w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+            for (size_t i = 0; i < 80; ++i)
+            {
+                uint32_t f = 0, k = 0;
+                if (i < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if (i < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if (i < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+
+                const uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = RotateLeft(b, 30);
+                b = a;
+                a = temp;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+        }
+
+        // 计算SHA1摘要，只用于握手
+        void Sha1(const uint8_t *data, size_t size, uint8_t digest[20])
+        {
+            uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+            size_t offset = 0;
+            for (; offset + 64 <= size; offset += 64)
+            {
+                Sha1Block(data + offset, state);
+            }
+
+            // 补位：0x80、若干0和64位大端的比特长度
+            uint8_t tail[128] = { 0 };
+            const size_t rest = size - offset;
+            memcpy(tail, data + offset, rest);
+            tail[rest] = 0x80;
+            const size_t tail_size = rest + 1 + 8 <= 64 ? 64 : 128;
+            const uint64_t bits = static_cast<uint64_t>(size) * 8;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                tail[tail_size - 1 - i] = static_cast<uint8_t>(bits >> (i * 8));
+            }
+            for (size_t i = 0; i < tail_size; i += 64)
+            {
+                Sha1Block(tail + i, state);
+            }
+
+            for (size_t i = 0; i < 5; ++i)
+            {
+                digest[i * 4] = static_cast<uint8_t>(state[i] >> 24);
+                digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+                digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+                digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+            }
+        }
+
+        // Base64编码
+        std::string Base64Encode(const uint8_t *data, size_t size)
+        {
+            static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            std::string result;
+            result.reserve((size + 2) / 3 * 4);
+            for (size_t i = 0; i < size; i += 3)
+            {
+                const uint32_t group = (static_cast<uint32_t>(data[i]) << 16)
+                    | (i + 1 < size ? static_cast<uint32_t>(data[i + 1]) << 8 : 0)
+                    | (i + 2 < size ? static_cast<uint32_t>(data[i + 2]) : 0);
+                result.push_back(kAlphabet[(group >> 18) & 0x3F]);
+                result.push_back(kAlphabet[(group >> 12) & 0x3F]);
+                result.push_back(i + 1 < size ? kAlphabet[(group >> 6) & 0x3F] : '=');
+                result.push_back(i + 2 < size ? kAlphabet[group & 0x3F] : '=');
+            }
+            return result;
+        }
+
+        // 读取大端整数
+        inline uint64_t LoadBigEndian(const uint8_t *data, size_t size)
+        {
+            uint64_t value = 0;
+            for (size_t i = 0; i < size; ++i)
+            {
+                value = (value << 8) | data[i];
+            }
+            return value;
+        }
+    }
+
+    const uint8_t WebSocketMessageFilter::kContinuation;
+    const uint8_t WebSocketMessageFilter::kText;
+    const uint8_t WebSocketMessageFilter::kBinary;
+    const uint8_t WebSocketMessageFilter::kClose;
+    const uint8_t WebSocketMessageFilter::kPing;
+    const uint8_t WebSocketMessageFilter::kPong;
+    const size_t WebSocketMessageFilter::kMaxHeaderSize;
+    const size_t WebSocketMessageFilter::kDefaultMaxMessageSize;
+    const size_t WebSocketMessageFilter::kGatherThreshold;
+
+    WebSocketMessageFilter::WebSocketMessageFilter(size_t max_message_size)
+        : max_message_size_(max_message_size)
+        , error_(false)
+    {
+    }
+
+    // 创建消息
+    NetMessage WebSocketMessageFilter::make_message(uint8_t opcode, const void *data, size_t size)
+    {
+        NetMessage message(size + 1);
+        message.write_pod<uint8_t>(opcode);
+        message.write(data, size);
+        return message;
+    }
+
+    // 在载荷前写入操作码
+    void WebSocketMessageFilter::prepend_opcode(uint8_t opcode, NetMessage &message)
+    {
+        message.prepend(&opcode, sizeof(opcode));
+    }
+
+    // 读取并去掉消息开头的操作码
+    uint8_t WebSocketMessageFilter::take_opcode(NetMessage &message)
+    {
+        return message.read_pod<uint8_t>();
+    }
+
+    // 计算握手的Sec-WebSocket-Accept
+    std::string WebSocketMessageFilter::accept_key(const std::string &key)
+    {
+        const std::string source = key + websocket_stuff::kHandshakeGUID;
+        uint8_t digest[20];
+        websocket_stuff::Sha1(reinterpret_cast<const uint8_t*>(source.data()), source.size(), digest);
+        return websocket_stuff::Base64Encode(digest, sizeof(digest));
+    }
+
+    // 获取欲读取数据大小
+    size_t WebSocketMessageFilter::bytes_wanna_read()
+    {
+        return MessageFilterInterface::stream_bytes();
+    }
+
+    // 获取欲写入数据大小
+    size_t WebSocketMessageFilter::bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent)
+    {
+        uint8_t header[kMaxHeaderSize];
+        size_t bytes = 0;
+        for (size_t i = 0; i < messages_to_be_sent.size(); ++i)
+        {
+            if (!messages_to_be_sent[i].empty())
+            {
+                bytes += encode_header(messages_to_be_sent[i], header) + messages_to_be_sent[i].readable() - 1;
+            }
+        }
+        return bytes;
+    }
+
+    // 读取数据
+    size_t WebSocketMessageFilter::read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received)
+    {
+        return read_stream(buffer.data(), buffer.size(), messages_received);
+    }
+
+    // 流式读取数据
+    size_t WebSocketMessageFilter::read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received)
+    {
+        size_t bytes = 0;
+        while (!error_ && size - bytes >= 2)
+        {
+            const uint8_t *frame = data + bytes;
+            const size_t available = size - bytes;
+            const bool fin = (frame[0] & 0x80) != 0;
+            const uint8_t opcode = frame[0] & 0x0F;
+            const bool control = (opcode & 0x08) != 0;
+
+            // 不支持扩展，客户端的帧必须带掩码
+            if ((frame[0] & 0x70) != 0 || (frame[1] & 0x80) == 0)
+            {
+                error_ = true;
+                break;
+            }
+
+            size_t header_size = 2;
+            uint64_t length = frame[1] & 0x7F;
+            if (length == 126)
+            {
+                header_size += 2;
+            }
+            else if (length == 127)
+            {
+                header_size += 8;
+            }
+
+            if (available < header_size + 4)
+            {
+                break;
+            }
+
+            if (header_size > 2)
+            {
+                length = websocket_stuff::LoadBigEndian(frame + 2, header_size - 2);
+            }
+            const uint8_t *key = frame + header_size;
+            header_size += 4;
+
+            // 控制帧不能分片，数据帧的分片必须连续
+            bool valid = false;
+            if (control)
+            {
+                valid = fin && length <= 125 && (opcode == kClose || opcode == kPing || opcode == kPong);
+            }
+            else if (opcode == kContinuation)
+            {
+                valid = !fragments_.empty() && length <= max_message_size_ - (fragments_.readable() - 1);
+            }
+            else
+            {
+                valid = (opcode == kText || opcode == kBinary) && fragments_.empty() && length <= max_message_size_;
+            }
+
+            if (!valid)
+            {
+                error_ = true;
+                break;
+            }
+
+            if (available - header_size < length)
+            {
+                break;
+            }
+
+            // 载荷拷贝到池化的缓冲块后就地解码
+            const size_t payload_size = static_cast<size_t>(length);
+            const uint8_t *payload = frame + header_size;
+            if (control || (fin && opcode != kContinuation))
+            {
+                NetMessage message(payload_size + 1);
+                message.write_pod<uint8_t>(opcode);
+                message.write(payload, payload_size);
+                SIMD::mask_bytes(message.data() + 1, payload_size, key);
+                messages_received.push_back(std::move(message));
+            }
+            else
+            {
+                if (opcode != kContinuation)
+                {
+                    fragments_.write_pod<uint8_t>(opcode);
+                }
+
+                const size_t offset = fragments_.readable();
+                fragments_.write(payload, payload_size);
+                SIMD::mask_bytes(fragments_.data() + offset, payload_size, key);
+                if (fin)
+                {
+                    messages_received.push_back(std::move(fragments_));
+                }
+            }
+            bytes += header_size + payload_size;
+        }
+        return bytes;
+    }
+
+    // 写入数据
+    size_t WebSocketMessageFilter::write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer)
+    {
+        return write_frames(messages_to_be_sent, 0, buffer, error_);
+    }
+
+    // 聚集写入数据
+    size_t WebSocketMessageFilter::write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers)
+    {
+        return write_frames(messages_to_be_sent, 0, headers, buffers, error_);
+    }
+
+    // 编码广播帧
+    bool WebSocketMessageFilter::write_frame(const NetMessage &message, NetMessage &frame) const
+    {
+        if (message.empty())
+        {
+            return false;
+        }
+
+        uint8_t header[kMaxHeaderSize];
+        const size_t header_size = encode_header(message, header);
+        frame = message;
+        frame.retrieve(1);
+        frame.prepend(header, header_size);
+        return true;
+    }
+
+    // 编码帧
+    size_t WebSocketMessageFilter::write_frames(std::vector<NetMessage> &messages, size_t first, ByteArrray &headers, BufferSequence &buffers, bool &error)
+    {
+        // 先确定缓存区大小，避免写入过程中重新分配导致缓冲区失效
+        uint8_t header[kMaxHeaderSize];
+        size_t headers_size = 0;
+        for (size_t i = first; i < messages.size(); ++i)
+        {
+            const NetMessage &message = messages[i];
+            if (message.empty())
+            {
+                continue;
+            }
+
+            const size_t header_size = encode_header(message, header);
+            if (message.readable() - 1 < kGatherThreshold)
+            {
+                headers_size += header_size + message.readable() - 1;
+            }
+            else if (!in_place(message, header_size))
+            {
+                headers_size += header_size;
+            }
+        }
+        headers.resize(headers_size);
+
+        size_t bytes = 0;
+        size_t offset = 0;
+        size_t chunk_begin = 0;
+        for (size_t i = first; i < messages.size(); ++i)
+        {
+            NetMessage &message = messages[i];
+            const NetMessage &content = message;
+            if (message.empty())
+            {
+                error = true;
+                continue;
+            }
+
+            const size_t header_size = encode_header(message, header);
+            const size_t payload_size = message.readable() - 1;
+            bytes += header_size + payload_size;
+
+            if (payload_size >= kGatherThreshold && in_place(message, header_size))
+            {
+                // 帧头替换操作码写入载荷前的头部空间，整帧作为一个缓冲区
+                message.retrieve(1);
+                message.prepend(header, header_size);
+                if (offset > chunk_begin)
+                {
+                    buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                    chunk_begin = offset;
+                }
+                buffers.push_back(asio::buffer(content.data(), content.readable()));
+                continue;
+            }
+
+            memcpy(headers.data() + offset, header, header_size);
+            offset += header_size;
+
+            if (payload_size < kGatherThreshold)
+            {
+                memcpy(headers.data() + offset, content.data() + 1, payload_size);
+                offset += payload_size;
+            }
+            else
+            {
+                buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+                buffers.push_back(asio::buffer(content.data() + 1, payload_size));
+                chunk_begin = offset;
+            }
+        }
+
+        if (offset > chunk_begin)
+        {
+            buffers.push_back(asio::buffer(headers.data() + chunk_begin, offset - chunk_begin));
+        }
+        return bytes;
+    }
+
+    size_t WebSocketMessageFilter::write_frames(const std::vector<NetMessage> &messages, size_t first, ByteArrray &buffer, bool &error)
+    {
+        uint8_t header[kMaxHeaderSize];
+        size_t bytes = 0;
+        for (size_t i = first; i < messages.size(); ++i)
+        {
+            const NetMessage &message = messages[i];
+            if (message.empty())
+            {
+                error = true;
+                continue;
+            }
+
+            const size_t header_size = encode_header(message, header);
+            buffer.insert(buffer.end(), header, header + header_size);
+            buffer.insert(buffer.end(), message.data() + 1, message.data() + message.readable());
+            bytes += header_size + message.readable() - 1;
+        }
+        return bytes;
+    }
+
+    // 编码帧头
+    size_t WebSocketMessageFilter::encode_header(const NetMessage &message, uint8_t *header)
+    {
+        assert(!message.empty());
+        const uint64_t length = message.readable() - 1;
+        header[0] = 0x80 | (message.data()[0] & 0x0F);
+        if (length < 126)
+        {
+            header[1] = static_cast<uint8_t>(length);
+            return 2;
+        }
+
+        const size_t size = length <= 0xFFFF ? 2 : 8;
+        header[1] = size == 2 ? 126 : 127;
+        for (size_t i = 0; i < size; ++i)
+        {
+            header[1 + size - i] = static_cast<uint8_t>(length >> (i * 8));
+        }
+        return 2 + size;
+    }
+
+    // 是否可以在载荷前直接写入帧头
+    bool WebSocketMessageFilter::in_place(const NetMessage &message, size_t header_size)
+    {
+        return message.prependable() + 1 >= header_size && !message.is_shared();
+    }
+}
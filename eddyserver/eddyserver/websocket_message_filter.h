@@ -0,0 +1,174 @@
+﻿#ifndef __WEBSOCKET_MESSAGE_FILTER_H__
+#define __WEBSOCKET_MESSAGE_FILTER_H__
+
+#include <string>
+#include "net_message.h"
+#include "message_filter.h"
+
+namespace eddyserver
+{
+    /**
+     * WebSocket消息过滤器（RFC 6455服务端）
+     * 收发的消息开头为1字节操作码，之后为载荷，回显时可直接发送收到的消息
+     * 读取时检查帧格式，客户端的帧必须带掩码，载荷拷贝到池化的NetMessage后按向量指令就地解码（见simd.h）
+     * 分片的消息合并为一条后读取，控制帧可以穿插在分片之间
+     * Ping、Close等控制帧交给SessionHandler处理，回复Pong和Close需自行发送
+     * 不支持扩展，不检查文本消息的UTF-8编码
+     * 发送的帧不带掩码，帧头直接写入消息的头部空间
+     */
+    class WebSocketMessageFilter final : public MessageFilterInterface
+    {
+    public:
+        /* 操作码 */
+        static const uint8_t kContinuation = 0x0;
+        static const uint8_t kText = 0x1;
+        static const uint8_t kBinary = 0x2;
+        static const uint8_t kClose = 0x8;
+        static const uint8_t kPing = 0x9;
+        static const uint8_t kPong = 0xA;
+
+        /* 服务端帧头最大长度 */
+        static const size_t kMaxHeaderSize = 10;
+
+        /* 默认的消息最大长度 */
+        static const size_t kDefaultMaxMessageSize = 16 * 1024 * 1024;
+
+        /* 聚集写入时小于此大小的消息体直接拷贝到消息头缓存区 */
+        static const size_t kGatherThreshold = MessageFilter::kGatherThreshold;
+
+    public:
+        /**
+         * 构造函数
+         * @param max_message_size 合并分片后的载荷最大长度，超过时出错
+         */
+        explicit WebSocketMessageFilter(size_t max_message_size = kDefaultMaxMessageSize);
+
+    public:
+        /**
+         * 创建消息
+         * @param opcode 操作码
+         * @param data 载荷地址
+         * @param size 载荷大小
+         */
+        static NetMessage make_message(uint8_t opcode, const void *data, size_t size);
+
+        /**
+         * 在载荷前写入操作码
+         * 独占缓冲块且有头部空间时不移动数据
+         */
+        static void prepend_opcode(uint8_t opcode, NetMessage &message);
+
+        /**
+         * 读取并去掉消息开头的操作码
+         */
+        static uint8_t take_opcode(NetMessage &message);
+
+        /**
+         * 计算握手的Sec-WebSocket-Accept
+         * @param key 客户端的Sec-WebSocket-Key
+         */
+        static std::string accept_key(const std::string &key);
+
+        /**
+         * 编码帧
+         * 从first开始的消息编码后写入，消息开头的操作码替换为帧头
+         * 没有操作码的空消息不写入，并设置error
+         * 供HttpMessageFilter升级后使用
+         */
+        static size_t write_frames(std::vector<NetMessage> &messages, size_t first, ByteArrray &headers, BufferSequence &buffers, bool &error);
+        static size_t write_frames(const std::vector<NetMessage> &messages, size_t first, ByteArrray &buffer, bool &error);
+
+    public:
+        /**
+         * 获取欲读取数据大小
+         */
+        virtual size_t bytes_wanna_read();
+
+        /**
+         * 获取欲写入数据大小
+         * @param messages_to_be_sent 将被发送的消息列表
+         */
+        virtual size_t bytes_wanna_write(const std::vector<NetMessage> &messages_to_be_sent);
+
+        /**
+         * 读取数据
+         * 与流式读取相同
+         */
+        virtual size_t read(const ByteArrray &buffer, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 流式读取数据
+         * 解析data中所有完整的帧，出错后不再读取
+         * @param data 数据地址
+         * @param size 数据大小
+         * @param messages_received 读取的消息列表
+         * @return 已解析的字节数
+         */
+        virtual size_t read_stream(const uint8_t *data, size_t size, std::vector<NetMessage> &messages_received);
+
+        /**
+         * 写入数据
+         * 将param1 messages_to_be_sent的消息列表写入param2 buffer中
+         * @param messages_to_be_sent 写入的消息列表
+         * @param &buffer 缓存区
+         * @return 写入字节数
+         */
+        virtual size_t write(const std::vector<NetMessage> &messages_to_be_sent, ByteArrray &buffer);
+
+        /**
+         * 是否支持聚集写入
+         */
+        virtual bool supports_gather_write() const
+        {
+            return true;
+        }
+
+        /**
+         * 聚集写入数据
+         * 独占缓冲块的消息直接在载荷前写入帧头
+         * @param messages_to_be_sent 写入的消息列表
+         * @param headers 消息头缓存区
+         * @param buffers 缓冲区序列
+         * @return 写入字节数
+         */
+        virtual size_t write_gather(std::vector<NetMessage> &messages_to_be_sent, ByteArrray &headers, BufferSequence &buffers);
+
+        /**
+         * 编码广播帧
+         * 服务端的帧不带掩码，只依赖消息内容
+         * @param message 消息
+         * @param frame 编码后的帧
+         * @return 是否支持
+         */
+        virtual bool write_frame(const NetMessage &message, NetMessage &frame) const;
+
+        /**
+         * 是否出错
+         */
+        virtual bool has_error() const
+        {
+            return error_;
+        }
+
+    private:
+        /**
+         * 编码帧头
+         * @param message 以操作码开头的消息
+         * @param header 帧头缓存区，至少kMaxHeaderSize字节
+         * @return 帧头字节数
+         */
+        static size_t encode_header(const NetMessage &message, uint8_t *header);
+
+        /**
+         * 是否可以在载荷前直接写入帧头
+         */
+        static bool in_place(const NetMessage &message, size_t header_size);
+
+    private:
+        const size_t    max_message_size_;
+        bool            error_;
+        NetMessage      fragments_;
+    };
+}
+
+#endif
@@ -0,0 +1,182 @@
+﻿#ifndef __WORK_STEALING_DEQUE_H__
+#define __WORK_STEALING_DEQUE_H__
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+namespace eddyserver
+{
+    /**
+     * 无锁工作窃取双端队列（Chase-Lev）
+     * 所有者在底部压入和弹出，其它线程从顶部窃取
+     * 扩容后旧数组延迟到析构时释放，窃取者不会访问到已释放的内存
+     */
+    template <typename T>
+    class WorkStealingDeque final
+    {
+        static_assert(std::is_pointer<T>::value, "T must be a pointer type");
+
+        struct Array
+        {
+            const int64_t                       capacity;
+            std::unique_ptr<std::atomic<T>[]>   buffer;
+
+            explicit Array(int64_t size)
+                : capacity(size)
+                , buffer(new std::atomic<T>[static_cast<size_t>(size)])
+            {
+            }
+
+            T get(int64_t index) const
+            {
+                return buffer[static_cast<size_t>(index & (capacity - 1))].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t index, T value)
+            {
+                buffer[static_cast<size_t>(index & (capacity - 1))].store(value, std::memory_order_relaxed);
+            }
+        };
+
+    public:
+        /**
+         * 构造函数
+         * @param capacity 初始容量，必须为2的幂
+         */
+        explicit WorkStealingDeque(int64_t capacity = 256)
+            : top_(0)
+            , bottom_(0)
+        {
+            garbage_.push_back(std::make_unique<Array>(capacity));
+            array_.store(garbage_.back().get(), std::memory_order_relaxed);
+        }
+
+    public:
+        /**
+         * 获取元素数量
+         * 其它线程调用时只是近似值
+         */
+        size_t size() const
+        {
+            const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+            const int64_t top = top_.load(std::memory_order_relaxed);
+            return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+        }
+
+        /**
+         * 是否为空
+         */
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        /**
+         * 压入底部
+         * 只能由所有者调用
+         */
+        void push(T value)
+        {
+            const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+            const int64_t top = top_.load(std::memory_order_acquire);
+            Array *array = array_.load(std::memory_order_relaxed);
+            if (bottom - top > array->capacity - 1)
+            {
+                array = grow(array, bottom, top);
+            }
+            array->put(bottom, value);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * 从底部弹出
+         * 只能由所有者调用
+         * @return 为空时返回nullptr
+         */
+        T pop()
+        {
+            const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+            Array *array = array_.load(std::memory_order_relaxed);
+            bottom_.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = top_.load(std::memory_order_relaxed);
+
+            T value = nullptr;
+            if (top <= bottom)
+            {
+                value = array->get(bottom);
+                if (top == bottom)
+                {
+                    // 最后一个元素，与窃取者竞争
+                    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        value = nullptr;
+                    }
+                    bottom_.store(bottom + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return value;
+        }
+
+        /**
+         * 从顶部窃取
+         * 可在任意线程调用
+         * @return 为空或竞争失败时返回nullptr
+         */
+        T steal()
+        {
+            int64_t top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+            T value = nullptr;
+            if (top < bottom)
+            {
+                Array *array = array_.load(std::memory_order_acquire);
+                value = array->get(top);
+                if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    return nullptr;
+                }
+            }
+            return value;
+        }
+
+    private:
+        /**
+         * 扩容
+         */
+        Array* grow(Array *array, int64_t bottom, int64_t top)
+        {
+            garbage_.push_back(std::make_unique<Array>(array->capacity * 2));
+            Array *new_array = garbage_.back().get();
+            for (int64_t i = top; i < bottom; ++i)
+            {
+                new_array->put(i, array->get(i));
+            }
+            array_.store(new_array, std::memory_order_release);
+            return new_array;
+        }
+
+    private:
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator= (const WorkStealingDeque&) = delete;
+
+    private:
+        std::atomic<int64_t>                top_;
+        std::atomic<int64_t>                bottom_;
+        std::atomic<Array*>                 array_;
+        std::vector<std::unique_ptr<Array>> garbage_;
+    };
+}
+
+#endif
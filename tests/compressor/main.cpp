@@ -0,0 +1,278 @@
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <eddyserver.h>
+#include <eddyserver/compressor.h>
+#include <eddyserver/basic_message_filter.h>
+#include <eddyserver/compression_filter.h>
+
+typedef std::vector<uint8_t> Bytes;
+
+// 随机损坏输入的次数
+const size_t kFuzzRounds = 10000;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 压缩
+     * 输出缓存为compress_bound大小，至少1字节
+     */
+    Bytes Compress(const Bytes &input, const eddyserver::CompressionDictionary *dictionary = nullptr)
+    {
+        Bytes output(eddyserver::Compressor::compress_bound(input.size()));
+        const size_t size = eddyserver::Compressor::compress(input.data(), input.size(), output.data(), output.size(), dictionary);
+        output.resize(size);
+        return output;
+    }
+
+    /**
+     * 解压
+     * 输出缓存至少1字节，避免空数据时传入空指针
+     */
+    bool Decompress(const Bytes &input, size_t original_size, Bytes &output,
+        const eddyserver::CompressionDictionary *dictionary = nullptr)
+    {
+        output.assign(original_size + 1, 0);
+        const bool success = eddyserver::Compressor::decompress(input.data(), input.size(), output.data(), original_size, dictionary);
+        output.resize(original_size);
+        return success;
+    }
+
+    /**
+     * 压缩后解压，结果与原始数据相同
+     * @return 压缩后的大小
+     */
+    size_t RoundTrip(const Bytes &input, const char *description, const eddyserver::CompressionDictionary *dictionary = nullptr)
+    {
+        const Bytes compressed = Compress(input, dictionary);
+        Bytes output;
+        Expect(!compressed.empty() && Decompress(compressed, input.size(), output, dictionary) && output == input, description);
+        return compressed.size();
+    }
+
+    /**
+     * 生成随机数据
+     */
+    Bytes RandomBytes(size_t size, std::mt19937 &engine)
+    {
+        Bytes bytes(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            bytes[i] = static_cast<uint8_t>(engine());
+        }
+        return bytes;
+    }
+
+    /**
+     * 生成类似JSON的消息
+     */
+    std::string JsonMessage(size_t id)
+    {
+        return "{\"id\":" + std::to_string(id) + ",\"type\":\"move\",\"position\":{\"x\":12,\"y\":34},\"status\":\"ok\"}";
+    }
+}
+
+// 不可压缩、高度重复和空数据的往返
+void TestRoundTrip()
+{
+    std::mt19937 engine(20261017);
+
+    const Bytes random = RandomBytes(64 * 1024, engine);
+    const size_t random_size = RoundTrip(random, "incompressible input round-trips");
+    Expect(random_size <= eddyserver::Compressor::compress_bound(random.size()), "incompressible input stays within compress_bound");
+
+    const Bytes repeated(1024 * 1024, 'x');
+    const size_t repeated_size = RoundTrip(repeated, "highly repetitive input round-trips");
+    Expect(repeated_size < repeated.size() / 200, "highly repetitive input shrinks");
+
+    Bytes pattern;
+    for (size_t i = 0; pattern.size() < 256 * 1024; ++i)
+    {
+        const std::string message = JsonMessage(i % 100);
+        pattern.insert(pattern.end(), message.begin(), message.end());
+    }
+    RoundTrip(pattern, "repeated messages round-trip");
+
+    RoundTrip(Bytes(), "empty input round-trips");
+    for (size_t size = 1; size <= 32; ++size)
+    {
+        RoundTrip(RandomBytes(size, engine), "short input round-trips");
+        RoundTrip(Bytes(size, 'a'), "short repetitive input round-trips");
+    }
+
+    // 输出缓存不足时失败而不越界
+    Bytes output(16);
+    Expect(eddyserver::Compressor::compress(random.data(), random.size(), output.data(), output.size()) == 0,
+        "compress fails when the output does not fit");
+}
+
+// 字典的往返，解压时必须使用相同的字典
+void TestDictionary()
+{
+    std::string sample;
+    for (size_t i = 0; i < 16; ++i)
+    {
+        sample += JsonMessage(i);
+    }
+    const eddyserver::CompressionDictionary dictionary(sample.data(), sample.size());
+
+    const std::string message = JsonMessage(1000);
+    const Bytes input(message.begin(), message.end());
+    const size_t without_dictionary = Compress(input).size();
+    const size_t with_dictionary = RoundTrip(input, "dictionary round-trips", &dictionary);
+    Expect(with_dictionary < without_dictionary, "dictionary shrinks small messages");
+
+    Bytes output;
+    const Bytes compressed = Compress(input, &dictionary);
+    Expect(!Decompress(compressed, input.size(), output), "dictionary matches are rejected without the dictionary");
+
+    // 超过上限的字典只保留末尾
+    const std::string large(eddyserver::CompressionDictionary::kMaxSize + 100, 'd');
+    const eddyserver::CompressionDictionary truncated(large.data(), large.size());
+    Expect(truncated.size() == eddyserver::CompressionDictionary::kMaxSize, "large dictionaries keep their tail");
+    RoundTrip(Bytes(4096, 'd'), "large dictionary round-trips", &truncated);
+}
+
+// 拒绝格式错误或被截断的输入
+void TestMalformed()
+{
+    Bytes input;
+    for (size_t i = 0; i < 200; ++i)
+    {
+        const std::string message = JsonMessage(i);
+        input.insert(input.end(), message.begin(), message.end());
+    }
+    const Bytes compressed = Compress(input);
+
+    Bytes output;
+    for (size_t size = 0; size < compressed.size(); ++size)
+    {
+        const Bytes truncated(compressed.begin(), compressed.begin() + size);
+        if (Decompress(truncated, input.size(), output))
+        {
+            Expect(false, "truncated input is rejected");
+            break;
+        }
+    }
+    Expect(!Decompress(compressed, input.size() + 1, output), "larger claimed size is rejected");
+    Expect(!Decompress(compressed, input.size() - 1, output), "smaller claimed size is rejected");
+
+    const uint8_t zero_offset[] = { 0x10, 'a', 0x00, 0x00 };
+    Expect(!Decompress(Bytes(zero_offset, zero_offset + sizeof(zero_offset)), 5, output), "zero offset is rejected");
+
+    const uint8_t far_offset[] = { 0x10, 'a', 0x02, 0x00 };
+    Expect(!Decompress(Bytes(far_offset, far_offset + sizeof(far_offset)), 5, output), "offset before the start is rejected");
+
+    const uint8_t long_literals[] = { 0xF0, 0xFF, 0xFF };
+    Expect(!Decompress(Bytes(long_literals, long_literals + sizeof(long_literals)), 600, output), "unterminated length is rejected");
+
+    const uint8_t missing_offset[] = { 0x10, 'a', 0x01 };
+    Expect(!Decompress(Bytes(missing_offset, missing_offset + sizeof(missing_offset)), 5, output), "missing offset byte is rejected");
+
+    // 随机损坏的输入只能失败或得到声明大小的数据，不能越界
+    std::mt19937 engine(17);
+    size_t rejected = 0;
+    for (size_t i = 0; i < kFuzzRounds; ++i)
+    {
+        Bytes corrupted = compressed;
+        corrupted[engine() % corrupted.size()] = static_cast<uint8_t>(engine());
+        corrupted[engine() % corrupted.size()] = static_cast<uint8_t>(engine());
+        if (!Decompress(corrupted, input.size(), output))
+        {
+            ++rejected;
+        }
+    }
+    Expect(rejected > 0, "corrupted input is rejected");
+}
+
+// CompressionStage按阈值压缩并写入标志
+void TestStage()
+{
+    std::string sample;
+    for (size_t i = 0; i < 16; ++i)
+    {
+        sample += JsonMessage(i);
+    }
+    auto dictionary = std::make_shared<eddyserver::CompressionDictionary>(sample.data(), sample.size());
+    const eddyserver::CompressionStage stage(64, dictionary);
+
+    const std::string small = "tiny";
+    eddyserver::NetMessage message(small.data(), small.size());
+    stage.encode(message);
+    Expect(message.readable() == small.size() + 1 && message.data()[0] == eddyserver::CompressionStage::kRaw,
+        "messages below the threshold are sent raw");
+    Expect(stage.decode(message) && message.readable() == small.size() && memcmp(message.data(), small.data(), small.size()) == 0,
+        "raw messages decode");
+
+    const std::string large = JsonMessage(1000) + JsonMessage(1001);
+    message = eddyserver::NetMessage(large.data(), large.size());
+    stage.encode(message);
+    Expect(message.readable() < large.size() && message.data()[0] == eddyserver::CompressionStage::kCompressedWithDictionary,
+        "messages above the threshold are compressed with the dictionary");
+    Expect(stage.decode(message) && message.readable() == large.size() && memcmp(message.data(), large.data(), large.size()) == 0,
+        "compressed messages decode");
+
+    const uint8_t bad_flag[] = { 7, 'a' };
+    eddyserver::NetMessage bad(reinterpret_cast<const char*>(bad_flag), sizeof(bad_flag));
+    Expect(!stage.decode(bad), "unknown flags are rejected");
+
+    const uint8_t huge_size[] = { eddyserver::CompressionStage::kCompressed, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 0x00 };
+    eddyserver::NetMessage huge(reinterpret_cast<const char*>(huge_size), sizeof(huge_size));
+    Expect(!stage.decode(huge), "claimed sizes beyond the maximum ratio are rejected");
+}
+
+// CompressionFilter包装分帧过滤器的往返
+void TestFilter()
+{
+    std::vector<eddyserver::NetMessage> messages;
+    std::vector<std::string> payloads;
+    payloads.push_back("tiny");
+    payloads.push_back(std::string(4096, 'z'));
+    payloads.push_back(JsonMessage(1) + JsonMessage(2) + JsonMessage(3) + JsonMessage(4));
+    for (size_t i = 0; i < payloads.size(); ++i)
+    {
+        messages.emplace_back(payloads[i].data(), payloads[i].size());
+    }
+
+    eddyserver::CompressionFilter writer(std::make_shared<eddyserver::VarintMessageFilter>());
+    eddyserver::MessageFilterInterface::ByteArrray buffer;
+    const size_t bytes = writer.write(messages, buffer);
+    Expect(bytes == buffer.size() && bytes < payloads[1].size(), "filter compresses large messages");
+
+    eddyserver::CompressionFilter reader(std::make_shared<eddyserver::VarintMessageFilter>());
+    std::vector<eddyserver::NetMessage> received;
+    const size_t consumed = reader.read_stream(buffer.data(), buffer.size(), received);
+    bool same = consumed == buffer.size() && received.size() == payloads.size();
+    for (size_t i = 0; same && i < payloads.size(); ++i)
+    {
+        same = received[i].readable() == payloads[i].size() && memcmp(received[i].data(), payloads[i].data(), payloads[i].size()) == 0;
+    }
+    Expect(same && !reader.has_error(), "filter round-trips messages");
+}
+
+int main(int argc, char *argv[])
+{
+    TestRoundTrip();
+    TestDictionary();
+    TestMalformed();
+    TestStage();
+    TestFilter();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,220 @@
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <condition_variable>
+#include <eddyserver.h>
+#include <eddyserver/thread_pool.h>
+#include <eddyserver/io_service_thread.h>
+
+#if !defined(__cpp_impl_coroutine)
+#error "coroutine_echo must be compiled with C++20 coroutines"
+#endif
+
+// 往返次数
+const uint32_t kRounds = 1000;
+
+// IO线程数量（含主线程）
+const size_t kThreadCount = 3;
+
+// 超时时间
+const std::chrono::seconds kTimeout(30);
+
+/**
+ * 读取消息中的序号
+ */
+uint32_t SequenceOf(const eddyserver::NetMessage &message)
+{
+    uint32_t sequence = 0;
+    if (message.readable() >= sizeof(sequence))
+    {
+        memcpy(&sequence, message.data(), sizeof(sequence));
+    }
+    return sequence;
+}
+
+/**
+ * 协程回显
+ * 主线程中以co_await async_connect连接，服务端协程以receive/send回显
+ * 客户端协程每轮co_await线程池计算出的序号，发送后等待回显并检查
+ */
+class CoroutineEcho
+{
+    /**
+     * 服务端，原样回显直到连接关闭
+     */
+    class ServerHandler : public eddyserver::CoroutineSessionHandler
+    {
+    public:
+        virtual eddyserver::Coroutine<> run() override
+        {
+            for (;;)
+            {
+                eddyserver::NetMessage message = co_await receive();
+                if (message.empty())
+                {
+                    co_return;
+                }
+                co_await send(message);
+            }
+        }
+    };
+
+    /**
+     * 客户端
+     */
+    class ClientHandler : public eddyserver::CoroutineSessionHandler
+    {
+    public:
+        explicit ClientHandler(CoroutineEcho &test)
+            : test_(test)
+        {
+        }
+
+    public:
+        virtual eddyserver::Coroutine<> run() override
+        {
+            eddyserver::IOServiceThread *td = eddyserver::IOServiceThread::current_thread();
+            for (uint32_t i = 0; i < kRounds; ++i)
+            {
+                const uint32_t sequence = co_await test_.pool_.submit([i]() { return i * 3 + 1; });
+                if (eddyserver::IOServiceThread::current_thread() != td)
+                {
+                    test_.finish("future resumed on another thread");
+                    co_return;
+                }
+
+                eddyserver::NetMessage message;
+                message.write_pod(sequence);
+                if (!co_await send(message))
+                {
+                    test_.finish("send failed");
+                    co_return;
+                }
+
+                eddyserver::NetMessage reply = co_await receive();
+                if (reply.empty() || SequenceOf(reply) != sequence)
+                {
+                    test_.finish("unexpected reply");
+                    co_return;
+                }
+            }
+            test_.finish(nullptr);
+        }
+
+    private:
+        CoroutineEcho &test_;
+    };
+
+public:
+    CoroutineEcho()
+        : io_thread_manager_(kThreadCount)
+        , pool_(1)
+        , finished_(false)
+        , error_(nullptr)
+    {
+    }
+
+public:
+    /**
+     * 执行测试
+     * @return 是否成功
+     */
+    bool run()
+    {
+        asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), 0);
+        eddyserver::TCPServer server(endpoint, io_thread_manager_,
+            []() { return std::make_shared<ServerHandler>(); },
+            []() { return std::make_shared<eddyserver::MessageFilter>(); });
+        server_endpoint_ = server.get_local_endpoint();
+
+        client_ = std::make_unique<eddyserver::TCPClient>(io_thread_manager_,
+            [this]() { return std::make_shared<ClientHandler>(*this); },
+            []() { return std::make_shared<eddyserver::MessageFilter>(); });
+
+        io_thread_manager_.get_main_thread()->post([this]()
+        {
+            eddyserver::spawn(connect());
+        });
+
+        std::thread watchdog([this]()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!condition_.wait_for(lock, kTimeout, [this]() { return finished_; }))
+            {
+                std::cerr << "timeout" << std::endl;
+                std::_Exit(EXIT_FAILURE);
+            }
+        });
+
+        io_thread_manager_.run();
+        watchdog.join();
+        pool_.join();
+
+        if (error_ != nullptr)
+        {
+            std::cerr << error_ << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    /**
+     * 连接协程
+     */
+    eddyserver::Coroutine<> connect()
+    {
+        asio::error_code error_code = co_await client_->async_connect(server_endpoint_);
+        if (error_code)
+        {
+            finish("connect failed");
+        }
+    }
+
+    /**
+     * 结束测试
+     * 存活的Session仍有未完成的读操作，直接停止io_service
+     */
+    void finish(const char *error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_)
+            {
+                return;
+            }
+            finished_ = true;
+            error_ = error;
+        }
+        condition_.notify_all();
+
+        for (size_t i = 1; i <= io_thread_manager_.get_thread_count(); ++i)
+        {
+            io_thread_manager_.get_thread(static_cast<eddyserver::IOThreadID>(i))->get_io_service().stop();
+        }
+    }
+
+private:
+    eddyserver::IOServiceThreadManager      io_thread_manager_;
+    ThreadPool                              pool_;
+    std::unique_ptr<eddyserver::TCPClient>  client_;
+    asio::ip::tcp::endpoint                 server_endpoint_;
+    std::mutex                              mutex_;
+    std::condition_variable                 condition_;
+    bool                                    finished_;
+    const char*                             error_;
+};
+
+int main(int argc, char *argv[])
+{
+    CoroutineEcho test;
+    if (!test.run())
+    {
+        return EXIT_FAILURE;
+    }
+    std::cout << kRounds << " coroutine round trips" << std::endl;
+    return EXIT_SUCCESS;
+}
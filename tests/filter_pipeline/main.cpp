@@ -0,0 +1,235 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <eddyserver.h>
+#include <eddyserver/filter_pipeline.h>
+#include <eddyserver/compression_filter.h>
+
+typedef eddyserver::MessageFilterInterface::ByteArrray ByteArrray;
+typedef std::vector<eddyserver::NetMessage> NetMessageVector;
+
+// 压缩阈值
+const size_t kCompressionThreshold = 64;
+
+// 分帧过滤器的消息头大小
+const size_t kFrameHeaderSize = eddyserver::MessageFilter::header_size;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 字符串转为消息
+     */
+    eddyserver::NetMessage ToMessage(const std::string &text)
+    {
+        return eddyserver::NetMessage(text.data(), text.size());
+    }
+
+    /**
+     * 消息转为字符串
+     */
+    std::string ToString(const eddyserver::NetMessage &message)
+    {
+        return std::string(reinterpret_cast<const char*>(message.data()), message.readable());
+    }
+
+    /**
+     * 创建压缩、校验的管道
+     * 分帧过滤器为MessageFilter
+     */
+    eddyserver::MessageFilterCreator BuildPipeline(eddyserver::FilterPipelineStatisticsPointer *statistics = nullptr)
+    {
+        return eddyserver::FilterPipelineBuilder([]() { return std::make_shared<eddyserver::MessageFilter>(); })
+            .add_stage(std::make_shared<eddyserver::CompressionStage>(kCompressionThreshold))
+            .add_stage(std::make_shared<eddyserver::ChecksumStage>())
+            .build(statistics);
+    }
+
+    /**
+     * 测试用的消息
+     * 包含不压缩的短消息和可压缩的长消息
+     */
+    std::vector<std::string> SampleTexts()
+    {
+        std::vector<std::string> texts;
+        texts.push_back("short");
+        texts.push_back(std::string(1000, 'a'));
+        std::string mixed;
+        for (size_t i = 0; mixed.size() < 4096; ++i)
+        {
+            mixed += "message " + std::to_string(i % 17) + ";";
+        }
+        texts.push_back(mixed);
+        return texts;
+    }
+
+    /**
+     * 解析全部数据
+     */
+    size_t ReadAll(eddyserver::MessageFilterInterface &filter, const ByteArrray &bytes, NetMessageVector &received)
+    {
+        return filter.read_stream(bytes.data(), bytes.size(), received);
+    }
+}
+
+// CRC32与zlib相同，校验阶段写入并去掉校验码
+void TestChecksum()
+{
+    const char check[] = "123456789";
+    Expect(eddyserver::ChecksumStage::crc32(check, 9) == 0xCBF43926, "CRC32 check value matches");
+    Expect(eddyserver::ChecksumStage::crc32(check + 4, 5, eddyserver::ChecksumStage::crc32(check, 4)) == 0xCBF43926,
+        "CRC32 can be computed in pieces");
+    Expect(eddyserver::ChecksumStage::crc32(nullptr, 0) == 0, "CRC32 of nothing is zero");
+
+    const eddyserver::ChecksumStage stage;
+    eddyserver::NetMessage message = ToMessage("payload");
+    message.reserve_room(stage.headroom(), stage.tailroom());
+    stage.encode(message);
+    Expect(message.readable() == 7 + eddyserver::ChecksumStage::kChecksumSize, "checksum is appended");
+    Expect(stage.decode(message) && ToString(message) == "payload", "checksum is verified and removed");
+
+    eddyserver::NetMessage corrupted = ToMessage("payload");
+    corrupted.reserve_room(stage.headroom(), stage.tailroom());
+    stage.encode(corrupted);
+    corrupted.data()[0] ^= 0x01;
+    Expect(!stage.decode(corrupted), "corrupted payload fails the checksum");
+}
+
+// 经过分帧、压缩和校验的往返
+void TestRoundTrip()
+{
+    eddyserver::FilterPipelineStatisticsPointer statistics;
+    const eddyserver::MessageFilterCreator creator = BuildPipeline(&statistics);
+    Expect(statistics != nullptr && statistics->stage_count() == 3, "statistics cover the framing filter and both stages");
+
+    const std::vector<std::string> texts = SampleTexts();
+    NetMessageVector messages;
+    size_t original_bytes = 0;
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        messages.push_back(ToMessage(texts[i]));
+        original_bytes += texts[i].size();
+    }
+
+    // 连续写入
+    eddyserver::MessageFilterPointer writer = creator();
+    ByteArrray bytes;
+    writer->write(messages, bytes);
+    Expect(!writer->has_error() && bytes.size() < original_bytes, "compressible messages shrink on the wire");
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        Expect(ToString(messages[i]) == texts[i], "write leaves the caller's messages untouched");
+    }
+
+    eddyserver::MessageFilterPointer reader = creator();
+    NetMessageVector received;
+    Expect(ReadAll(*reader, bytes, received) == bytes.size() && !reader->has_error(), "written bytes are consumed");
+    Expect(received.size() == texts.size(), "every message is received");
+    for (size_t i = 0; i < received.size() && i < texts.size(); ++i)
+    {
+        Expect(ToString(received[i]) == texts[i], "message survives the round trip");
+    }
+
+    // 聚集写入，缓冲区序列拼接后与连续写入的结果相同
+    eddyserver::MessageFilterPointer gather_writer = creator();
+    NetMessageVector gather_messages;
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        gather_messages.push_back(ToMessage(texts[i]));
+    }
+    ByteArrray headers;
+    eddyserver::MessageFilterInterface::BufferSequence buffers;
+    gather_writer->write_gather(gather_messages, headers, buffers);
+    ByteArrray gathered(asio::buffer_size(buffers));
+    asio::buffer_copy(asio::buffer(gathered), buffers);
+    Expect(gathered == bytes, "gather write produces the same bytes");
+
+    const std::vector<eddyserver::StageStatistics> snapshot = statistics->snapshot();
+    Expect(snapshot.size() == 3 && snapshot[1].name == "compression" && snapshot[2].name == "checksum", "stages are named");
+    Expect(snapshot.size() == 3 && snapshot[2].encode_calls == texts.size() * 2 && snapshot[2].decode_calls == texts.size(),
+        "each stage counts its messages");
+}
+
+// 损坏的帧被丢弃，管道出错，之后的消息不再交给上层
+void TestCorruptedFrame()
+{
+    const eddyserver::MessageFilterCreator creator = BuildPipeline();
+    const std::vector<std::string> texts = SampleTexts();
+    NetMessageVector messages;
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        messages.push_back(ToMessage(texts[i]));
+    }
+
+    ByteArrray bytes;
+    creator()->write(messages, bytes);
+    Expect(bytes.size() > kFrameHeaderSize, "frame is written");
+    bytes[kFrameHeaderSize] ^= 0x40;
+
+    eddyserver::MessageFilterPointer reader = creator();
+    NetMessageVector received;
+    ReadAll(*reader, bytes, received);
+    Expect(reader->has_error(), "corrupted frame sets the error");
+    Expect(received.empty(), "corrupted frame and the frames after it are dropped");
+
+    // 损坏在后面的帧时，此前的消息照常交付
+    ByteArrray tail_corrupted;
+    creator()->write(messages, tail_corrupted);
+    tail_corrupted.back() ^= 0x01;
+    eddyserver::MessageFilterPointer tail_reader = creator();
+    received.clear();
+    ReadAll(*tail_reader, tail_corrupted, received);
+    Expect(tail_reader->has_error() && received.size() == texts.size() - 1, "frames before the corrupted one are kept");
+}
+
+// 空间足够且独占缓冲块时reserve_room不移动数据
+void TestReserveRoom()
+{
+    eddyserver::NetMessage message(64, 16);
+    message.write("payload", 7);
+    const uint8_t *data = message.data();
+    const size_t prependable = message.prependable();
+    Expect(prependable >= 16 && message.writeable() >= 8, "message starts with head and tail room");
+
+    message.reserve_room(prependable, 8);
+    Expect(message.data() == data && ToString(message) == "payload", "sufficient room does not move the data");
+
+    message.reserve_room(prependable + 64, 0);
+    Expect(message.prependable() >= prependable + 64 && ToString(message) == "payload", "missing headroom is added");
+
+    // 共享的缓冲块先复制，原消息不受影响
+    eddyserver::NetMessage shared = message;
+    const uint8_t *shared_data = message.data();
+    shared.reserve_room(0, 0);
+    Expect(shared.data() != shared_data && !shared.is_shared() && !message.is_shared(), "shared buffer is copied");
+    Expect(message.data() == shared_data && ToString(message) == "payload" && ToString(shared) == "payload",
+        "copy leaves the original intact");
+
+    eddyserver::NetMessage empty;
+    empty.reserve_room(4, 4);
+    Expect(empty.prependable() >= 4 && empty.writeable() >= 4 && empty.empty(), "empty message gets room");
+}
+
+int main(int argc, char *argv[])
+{
+    TestChecksum();
+    TestRoundTrip();
+    TestCorruptedFrame();
+    TestReserveRoom();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
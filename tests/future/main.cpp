@@ -0,0 +1,131 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <eddyserver/future.h>
+
+using eddyserver::Future;
+using eddyserver::Promise;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+}
+
+// 任一就绪后，未就绪的Future仍可设置后续任务
+void TestWhenAnyLoserThen()
+{
+    std::vector<Promise<int>> promises(3);
+    std::vector<Future<int>> futures;
+    for (size_t i = 0; i < promises.size(); ++i)
+    {
+        futures.push_back(promises[i].get_future());
+    }
+
+    Future<eddyserver::WhenAnyResult<int>> any = eddyserver::when_any(std::move(futures));
+    Expect(!any.is_ready(), "when_any waits for an input");
+
+    promises[1].set_value(11);
+    Expect(any.is_ready(), "when_any is ready once an input is ready");
+    eddyserver::WhenAnyResult<int> result = any.get();
+    Expect(result.index == 1, "when_any reports the winner");
+    Expect(result.futures.size() == 3, "when_any returns every future");
+    Expect(result.futures[1].is_ready() && result.futures[1].get() == 11, "winner carries its value");
+
+    // 未就绪的Future设置后续任务
+    int loser_value = 0;
+    Future<void> loser = result.futures[0].then([&loser_value](Future<int> future)
+    {
+        loser_value = future.get();
+    });
+    Future<std::string> failed = result.futures[2].then([](Future<int> future)
+    {
+        try
+        {
+            future.get();
+        }
+        catch (const std::runtime_error &e)
+        {
+            return std::string(e.what());
+        }
+        return std::string();
+    });
+    Expect(!loser.is_ready() && !failed.is_ready(), "loser continuations wait for their inputs");
+
+    promises[0].set_value(10);
+    promises[2].set_exception(std::make_exception_ptr(std::runtime_error("loser failed")));
+    Expect(loser.is_ready() && loser_value == 10, "loser continuation receives the value");
+    Expect(failed.get() == "loser failed", "loser continuation receives the exception");
+}
+
+// 放弃的Promise通过新的Future传递broken_promise
+void TestWhenAnyBrokenPromise()
+{
+    std::vector<Future<void>> futures;
+    {
+        Promise<void> promise;
+        futures.push_back(promise.get_future());
+    }
+
+    eddyserver::WhenAnyResult<void> result = eddyserver::when_any(std::move(futures)).get();
+    bool broken = false;
+    try
+    {
+        result.futures[0].get();
+    }
+    catch (const std::future_error &e)
+    {
+        broken = e.code() == std::future_errc::broken_promise;
+    }
+    Expect(result.index == 0, "abandoned input wins");
+    Expect(broken, "broken promise reaches the new future");
+}
+
+// 空列表立即就绪
+void TestWhenAnyEmpty()
+{
+    Future<eddyserver::WhenAnyResult<int>> any = eddyserver::when_any(std::vector<Future<int>>());
+    Expect(any.is_ready(), "empty when_any is ready");
+    Expect(any.get().index == static_cast<size_t>(-1), "empty when_any has no winner");
+}
+
+// 全部就绪
+void TestWhenAll()
+{
+    std::vector<Promise<int>> promises(2);
+    std::vector<Future<int>> futures;
+    for (size_t i = 0; i < promises.size(); ++i)
+    {
+        futures.push_back(promises[i].get_future());
+    }
+
+    Future<std::vector<Future<int>>> all = eddyserver::when_all(std::move(futures));
+    promises[1].set_value(2);
+    Expect(!all.is_ready(), "when_all waits for every input");
+    promises[0].set_value(1);
+
+    std::vector<Future<int>> results = all.get();
+    Expect(results.size() == 2 && results[0].get() == 1 && results[1].get() == 2, "when_all keeps the order");
+}
+
+int main(int argc, char *argv[])
+{
+    TestWhenAnyLoserThen();
+    TestWhenAnyBrokenPromise();
+    TestWhenAnyEmpty();
+    TestWhenAll();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
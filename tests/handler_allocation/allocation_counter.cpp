@@ -0,0 +1,40 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<size_t> allocations(0);
+}
+
+// 分配内存并计数
+void* operator new(size_t size)
+{
+    ++allocations;
+    void *pointer = std::malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+// 释放内存
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+// 释放内存
+void operator delete(void *pointer, size_t size) noexcept
+{
+    std::free(pointer);
+}
+
+// 获取分配次数
+size_t AllocationCount()
+{
+    return allocations.load();
+}
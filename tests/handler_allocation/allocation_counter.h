@@ -0,0 +1,12 @@
+#ifndef __ALLOCATION_COUNTER_H__
+#define __ALLOCATION_COUNTER_H__
+
+#include <cstddef>
+
+/**
+ * 获取全局operator new的调用次数
+ * 替换的operator new/delete定义在单独的编译单元，避免被内联后与malloc/free误报不匹配
+ */
+size_t AllocationCount();
+
+#endif
@@ -0,0 +1,265 @@
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <eddyserver.h>
+#include <eddyserver/buffer_pool.h>
+#include <eddyserver/thread_pool.h>
+#include <eddyserver/io_service_thread.h>
+#include "allocation_counter.h"
+
+// 预热和统计的往返次数
+const size_t kWarmupRounds = 1000;
+const size_t kMeasureRounds = 10000;
+
+// 消息大小
+const size_t kMessageSize = 64;
+
+// IO线程数量（含主线程）
+const size_t kThreadCount = 3;
+
+// 预热时每个线程每级预留的缓冲块数量
+// 跨线程释放的缓冲块归还时机取决于调度，预留的余量覆盖调度带来的短暂峰值
+const size_t kPrimedBlocks = 8;
+
+// 预留缓冲块的最大容量
+const size_t kMaxPrimedBlockSize = 4096;
+
+// 线程池的工作线程数量
+const size_t kWorkerCount = 2;
+
+// 线程池每批提交的任务数量，在途的任务节点和共享状态不超过BufferPool每级的缓存上限
+const size_t kTaskBatch = 500;
+
+// 任务节点、信箱节点和共享状态的最大容量
+// 一批任务的在途节点数量取决于工作线程是否与提交同时运行，按整批全部在途预留
+const size_t kMaxTaskBlockSize = 256;
+
+// 线程池统计的批数
+const size_t kTaskRounds = 20;
+
+// 线程池允许的一次性分配次数
+// 工作线程首次使用BufferPool时创建线程缓存，本地队列扩容时分配新数组，都与任务数量无关
+const size_t kMaxOneOffAllocations = 100;
+
+/**
+ * 在当前线程的BufferPool缓存中预留缓冲块
+ * @param count 每级预留的数量
+ * @param max_block_size 预留的最大容量
+ */
+void PrimeBufferPool(size_t count, size_t max_block_size)
+{
+    std::vector<eddyserver::BufferBlock*> blocks(count);
+    for (size_t capacity = eddyserver::BufferPool::kMinBlockSize; capacity <= max_block_size; capacity <<= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            blocks[i] = eddyserver::BufferPool::allocate(capacity);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            eddyserver::BufferPool::release(blocks[i]);
+        }
+    }
+}
+
+/**
+ * 回环连接上的回显往返
+ * 服务端和客户端的Session分别由TCPServer和TCPClient创建，每次往返经过双方的读写、发送信箱和消息分发
+ * 非分片模式下消息经由post_messages投递到主线程，分片模式下在IO线程直接分发
+ */
+class EchoRoundTrip
+{
+    /**
+     * 服务端，原样回显
+     */
+    class ServerHandler : public eddyserver::TCPSessionHandler
+    {
+    public:
+        virtual void on_connected() override
+        {
+        }
+
+        virtual void on_message(eddyserver::NetMessage &message) override
+        {
+            send(message);
+        }
+
+        virtual void on_closed() override
+        {
+        }
+    };
+
+    /**
+     * 客户端，连接后发出第一条消息，收到回显后再次发送
+     */
+    class ClientHandler : public eddyserver::TCPSessionHandler
+    {
+    public:
+        explicit ClientHandler(EchoRoundTrip &owner)
+            : owner_(owner)
+        {
+        }
+
+    public:
+        virtual void on_connected() override
+        {
+            const std::string payload(kMessageSize, 'x');
+            send(eddyserver::NetMessage(payload.data(), payload.size()));
+        }
+
+        virtual void on_message(eddyserver::NetMessage &message) override
+        {
+            if (owner_.on_round_trip())
+            {
+                send(message);
+            }
+        }
+
+        virtual void on_closed() override
+        {
+        }
+
+    private:
+        EchoRoundTrip &owner_;
+    };
+
+public:
+    explicit EchoRoundTrip(bool shard_mode)
+        : io_thread_manager_(kThreadCount, shard_mode)
+        , rounds_(0)
+        , allocations_before_(0)
+        , allocations_after_(0)
+    {
+    }
+
+public:
+    /**
+     * 执行往返
+     * @return 稳定状态下每次往返的堆分配次数
+     */
+    double run()
+    {
+        asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), 0);
+        eddyserver::TCPServer server(endpoint, io_thread_manager_,
+            []() { return std::make_shared<ServerHandler>(); },
+            []() { return std::make_shared<eddyserver::MessageFilter>(); });
+
+        eddyserver::TCPClient client(io_thread_manager_,
+            [this]() { return std::make_shared<ClientHandler>(*this); },
+            []() { return std::make_shared<eddyserver::MessageFilter>(); });
+
+        asio::error_code error_code;
+        asio::ip::tcp::endpoint server_endpoint = server.get_local_endpoint();
+        client.connect(server_endpoint, error_code);
+        if (error_code)
+        {
+            std::cerr << error_code.message() << std::endl;
+            return -1;
+        }
+
+        for (size_t i = 1; i <= io_thread_manager_.get_thread_count(); ++i)
+        {
+            io_thread_manager_.get_thread(static_cast<eddyserver::IOThreadID>(i))->post([]() { PrimeBufferPool(kPrimedBlocks, kMaxPrimedBlockSize); });
+        }
+
+        io_thread_manager_.run();
+        return static_cast<double>(allocations_after_ - allocations_before_) / static_cast<double>(kMeasureRounds);
+    }
+
+private:
+    /**
+     * 完成一次往返
+     * 在客户端SessionHandler运行的线程中调用
+     * @return 是否继续
+     */
+    bool on_round_trip()
+    {
+        const size_t rounds = ++rounds_;
+        if (rounds == kWarmupRounds)
+        {
+            allocations_before_ = AllocationCount();
+        }
+        else if (rounds == kWarmupRounds + kMeasureRounds)
+        {
+            allocations_after_ = AllocationCount();
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * 停止全部IO线程
+     * 存活的Session仍有未完成的读操作，直接停止io_service
+     */
+    void stop()
+    {
+        for (size_t i = 1; i <= io_thread_manager_.get_thread_count(); ++i)
+        {
+            io_thread_manager_.get_thread(static_cast<eddyserver::IOThreadID>(i))->get_io_service().stop();
+        }
+    }
+
+private:
+    eddyserver::IOServiceThreadManager  io_thread_manager_;
+    std::atomic<size_t>                 rounds_;
+    size_t                              allocations_before_;
+    size_t                              allocations_after_;
+};
+
+/**
+ * 线程池提交任务
+ * 提交前按整批在途预留缓冲块，每批提交后等待全部完成，预热一批后统计其余各批
+ * @return 统计期间的堆分配次数
+ */
+size_t SubmitTasks()
+{
+    ThreadPool pool(kWorkerCount);
+    std::atomic<size_t> sum(0);
+    // 每批append和submit各kTaskBatch个任务，每个任务占用一个任务节点和一个信箱节点
+    PrimeBufferPool(kTaskBatch * 4, kMaxTaskBlockSize);
+
+    size_t allocations_before = 0;
+    for (size_t round = 0; round <= kTaskRounds; ++round)
+    {
+        if (round == 1)
+        {
+            allocations_before = AllocationCount();
+        }
+        for (size_t i = 0; i < kTaskBatch; ++i)
+        {
+            pool.append([&sum, i]() { sum += i; });
+            pool.submit([i]() { return i; });
+        }
+        pool.wait_for_idle();
+    }
+    const size_t allocations = AllocationCount() - allocations_before;
+    pool.join();
+    return allocations;
+}
+
+int main(int argc, char *argv[])
+{
+    const bool modes[] = { false, true };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+    {
+        EchoRoundTrip round_trip(modes[i]);
+        const double allocations = round_trip.run();
+        std::cout << (modes[i] ? "shard" : "main thread") << ": " << allocations << " allocations per round trip" << std::endl;
+        if (allocations != 0)
+        {
+            std::cerr << "unexpected allocations in steady state" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const size_t allocations = SubmitTasks();
+    std::cout << "thread pool: " << allocations << " allocations for " << kTaskBatch * kTaskRounds * 2 << " tasks" << std::endl;
+    if (allocations > kMaxOneOffAllocations)
+    {
+        std::cerr << "unexpected allocations per task" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,487 @@
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <condition_variable>
+#include <eddyserver.h>
+#include <eddyserver/io_service_thread.h>
+#include <eddyserver/http_message_filter.h>
+#include <eddyserver/websocket_message_filter.h>
+
+typedef eddyserver::MessageFilterInterface::ByteArrray ByteArrray;
+typedef eddyserver::WebSocketMessageFilter WebSocket;
+
+// RFC 6455中握手的示例
+const char kSampleKey[] = "dGhlIHNhbXBsZSBub25jZQ==";
+const char kSampleAccept[] = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+// 握手请求
+const std::string kUpgradeRequest = std::string("GET /chat HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Sec-WebSocket-Key: ") + kSampleKey + "\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n";
+
+// 客户端使用的掩码
+const uint8_t kMaskKey[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+// 超时时间
+const std::chrono::seconds kTimeout(30);
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 模拟Session的流式读取
+     * 未解析的数据保留在pending中，与下次读取的数据拼接
+     */
+    void Feed(eddyserver::MessageFilterInterface &filter, ByteArrray &pending, const std::string &chunk,
+        std::vector<eddyserver::NetMessage> &received)
+    {
+        pending.insert(pending.end(), chunk.begin(), chunk.end());
+        const size_t consumed = filter.read_stream(pending.data(), pending.size(), received);
+        pending.erase(pending.begin(), pending.begin() + consumed);
+    }
+
+    /**
+     * 消息转为字符串
+     */
+    std::string ToString(const eddyserver::NetMessage &message)
+    {
+        return std::string(reinterpret_cast<const char*>(message.data()), message.readable());
+    }
+
+    /**
+     * 写入消息并转为字符串
+     */
+    std::string Write(eddyserver::MessageFilterInterface &filter, const std::vector<eddyserver::NetMessage> &messages)
+    {
+        ByteArrray buffer;
+        filter.write(messages, buffer);
+        return std::string(buffer.begin(), buffer.end());
+    }
+
+    /**
+     * 编码客户端的帧，载荷按掩码编码
+     * @param first 帧的第一个字节，FIN位和操作码
+     */
+    std::string ClientFrame(uint8_t first, const std::string &payload, bool masked = true)
+    {
+        std::string frame(1, static_cast<char>(first));
+        const uint8_t mask_bit = masked ? 0x80 : 0;
+        const uint64_t size = payload.size();
+        if (size < 126)
+        {
+            frame.push_back(static_cast<char>(mask_bit | size));
+        }
+        else
+        {
+            const size_t length_size = size <= 0xFFFF ? 2 : 8;
+            frame.push_back(static_cast<char>(mask_bit | (length_size == 2 ? 126 : 127)));
+            for (size_t i = length_size; i > 0; --i)
+            {
+                frame.push_back(static_cast<char>(size >> ((i - 1) * 8)));
+            }
+        }
+
+        if (!masked)
+        {
+            return frame + payload;
+        }
+
+        frame.append(reinterpret_cast<const char*>(kMaskKey), sizeof(kMaskKey));
+        for (size_t i = 0; i < payload.size(); ++i)
+        {
+            frame.push_back(static_cast<char>(payload[i] ^ kMaskKey[i % 4]));
+        }
+        return frame;
+    }
+
+    /**
+     * 读取消息的操作码和载荷
+     */
+    bool IsFrame(eddyserver::NetMessage message, uint8_t opcode, const std::string &payload)
+    {
+        return !message.empty() && WebSocket::take_opcode(message) == opcode && ToString(message) == payload;
+    }
+}
+
+// 解析请求行、请求头和请求体
+void TestRequestParsing()
+{
+    const std::string request = "POST /submit?id=1 HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "X-Custom:  padded value \r\n"
+        "Content-Length: 5\r\n\r\n"
+        "hello"
+        "GET /next HTTP/1.0\r\n"
+        "Connection: keep-alive\r\n\r\n"
+        "\r\n"
+        "GET /last HTTP/1.1\n"
+        "Connection: close\n\n";
+
+    // 一次读取和逐字节读取的结果相同
+    for (size_t chunk_size = request.size(); chunk_size > 0; chunk_size = chunk_size == request.size() ? 1 : 0)
+    {
+        eddyserver::HttpMessageFilter filter;
+        ByteArrray pending;
+        std::vector<eddyserver::NetMessage> received;
+        for (size_t offset = 0; offset < request.size(); offset += chunk_size)
+        {
+            Feed(filter, pending, request.substr(offset, chunk_size), received);
+        }
+        Expect(received.size() == 3 && pending.empty() && !filter.has_error(), "pipelined requests are split");
+        if (received.size() != 3)
+        {
+            continue;
+        }
+
+        const eddyserver::HttpRequest post(received[0]);
+        Expect(post.valid() && post.method() == "POST" && post.target() == "/submit?id=1" && post.minor_version() == 1,
+            "request line is parsed");
+        Expect(post.header_count() == 3 && post.header_name(1) == "X-Custom" && post.header_value(1) == "padded value",
+            "header values are trimmed");
+        Expect(post.header("content-length") == "5" && post.header("missing").empty(), "header lookup ignores case");
+        Expect(ToString(post.body()) == "hello" && post.keep_alive() && !post.is_websocket_upgrade(), "body is read");
+
+        const eddyserver::HttpRequest next(received[1]);
+        Expect(next.minor_version() == 0 && next.keep_alive() && next.body().empty(), "HTTP/1.0 keep-alive is honoured");
+
+        const eddyserver::HttpRequest last(received[2]);
+        Expect(last.target() == "/last" && !last.keep_alive(), "bare newlines and Connection: close are accepted");
+    }
+
+    const char *malformed[] = {
+        "GET /\r\n\r\n",
+        "GET / HTTP/2.0\r\n\r\n",
+        "GET / HTTP/1.1\r\n folded: header\r\n\r\n",
+        "GET / HTTP/1.1\r\nName : value\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i)
+    {
+        eddyserver::HttpMessageFilter filter;
+        ByteArrray pending;
+        std::vector<eddyserver::NetMessage> received;
+        Feed(filter, pending, malformed[i], received);
+        Expect(filter.has_error() && received.empty(), "malformed request is rejected");
+    }
+
+    eddyserver::HttpMessageFilter limited(64, 16);
+    ByteArrray pending;
+    std::vector<eddyserver::NetMessage> received;
+    Feed(limited, pending, "GET / HTTP/1.1\r\nX-Long: " + std::string(64, 'x'), received);
+    Expect(limited.has_error(), "oversize header is rejected before the blank line");
+
+    eddyserver::HttpMessageFilter small_body(1024, 16);
+    pending.clear();
+    Feed(small_body, pending, "POST / HTTP/1.1\r\nContent-Length: 17\r\n\r\n", received);
+    Expect(small_body.has_error(), "oversize body is rejected");
+}
+
+// 握手：101响应后切换为WebSocket，升级期间收到的数据在响应发出后解析
+void TestUpgrade()
+{
+    Expect(WebSocket::accept_key(kSampleKey) == kSampleAccept, "accept key matches RFC 6455");
+
+    eddyserver::HttpMessageFilter filter;
+    ByteArrray pending;
+    std::vector<eddyserver::NetMessage> received;
+    Feed(filter, pending, kUpgradeRequest + ClientFrame(0x81, "early"), received);
+    Expect(received.size() == 1 && !filter.is_websocket(), "upgrade request pauses parsing");
+    Expect(!pending.empty() && !filter.take_read_resumed(), "data after the upgrade request is held");
+
+    const eddyserver::HttpRequest request(received[0]);
+    Expect(request.is_websocket_upgrade(), "upgrade request is recognised");
+    const eddyserver::NetMessage accept = eddyserver::HttpResponse::websocket_accept(request);
+    Expect(ToString(accept).find(std::string("Sec-WebSocket-Accept: ") + kSampleAccept + "\r\n") != std::string::npos,
+        "101 response carries the accept key");
+
+    // 101响应之后的消息在同一批写入中编码为帧
+    std::vector<eddyserver::NetMessage> responses;
+    responses.push_back(accept);
+    responses.push_back(WebSocket::make_message(WebSocket::kText, "hi", 2));
+    const std::string written = Write(filter, responses);
+    Expect(written == ToString(accept) + "\x81\x02hi", "messages after the 101 response are framed");
+    Expect(filter.is_websocket(), "101 response switches to WebSocket");
+    Expect(filter.take_read_resumed() && !filter.take_read_resumed(), "held data is reported once");
+
+    received.clear();
+    Feed(filter, pending, "", received);
+    Expect(received.size() == 1 && IsFrame(received[0], WebSocket::kText, "early") && pending.empty(),
+        "held frame is parsed after the switch");
+
+    // 拒绝升级时继续解析HTTP请求
+    eddyserver::HttpMessageFilter rejecting;
+    pending.clear();
+    received.clear();
+    Feed(rejecting, pending, kUpgradeRequest + "GET /after HTTP/1.1\r\n\r\n", received);
+    Expect(received.size() == 1, "pipelined request waits for the upgrade response");
+    Write(rejecting, std::vector<eddyserver::NetMessage>(1, eddyserver::HttpResponse(400, "Bad Request").to_message("", true)));
+    Expect(!rejecting.is_websocket() && rejecting.take_read_resumed(), "rejected upgrade resumes HTTP parsing");
+    Feed(rejecting, pending, "", received);
+    Expect(received.size() == 2 && eddyserver::HttpRequest(received[1]).target() == "/after", "held request is parsed");
+
+    // 没有暂缓的数据时不需要重新解析
+    eddyserver::HttpMessageFilter idle;
+    pending.clear();
+    received.clear();
+    Feed(idle, pending, kUpgradeRequest, received);
+    Write(idle, std::vector<eddyserver::NetMessage>(1, eddyserver::HttpResponse::websocket_accept(eddyserver::HttpRequest(received[0]))));
+    Expect(idle.is_websocket() && !idle.take_read_resumed(), "no reparse without held data");
+}
+
+// 掩码解码、长度编码和分片合并
+void TestWebSocket()
+{
+    const size_t sizes[] = { 0, 1, 125, 126, 0xFFFF, 0x10000, 70001 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        std::string payload(sizes[i], '\0');
+        for (size_t j = 0; j < payload.size(); ++j)
+        {
+            payload[j] = static_cast<char>(j * 7 + 3);
+        }
+
+        WebSocket filter;
+        ByteArrray pending;
+        std::vector<eddyserver::NetMessage> received;
+        Feed(filter, pending, ClientFrame(0x82, payload), received);
+        Expect(received.size() == 1 && IsFrame(received[0], WebSocket::kBinary, payload) && pending.empty(),
+            "masked payload is decoded");
+
+        // 服务端的帧不带掩码，长度按大小编码
+        const std::string frame = Write(filter, std::vector<eddyserver::NetMessage>(1,
+            WebSocket::make_message(WebSocket::kBinary, payload.data(), payload.size())));
+        const size_t header_size = payload.size() < 126 ? 2 : (payload.size() <= 0xFFFF ? 4 : 10);
+        Expect(frame.size() == header_size + payload.size() && static_cast<uint8_t>(frame[0]) == 0x82
+            && (static_cast<uint8_t>(frame[1]) & 0x80) == 0 && frame.compare(header_size, std::string::npos, payload) == 0,
+            "server frame is unmasked with the right length encoding");
+    }
+
+    // 分片之间穿插控制帧
+    const std::string fragmented = ClientFrame(0x01, "Hel") + ClientFrame(0x89, "ping") + ClientFrame(0x00, "lo, ")
+        + ClientFrame(0x80, "world") + ClientFrame(0x81, "next");
+    for (size_t chunk_size = 1; chunk_size <= fragmented.size(); chunk_size += fragmented.size() - 1)
+    {
+        WebSocket filter;
+        ByteArrray pending;
+        std::vector<eddyserver::NetMessage> received;
+        for (size_t offset = 0; offset < fragmented.size(); offset += chunk_size)
+        {
+            Feed(filter, pending, fragmented.substr(offset, chunk_size), received);
+        }
+        Expect(received.size() == 3 && IsFrame(received[0], WebSocket::kPing, "ping")
+            && IsFrame(received[1], WebSocket::kText, "Hello, world") && IsFrame(received[2], WebSocket::kText, "next"),
+            "fragments are merged around control frames");
+        Expect(!filter.has_error() && pending.empty(), "fragmented stream is consumed");
+    }
+
+    struct Invalid
+    {
+        std::string frames;
+        const char *description;
+    };
+    const Invalid invalid[] = {
+        { ClientFrame(0x81, "plain", false), "unmasked client frame is rejected" },
+        { ClientFrame(0xC1, "rsv"), "reserved bits are rejected" },
+        { ClientFrame(0x80, "orphan"), "continuation without a start is rejected" },
+        { ClientFrame(0x01, "a") + ClientFrame(0x81, "b"), "new message inside a fragmented one is rejected" },
+        { ClientFrame(0x09, "ping"), "fragmented control frame is rejected" },
+        { ClientFrame(0x89, std::string(126, 'p')), "long control frame is rejected" },
+        { ClientFrame(0x83, "op"), "unknown opcode is rejected" },
+        { ClientFrame(0x01, std::string(10, 'a')) + ClientFrame(0x80, std::string(10, 'b')), "merged message over the limit is rejected" },
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    {
+        WebSocket filter(16);
+        ByteArrray pending;
+        std::vector<eddyserver::NetMessage> received;
+        Feed(filter, pending, invalid[i].frames, received);
+        Expect(filter.has_error(), invalid[i].description);
+    }
+
+    // 空消息没有操作码，跳过不写并设置错误，前后的消息照常编码
+    std::vector<eddyserver::NetMessage> with_empty;
+    with_empty.push_back(WebSocket::make_message(WebSocket::kText, "a", 1));
+    with_empty.push_back(eddyserver::NetMessage());
+    with_empty.push_back(WebSocket::make_message(WebSocket::kText, "b", 1));
+
+    WebSocket writing;
+    Expect(writing.bytes_wanna_write(with_empty) == 6, "empty message is excluded from the write size");
+    Expect(Write(writing, with_empty) == "\x81\x01" "a" "\x81\x01" "b" && writing.has_error(), "empty message is skipped by write");
+
+    WebSocket gathering;
+    std::vector<eddyserver::NetMessage> gather_messages = with_empty;
+    ByteArrray headers;
+    eddyserver::MessageFilterInterface::BufferSequence buffers;
+    Expect(gathering.write_gather(gather_messages, headers, buffers) == 6 && asio::buffer_size(buffers) == 6 && gathering.has_error(),
+        "empty message is skipped by write_gather");
+
+    eddyserver::NetMessage frame;
+    Expect(!WebSocket().write_frame(eddyserver::NetMessage(), frame), "empty message has no broadcast frame");
+
+    // 升级后的HTTP连接同样拒绝空消息
+    eddyserver::HttpMessageFilter upgraded;
+    ByteArrray pending;
+    std::vector<eddyserver::NetMessage> received;
+    Feed(upgraded, pending, kUpgradeRequest, received);
+    std::vector<eddyserver::NetMessage> responses(1, eddyserver::HttpResponse::websocket_accept(eddyserver::HttpRequest(received[0])));
+    responses.push_back(eddyserver::NetMessage());
+    const std::string written = Write(upgraded, responses);
+    Expect(written == ToString(responses[0]) && upgraded.has_error(), "empty message after the upgrade is rejected");
+}
+
+/**
+ * 经由Session的握手
+ * 客户端把握手请求和第一个帧在一次写入中发出，之后不再发送
+ * 服务端发出101响应后应立即解析已收到的帧，不等待新的数据
+ */
+class SessionUpgradeTest
+{
+    class ServerHandler : public eddyserver::TCPSessionHandler
+    {
+    public:
+        explicit ServerHandler(SessionUpgradeTest &test)
+            : test_(test)
+        {
+        }
+
+    public:
+        virtual void on_connected() override
+        {
+        }
+
+        virtual void on_message(eddyserver::NetMessage &message) override
+        {
+            const eddyserver::HttpRequest request(message);
+            if (request.valid())
+            {
+                send(request.is_websocket_upgrade()
+                    ? eddyserver::HttpResponse::websocket_accept(request)
+                    : eddyserver::HttpResponse(400, "Bad Request").to_message("", false));
+                return;
+            }
+            test_.finish(IsFrame(message, WebSocket::kText, "early"));
+        }
+
+        virtual void on_closed() override
+        {
+        }
+
+    private:
+        SessionUpgradeTest &test_;
+    };
+
+public:
+    SessionUpgradeTest()
+        : io_thread_manager_(2)
+        , finished_(false)
+        , success_(false)
+    {
+    }
+
+public:
+    /**
+     * 执行测试
+     * @return 是否成功
+     */
+    bool run()
+    {
+        asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), 0);
+        eddyserver::TCPServer server(endpoint, io_thread_manager_,
+            [this]() { return std::make_shared<ServerHandler>(*this); },
+            []() { return std::make_shared<eddyserver::HttpMessageFilter>(); });
+        const asio::ip::tcp::endpoint server_endpoint = server.get_local_endpoint();
+
+        std::thread client([this, server_endpoint]()
+        {
+            asio::io_service io_service;
+            asio::ip::tcp::socket socket(io_service);
+            asio::error_code error_code;
+            socket.connect(server_endpoint, error_code);
+            const std::string data = kUpgradeRequest + ClientFrame(0x81, "early");
+            if (!error_code)
+            {
+                asio::write(socket, asio::buffer(data), error_code);
+            }
+            if (error_code)
+            {
+                std::cerr << error_code.message() << std::endl;
+                finish(false);
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!condition_.wait_for(lock, kTimeout, [this]() { return finished_; }))
+            {
+                std::cerr << "timeout: frame received during the upgrade was not parsed" << std::endl;
+                std::_Exit(EXIT_FAILURE);
+            }
+        });
+
+        io_thread_manager_.run();
+        client.join();
+        return success_;
+    }
+
+private:
+    /**
+     * 结束测试
+     */
+    void finish(bool success)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_)
+            {
+                return;
+            }
+            finished_ = true;
+            success_ = success;
+        }
+        condition_.notify_all();
+
+        for (size_t i = 1; i <= io_thread_manager_.get_thread_count(); ++i)
+        {
+            io_thread_manager_.get_thread(static_cast<eddyserver::IOThreadID>(i))->get_io_service().stop();
+        }
+    }
+
+private:
+    eddyserver::IOServiceThreadManager  io_thread_manager_;
+    std::mutex                          mutex_;
+    std::condition_variable             condition_;
+    bool                                finished_;
+    bool                                success_;
+};
+
+int main(int argc, char *argv[])
+{
+    TestRequestParsing();
+    TestUpgrade();
+    TestWebSocket();
+
+    SessionUpgradeTest session_upgrade;
+    Expect(session_upgrade.run(), "session parses the frame held during the upgrade");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
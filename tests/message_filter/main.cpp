@@ -0,0 +1,274 @@
+#include <string>
+#include <initializer_list>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <eddyserver.h>
+#include <eddyserver/basic_message_filter.h>
+#include <eddyserver/delimiter_message_filter.h>
+
+typedef eddyserver::MessageFilterInterface::ByteArrray ByteArrray;
+typedef eddyserver::MessageFilterInterface::BufferSequence BufferSequence;
+
+// 超过2字节长度上限的消息体大小
+const size_t kOversize = 0x10000;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 生成消息
+     */
+    eddyserver::NetMessage MakeMessage(size_t size, char fill)
+    {
+        const std::string payload(size, fill);
+        return eddyserver::NetMessage(payload.data(), payload.size());
+    }
+
+    /**
+     * 两条正常消息中间夹一条超长消息
+     */
+    std::vector<eddyserver::NetMessage> MakeMessages()
+    {
+        std::vector<eddyserver::NetMessage> messages;
+        messages.push_back(MakeMessage(16, 'a'));
+        messages.push_back(MakeMessage(kOversize, 'b'));
+        messages.push_back(MakeMessage(1024, 'c'));
+        return messages;
+    }
+
+    /**
+     * 模拟Session的流式读取
+     * 未解析的数据保留在pending中，与下次读取的数据拼接
+     */
+    void Feed(eddyserver::MessageFilterInterface &filter, ByteArrray &pending, const std::string &chunk,
+        std::vector<std::string> &received)
+    {
+        pending.insert(pending.end(), chunk.begin(), chunk.end());
+        std::vector<eddyserver::NetMessage> messages;
+        const size_t consumed = filter.read_stream(pending.data(), pending.size(), messages);
+        pending.erase(pending.begin(), pending.begin() + consumed);
+        for (size_t i = 0; i < messages.size(); ++i)
+        {
+            received.emplace_back(reinterpret_cast<const char*>(messages[i].data()), messages[i].readable());
+        }
+    }
+
+    /**
+     * 按固定大小分块读取
+     */
+    std::vector<std::string> FeedInChunks(eddyserver::MessageFilterInterface &filter, const std::string &data, size_t chunk_size)
+    {
+        ByteArrray pending;
+        std::vector<std::string> received;
+        for (size_t offset = 0; offset < data.size(); offset += chunk_size)
+        {
+            Feed(filter, pending, data.substr(offset, chunk_size), received);
+        }
+        return received;
+    }
+
+    /**
+     * 生成字符串列表
+     */
+    std::vector<std::string> Lines(std::initializer_list<const char*> lines)
+    {
+        return std::vector<std::string>(lines.begin(), lines.end());
+    }
+
+    /**
+     * 拼接缓冲区序列
+     */
+    ByteArrray Concat(const BufferSequence &buffers)
+    {
+        ByteArrray bytes;
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            const uint8_t *data = static_cast<const uint8_t*>(buffers[i].data());
+            bytes.insert(bytes.end(), data, data + buffers[i].size());
+        }
+        return bytes;
+    }
+
+    /**
+     * 解析的消息只有两条正常消息
+     */
+    template <typename Filter>
+    void ExpectSurvivors(const ByteArrray &bytes, const char *description)
+    {
+        Filter reader(true);
+        std::vector<eddyserver::NetMessage> messages;
+        const size_t consumed = reader.read_stream(bytes.data(), bytes.size(), messages);
+        const bool framed = consumed == bytes.size() && messages.size() == 2
+            && messages[0].readable() == 16 && messages[0].data()[0] == 'a'
+            && messages[1].readable() == 1024 && messages[1].data()[0] == 'c';
+        Expect(framed && !reader.has_error(), description);
+    }
+}
+
+// 超长消息被丢弃，后续消息的边界不受影响
+void TestOversize()
+{
+    {
+        eddyserver::MessageFilter filter;
+        ByteArrray buffer;
+        const std::vector<eddyserver::NetMessage> messages = MakeMessages();
+        const size_t bytes = filter.write(messages, buffer);
+        Expect(bytes == buffer.size() && bytes == filter.bytes_wanna_write(messages), "write skips the oversize message");
+        Expect(filter.has_error(), "write flags the oversize message");
+        ExpectSurvivors<eddyserver::MessageFilter>(buffer, "write keeps the other messages framed");
+    }
+
+    {
+        eddyserver::MessageFilter filter;
+        ByteArrray headers;
+        BufferSequence buffers;
+        std::vector<eddyserver::NetMessage> messages = MakeMessages();
+        const size_t bytes = filter.write_gather(messages, headers, buffers);
+        const ByteArrray gathered = Concat(buffers);
+        Expect(bytes == gathered.size(), "write_gather skips the oversize message");
+        Expect(filter.has_error(), "write_gather flags the oversize message");
+        ExpectSurvivors<eddyserver::MessageFilter>(gathered, "write_gather keeps the other messages framed");
+    }
+
+    {
+        eddyserver::MessageFilter filter;
+        eddyserver::NetMessage frame;
+        Expect(!filter.write_frame(MakeMessage(kOversize, 'b'), frame), "write_frame refuses the oversize message");
+        Expect(filter.write_frame(MakeMessage(16, 'a'), frame) && frame.readable() == 18, "write_frame encodes a normal message");
+        Expect(!filter.has_error(), "write_frame does not flag the filter");
+    }
+}
+
+// 2字节长度的Codec同样不截断
+void TestFixedLengthOversize()
+{
+    typedef eddyserver::BasicMessageFilter<eddyserver::Uint16LengthCodec> Filter;
+
+    Filter filter;
+    ByteArrray buffer;
+    const std::vector<eddyserver::NetMessage> messages = MakeMessages();
+    const size_t bytes = filter.write(messages, buffer);
+    Expect(bytes == buffer.size() && bytes == filter.bytes_wanna_write(messages), "fixed length write skips the oversize message");
+    Expect(filter.has_error(), "fixed length write flags the oversize message");
+
+    Filter reader;
+    std::vector<eddyserver::NetMessage> received;
+    reader.read_stream(buffer.data(), buffer.size(), received);
+    Expect(received.size() == 2 && received[1].readable() == 1024, "fixed length write keeps the other messages framed");
+
+    eddyserver::NetMessage frame;
+    Expect(!filter.write_frame(MakeMessage(kOversize, 'b'), frame), "fixed length write_frame refuses the oversize message");
+}
+
+// 分隔符跨越两次读取，第二次从已查找的位置继续
+void TestDelimiterSplit()
+{
+    eddyserver::DelimiterMessageFilter filter("\r\n");
+    ByteArrray pending;
+    std::vector<std::string> received;
+    Feed(filter, pending, "hello\r", received);
+    Expect(received.empty() && pending.size() == 6, "incomplete delimiter keeps the data pending");
+    Feed(filter, pending, "\nworld\r\n", received);
+    Expect(received == Lines({ "hello", "world" }) && pending.empty(), "delimiter split across reads completes the message");
+
+    // 逐字节读取与一次读取结果相同
+    std::string data;
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < 50; ++i)
+    {
+        lines.push_back(std::string(i, static_cast<char>('a' + i % 26)));
+        data += lines.back() + "\r\n";
+    }
+    for (size_t chunk_size = 1; chunk_size <= 7; ++chunk_size)
+    {
+        eddyserver::DelimiterMessageFilter chunked("\r\n");
+        Expect(FeedInChunks(chunked, data, chunk_size) == lines, "chunked reads split the same messages");
+    }
+}
+
+// 多字节分隔符的最后一个字节出现在消息中
+void TestDelimiterLastByteInPayload()
+{
+    eddyserver::DelimiterMessageFilter crlf("\r\n");
+    Expect(FeedInChunks(crlf, "a\nb\r\n\n\r\n\r\r\n", 64) == Lines({ "a\nb", "\n", "\r" }), "lone last bytes stay in the message");
+
+    eddyserver::DelimiterMessageFilter end("END");
+    Expect(FeedInChunks(end, "xNDyDENDEEND", 64) == Lines({ "xNDyD", "E" }), "partial delimiters stay in the message");
+    eddyserver::DelimiterMessageFilter end_chunked("END");
+    Expect(FeedInChunks(end_chunked, "xNDyDENDEEND", 1) == Lines({ "xNDyD", "E" }), "partial delimiters split across reads");
+
+    eddyserver::DelimiterMessageFilter repeated("aa");
+    Expect(FeedInChunks(repeated, "xaaaaaay", 64) == Lines({ "x", "", "" }) , "repeated delimiter bytes do not overlap");
+}
+
+// 超长消息丢弃到下一个分隔符，未解析的数据不超过上限
+void TestDelimiterMaxLength()
+{
+    eddyserver::DelimiterMessageFilter filter("\n", 8);
+    Expect(FeedInChunks(filter, "short\nwaytoolongline\n12345678\nok\n", 64) == Lines({ "short", "12345678", "ok" }),
+        "overlong message is discarded");
+    Expect(filter.discarded() == 1, "discarded message is counted");
+
+    eddyserver::DelimiterMessageFilter split("\r\n", 8);
+    ByteArrray pending;
+    std::vector<std::string> received;
+    Feed(split, pending, "0123456789abc\r", received);
+    Expect(received.empty() && pending.size() == 1, "overlong pending data is dropped except a partial delimiter");
+    Feed(split, pending, "\nnext\r\n", received);
+    Expect(received == Lines({ "next" }) && split.discarded() == 1, "discarding ends at the next delimiter");
+    Feed(split, pending, "0123456789", received);
+    Feed(split, pending, "abcdef", received);
+    Expect(pending.size() <= 1, "pending data stays bounded while discarding");
+    Feed(split, pending, "\r\nlast\r\n", received);
+    Expect(received == Lines({ "next", "last" }) && split.discarded() == 2, "discarding spans several reads");
+    Expect(!split.has_error(), "discarding is not an error");
+}
+
+// 写入后读取
+void TestDelimiterWrite()
+{
+    std::vector<eddyserver::NetMessage> messages;
+    messages.push_back(MakeMessage(16, 'a'));
+    messages.push_back(MakeMessage(1024, 'b'));
+    messages.push_back(MakeMessage(0, 'c'));
+    const std::vector<std::string> lines = { std::string(16, 'a'), std::string(1024, 'b'), std::string() };
+
+    eddyserver::DelimiterMessageFilter filter("\r\n", 4096);
+    ByteArrray buffer;
+    Expect(filter.write(messages, buffer) == buffer.size() && buffer.size() == filter.bytes_wanna_write(messages), "write appends delimiters");
+    eddyserver::DelimiterMessageFilter reader("\r\n", 4096);
+    Expect(FeedInChunks(reader, std::string(buffer.begin(), buffer.end()), 100) == lines, "written messages read back");
+
+    ByteArrray headers;
+    BufferSequence buffers;
+    const size_t bytes = filter.write_gather(messages, headers, buffers);
+    const ByteArrray gathered = Concat(buffers);
+    eddyserver::DelimiterMessageFilter gather_reader("\r\n", 4096);
+    Expect(bytes == gathered.size() && FeedInChunks(gather_reader, std::string(gathered.begin(), gathered.end()), 100) == lines,
+        "gathered messages read back");
+}
+
+int main(int argc, char *argv[])
+{
+    TestOversize();
+    TestFixedLengthOversize();
+    TestDelimiterSplit();
+    TestDelimiterLastByteInPayload();
+    TestDelimiterMaxLength();
+    TestDelimiterWrite();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,426 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <condition_variable>
+#include <eddyserver.h>
+#include <eddyserver/io_service_thread.h>
+
+// 消息总数
+const uint32_t kMessageCount = 20000;
+
+// 同时在途的消息数量
+const uint32_t kInFlight = 32;
+
+// 每收到多少条消息迁移一次
+const uint32_t kMigrateEvery = 500;
+
+// IO线程数量（含主线程），主线程之外的两个IO线程互相迁移
+const size_t kThreadCount = 3;
+
+// 第二个连接使用的消息
+const uint32_t kHello = 0xfffffff0;
+const uint32_t kStale = 0xfffffff1;
+const uint32_t kFresh = 0xfffffff2;
+
+// 超时时间
+const std::chrono::seconds kTimeout(30);
+
+/**
+ * 读取消息中的序号
+ */
+uint32_t SequenceOf(const eddyserver::NetMessage &message)
+{
+    uint32_t sequence = 0;
+    if (message.readable() >= sizeof(sequence))
+    {
+        memcpy(&sequence, message.data(), sizeof(sequence));
+    }
+    return sequence;
+}
+
+/**
+ * 生成带序号的消息
+ */
+eddyserver::NetMessage MakeMessage(uint32_t sequence)
+{
+    eddyserver::NetMessage message;
+    message.write_pod(sequence);
+    return message;
+}
+
+/**
+ * 获取另一个IO线程
+ */
+eddyserver::IOThreadID OtherThread(eddyserver::IOThreadID tid)
+{
+    return tid == 2 ? 3 : 2;
+}
+
+/**
+ * 迁移中收发的消息不丢失、不乱序，迁移和关闭后过期的Session ID不会误发到新的Session
+ *
+ * 第一个连接：客户端保持kInFlight条消息在途，服务端回显
+ * 双方每收到kMigrateEvery条消息把自己的Session迁移到另一个IO线程，双方都按序号检查顺序
+ * 客户端收齐后关闭连接
+ *
+ * 第二个连接：复用已释放的槽位
+ * 服务端收到kHello后通过旧的SessionHandler和过期的Session ID发送kStale，再在IO线程之外向自己广播kFresh
+ * IO线程之外的广播不经由SessionHandler，按所在线程表投递到Session所属的线程
+ * 客户端收到kStale即失败，收到kFresh即成功
+ */
+class MigrationTest
+{
+    class ServerHandler : public eddyserver::TCPSessionHandler
+    {
+    public:
+        explicit ServerHandler(MigrationTest &test)
+            : test_(test)
+            , expected_(0)
+            , last_thread_(0)
+        {
+        }
+
+    public:
+        virtual void on_connected() override
+        {
+            last_thread_ = get_thread_id();
+        }
+
+        virtual void on_message(eddyserver::NetMessage &message) override
+        {
+            const uint32_t sequence = SequenceOf(message);
+            if (sequence == kHello)
+            {
+                test_.check_stale(*this);
+                return;
+            }
+
+            if (sequence != expected_++)
+            {
+                test_.fail("server received out of order message");
+                return;
+            }
+
+            if (get_thread_id() != last_thread_)
+            {
+                last_thread_ = get_thread_id();
+                ++test_.migrations_;
+            }
+
+            send(message);
+            if (expected_ % kMigrateEvery == 0)
+            {
+                get_thread_manager()->migrate_session(get_thread_id(), get_session_id(), OtherThread(get_thread_id()));
+            }
+        }
+
+        virtual void on_closed() override
+        {
+            test_.on_closed(*this);
+        }
+
+    private:
+        MigrationTest&          test_;
+        uint32_t                expected_;
+        eddyserver::IOThreadID  last_thread_;
+    };
+
+    class ClientHandler : public eddyserver::TCPSessionHandler
+    {
+    public:
+        explicit ClientHandler(MigrationTest &test, bool first)
+            : test_(test)
+            , first_(first)
+            , expected_(0)
+            , next_(0)
+            , last_thread_(0)
+        {
+        }
+
+    public:
+        virtual void on_connected() override
+        {
+            last_thread_ = get_thread_id();
+            if (!first_)
+            {
+                send(MakeMessage(kHello));
+                return;
+            }
+
+            for (; next_ < kInFlight; ++next_)
+            {
+                send(MakeMessage(next_));
+            }
+        }
+
+        virtual void on_message(eddyserver::NetMessage &message) override
+        {
+            const uint32_t sequence = SequenceOf(message);
+            if (!first_)
+            {
+                if (sequence == kStale)
+                {
+                    test_.fail("stale session id reached a new session");
+                }
+                else if (sequence == kFresh)
+                {
+                    test_.finish();
+                }
+                return;
+            }
+
+            if (sequence != expected_++)
+            {
+                test_.fail("client received out of order message");
+                return;
+            }
+
+            if (get_thread_id() != last_thread_)
+            {
+                last_thread_ = get_thread_id();
+                ++test_.migrations_;
+            }
+
+            if (expected_ == kMessageCount)
+            {
+                close();
+                return;
+            }
+
+            if (next_ < kMessageCount)
+            {
+                send(MakeMessage(next_++));
+            }
+
+            // 与服务端错开迁移
+            if (expected_ % kMigrateEvery == kMigrateEvery / 2)
+            {
+                get_thread_manager()->migrate_session(get_thread_id(), get_session_id(), OtherThread(get_thread_id()));
+            }
+        }
+
+        virtual void on_closed() override
+        {
+            test_.on_closed(*this);
+        }
+
+    private:
+        MigrationTest&          test_;
+        const bool              first_;
+        uint32_t                expected_;
+        uint32_t                next_;
+        eddyserver::IOThreadID  last_thread_;
+    };
+
+public:
+    explicit MigrationTest(bool shard_mode)
+        : io_thread_manager_(kThreadCount, shard_mode)
+        , connections_(0)
+        , closed_(0)
+        , migrations_(0)
+        , finished_(false)
+        , failed_(false)
+    {
+    }
+
+public:
+    /**
+     * 执行测试
+     * @return 是否成功
+     */
+    bool run()
+    {
+        asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), 0);
+        eddyserver::TCPServer server(endpoint, io_thread_manager_,
+            [this]() { return std::make_shared<ServerHandler>(*this); },
+            []() { return std::make_shared<eddyserver::MessageFilter>(); });
+        server_endpoint_ = server.get_local_endpoint();
+
+        client_ = std::make_unique<eddyserver::TCPClient>(io_thread_manager_,
+            [this]() { return std::make_shared<ClientHandler>(*this, connections_++ == 0); },
+            []() { return std::make_shared<eddyserver::MessageFilter>(); });
+
+        asio::error_code error_code;
+        client_->connect(server_endpoint_, error_code);
+        if (error_code)
+        {
+            std::cerr << error_code.message() << std::endl;
+            return false;
+        }
+
+        std::thread watchdog([this]()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!condition_.wait_for(lock, kTimeout, [this]() { return finished_; }))
+            {
+                std::cerr << "timeout, migrations: " << migrations_ << std::endl;
+                std::_Exit(EXIT_FAILURE);
+            }
+        });
+
+        io_thread_manager_.run();
+        watchdog.join();
+        if (broadcaster_.joinable())
+        {
+            broadcaster_.join();
+        }
+
+        if (migrations_ < 2)
+        {
+            std::cerr << "sessions did not migrate" << std::endl;
+            return false;
+        }
+        return !failed_;
+    }
+
+private:
+    /**
+     * 连接关闭
+     * 等SessionHandler处置完成后再记录，第一个连接的两端都关闭后，在主线程中发起第二个连接
+     */
+    void on_closed(eddyserver::TCPSessionHandler &handler)
+    {
+        const eddyserver::TCPSessionID id = handler.get_session_id();
+        eddyserver::SessionHandlePointer handler_ptr = handler.shared_from_this();
+        eddyserver::IOServiceThread::current_thread()->post([this, id, handler_ptr]()
+        {
+            on_disposed(id, handler_ptr);
+        });
+    }
+
+    /**
+     * SessionHandler处置完成
+     */
+    void on_disposed(eddyserver::TCPSessionID id, eddyserver::SessionHandlePointer handler_ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stale_ids_.push_back(id);
+        if (dynamic_cast<ServerHandler*>(handler_ptr.get()) != nullptr)
+        {
+            stale_handler_ = handler_ptr;
+        }
+
+        if (++closed_ == 2)
+        {
+            io_thread_manager_.get_main_thread()->post([this]()
+            {
+                asio::error_code error_code;
+                client_->connect(server_endpoint_, error_code);
+                if (error_code)
+                {
+                    fail(error_code.message().c_str());
+                }
+            });
+        }
+    }
+
+    /**
+     * 通过过期的Session ID和旧的SessionHandler发送
+     * 在第二个连接的服务端SessionHandler运行的线程中调用
+     */
+    void check_stale(eddyserver::TCPSessionHandler &handler)
+    {
+        std::vector<eddyserver::TCPSessionID> stale_ids;
+        eddyserver::SessionHandlePointer stale_handler;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stale_ids = stale_ids_;
+            stale_handler = stale_handler_;
+        }
+
+        for (size_t i = 0; i < stale_ids.size(); ++i)
+        {
+            if (stale_ids[i] == handler.get_session_id())
+            {
+                fail("session id reused without a new generation");
+                return;
+            }
+            if (eddyserver::IOServiceThread::current_thread()->get_session_handler(stale_ids[i]) != nullptr)
+            {
+                fail("stale session id still has a handler");
+                return;
+            }
+        }
+
+        if (stale_handler == nullptr || !stale_handler->is_closed())
+        {
+            fail("old handler is not closed");
+            return;
+        }
+
+        stale_handler->send(MakeMessage(kStale));
+        io_thread_manager_.broadcast(stale_ids, MakeMessage(kStale));
+        const eddyserver::TCPSessionID fresh_id = handler.get_session_id();
+        broadcaster_ = std::thread([this, fresh_id]()
+        {
+            io_thread_manager_.broadcast(std::vector<eddyserver::TCPSessionID>(1, fresh_id), MakeMessage(kFresh));
+        });
+    }
+
+    /**
+     * 失败
+     */
+    void fail(const char *reason)
+    {
+        std::cerr << reason << std::endl;
+        failed_ = true;
+        finish();
+    }
+
+    /**
+     * 结束测试
+     * 存活的Session仍有未完成的读操作，直接停止io_service
+     */
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_)
+            {
+                return;
+            }
+            finished_ = true;
+        }
+        condition_.notify_all();
+
+        for (size_t i = 1; i <= io_thread_manager_.get_thread_count(); ++i)
+        {
+            io_thread_manager_.get_thread(static_cast<eddyserver::IOThreadID>(i))->get_io_service().stop();
+        }
+    }
+
+private:
+    eddyserver::IOServiceThreadManager      io_thread_manager_;
+    std::unique_ptr<eddyserver::TCPClient>  client_;
+    asio::ip::tcp::endpoint                 server_endpoint_;
+    std::atomic<size_t>                     connections_;
+    size_t                                  closed_;
+    std::atomic<size_t>                     migrations_;
+    std::vector<eddyserver::TCPSessionID>   stale_ids_;
+    eddyserver::SessionHandlePointer        stale_handler_;
+    std::thread                             broadcaster_;
+    std::mutex                              mutex_;
+    std::condition_variable                 condition_;
+    bool                                    finished_;
+    std::atomic_bool                        failed_;
+};
+
+int main(int argc, char *argv[])
+{
+    const bool modes[] = { false, true };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+    {
+        MigrationTest test(modes[i]);
+        if (!test.run())
+        {
+            std::cerr << (modes[i] ? "shard" : "main thread") << ": failed" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << (modes[i] ? "shard" : "main thread") << ": passed" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
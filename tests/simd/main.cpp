@@ -0,0 +1,156 @@
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <eddyserver/simd.h>
+
+typedef std::vector<uint8_t> Bytes;
+
+// 检查的最大长度，覆盖AVX2的两个块加1字节
+const size_t kMaxLength = 65;
+
+// 检查的起始偏移，覆盖32字节内的所有对齐
+const size_t kMaxOffset = 32;
+
+// 缓冲区前后的保护字节
+const size_t kGuard = 32;
+
+// 保护字节的值
+const uint8_t kGuardValue = 0xA5;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 检查条件，失败时输出实现和位置
+     */
+    void Expect(bool condition, const char *description, const char *instruction_set, size_t offset, size_t length)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << " (" << instruction_set
+                << ", offset " << offset << ", length " << length << ")" << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 生成不含value的随机数据
+     */
+    Bytes RandomBytes(size_t size, uint8_t value, std::mt19937 &engine)
+    {
+        Bytes bytes(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            do
+            {
+                bytes[i] = static_cast<uint8_t>(engine());
+            } while (bytes[i] == value);
+        }
+        return bytes;
+    }
+}
+
+// 各实现查找的结果与逐字节查找相同
+void TestFindByte(const eddyserver::SIMD::Implementation &implementation)
+{
+    std::mt19937 engine(1);
+    const uint8_t value = '\n';
+    for (size_t offset = 0; offset < kMaxOffset; ++offset)
+    {
+        for (size_t length = 0; length <= kMaxLength; ++length)
+        {
+            // 范围外的value不能被找到
+            Bytes buffer = RandomBytes(offset + length + kGuard, value, engine);
+            std::fill(buffer.begin(), buffer.begin() + offset, value);
+            std::fill(buffer.begin() + offset + length, buffer.end(), value);
+            const uint8_t *begin = buffer.data() + offset;
+            const uint8_t *end = begin + length;
+            Expect(implementation.find_byte(begin, end, value) == end, "find_byte returns end when absent",
+                implementation.instruction_set, offset, length);
+
+            // 逐个位置放入value，还要在其后放入第二个
+            for (size_t position = 0; position < length; ++position)
+            {
+                Bytes copy = buffer;
+                const uint8_t *copy_begin = copy.data() + offset;
+                copy[offset + position] = value;
+                if (position + 1 < length)
+                {
+                    copy[offset + length - 1] = value;
+                }
+                if (implementation.find_byte(copy_begin, copy_begin + length, value) != copy_begin + position)
+                {
+                    Expect(false, "find_byte returns the first match", implementation.instruction_set, offset, length);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// 各实现异或的结果与逐字节异或相同，不写入范围之外
+void TestMaskBytes(const eddyserver::SIMD::Implementation &implementation)
+{
+    std::mt19937 engine(2);
+    for (size_t offset = 0; offset < kMaxOffset; ++offset)
+    {
+        for (size_t length = 0; length <= kMaxLength; ++length)
+        {
+            const uint8_t key[4] = { static_cast<uint8_t>(engine()), static_cast<uint8_t>(engine()),
+                static_cast<uint8_t>(engine()), static_cast<uint8_t>(engine()) };
+            const Bytes data = RandomBytes(length, 0, engine);
+
+            Bytes buffer(kGuard + offset + length + kGuard, kGuardValue);
+            std::copy(data.begin(), data.end(), buffer.begin() + kGuard + offset);
+            implementation.mask_bytes(buffer.data() + kGuard + offset, length, key);
+
+            bool masked = true;
+            for (size_t i = 0; i < length; ++i)
+            {
+                masked = masked && buffer[kGuard + offset + i] == (data[i] ^ key[i % 4]);
+            }
+            Expect(masked, "mask_bytes xors with the key", implementation.instruction_set, offset, length);
+
+            const bool untouched = std::count(buffer.begin(), buffer.begin() + kGuard + offset, kGuardValue) == static_cast<ptrdiff_t>(kGuard + offset)
+                && std::count(buffer.end() - kGuard, buffer.end(), kGuardValue) == static_cast<ptrdiff_t>(kGuard);
+            Expect(untouched, "mask_bytes stays within the range", implementation.instruction_set, offset, length);
+
+            // 再次异或还原
+            implementation.mask_bytes(buffer.data() + kGuard + offset, length, key);
+            Expect(std::equal(data.begin(), data.end(), buffer.begin() + kGuard + offset), "mask_bytes is its own inverse",
+                implementation.instruction_set, offset, length);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const std::vector<eddyserver::SIMD::Implementation> implementations = eddyserver::SIMD::implementations();
+    Expect(!implementations.empty() && strcmp(implementations.back().instruction_set, "scalar") == 0, "scalar implementation is last");
+    Expect(!implementations.empty() && strcmp(implementations.front().instruction_set, eddyserver::SIMD::instruction_set()) == 0,
+        "selected implementation is first");
+
+    for (size_t i = 0; i < implementations.size(); ++i)
+    {
+        std::cout << "checking " << implementations[i].instruction_set << std::endl;
+        TestFindByte(implementations[i]);
+        TestMaskBytes(implementations[i]);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
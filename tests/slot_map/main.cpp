@@ -0,0 +1,133 @@
+#include <memory>
+#include <cstdlib>
+#include <iostream>
+#include <eddyserver/slot_map.h>
+
+typedef eddyserver::SlotMap<int> IntSlotMap;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+
+    /**
+     * 获取键的代数
+     */
+    uint32_t GenerationOf(IntSlotMap::Key key)
+    {
+        return static_cast<uint32_t>(key >> IntSlotMap::kIndexBits) & ((1u << IntSlotMap::kGenerationBits) - 1);
+    }
+
+    /**
+     * 获取键的槽位索引
+     */
+    uint32_t IndexOf(IntSlotMap::Key key)
+    {
+        return static_cast<uint32_t>(key);
+    }
+}
+
+// 插入、查找和移除
+void TestInsertAndErase()
+{
+    IntSlotMap slots;
+    const IntSlotMap::Key first = slots.insert(1);
+    const IntSlotMap::Key second = slots.insert(2);
+    Expect(first != 0 && second != 0, "keys are never 0");
+    Expect(first != second, "keys are distinct");
+    Expect(slots.size() == 2, "size counts inserted values");
+    Expect(slots.get(first) != nullptr && *slots.get(first) == 1, "get returns the first value");
+    Expect(slots.get(second) != nullptr && *slots.get(second) == 2, "get returns the second value");
+
+    Expect(slots.erase(first), "erase succeeds once");
+    Expect(!slots.erase(first), "erase fails on an erased key");
+    Expect(slots.get(first) == nullptr, "erased key is not found");
+    Expect(slots.size() == 1, "size drops after erase");
+    Expect(slots.get(0) == nullptr, "key 0 is never valid");
+    Expect(slots.get(first + (IntSlotMap::Key(1) << 31)) == nullptr, "out of range index is not found");
+}
+
+// 槽位复用后过期的键失效
+void TestStaleKeyAfterReuse()
+{
+    IntSlotMap slots;
+    const IntSlotMap::Key stale = slots.insert(1);
+    slots.erase(stale);
+
+    const IntSlotMap::Key fresh = slots.insert(2);
+    Expect(IndexOf(fresh) == IndexOf(stale), "freed slot is reused");
+    Expect(GenerationOf(fresh) == GenerationOf(stale) + 1, "reused slot gets the next generation");
+    Expect(slots.get(stale) == nullptr, "stale key does not reach the new value");
+    Expect(!slots.erase(stale), "stale key cannot erase the new value");
+    Expect(slots.get(fresh) != nullptr && *slots.get(fresh) == 2, "new key reaches the new value");
+}
+
+// 代数回绕时跳过0
+void TestGenerationWrap()
+{
+    IntSlotMap slots(IntSlotMap::kMaxTag);
+    const uint32_t max_generation = (1u << IntSlotMap::kGenerationBits) - 1;
+
+    IntSlotMap::Key key = slots.insert(0);
+    Expect(GenerationOf(key) == 1, "first generation is 1");
+
+    bool saw_zero = false;
+    IntSlotMap::Key last = key;
+    for (uint32_t i = 0; i < max_generation; ++i)
+    {
+        last = key;
+        slots.erase(key);
+        key = slots.insert(static_cast<int>(i));
+        saw_zero = saw_zero || GenerationOf(key) == 0 || key == 0;
+    }
+
+    Expect(!saw_zero, "generation 0 is never handed out");
+    Expect(GenerationOf(last) == max_generation, "generation reaches the maximum before wrapping");
+    Expect(GenerationOf(key) == 1, "generation wraps to 1");
+    Expect(slots.get(last) == nullptr, "key from before the wrap is stale");
+    Expect(slots.get(key) != nullptr, "key after the wrap is valid");
+    Expect(IntSlotMap::tag_of(key) == IntSlotMap::kMaxTag, "wrapping does not disturb the tag");
+}
+
+// 标签
+void TestTag()
+{
+    for (uint32_t tag = 0; tag <= IntSlotMap::kMaxTag; ++tag)
+    {
+        IntSlotMap slots(tag);
+        Expect(slots.tag() == tag, "tag is kept");
+        for (int i = 0; i < 4; ++i)
+        {
+            const IntSlotMap::Key key = slots.insert(i);
+            Expect(IntSlotMap::tag_of(key) == tag, "tag_of extracts the tag");
+        }
+    }
+
+    // 不同标签的表分配的键互不冲突
+    IntSlotMap first(1);
+    IntSlotMap second(2);
+    const IntSlotMap::Key first_key = first.insert(1);
+    const IntSlotMap::Key second_key = second.insert(2);
+    Expect(first_key != second_key, "tags keep keys apart");
+    Expect(first.get(second_key) == nullptr, "key from another tag is rejected");
+}
+
+int main(int argc, char *argv[])
+{
+    TestInsertAndErase();
+    TestStaleKeyAfterReuse();
+    TestGenerationWrap();
+    TestTag();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
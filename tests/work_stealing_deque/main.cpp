@@ -0,0 +1,195 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <eddyserver/work_stealing_deque.h>
+
+typedef eddyserver::WorkStealingDeque<int*> IntDeque;
+
+// 最后一个元素的竞争轮数
+const size_t kRaceRounds = 100000;
+
+// 多个窃取者时的元素数量
+const size_t kItemCount = 1000000;
+
+// 窃取者数量
+const size_t kThiefCount = 3;
+
+namespace
+{
+    bool passed = true;
+
+    /**
+     * 检查条件
+     */
+    void Expect(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cerr << "failed: " << description << std::endl;
+            passed = false;
+        }
+    }
+}
+
+// 单线程下底部后进先出，顶部先进先出
+void TestOrder()
+{
+    int values[4] = { 0, 1, 2, 3 };
+    IntDeque deque(2);
+    for (int i = 0; i < 4; ++i)
+    {
+        deque.push(&values[i]);
+    }
+    Expect(deque.size() == 4, "deque grows past its initial capacity");
+    Expect(deque.steal() == &values[0], "steal takes from the top");
+    Expect(deque.pop() == &values[3], "pop takes from the bottom");
+    Expect(deque.pop() == &values[2], "pop keeps taking from the bottom");
+    Expect(deque.steal() == &values[1], "steal takes the remaining element");
+    Expect(deque.pop() == nullptr, "pop on an empty deque returns nullptr");
+    Expect(deque.steal() == nullptr, "steal on an empty deque returns nullptr");
+    Expect(deque.empty(), "deque is empty");
+}
+
+// 所有者弹出与窃取者竞争最后一个元素，恰好一方取得
+void TestLastElementRace()
+{
+    int value = 0;
+    IntDeque deque;
+    std::atomic<size_t> round(0);
+    std::atomic<size_t> stolen_round(0);
+    std::atomic<int*> stolen(nullptr);
+
+    std::thread thief([&]()
+    {
+        for (size_t i = 1; i <= kRaceRounds; ++i)
+        {
+            while (round.load(std::memory_order_acquire) < i)
+            {
+                std::this_thread::yield();
+            }
+            stolen.store(deque.steal(), std::memory_order_relaxed);
+            stolen_round.store(i, std::memory_order_release);
+        }
+    });
+
+    size_t owner_wins = 0;
+    size_t thief_wins = 0;
+    for (size_t i = 1; i <= kRaceRounds; ++i)
+    {
+        deque.push(&value);
+        round.store(i, std::memory_order_release);
+
+        // 隔轮让出CPU，单核上也能让窃取者先行
+        if (i % 2 == 0)
+        {
+            std::this_thread::yield();
+        }
+        int *popped = deque.pop();
+
+        while (stolen_round.load(std::memory_order_acquire) < i)
+        {
+            std::this_thread::yield();
+        }
+        int *taken = stolen.load(std::memory_order_relaxed);
+
+        if ((popped == nullptr) == (taken == nullptr))
+        {
+            Expect(false, "last element is taken by exactly one side");
+            break;
+        }
+        if (popped != nullptr)
+        {
+            ++owner_wins;
+        }
+        else
+        {
+            ++thief_wins;
+        }
+        Expect(deque.empty(), "deque is empty after the race");
+    }
+    thief.join();
+
+    std::cout << "last element race: owner " << owner_wins << ", thief " << thief_wins << std::endl;
+}
+
+// 所有者压入和弹出时多个窃取者同时窃取，每个元素恰好被取得一次
+void TestConcurrentSteal()
+{
+    std::vector<int> values(kItemCount, 0);
+    std::vector<std::atomic<int>> taken(kItemCount);
+    for (size_t i = 0; i < kItemCount; ++i)
+    {
+        values[i] = static_cast<int>(i);
+        taken[i].store(0, std::memory_order_relaxed);
+    }
+
+    IntDeque deque(64);
+    std::atomic_bool done(false);
+    std::atomic<size_t> count(0);
+
+    std::vector<std::thread> thieves;
+    for (size_t i = 0; i < kThiefCount; ++i)
+    {
+        thieves.emplace_back([&]()
+        {
+            while (!done.load(std::memory_order_acquire) || !deque.empty())
+            {
+                int *value = deque.steal();
+                if (value != nullptr)
+                {
+                    ++taken[static_cast<size_t>(*value)];
+                    ++count;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // 每压入两个弹出一个，其余留给窃取者
+    for (size_t i = 0; i < kItemCount; ++i)
+    {
+        deque.push(&values[i]);
+        if (i % 2 == 1)
+        {
+            int *value = deque.pop();
+            if (value != nullptr)
+            {
+                ++taken[static_cast<size_t>(*value)];
+                ++count;
+            }
+        }
+    }
+
+    int *value = nullptr;
+    while ((value = deque.pop()) != nullptr)
+    {
+        ++taken[static_cast<size_t>(*value)];
+        ++count;
+    }
+    done.store(true, std::memory_order_release);
+    for (size_t i = 0; i < thieves.size(); ++i)
+    {
+        thieves[i].join();
+    }
+
+    bool exactly_once = true;
+    for (size_t i = 0; i < kItemCount; ++i)
+    {
+        exactly_once = exactly_once && taken[i].load() == 1;
+    }
+    Expect(count == kItemCount, "every element is taken");
+    Expect(exactly_once, "no element is taken twice");
+}
+
+int main(int argc, char *argv[])
+{
+    TestOrder();
+    TestLastElementRace();
+    TestConcurrentSteal();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}